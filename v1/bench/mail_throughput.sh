@@ -0,0 +1,95 @@
+#!/bin/bash
+# Mail delivery throughput against a local SendGrid stand-in
+# (bench/sendgrid_standin.py, HTTPS with a throw-away certificate): queues
+# COUNT asynchronous SENDMAILs and reports how long the dispatcher takes to
+# deliver them all, and how many connections it opened for that.
+#
+# Usage: bench/mail_throughput.sh [build_dir]
+#   e.g. COUNT=100 DELAY_MS=20 bench/mail_throughput.sh build
+#   SCHEME=http benchmarks without TLS
+#   SERVER_ARGS=--mail-journal=FILE adds server options
+#   FAIL_EVERY=N has the stand-in answer every Nth request with 503
+
+BUILD_DIR=$(cd "${1:-build}" && pwd)
+COUNT=${COUNT:-100}
+DELAY_MS=${DELAY_MS:-0}
+SCHEME=${SCHEME:-https}
+PORT=${PORT:-18443}
+ENGINE=${ENGINE:-epoll}
+FAIL_EVERY=${FAIL_EVERY:-0}
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+
+SERVER="$BUILD_DIR/bin/server"
+if [ ! -x "$SERVER" ]; then
+    echo "Build first: $SERVER is required" >&2
+    exit 1
+fi
+
+TMP=$(mktemp -d)
+standin=""
+server=""
+cleanup() {
+    [ -n "$server" ] && kill -QUIT "$server" 2>/dev/null && wait "$server" 2>/dev/null
+    [ -n "$standin" ] && kill "$standin" 2>/dev/null && wait "$standin" 2>/dev/null
+    rm -rf "$TMP"
+}
+trap cleanup EXIT
+
+STANDIN_ARGS=(--delay-ms "$DELAY_MS" --fail-every "$FAIL_EVERY")
+if [ "$SCHEME" = https ]; then
+    openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=127.0.0.1 \
+        -addext subjectAltName=IP:127.0.0.1 \
+        -keyout "$TMP/key.pem" -out "$TMP/cert.pem" >/dev/null 2>&1 || exit 1
+    STANDIN_ARGS+=(--cert "$TMP/cert.pem" --key "$TMP/key.pem")
+    export SENDGRID_CA_FILE="$TMP/cert.pem"
+fi
+python3 "$BENCH_DIR/sendgrid_standin.py" "$PORT" "${STANDIN_ARGS[@]}" > "$TMP/standin.out" &
+standin=$!
+
+# The server insists on a .env; the environment takes precedence over it
+printf 'SENDGRID_API_KEY=bench\nSENDGRID_FROM=bench@example.com\n' > "$TMP/.env"
+export SENDGRID_API_URL="$SCHEME://127.0.0.1:$PORT/v3/mail/send"
+sock="$TMP/server.sock"
+(cd "$TMP" && exec "$SERVER" --engine="$ENGINE" --unix="$sock" --async-mail \
+    --rate-sendmail=0 $SERVER_ARGS >/dev/null 2>&1) &
+server=$!
+sleep 0.5
+
+stats() {
+    curl -s ${SENDGRID_CA_FILE:+--cacert "$SENDGRID_CA_FILE"} "$SCHEME://127.0.0.1:$PORT/stats"
+}
+start=$(date +%s.%N)
+python3 - "$sock" "$COUNT" <<'EOF' || exit 1
+import socket, sys
+for i in range(int(sys.argv[2])):
+    s = socket.socket(socket.AF_UNIX)
+    s.connect(sys.argv[1])
+    s.sendall(b"SENDMAIL|user%d@example.com|bench %d|hello\n" % (i, i))
+    reply = b""
+    while b"Queued:" not in reply and b"Error" not in reply:
+        chunk = s.recv(4096)
+        if not chunk:
+            break
+        reply += chunk
+    s.close()
+    if b"Queued:" not in reply:
+        sys.exit("SENDMAIL %d not queued: %r" % (i, reply))
+EOF
+queued=$(date +%s.%N)
+
+for _ in $(seq 600); do
+    done_count=$(stats | awk '/^recipients:/ {print $2}')
+    [ "${done_count:-0}" -ge "$COUNT" ] && break
+    sleep 0.05
+done
+end=$(date +%s.%N)
+conns=$(stats | awk '/^connections:/ {print $2}')
+
+awk -v s="$start" -v q="$queued" -v e="$end" -v n="$COUNT" -v d="${done_count:-0}" \
+    -v c="${conns:-0}" 'BEGIN {
+    printf "delivered: %d of %d\n", d, n
+    printf "queue_s: %.3f\n", q - s
+    printf "total_s: %.3f\n", e - s
+    printf "mails_per_s: %.1f\n", d / (e - s)
+    printf "connections: %d\n", c
+}'
@@ -0,0 +1,64 @@
+#!/bin/bash
+# Compare connection engines over loopback TCP and the AF_UNIX listener:
+# requests per second and, when strace is installed, server-side syscalls
+# per request.
+#
+# Usage: bench/run_bench.sh [build_dir] [bench args...]
+#   e.g. bench/run_bench.sh build --clients 32 --requests 500
+
+BUILD_DIR=${1:-build}
+shift || true
+BENCH_ARGS=("$@")
+[ ${#BENCH_ARGS[@]} -eq 0 ] && BENCH_ARGS=(--clients 16 --requests 1000)
+ENGINES=${ENGINES:-"fork epoll uring"}
+TRANSPORTS=${TRANSPORTS:-"tcp unix"}
+
+SERVER="$BUILD_DIR/bin/server"
+BENCH="$BUILD_DIR/bin/bench"
+if [ ! -x "$SERVER" ] || [ ! -x "$BENCH" ]; then
+    echo "Build first: $SERVER and $BENCH are required" >&2
+    exit 1
+fi
+
+HAVE_STRACE=0
+command -v strace >/dev/null 2>&1 && HAVE_STRACE=1
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+printf "%-12s %10s %12s %12s %14s\n" engine rps p50_us p99_us syscalls/req
+for engine in $ENGINES; do
+  for transport in $TRANSPORTS; do
+    run="$engine.$transport"
+    sock="$TMP/server.sock"
+    TRANSPORT_ARGS=()
+    [ "$transport" = unix ] && TRANSPORT_ARGS=(--unix "$sock")
+    if [ $HAVE_STRACE -eq 1 ]; then
+        strace -f -c -o "$TMP/strace.$run" "$SERVER" --engine="$engine" --unix="$sock" >/dev/null 2>&1 &
+    else
+        "$SERVER" --engine="$engine" --unix="$sock" >/dev/null 2>&1 &
+    fi
+    pid=$!
+    sleep 0.5
+
+    "$BENCH" "${BENCH_ARGS[@]}" "${TRANSPORT_ARGS[@]}" > "$TMP/bench.$run"
+
+    kill -QUIT $pid 2>/dev/null
+    # Under strace, the signal goes to strace's tracee via the process group
+    pkill -QUIT -P $pid 2>/dev/null
+    wait $pid 2>/dev/null
+
+    rps=$(awk '/^rps:/ {print $2}' "$TMP/bench.$run")
+    p50=$(awk '/^latency:/ {print $3}' "$TMP/bench.$run")
+    p99=$(awk '/^latency:/ {print $6}' "$TMP/bench.$run")
+    done_reqs=$(awk '/^completed:/ {print $2}' "$TMP/bench.$run")
+    per_req="n/a"
+    if [ $HAVE_STRACE -eq 1 ] && [ -s "$TMP/strace.$run" ] && [ "${done_reqs:-0}" -gt 0 ]; then
+        calls=$(awk '$NF == "total" {print $(NF-2)}' "$TMP/strace.$run")
+        per_req=$(awk -v c="$calls" -v r="$done_reqs" 'BEGIN {printf "%.1f", c / r}')
+    fi
+    printf "%-12s %10s %12s %12s %14s\n" "$engine/$transport" "$rps" "$p50" "$p99" "$per_req"
+    sleep 0.5
+  done
+done
+[ $HAVE_STRACE -eq 0 ] && echo "(install strace to measure syscalls per request)"
+exit 0
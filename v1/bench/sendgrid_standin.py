@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Local stand-in for the SendGrid mail endpoint, for bench/mail_throughput.sh.
+
+Answers every POST with 202 after an optional delay (the API's own latency),
+or 400 when it breaks the API's limit of 1000 personalizations, and counts
+requests, recipients (also distinct ones, to spot lost or repeated mail)
+and the connections that carried them. --fail-every N answers every Nth
+request with 503, to exercise retries. Speaks HTTPS with
+HTTP/1.1 keep-alive when given a certificate, plain HTTP otherwise.
+
+Usage: sendgrid_standin.py PORT [--delay-ms N] [--fail-every N] [--cert FILE --key FILE]
+Counters are printed on SIGTERM/SIGINT and served at GET /stats.
+"""
+import argparse
+import http.server
+import json
+import signal
+import ssl
+import sys
+import threading
+import time
+
+lock = threading.Lock()
+counts = {"connections": 0, "requests": 0, "recipients": 0, "distinct_recipients": 0, "failed": 0}
+seen = set()
+MAX_PERSONALIZATIONS = 1000
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"   # keep-alive
+
+    def do_POST(self):
+        data = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+        try:
+            addrs = [p["to"][0]["email"] for p in json.loads(data)["personalizations"]]
+        except (ValueError, KeyError, TypeError, IndexError):
+            addrs = []
+        status = 202 if 0 < len(addrs) <= MAX_PERSONALIZATIONS else 400
+        if self.server.delay > 0:
+            time.sleep(self.server.delay)
+        with lock:
+            # One handler per connection: only those that carried mail count
+            if not getattr(self, "counted", False):
+                self.counted = True
+                counts["connections"] += 1
+            counts["requests"] += 1
+            if self.server.fail_every > 0 and counts["requests"] % self.server.fail_every == 0:
+                status = 503
+                counts["failed"] += 1
+            if status == 202:
+                counts["recipients"] += len(addrs)
+                seen.update(addrs)
+                counts["distinct_recipients"] = len(seen)
+        self.send_response(status)
+        self.send_header("Content-Length", "0")
+        self.end_headers()
+
+    def do_GET(self):
+        with lock:
+            body = "".join("%s: %d\n" % kv for kv in counts.items())
+        data = body.encode()
+        self.send_response(200)
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def log_message(self, fmt, *args):
+        pass
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument("port", type=int)
+    ap.add_argument("--delay-ms", type=int, default=0)
+    ap.add_argument("--fail-every", type=int, default=0)
+    ap.add_argument("--cert")
+    ap.add_argument("--key")
+    args = ap.parse_args()
+
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", args.port), Handler)
+    server.daemon_threads = True
+    server.delay = args.delay_ms / 1000.0
+    server.fail_every = args.fail_every
+    if args.cert:
+        ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+        ctx.load_cert_chain(args.cert, args.key)
+        server.socket = ctx.wrap_socket(server.socket, server_side=True)
+
+    def stop(sig, frame):
+        print("".join("%s: %d\n" % kv for kv in counts.items()), end="", flush=True)
+        sys.exit(0)
+    signal.signal(signal.SIGTERM, stop)
+    signal.signal(signal.SIGINT, stop)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
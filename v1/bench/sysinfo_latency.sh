@@ -0,0 +1,56 @@
+#!/bin/bash
+# Latency check for an uncached SYSINFO: every request runs all collectors
+# (--sysinfo-ttl=0). Fails if the p50 of any engine reaches LIMIT_US, which
+# catches a sleep or a blocking call creeping back into the request path.
+#
+# Usage: bench/sysinfo_latency.sh [build_dir] [bench args...]
+#   e.g. LIMIT_US=50000 bench/sysinfo_latency.sh build --clients 8 --requests 50
+#   SERVER_ARGS="--sysinfo-threads=0" adds server options
+
+BUILD_DIR=${1:-build}
+shift || true
+BENCH_ARGS=("$@")
+[ ${#BENCH_ARGS[@]} -eq 0 ] && BENCH_ARGS=(--clients 4 --requests 25)
+ENGINES=${ENGINES:-"fork epoll uring"}
+LIMIT_US=${LIMIT_US:-100000}
+read -r -a SERVER_ARGS <<< "${SERVER_ARGS:-}"
+
+SERVER="$BUILD_DIR/bin/server"
+BENCH="$BUILD_DIR/bin/bench"
+if [ ! -x "$SERVER" ] || [ ! -x "$BENCH" ]; then
+    echo "Build first: $SERVER and $BENCH are required" >&2
+    exit 1
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+status=0
+printf "%-8s %12s %12s %8s\n" engine p50_us p99_us result
+for engine in $ENGINES; do
+    sock="$TMP/server.sock"
+    "$SERVER" --engine="$engine" --unix="$sock" --sysinfo-ttl=0 --rate-sysinfo=0 "${SERVER_ARGS[@]}" >/dev/null 2>&1 &
+    pid=$!
+    sleep 0.5
+
+    "$BENCH" "${BENCH_ARGS[@]}" --command SYSINFO --unix "$sock" > "$TMP/bench.$engine"
+    rc=$?
+
+    kill -QUIT $pid 2>/dev/null
+    wait $pid 2>/dev/null
+
+    p50=$(awk '/^latency:/ {print $3}' "$TMP/bench.$engine")
+    p99=$(awk '/^latency:/ {print $6}' "$TMP/bench.$engine")
+    result=ok
+    if [ $rc -ne 0 ] || [ -z "$p50" ]; then
+        result=error
+        status=1
+    elif [ "$p50" -ge "$LIMIT_US" ]; then
+        result=SLOW
+        status=1
+    fi
+    printf "%-8s %12s %12s %8s\n" "$engine" "${p50:-n/a}" "${p99:-n/a}" "$result"
+    rm -f "$sock"
+    sleep 0.5
+done
+exit $status
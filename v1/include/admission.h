@@ -0,0 +1,109 @@
+#pragma once
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+// Admission control at accept time and per-command rate limits. A global
+// cap and a per-source-address cap on concurrent connections are checked
+// before any fork or allocation; each command class has a token bucket per
+// address. State lives in a compact open-addressing hash table keyed by
+// IPv4 address, in a shared mapping created before any worker is forked.
+// Each admitted connection holds a ticket that records the PID of the
+// process serving it, so the slot can be reclaimed when that process is
+// reaped, however it died.
+
+#define ADMISSION_TABLE_SIZE          4096    // addresses tracked, power of two
+#define ADMISSION_DEFAULT_MAX_CONNS   1024
+#define ADMISSION_DEFAULT_MAX_PER_IP  64
+// An address without connections and unseen for this long may be recycled
+#define ADMISSION_ENTRY_TTL_MS        60000
+// Connections admitted at once; beyond this everyone gets the global cap reply
+#define ADMISSION_MAX_TICKETS         65536
+
+// Returned by admission_acquire()
+#define ADMISSION_OK            0
+#define ADMISSION_REJECT_GLOBAL 1   // server-wide connection cap reached
+#define ADMISSION_REJECT_PER_IP 2   // this address already has its cap
+
+// Command classes with their own token bucket
+enum admission_class {
+    ADMISSION_SYSINFO = 0,
+    ADMISSION_SENDMAIL,
+    ADMISSION_OTHER,        // PING, STATS, STATUS
+    ADMISSION_CLASSES
+};
+
+// Token bucket: rate tokens per second, up to burst; rate 0 = unlimited
+struct admission_rate {
+    int rate;
+    int burst;
+};
+
+struct admission_config {
+    int max_conns;          // 0 = unlimited
+    int max_per_ip;         // 0 = unlimited
+    struct admission_rate rates[ADMISSION_CLASSES];
+};
+
+struct admission_stats {
+    uint64_t active;                            // connections admitted and open
+    uint64_t rejected_global;
+    uint64_t rejected_per_ip;
+    uint64_t rate_limited[ADMISSION_CLASSES];
+};
+
+// Defaults: caps above, SYSINFO 5/s (burst 10), SENDMAIL 1/s (burst 5), others unlimited
+void admission_default_config(struct admission_config *cfg);
+
+/**
+ * Map the shared table. Call once at startup, before forking.
+ *
+ * @return 0 on success, -1 on error (every connection is then admitted
+ *         and no command is rate limited)
+ */
+int admission_init(const struct admission_config *cfg);
+
+/**
+ * Admit a newly accepted connection from addr. The calling process owns
+ * the ticket until it is released or handed on with admission_set_owner().
+ *
+ * @param ticket receives the handle to pass to admission_release() and
+ *               admission_set_current(); -1 if nothing is tracked
+ * @return ADMISSION_OK, or the ADMISSION_REJECT_* reason (counted)
+ */
+int admission_acquire(const struct sockaddr *addr, int *ticket);
+
+// Release an admitted connection; no-op for ticket -1. Async-signal-safe.
+void admission_release(int ticket);
+
+// Hand a connection admitted by the calling process to another process (a
+// fork engine child); no-op if that process has already released it
+void admission_set_owner(int ticket, pid_t owner);
+
+/**
+ * Release every connection still held by a process that has been reaped.
+ * Call with each PID returned by waitpid(): a child killed by SIGKILL, the
+ * OOM killer or a crash never released its own.
+ *
+ * @return number of connections released
+ */
+int admission_release_owner(pid_t owner);
+
+// Answer a rejected connection with a one-line error and close it
+void admission_reject(int fd, int reason);
+
+// Commands run by the calling thread are charged to this connection
+void admission_set_current(int ticket);
+
+/**
+ * Take one token from the calling thread's connection for the given class.
+ *
+ * @return 0 if the command may run, -1 if it is rate limited (counted)
+ */
+int admission_take(enum admission_class cls);
+
+// Copy the counters; all zero if not initialised
+void admission_get_stats(struct admission_stats *stats);
+
+// Name used in STATS, e.g. "sysinfo"
+const char *admission_class_name(enum admission_class cls);
@@ -0,0 +1,70 @@
+#pragma once
+#include <stddef.h>
+#include "response.h"
+
+// Maximum length of one text command line (including the terminating '\0')
+#define COMMAND_MAX_LEN 256
+
+// Keep-alive mode: a client that sends this as its first line may pipeline
+// further commands on the same connection. Every response then ends with the
+// marker line "."; response lines that start with '.' get a second '.'
+// prepended (as in SMTP), so the marker never appears inside a payload.
+#define KEEPALIVE_COMMAND    "KEEPALIVE"
+#define KEEPALIVE_END_MARKER ".\n"
+// Input buffer of a keep-alive connection (several pipelined command lines)
+#define KEEPALIVE_BUF_LEN    4096
+
+/**
+ * Execute one text protocol command and write the response to out.
+ *
+ * @param command command line without trailing newline, e.g. "PING", "SYSINFO",
+ *                "SYSINFO memory,disk FORMAT=json", "SYSINFO SINCE 42",
+ *                "SENDMAIL|to|subject|body", "STATUS <job id>", "STATS" or
+ *                "HISTORY load1 5m"
+ *                (modified in place while parsing)
+ * @param out     builder that receives the response text
+ * @return 0 if the command was recognised, -1 for unknown commands
+ *
+ * May block (SYSINFO collection, SendGrid round trip), so event-driven
+ * engines must call it from a worker thread, never from the I/O loop.
+ */
+int command_execute(char *command, struct response *out);
+
+/**
+ * Check whether the first line of buf is the KEEPALIVE command.
+ *
+ * @return 1 if buf starts with a complete "KEEPALIVE" line, 0 otherwise
+ */
+int command_is_keepalive(const char *buf, size_t len);
+
+/**
+ * Run one keep-alive command line (without its terminator) and write the
+ * framed response to out. Empty lines are skipped and over-long ones get
+ * "Error: Command too long"; line[len] is overwritten with '\0'.
+ */
+void command_execute_line(char *line, size_t len, struct response *out);
+
+/**
+ * Keep-alive answer for a line longer than COMMAND_MAX_LEN that the engine
+ * dropped up to its '\n' instead of buffering it: "Error: Command too long".
+ */
+void command_reject_line(struct response *out);
+
+/**
+ * Run every complete line at the start of buf in keep-alive mode.
+ *
+ * Each command's response is written to out followed by the end marker;
+ * unknown and over-long commands get an "Error: ..." response, empty lines
+ * are skipped. Processed lines are modified in place.
+ *
+ * @return number of bytes consumed (0 if buf holds no complete line)
+ */
+size_t command_execute_pipeline(char *buf, size_t len, struct response *out);
+
+/**
+ * Run every complete binary frame (see protocol.h) at the start of buf,
+ * writing one response frame per request to out.
+ *
+ * @return number of bytes consumed; stops at an incomplete or oversized frame
+ */
+size_t command_execute_frames(const char *buf, size_t len, struct response *out);
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include "timerwheel.h"
+
+// Connection deadlines shared by all engines. Each connection has a
+// read-idle deadline (no bytes received), a write-idle deadline (response
+// not accepted by the socket) and a total-request deadline (first byte of
+// a request until its response is written, so trickling bytes cannot keep
+// a connection alive). SYSINFO collectors have a deadline too (see
+// sysinfo_sched.h). Timeouts are counted per reason in a shared mapping
+// created before any worker is forked and reported by STATS.
+
+#define DEADLINE_DEFAULT_READ_IDLE_MS   30000
+#define DEADLINE_DEFAULT_WRITE_IDLE_MS  30000
+#define DEADLINE_DEFAULT_REQUEST_MS     60000
+#define DEADLINE_DEFAULT_COLLECTOR_MS   2000
+
+enum deadline_kind {
+    DEADLINE_READ_IDLE = 0,
+    DEADLINE_WRITE_IDLE,
+    DEADLINE_REQUEST,
+    DEADLINE_COLLECTOR,     // one SYSINFO collector run
+    DEADLINE_KINDS
+};
+
+// Milliseconds per deadline, 0 = no deadline (--read-timeout= etc.)
+struct deadline_config {
+    int read_idle_ms;
+    int write_idle_ms;
+    int request_ms;
+    int collector_ms;
+};
+
+/**
+ * Store the configuration and map the shared counters. Call once at
+ * startup, before forking.
+ *
+ * @return 0 on success, -1 if the counters could not be mapped (deadlines
+ *         still apply, timeouts are not counted)
+ */
+int deadline_init(const struct deadline_config *cfg);
+
+// Configured deadline of the given kind in milliseconds, 0 if disabled
+int deadline_ms(enum deadline_kind kind);
+
+// Count one timeout; async-signal-safe
+void deadline_count(enum deadline_kind kind);
+
+// Copy the counters (indexed by enum deadline_kind); all zero if not initialised
+void deadline_get_stats(uint64_t counts[DEADLINE_KINDS]);
+
+// Name used in logs and STATS, e.g. "read_idle"
+const char *deadline_name(enum deadline_kind kind);
+
+// Current CLOCK_MONOTONIC time in milliseconds
+uint64_t deadline_now_ms(void);
+
+// Arm t in the wheel to fire after the deadline of the given kind (stored in
+// t->kind); disarm it instead if that deadline is disabled
+void deadline_arm(struct timer_wheel *w, struct timer *t, enum deadline_kind kind);
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include "sysinfo.h"
+
+// Multi-mount disk collector. Mounts come from /proc/self/mountinfo, with
+// pseudo filesystems (proc, sysfs, cgroup, ...) and repeats of a device
+// (bind mounts) left out. Each mount is statvfs()ed on a small per-process
+// probe pool, so one scan takes at most the disk budget however many mounts
+// there are and however slow some of them are.
+//
+// Answers go to a table in shared memory, seen by every worker:
+// - a mount that answered within the cache window is not probed again;
+// - a mount is probed by one thread at a time: while a probe is running
+//   (a hung NFS or FUSE server) nobody starts another one, so a hung mount
+//   ties up one thread, not one per request;
+// - a mount that missed the budget is not waited for again for
+//   DISKINFO_RETRY_MS, unless it answers in the meantime.
+// A mount without a fresh answer is reported as timed out, with the sizes of
+// its last answer if it ever gave one.
+
+#define DISKINFO_DEFAULT_TIMEOUT_MS 200     // --disk-timeout=
+#define DISKINFO_DEFAULT_CACHE_MS   5000    // --disk-cache=
+#define DISKINFO_RETRY_MS           30000
+#define DISKINFO_PROBE_THREADS      8       // per process
+
+struct diskinfo_stats {
+    uint64_t scans;         // collector runs
+    uint64_t probes;        // statvfs() calls started
+    uint64_t cache_hits;    // mounts served from an earlier answer
+    uint64_t timeouts;      // mounts reported as timed out
+    uint64_t errors;        // statvfs() calls that failed
+};
+
+/**
+ * Create the shared table. Call once at startup, before forking; without
+ * it the first scan creates a table private to its process.
+ *
+ * @param timeout_ms budget of one scan, 0 waits for every probe
+ * @param cache_ms   how long an answer is reused, 0 probes every scan
+ * @return 0 on success, -1 on error
+ */
+int diskinfo_init(int timeout_ms, int cache_ms);
+
+/**
+ * Fill snap->mounts (mount_count, mounts_dropped). Mounts that did not
+ * answer are still listed, flagged SYSINFO_MOUNT_TIMED_OUT.
+ *
+ * @return 0, or -1 if the mount table could not be read
+ */
+int diskinfo_collect(struct sysinfo_snapshot *snap);
+
+// Counters since startup, summed over all processes
+void diskinfo_get_stats(struct diskinfo_stats *stats);
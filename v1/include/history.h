@@ -0,0 +1,66 @@
+#pragma once
+#include <stdint.h>
+
+// Metric history: a sampler process records key metrics every interval
+// into a fixed-size columnar ring (one array per metric plus a timestamp
+// column) in shared memory, optionally backed by a file so the series
+// survive a restart. HISTORY <metric> <window> reads it from any worker.
+//
+// The sampler is the only writer. It fills slot head % capacity and then
+// publishes head, so readers need no lock: a reader drops whatever the
+// writer may have overwritten while it was copying.
+
+#define HISTORY_CAPACITY        3600    // samples kept per metric (1 h at 1 s)
+#define HISTORY_MIN_INTERVAL_MS 100
+
+enum history_metric {
+    HISTORY_LOAD1 = 0,
+    HISTORY_LOAD5,
+    HISTORY_LOAD15,
+    HISTORY_CPU_BUSY,       // % of all CPUs since the previous sample
+    HISTORY_MEM_USED,       // bytes, total - free
+    HISTORY_MEM_AVAILABLE,  // bytes, MemAvailable
+    HISTORY_DISK_USED,      // bytes, root filesystem
+    HISTORY_DISK_FREE,
+    HISTORY_RX_BYTES,       // counters summed over all non-loopback links
+    HISTORY_TX_BYTES,
+    HISTORY_RX_PACKETS,
+    HISTORY_TX_PACKETS,
+    HISTORY_METRICS
+};
+
+/**
+ * Map the ring and fork the sampler process. Call once at startup, before
+ * worker processes or threads are created.
+ *
+ * @param interval_ms time between samples (>= HISTORY_MIN_INTERVAL_MS)
+ * @param path        file backing the ring, NULL for memory only. Samples
+ *                    already in a file of the same layout are kept.
+ * @return 0 on success, -1 on error (HISTORY then answers with an error)
+ */
+int history_start(int interval_ms, const char *path);
+
+// Stop the sampler process
+void history_stop(void);
+
+// @return 1 if history_start() succeeded
+int history_enabled(void);
+
+// Sampling interval given to history_start()
+int history_interval_ms(void);
+
+// Lower-case name of a metric ("load1", "mem_used", ...)
+const char *history_metric_name(enum history_metric metric);
+
+// Metric with the given name; -1 if unknown
+int history_metric_by_name(const char *name);
+
+/**
+ * Copy the samples of one metric taken in the last window_ms, oldest first.
+ *
+ * @param times_ms receives wall-clock sample times (ms since the epoch)
+ * @param values   receives the values
+ * @param max      capacity of both arrays
+ * @return number of samples copied, or -1 if history is disabled
+ */
+int history_read(enum history_metric metric, int64_t window_ms, int64_t *times_ms, double *values, int max);
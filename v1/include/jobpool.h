@@ -0,0 +1,85 @@
+#pragma once
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Per-process pool of detached threads for jobs that may block for a long
+ * time (slow SYSINFO collectors, statvfs() of a hung mount), shared by
+ * the worker threads of one process.
+ *
+ * Threads are started by the first submit in each process. They do not
+ * survive fork(): the child gets an empty pool and starts its own threads
+ * on first use, while the parent's threads and queued jobs stay behind in
+ * the parent. Unlike the workpool there is no completion list: a job
+ * reports its result itself, and the pool only counts finished jobs so
+ * callers can wait for the next one.
+ *
+ * Jobs are intrusive, like workpool items: embed a struct jobpool_job and
+ * recover the enclosing state in run().
+ */
+
+struct jobpool_job {
+    // Executed on a pool thread; ctx is the thread's context (see
+    // jobpool_init()). The job may be freed by run() itself.
+    void (*run)(struct jobpool_job *job, void *ctx);
+    struct jobpool_job *next;               // list linkage
+};
+
+// Fields are internal; declared here so pools can be static
+struct jobpool {
+    pthread_mutex_t lock;
+    pthread_cond_t queued;                  // a job was queued
+    pthread_cond_t finished_cond;           // a job finished (CLOCK_MONOTONIC)
+    uint64_t finished;                      // ... counted here
+    struct jobpool_job *head;               // pending jobs (FIFO)
+    struct jobpool_job *tail;
+    const char *name;                       // for log messages
+    void *(*thread_ctx)(void);
+    int threads;                            // configured size
+    int running;                            // threads started in this process
+    int started;                            // start attempted in this process
+    struct jobpool *next_pool;              // fork handler list
+};
+
+/**
+ * Set up a pool. Call once per pool, before it is used and before forking;
+ * no thread is started yet.
+ *
+ * @param name       what the threads are for, in log messages
+ * @param threads    threads per process
+ * @param thread_ctx if not NULL, called once for each thread to start; its
+ *                   result is passed to every job the thread runs, and a
+ *                   NULL result leaves the thread (and the ones after it)
+ *                   unstarted; a context whose thread fails to start is
+ *                   released with free()
+ */
+void jobpool_init(struct jobpool *pool, const char *name, int threads, void *(*thread_ctx)(void));
+
+/**
+ * Queue a list of jobs linked through ->next, run in list order, starting
+ * the threads of this process if needed.
+ *
+ * @return 0 on success, -1 if the pool has no thread in this process; the
+ *         jobs are then still the caller's
+ */
+int jobpool_submit(struct jobpool *pool, struct jobpool_job *jobs);
+
+// Number of jobs finished in this process so far
+uint64_t jobpool_finished(struct jobpool *pool);
+
+/**
+ * Wait until jobpool_finished() differs from seen.
+ *
+ * @param until CLOCK_MONOTONIC time to give up at, NULL to wait for good
+ * @return 0 once a job finished, -1 if until passed first
+ */
+int jobpool_wait(struct jobpool *pool, uint64_t seen, const struct timespec *until);
+
+/**
+ * Start a detached thread with every signal blocked: signals are left to
+ * the engine's own threads, which rely on them interrupting their waits.
+ *
+ * @return 0 on success, -1 on error
+ */
+int jobpool_spawn(void *(*fn)(void *), void *arg);
@@ -0,0 +1,77 @@
+#pragma once
+#include <stddef.h>
+#include <sys/types.h>
+
+// Buffered line reader for text protocol sockets, shared by client and
+// server. Each read() takes as much as the socket has, so long or pipelined
+// input costs a handful of syscalls; complete lines are handed out as
+// slices of the buffer (no copy) and a partial line carries over to the
+// next read. Line ends are found 16/32 bytes at a time with SSE2/AVX2.
+
+// Returned by line_reader_next()
+#define LINE_OK        1    // line holds a complete line
+#define LINE_NEED_MORE 0    // no complete line buffered, call line_reader_fill()
+#define LINE_TOO_LONG  (-1) // a line exceeded max_line; it is skipped up to its '\n'
+
+struct line_reader {
+    int fd;
+    char *buf;              // cap + 1 bytes: room for the '\0' of a final line
+    size_t cap;
+    size_t max_line;        // longest accepted line, '\n' included
+    size_t head;            // first byte not handed out yet
+    size_t tail;            // end of the buffered data
+    size_t scanned;         // bytes after head known to hold no '\n'
+    size_t cut;             // length of the current line up to its first '\r', or (size_t)-1
+    int discarding;         // dropping the rest of an over-long line
+};
+
+// A line without its terminator, '\0'-terminated in place. Valid until the
+// next line_reader_fill().
+struct line_slice {
+    char *data;
+    size_t len;
+};
+
+/**
+ * Set up a reader on fd with a cap-byte buffer.
+ *
+ * @param max_line longest line accepted, terminator included (<= cap)
+ * @return 0 on success, -1 if the buffer cannot be allocated
+ */
+int line_reader_init(struct line_reader *r, int fd, size_t cap, size_t max_line);
+
+void line_reader_destroy(struct line_reader *r);
+
+/**
+ * One read() into the free space of the buffer; consumed lines are
+ * dropped first so a partial line moves to the front.
+ *
+ * @return bytes read, 0 at EOF, -1 on error (errno from read(), EAGAIN on a
+ *         non-blocking socket, ENOBUFS if the buffer is full)
+ */
+ssize_t line_reader_fill(struct line_reader *r);
+
+/**
+ * Take the next complete line. The line ends at its first '\r' or '\n';
+ * anything between a '\r' and the '\n' is dropped.
+ *
+ * @return LINE_OK, LINE_NEED_MORE or LINE_TOO_LONG
+ */
+int line_reader_next(struct line_reader *r, struct line_slice *line);
+
+/**
+ * At EOF: take the unterminated data left after the last line.
+ *
+ * @return 1 if line holds a non-empty final line, 0 otherwise
+ */
+int line_reader_rest(struct line_reader *r, struct line_slice *line);
+
+// Bytes buffered but not handed out yet, e.g. to hand a connection over to
+// another protocol after sniffing its first bytes
+const char *line_reader_pending(const struct line_reader *r, size_t *len);
+
+// First '\n' in p[0..len), NULL if none (vectorized memchr)
+const char *line_find_newline(const char *p, size_t len);
+
+// First '\r' or '\n' in p[0..len), NULL if none
+const char *line_find_eol(const char *p, size_t len);
@@ -0,0 +1,41 @@
+#pragma once
+#include <stddef.h>
+
+// Mail API transport: one thread per process drives every SendGrid POST
+// through a libcurl multi handle. Its connections stay open between
+// requests (no DNS, TCP or TLS setup per message), concurrent requests
+// are multiplexed over HTTP/2 where the server offers it, and over up to
+// MAILHTTP_MAX_CONNECTIONS parallel connections otherwise. The thread is
+// started on first use; after fork() a child starts its own and never
+// touches the parent's connections.
+//
+// The endpoint is SENDGRID_API_URL (default MAILHTTP_DEFAULT_URL), with
+// an optional CA bundle in SENDGRID_CA_FILE, both read from the
+// environment (.env) when the thread starts.
+
+#define MAILHTTP_DEFAULT_URL        "https://api.sendgrid.com/v3/mail/send"
+#define MAILHTTP_MAX_CONNECTIONS    8       // per host
+#define MAILHTTP_TIMEOUT_S          20      // whole request
+#define MAILHTTP_CONNECT_TIMEOUT_S  10
+
+// Called on the transport thread when a request ends: rc 0 once a response
+// arrived (any status), -1 on transport errors; http_code 0 without a response
+typedef void (*mailhttp_done_fn)(void *arg, int rc, int http_code);
+
+/**
+ * Queue a POST of a JSON payload. Returns at once; done runs later on the
+ * transport thread and must not block.
+ *
+ * @param auth    "Authorization: ..." header line, copied
+ * @param payload malloc()ed JSON body; owned (and freed) by the transport,
+ *                even on error
+ * @return 0 if queued, -1 on error (done is not called)
+ */
+int mailhttp_post(const char *auth, char *payload, size_t len, mailhttp_done_fn done, void *arg);
+
+/**
+ * POST and wait for the response, from any thread.
+ *
+ * @return 0 once a response arrived (its status in *http_code), -1 on error
+ */
+int mailhttp_post_wait(const char *auth, char *payload, size_t len, int *http_code);
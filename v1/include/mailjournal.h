@@ -0,0 +1,82 @@
+#pragma once
+#include <stdint.h>
+
+// Durable outbox of the mail queue: an append-only log in a file mapped
+// MAP_SHARED by every process. A queued message is one MESSAGE record; a
+// job that reached a final state adds a DONE record. On startup the log is
+// replayed and messages without a DONE record are queued again, so a
+// message that was acknowledged is delivered at least once even if the
+// server dies mid-send.
+//
+// Appending is a copy into the mapping. Durability is a separate step,
+// mailj_sync(), with group commit: the first waiter flushes everything
+// appended so far with one msync(), and every waiter whose record it
+// covered returns with it.
+//
+// The data area is a ring addressed by ever-growing logical offsets. When
+// half of it is in use, records of jobs still pending are copied forward
+// and the rest (delivered mail, DONE records) is dropped by moving the
+// head past them.
+
+#define MAILJ_SIZE  (32u << 20)     // data area; twice the worst case of pending jobs
+
+enum mailj_type {
+    MAILJ_PAD = 1,          // filler up to the end of the ring
+    MAILJ_MESSAGE,
+    MAILJ_DONE
+};
+
+// A record handed to the replay callback; strings point into the mapping
+struct mailj_record {
+    enum mailj_type type;
+    uint64_t id;
+    const char *to;         // MESSAGE
+    const char *subject;
+    const char *body;
+    int state;              // DONE: final job state
+    int http_code;
+};
+
+struct mailj_stats {
+    uint64_t appends;       // records written
+    uint64_t syncs;         // msync() calls; appends / syncs is the group size
+    uint64_t compactions;
+};
+
+/**
+ * Map the journal file (created if missing) and replay it in write order.
+ * Call once at startup, before forking. A file with another layout is
+ * refused, not overwritten: it may hold undelivered mail.
+ *
+ * @param live    whether job id is still pending; used by compaction,
+ *                called with the caller's append lock held
+ * @param replay  called for every MESSAGE and DONE record found
+ * @param next_id receives the lowest job ID never used by the journal
+ * @return 0 on success, -1 on error
+ */
+int mailj_open(const char *path, int (*live)(uint64_t id),
+               void (*replay)(const struct mailj_record *rec), uint64_t *next_id);
+
+// 1 once mailj_open() succeeded
+int mailj_enabled(void);
+
+/**
+ * Append records. Callers serialise appends with their own lock (the mail
+ * queue's), which also keeps live() consistent during compaction.
+ *
+ * @param end receives the logical offset to pass to mailj_sync()
+ * @return 0 on success, -1 if the journal is full or disabled
+ */
+int mailj_append_message(uint64_t id, const char *to, const char *subject, const char *body, uint64_t *end);
+int mailj_append_done(uint64_t id, int state, int http_code);
+
+/**
+ * Wait until everything up to end is on disk; must not be called with the
+ * append lock held.
+ *
+ * @return 0 on success, -1 if the flush failed
+ */
+int mailj_sync(uint64_t end);
+
+// Counters since startup, summed over all processes
+void mailj_get_stats(struct mailj_stats *stats);
@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include "protocol.h"
+
+// Asynchronous mail queue: SENDMAIL stores the message in a job table in
+// shared memory and replies with a job ID; a dispatcher process delivers
+// the queued jobs in the background. The table is created before any
+// worker is forked, so fork-engine children and pre-forked workers all
+// submit into (and answer STATUS from) the same queue. A small supervisor
+// process respawns the dispatcher if it dies; if neither is running,
+// SENDMAIL is refused instead of queued.
+//
+// Deliveries that get no response, a 429 or a 5xx are retried with
+// exponential backoff and jitter. With a journal (mailjournal.h) every
+// queued message is on disk before SENDMAIL is acknowledged, and messages
+// not delivered when the server stopped are sent after the restart.
+
+#define MAILQ_CAPACITY          128     // jobs kept, including finished ones
+#define MAILQ_MAX_IN_FLIGHT     64      // concurrent SendGrid calls
+#define MAILQ_MAX_ATTEMPTS      8       // deliveries of one job, first one included
+#define MAILQ_RETRY_BASE_MS     1000    // backoff before the first retry, doubled per attempt
+#define MAILQ_RETRY_MAX_MS      60000
+#define MAILQ_STALE_MS          5000    // dispatcher silent this long: considered dead
+#define MAILQ_ADDR_MAX          256
+#define MAILQ_SUBJECT_MAX       256
+#define MAILQ_BODY_MAX          PROTO_MAX_FRAME
+
+enum mail_job_state {
+    MAIL_JOB_FREE = 0,
+    MAIL_JOB_QUEUED,
+    MAIL_JOB_SENDING,
+    MAIL_JOB_SENT,
+    MAIL_JOB_FAILED,
+    MAIL_JOB_RETRY,         // waiting for the next attempt
+    MAIL_JOB_RESERVED       // journaled, not dispatched until the record is on disk
+};
+
+struct mail_job_status {
+    enum mail_job_state state;
+    int http_code;          // SendGrid response, 0 if none (yet)
+};
+
+struct mailq_stats {
+    uint64_t retries;
+    uint64_t dispatcher_restarts;
+    uint64_t journal_appends;
+    uint64_t journal_syncs;
+    uint64_t journal_compactions;
+};
+
+/**
+ * Map the shared job table and fork the dispatcher process.
+ * Call once at startup, before worker processes or threads are created.
+ *
+ * @param journal_path outbox journal to replay and append to, NULL for
+ *                     none (queued mail is then lost with the server)
+ * @return 0 on success, -1 on error (SENDMAIL then stays synchronous)
+ */
+int mailq_start(const char *journal_path);
+
+/**
+ * Ask the dispatcher to exit once its in-flight deliveries finish.
+ */
+void mailq_stop(void);
+
+/**
+ * @return 1 if mailq_start() succeeded and SENDMAIL should enqueue
+ */
+int mailq_enabled(void);
+
+/**
+ * Queue a message for delivery. Strings longer than the job fields are
+ * truncated.
+ *
+ * @param id receives the job ID on success
+ * @return 0 on success, -1 if the queue is full or disabled, -2 if the
+ *         journal could not store it (it may still be delivered), -3 if
+ *         no dispatcher is running
+ */
+int mailq_submit(const char *to, const char *subject, const char *body, uint64_t *id);
+
+/**
+ * Look up a job.
+ *
+ * @return 0 on success, -1 if the ID is unknown or was already recycled
+ */
+int mailq_status(uint64_t id, struct mail_job_status *status);
+
+// Counters since startup, summed over all processes
+void mailq_get_stats(struct mailq_stats *stats);
+
+// Lower-case name of a job state, e.g. "queued"
+const char *mailq_state_name(enum mail_job_state state);
@@ -0,0 +1,79 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Allocation-free /proc reader. Every file is opened once and kept open;
+// a read is one pread() at offset 0 into a caller's (stack) buffer,
+// followed by a hand-written number parser. pread() does not move a file
+// offset, so one descriptor serves every thread.
+//
+// System-wide files opened before fork() are shared with the children;
+// /proc/self files are dropped in the child and reopened on first use.
+
+enum procfs_file {
+    PROCFS_MEMINFO = 0,
+    PROCFS_LOADAVG,
+    PROCFS_STAT,
+    PROCFS_SELF_STAT,
+    PROCFS_SELF_MOUNTINFO,
+    PROCFS_FILES
+};
+
+// Bytes; 0 for fields the kernel does not report (MemAvailable needs 3.14)
+struct procfs_meminfo {
+    uint64_t total;
+    uint64_t free;
+    uint64_t available;
+    uint64_t buffers;
+    uint64_t cached;
+};
+
+struct procfs_loadavg {
+    uint64_t loads[3];      // 1/5/15 min, fixed point (x 65536) as in struct sysinfo
+    uint32_t running;       // runnable threads
+    uint32_t threads;       // all threads
+};
+
+// Aggregate "cpu" line of /proc/stat, in USER_HZ ticks summed over all CPUs
+struct procfs_cpu {
+    uint64_t user;
+    uint64_t nice;
+    uint64_t system;
+    uint64_t idle;
+    uint64_t iowait;
+    uint64_t irq;
+    uint64_t softirq;
+    uint64_t steal;
+};
+
+// The calling process (all threads)
+struct procfs_self {
+    uint64_t utime;         // USER_HZ ticks
+    uint64_t stime;
+    uint64_t rss;           // bytes
+    uint32_t threads;
+};
+
+// Open the system-wide files. Call once at startup, before forking, so
+// children inherit the descriptors; files are otherwise opened on first use.
+void procfs_init(void);
+
+/**
+ * Read a whole (small) file: one pread() at offset 0.
+ *
+ * @param buf receives the contents, '\0'-terminated; a file longer than
+ *            cap - 1 bytes is cut
+ * @return bytes read, or -1 on error
+ */
+ssize_t procfs_read(enum procfs_file file, char *buf, size_t cap);
+
+// Read the part of a longer file starting at off, like procfs_read(); a
+// file is read to its end by calling this until it returns 0
+ssize_t procfs_read_at(enum procfs_file file, char *buf, size_t cap, off_t off);
+
+// Parsed readers; 0 on success, -1 on error
+int procfs_meminfo(struct procfs_meminfo *m);
+int procfs_loadavg(struct procfs_loadavg *l);
+int procfs_cpu(struct procfs_cpu *c);
+int procfs_self(struct procfs_self *s);
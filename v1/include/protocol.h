@@ -0,0 +1,101 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Binary framed protocol, shared by client and server.
+//
+// A connection that starts with the 4-byte preamble PROTO_MAGIC speaks
+// binary frames for its whole life; anything else is the text protocol.
+// All integers are big-endian.
+//
+//   request  := header(payload_len:u32, opcode:u16, field_count:u16) field*
+//   field    := tag:u16 len:u32 data[len]
+//   response := header(payload_len:u32, status:u16, opcode:u16) text[payload_len]
+//
+// String fields carry their terminating '\0' inside len, so the server can
+// hand them to C string APIs straight from the receive buffer.
+
+#define PROTO_MAGIC            "\xB1" "MS\x01"
+#define PROTO_MAGIC_LEN        4
+#define PROTO_HEADER_LEN       8
+#define PROTO_FIELD_HEADER_LEN 6
+// Largest frame (header included) a peer may send
+#define PROTO_MAX_FRAME        (64 * 1024)
+
+enum proto_opcode {
+    PROTO_OP_PING = 1,
+    PROTO_OP_SYSINFO = 2,
+    PROTO_OP_SENDMAIL = 3,
+    PROTO_OP_STATUS = 4,    // field JOB: decimal job ID of a queued SENDMAIL
+    PROTO_OP_SENDMAIL_MULTI = 5 // field TO: comma-separated recipients
+};
+
+enum proto_field_tag {
+    PROTO_FIELD_TO = 1,
+    PROTO_FIELD_SUBJECT = 2,
+    PROTO_FIELD_BODY = 3,
+    PROTO_FIELD_JOB = 4,
+    PROTO_FIELD_FORMAT = 5, // SYSINFO output: "text" (default), "json" or "bin"
+    PROTO_FIELD_SECTIONS = 6,   // SYSINFO sections, e.g. "memory,disk" (default: all)
+    PROTO_FIELD_SINCE = 7,      // SYSINFO snapshot version: send only what changed after it
+    PROTO_FIELD_COUNT       // one past the highest known tag
+};
+
+enum proto_status {
+    PROTO_STATUS_OK = 0,
+    PROTO_STATUS_ERROR = 1
+};
+
+struct proto_field {
+    const char *data;       // points into the frame; NULL if absent
+    uint32_t len;           // including the terminating '\0'
+};
+
+struct proto_request {
+    uint16_t opcode;
+    struct proto_field fields[PROTO_FIELD_COUNT];   // indexed by tag
+};
+
+/**
+ * Check for the binary preamble at the start of a connection.
+ *
+ * @return 1 if buf starts with PROTO_MAGIC, 0 if buf is a (possibly empty)
+ *         prefix of it and more bytes are needed, -1 for the text protocol
+ */
+int proto_preamble(const char *buf, size_t len);
+
+/**
+ * Size of the frame at the start of buf, header included.
+ *
+ * @return frame size, 0 if the header is not complete yet, -1 if the frame
+ *         is larger than PROTO_MAX_FRAME
+ */
+ssize_t proto_frame_size(const char *buf, size_t len);
+
+/**
+ * Parse one complete request frame without copying: field pointers refer
+ * into frame. Unknown tags are skipped; a repeated tag keeps the last value.
+ *
+ * @return 0 on success, -1 if fields overrun the frame or a string field is
+ *         not '\0'-terminated
+ */
+int proto_parse_request(const char *frame, size_t len, struct proto_request *req);
+
+/**
+ * Decode a header (request or response).
+ *
+ * @param word1 opcode of a request, status of a response
+ * @param word2 field count of a request, opcode of a response
+ */
+void proto_get_header(const char *hdr, uint32_t *payload_len, uint16_t *word1, uint16_t *word2);
+
+// Encode a header into hdr (PROTO_HEADER_LEN bytes)
+void proto_encode_header(char *hdr, uint32_t payload_len, uint16_t word1, uint16_t word2);
+
+// Encoding helpers; return 0 on success, -1 on write error
+int proto_write_header(FILE *out, uint32_t payload_len, uint16_t word1, uint16_t word2);
+int proto_write_field(FILE *out, uint16_t tag, const char *value);
+
+// Encoded size of a string field written by proto_write_field()
+uint32_t proto_field_size(const char *value);
@@ -0,0 +1,117 @@
+#pragma once
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Response builder: commands and collectors append segments, the engine
+// sends them all with one sendmsg() (gather I/O). Small pieces are copied
+// into an arena, large ones can be referenced in place or handed over, so
+// a response is never staged in a stdio buffer.
+
+// Referenced segments shorter than this are copied: an iovec entry costs
+// more than the memcpy
+#define RESPONSE_REF_MIN 256
+
+struct response_seg {
+    const char *ref;        // referenced or owned bytes; NULL: arena bytes at off
+    size_t off;
+    size_t len;
+    int owned;              // ref was malloc'ed and is freed with the response
+};
+
+struct response {
+    struct response_seg *segs;
+    size_t nsegs;
+    size_t segs_cap;
+    char *arena;            // copied bytes of every arena segment
+    size_t arena_len;
+    size_t arena_cap;
+    size_t len;             // bytes appended
+    size_t sent;            // bytes already written
+    size_t cur_seg;         // first segment not fully sent
+    size_t cur_off;         // bytes of it already sent
+    struct iovec *iov;      // unsent segments, rebuilt by response_iov()
+    size_t iov_cap;
+    int failed;             // an append ran out of memory; the response is truncated
+    int streaming;          // response_flush() sends to stream_fd
+    int stream_fd;
+};
+
+void response_init(struct response *r);
+
+// Free every buffer; r can be reused after response_init()
+void response_free(struct response *r);
+
+// Drop the content but keep the allocations for the next response
+void response_reset(struct response *r);
+
+// Append helpers; return 0, or -1 if memory ran out (r->failed is set)
+int response_write(struct response *r, const void *data, size_t len);
+int response_puts(struct response *r, const char *s);
+int response_printf(struct response *r, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int response_vprintf(struct response *r, const char *fmt, va_list ap);
+
+// Reference data without copying; it must stay valid until r is sent
+int response_ref(struct response *r, const void *data, size_t len);
+
+// Take ownership of a malloc'ed buffer holding len bytes of response
+int response_attach(struct response *r, char *buf, size_t len);
+
+// Move all of src to the end of dst without copying; src is left empty
+int response_splice(struct response *dst, struct response *src);
+
+// Bytes appended so far, and bytes not sent yet
+size_t response_len(const struct response *r);
+size_t response_pending(const struct response *r);
+
+/**
+ * Copy up to cap bytes starting at offset off into dst.
+ *
+ * @return bytes copied
+ */
+size_t response_copy(const struct response *r, size_t off, char *dst, size_t cap);
+
+// The whole response in one malloc'ed buffer (NULL if out of memory or empty)
+char *response_flatten(const struct response *r, size_t *len);
+
+/**
+ * Describe the unsent bytes as an iovec array (at most IOV_MAX entries).
+ * Valid until the next append, response_consume() or response_iov().
+ *
+ * @return number of entries, 0 if everything was sent
+ */
+int response_iov(struct response *r, const struct iovec **iov);
+
+// Mark n more bytes as sent
+void response_consume(struct response *r, size_t n);
+
+/**
+ * One sendmsg() of the unsent bytes. MSG_MORE is set when more than
+ * IOV_MAX segments remain, so the kernel coalesces the chunks.
+ *
+ * @return bytes sent, or -1 with errno (EAGAIN on a non-blocking socket)
+ */
+ssize_t response_send_some(struct response *r, int fd);
+
+/**
+ * Let response_flush() send partial output to fd (a blocking socket).
+ * Only the owner of a connection's final response should enable this;
+ * builders that are framed or handed to another thread never stream.
+ */
+void response_stream(struct response *r, int fd);
+
+/**
+ * Producers call this at natural boundaries (e.g. after each SYSINFO
+ * section). Sends what has been built so far if r streams, else no-op.
+ *
+ * @return 0, or -1 with errno if the send failed (the bytes stay pending)
+ */
+int response_flush(struct response *r);
+
+/**
+ * Send everything that is left, then reset r. For blocking sockets.
+ *
+ * @return 0 on success, -1 with errno (EAGAIN if SO_SNDTIMEO expired)
+ */
+int response_send(struct response *r, int fd);
@@ -0,0 +1,113 @@
+#pragma once
+#include <signal.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include "deadline.h"
+#include "admission.h"
+
+// Address the server listens on
+#define SERVER_ADDR "127.0.0.1"
+#define SERVER_PORT 9734
+
+// Default listen() backlog (--backlog=)
+#define SERVER_DEFAULT_BACKLOG 10
+
+// Exit status of a pre-forked worker that could not set up its listener;
+// the supervisor stops instead of respawning it
+#define PREFORK_EXIT_SETUP 2
+
+// Connection engine, selected with --engine=
+typedef enum {
+    ENGINE_FORK  = 0,   // fork() per accepted connection (default)
+    ENGINE_EPOLL = 1,   // edge-triggered epoll loop + worker threads
+    ENGINE_URING = 2    // io_uring completion loop + worker threads
+} engine_t;
+
+// Listening sockets served by one process: the TCP socket first, then the
+// optional AF_UNIX socket (--unix=PATH) for same-host clients
+#define SERVER_MAX_LISTENERS 2
+
+struct listener_set {
+    int fds[SERVER_MAX_LISTENERS];
+    int count;
+};
+
+// Returned by uring_engine_run() when the kernel cannot run the engine
+#define URING_UNSUPPORTED (-2)
+
+// Runtime options parsed from the command line
+struct server_options {
+    engine_t engine;
+    int threads;        // worker threads for the epoll engine
+    int backlog;        // listen() backlog
+    int prefork;        // non-zero: supervisor + SO_REUSEPORT workers
+    int workers;        // number of pre-forked workers (0 = online CPUs)
+    int async_mail;     // non-zero: SENDMAIL queues the message (see mailq.h)
+    const char *mail_journal;   // outbox journal of the queue, NULL = memory only (see mailjournal.h)
+    int sysinfo_ttl_ms; // SYSINFO snapshot lifetime, 0 = no caching
+    int sysinfo_threads;    // SYSINFO collector threads per process, 0 = inline
+    int disk_timeout_ms;    // budget of one mount scan, 0 = wait for every mount (see diskinfo.h)
+    int disk_cache_ms;      // reuse of a mount's answer, 0 = probe every scan
+    int history_interval_ms;    // metric sampling interval, 0 = no HISTORY (see history.h)
+    const char *history_file;   // file backing the history ring, NULL = memory only
+    struct deadline_config deadlines;   // connection and collector timeouts (see deadline.h)
+    struct admission_config admission;  // connection caps and rate limits (see admission.h)
+    const char *unix_path;  // AF_UNIX listener path, NULL = TCP only
+    int unix_fd;            // that listener, opened once and shared by all workers (-1 if none)
+};
+
+/**
+ * Create a TCP socket bound to addr:port and listening with the given backlog.
+ *
+ * @param reuseport set SO_REUSEPORT so several workers can bind the same port
+ * @return listening fd, or -1 on failure (error already logged)
+ */
+int listener_open(const char *addr, int port, int backlog, int reuseport);
+
+/**
+ * Create a non-blocking AF_UNIX stream socket listening on path; a stale
+ * socket file at path is replaced.
+ *
+ * @return listening fd, or -1 on failure (error already logged)
+ */
+int listener_open_unix(const char *path, int backlog);
+
+// Format a peer address for logs ("127.0.0.1:5000", "unix socket"); returns buf
+const char *listener_peer_name(const struct sockaddr_storage *peer, char *buf, size_t len);
+
+/**
+ * Run the epoll connection engine on already listening sockets.
+ *
+ * @param ls          bound and listening sockets (switched to non-blocking)
+ * @param nthreads    worker threads used for blocking command handlers
+ * @param should_exit flag set by the SIGQUIT handler
+ * @return 0 on graceful shutdown, -1 on setup failure
+ */
+int epoll_engine_run(const struct listener_set *ls, int nthreads, volatile sig_atomic_t *should_exit);
+
+/**
+ * Run the io_uring connection engine on already listening sockets: multishot
+ * accept, reads into registered buffers, and each response written with a
+ * write linked to the close of the socket. Deadlines live in a timer wheel
+ * advanced by a periodic timeout.
+ *
+ * @return 0 on graceful shutdown, URING_UNSUPPORTED if the kernel lacks the
+ *         required io_uring features (nothing was consumed from ls),
+ *         -1 on other setup failures
+ */
+int uring_engine_run(const struct listener_set *ls, int nthreads, volatile sig_atomic_t *should_exit);
+
+// Serve connections on ls until shutdown; returns -1 on setup failure
+typedef int (*prefork_serve_fn)(const struct listener_set *ls, void *arg);
+
+/**
+ * Pre-forked worker model: fork opt->workers processes, pin each to a CPU,
+ * give each its own SO_REUSEPORT listener (plus the shared opt->unix_fd)
+ * and call serve() in it. The
+ * calling process only supervises: crashed workers are respawned, and on
+ * SIGQUIT the workers are told to exit and reaped.
+ *
+ * @return 0 on graceful shutdown, -1 if the workers could not be started
+ */
+int prefork_run(const struct server_options *opt, prefork_serve_fn serve, void *arg,
+                volatile sig_atomic_t *should_exit);
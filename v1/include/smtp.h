@@ -1,6 +1,37 @@
 #pragma once
 
+// One-time libcurl and .env initialisation; call before starting threads
+int smtp_global_init(void);
+
 int send_email(const char *recipient, const char *subject, const char *body);
 
-int send_email_to_multiple_recipients(const char *recipients[], int num_recipients, const char *subject, const char *body);
+// Like send_email(), also reporting the HTTP status of the SendGrid call
+// (0 when no response was received)
+int send_email_http(const char *recipient, const char *subject, const char *body, int *http_code);
+
+// Completion of send_email_async(), with send_email_http()'s rc and status;
+// runs on the mail transport thread and must not block
+typedef void (*send_email_done_fn)(void *arg, int rc, int http_code);
+
+// Queue a message on the mail transport (mailhttp.h) and return at once;
+// -1 if it could not be queued (done is then not called)
+int send_email_async(const char *recipient, const char *subject, const char *body,
+                     send_email_done_fn done, void *arg);
+
+#define SMTP_MAX_BATCH          1000    // SendGrid personalizations per request
+#define SMTP_ADDR_MAX           254
+#define SMTP_INVALID_RECIPIENT  (-1)    // http_codes entry of a skipped address
+
+/**
+ * Send one message to many recipients. Each gets a personalization of its
+ * own (nobody sees the other addresses); they are packed SMTP_MAX_BATCH to
+ * a SendGrid request and all requests are sent concurrently.
+ *
+ * @param http_codes per recipient: status of the request that carried it
+ *                   (202 = accepted), 0 without a response, or
+ *                   SMTP_INVALID_RECIPIENT if the address was not sent
+ * @return number of recipients accepted, -1 on error
+ */
+int send_email_to_multiple_recipients(const char *recipients[], int num_recipients, const char *subject, const char *body,
+                                      int *http_codes);
 
@@ -1,12 +1,198 @@
 #pragma once
+#include <stdint.h>
 #include <stdio.h>
+#include <net/if.h>
 #include "debug.h"
+#include "response.h"
 
-int get_hostname(FILE *fp);
-int get_local_time(FILE *fp);
-int get_os_info(FILE *fp);
-int get_memory_usage(FILE *fp);
-int get_user_info(FILE *fp);
-int get_disk_info(FILE *fp);
-int get_env_info(FILE *fp);
-int get_network_info(FILE *fp);
\ No newline at end of file
+// System information as typed records. Collectors fill a fixed-layout
+// snapshot (no pointers, so it can be copied into shared memory, cached
+// and compared as plain bytes); renderers turn a snapshot into a response.
+
+// Sections of a snapshot, in the order they are rendered
+enum sysinfo_section {
+    SYSINFO_HOSTNAME = 0,
+    SYSINFO_TIME,
+    SYSINFO_OS,
+    SYSINFO_MEMORY,
+    SYSINFO_USER,
+    SYSINFO_DISK,
+    SYSINFO_ENV,
+    SYSINFO_NETWORK,
+    SYSINFO_SECTIONS
+};
+
+// Output formats of SYSINFO (FORMAT=text|json|bin)
+enum sysinfo_format {
+    SYSINFO_FORMAT_TEXT = 0,
+    SYSINFO_FORMAT_JSON,
+    SYSINFO_FORMAT_BIN
+};
+
+#define SYSINFO_SECTION_BIT(s) (1u << (s))
+#define SYSINFO_ALL            ((1u << SYSINFO_SECTIONS) - 1)
+
+#define SYSINFO_NAME_LEN    256         // hostname, user name, home directory
+#define SYSINFO_UTS_LEN     65          // struct utsname fields
+#define SYSINFO_MAX_IFACES  1024        // link and address entries kept: hundreds of veths
+#define SYSINFO_ENV_MAX     (64 * 1024) // "KEY=value\n" text of all variables
+#define SYSINFO_MAX_MOUNTS  256         // mounted filesystems kept
+#define SYSINFO_MOUNT_PATH_LEN 256      // mount point, longer ones are cut
+#define SYSINFO_FSTYPE_LEN  32
+
+// struct sysinfo_iface.flags
+#define SYSINFO_IF_MAC        0x1
+#define SYSINFO_IF_MTU        0x2
+#define SYSINFO_IF_NETMASK    0x4
+#define SYSINFO_IF_BROADCAST  0x8
+#define SYSINFO_IF_STATS      0x10
+#define SYSINFO_IF_LOOPBACK   0x20
+
+// One interface entry, as getifaddrs() would list it: a link (AF_PACKET,
+// with counters) or one of its addresses; IPv4 addresses in network byte order
+struct sysinfo_iface {
+    char name[IFNAMSIZ];
+    uint16_t family;        // AF_INET, AF_INET6, AF_PACKET, ...
+    uint16_t flags;         // SYSINFO_IF_*: which fields below are set
+    uint8_t mac[6];
+    int32_t mtu;
+    uint32_t addr;          // family AF_INET only
+    uint32_t netmask;
+    uint32_t broadcast;
+    uint32_t index;         // kernel ifindex, 0 if unknown
+    uint64_t rx_bytes;      // SYSINFO_IF_STATS, links only
+    uint64_t tx_bytes;
+    uint64_t rx_packets;
+    uint64_t tx_packets;
+};
+
+// struct sysinfo_mount.flags
+#define SYSINFO_MOUNT_SIZES     0x1     // total/free/avail are set
+#define SYSINFO_MOUNT_TIMED_OUT 0x2     // no answer within the budget; sizes, if any, are older
+#define SYSINFO_MOUNT_ERROR     0x4     // statvfs() failed with error
+
+// One mounted filesystem (see diskinfo.h); entries are zeroed before they
+// are filled, so they compare and hash as bytes
+struct sysinfo_mount {
+    char path[SYSINFO_MOUNT_PATH_LEN];
+    char fstype[SYSINFO_FSTYPE_LEN];
+    uint32_t flags;         // SYSINFO_MOUNT_*
+    int32_t error;          // errno, with SYSINFO_MOUNT_ERROR
+    uint64_t total;         // bytes
+    uint64_t free;
+    uint64_t avail;         // free to unprivileged users
+};
+
+struct sysinfo_snapshot {
+    // Fixed-size numbers first: the fields most readers want share the
+    // first cache lines
+    uint32_t collected;     // SYSINFO_SECTION_BIT of every collector that ran
+    uint32_t failed;        // ... and of those that failed
+    uint32_t timed_out;     // ... and of those that missed their deadline (also failed)
+    int64_t time;           // seconds since the epoch
+    int64_t uptime;         // seconds
+    uint64_t loads[3];      // 1/5/15 min load average, fixed point (x 65536)
+    uint64_t total_ram;     // bytes
+    uint64_t free_ram;
+    uint64_t available_ram; // /proc/meminfo; 0 where the kernel lacks the field
+    uint64_t buffer_ram;
+    uint64_t cached_ram;
+    uint64_t disk_total;    // bytes, root filesystem
+    uint64_t disk_free;
+    uint32_t iface_count;
+    uint32_t ifaces_dropped;    // link and address entries that did not fit in ifaces
+    uint32_t mount_count;
+    uint32_t mounts_dropped;    // mounts that did not fit in mounts
+    uint32_t env_count;
+    uint32_t env_len;       // bytes used in env
+    uint32_t env_dropped;   // variables that did not fit in env
+    // Delta bookkeeping (SYSINFO SINCE): versions count content changes of
+    // the shared snapshot; the reader of this copy has every change up to
+    // version in the sections it holds
+    uint64_t version;
+    uint64_t changed[SYSINFO_SECTIONS]; // version of each section's last change
+    uint64_t hash[SYSINFO_SECTIONS];    // of each section's content, set by the collector
+    char hostname[SYSINFO_NAME_LEN];
+    char os_name[SYSINFO_UTS_LEN];
+    char os_release[SYSINFO_UTS_LEN];
+    char os_version[SYSINFO_UTS_LEN];
+    char os_machine[SYSINFO_UTS_LEN];
+    char user[SYSINFO_NAME_LEN];
+    char home[SYSINFO_NAME_LEN];
+    // Variable-length parts last, so copies can stop at iface_count,
+    // mount_count and env_len
+    struct sysinfo_iface ifaces[SYSINFO_MAX_IFACES];
+    struct sysinfo_mount mounts[SYSINFO_MAX_MOUNTS];
+    char env[SYSINFO_ENV_MAX];
+};
+
+// Collectors: fill one section; 0 on success, -1 on failure
+int get_hostname(struct sysinfo_snapshot *snap);
+int get_local_time(struct sysinfo_snapshot *snap);
+int get_os_info(struct sysinfo_snapshot *snap);
+int get_memory_usage(struct sysinfo_snapshot *snap);
+int get_user_info(struct sysinfo_snapshot *snap);
+int get_disk_info(struct sysinfo_snapshot *snap);
+int get_env_info(struct sysinfo_snapshot *snap);
+int get_network_info(struct sysinfo_snapshot *snap);
+
+// Reset snap and run the collectors of the given SYSINFO_SECTION_BIT set
+void sysinfo_collect(struct sysinfo_snapshot *snap, uint32_t sections);
+
+/**
+ * Run one collector, replacing that section of snap (other sections are
+ * left alone) and updating snap->collected / snap->failed.
+ *
+ * @return 0, or -1 if the collector failed
+ */
+int sysinfo_collect_section(struct sysinfo_snapshot *snap, enum sysinfo_section section);
+
+// Report sections as timed out: collected and failed, with no content
+void sysinfo_mark_timed_out(struct sysinfo_snapshot *snap, uint32_t sections);
+
+// FNV-1a hash of one section's content (and whether it failed)
+uint64_t sysinfo_section_hash(const struct sysinfo_snapshot *snap, enum sysinfo_section section);
+
+// Test hook: sleep ms before every run of a section's collector (default 0).
+// Set at startup, before workers are forked or started.
+void sysinfo_set_delay(enum sysinfo_section section, int ms);
+
+// 1 if a section's collector can take long or wait on something outside
+// the kernel (and for any section given a delay): worth a thread of its own
+int sysinfo_section_may_block(enum sysinfo_section section);
+
+// Lower-case name of a section ("hostname", "memory", ...), as used in JSON
+// and in SYSINFO section lists
+const char *sysinfo_section_name(enum sysinfo_section section);
+
+// Section with the given name (len bytes, not necessarily terminated); -1 if unknown
+int sysinfo_section_by_name(const char *name, size_t len);
+
+// Copy the given sections of src (the fixed part, and mounts and env only
+// if selected); dst->collected and dst->failed are limited to them
+void sysinfo_snapshot_copy(struct sysinfo_snapshot *dst, const struct sysinfo_snapshot *src, uint32_t sections);
+
+// Overwrite the fields of the given sections in dst with those of src
+void sysinfo_snapshot_merge(struct sysinfo_snapshot *dst, const struct sysinfo_snapshot *src, uint32_t sections);
+
+// Append the classic "=== Section ===" text of every collected section
+void sysinfo_render_text(const struct sysinfo_snapshot *snap, struct response *out);
+
+// Append the snapshot as one line of JSON; failed sections are null, timed
+// out ones {"timed_out":true}, and "snapshot" carries snap->version
+void sysinfo_render_json(const struct sysinfo_snapshot *snap, struct response *out);
+
+// Append the snapshot as a binary record (layout in sysinfo_wire.h)
+void sysinfo_render_bin(const struct sysinfo_snapshot *snap, struct response *out);
+
+// Render in the given format
+void sysinfo_render(const struct sysinfo_snapshot *snap, enum sysinfo_format format, struct response *out);
+
+// Section-at-a-time rendering for streaming (text and JSON only; a binary
+// record needs every section first): open, one call per section in
+// enum order (uncollected sections are skipped; a delta response leaves
+// out unchanged ones too), close
+void sysinfo_render_open(enum sysinfo_format format, struct response *out);
+void sysinfo_render_section(const struct sysinfo_snapshot *snap, enum sysinfo_section section,
+                            enum sysinfo_format format, struct response *out);
+void sysinfo_render_close(const struct sysinfo_snapshot *snap, enum sysinfo_format format, struct response *out);
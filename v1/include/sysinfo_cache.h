@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include "sysinfo.h"
+
+// Cross-process SYSINFO snapshot cache. The collected struct sysinfo_snapshot
+// is kept in a shared mapping created before any worker is forked; requests within the
+// TTL are answered from it. Each section has its own age and its own single
+// flight: when a section expires exactly one caller recollects it while
+// concurrent callers get the previous data. The cache also numbers content
+// changes, which SYSINFO SINCE <version> uses to send only what changed.
+
+#define SYSINFO_CACHE_DEFAULT_TTL_MS 1000
+// A refresh running longer than this is presumed dead and taken over
+#define SYSINFO_REFRESH_TIMEOUT_MS   30000
+
+struct sysinfo_cache_stats {
+    uint64_t collections;   // collector runs (cache misses and refreshes)
+    uint64_t hits;          // answered from a fresh snapshot
+    uint64_t stale_hits;    // answered from the previous snapshot during a refresh
+    uint64_t runs[SYSINFO_SECTIONS];    // collector runs per section
+};
+
+/**
+ * Map the shared snapshot region. Call once at startup, before forking.
+ *
+ * @param ttl_ms snapshot lifetime; 0 disables caching (collections are
+ *               still counted)
+ * @return 0 on success, -1 on error (every request then collects)
+ */
+int sysinfo_cache_init(int ttl_ms);
+
+/**
+ * Start a SYSINFO request: copy the requested sections that can be served
+ * from the cache into snap and claim the rest for this caller. Each claimed
+ * section must be collected into snap (sysinfo_collect_section()) and
+ * handed back with sysinfo_cache_store() as soon as it is done.
+ *
+ * @param sections SYSINFO_SECTION_BIT set the caller will send
+ * @param wait_ms  longest wait for a section another caller is collecting
+ *                 for the first time, 0 = until it is done. Such a section
+ *                 is then neither copied nor claimed.
+ * @return the sections the caller must collect itself (0: all served)
+ */
+uint32_t sysinfo_cache_begin(struct sysinfo_snapshot *snap, uint32_t sections, int wait_ms);
+
+/**
+ * Store freshly collected sections of snap and release their claim. A
+ * section whose hash differs from the stored one gets a new version;
+ * snap->changed and snap->version are updated to match.
+ */
+void sysinfo_cache_store(struct sysinfo_snapshot *snap, uint32_t sections);
+
+// Give up the claim on sections without storing them (their collector
+// will not finish), so the next request collects them at once
+void sysinfo_cache_release(uint32_t sections);
+
+/**
+ * Copy the counters; all zero if the cache is not initialised.
+ */
+void sysinfo_cache_get_stats(struct sysinfo_cache_stats *stats);
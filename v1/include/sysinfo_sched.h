@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+#include "sysinfo.h"
+
+// SYSINFO collector scheduler. Of the sections a request has to collect
+// itself, the slow ones (sysinfo_section_may_block()) run concurrently on a
+// small thread pool (one per process, started on first use) while the
+// request runs the quick ones, and takes all of them back in enum order, so
+// the response is assembled and streamed in the canonical order. Each pooled
+// collector has a deadline (DEADLINE_COLLECTOR): a section that misses it is
+// sent as timed out, and its collector finishes in the background and
+// still refreshes the cache.
+
+#define SYSINFO_SCHED_DEFAULT_THREADS 4
+#define SYSINFO_SCHED_MAX_THREADS     64
+
+/**
+ * Set the pool size. Call once at startup, before forking.
+ *
+ * @param threads collector threads per process; 0 runs every collector in
+ *                the requesting thread, one after another, with no deadline
+ */
+void sysinfo_sched_init(int threads);
+
+struct sysinfo_batch;
+
+/**
+ * Queue the slow collectors among the given sections (claimed with
+ * sysinfo_cache_begin()). Their deadline is deadline_ms(DEADLINE_COLLECTOR)
+ * from now; the others are collected by sysinfo_sched_wait().
+ *
+ * @return the batch, or NULL to collect everything inline (no pool, no slow
+ *         section or out of memory); sysinfo_sched_wait() handles both
+ */
+struct sysinfo_batch *sysinfo_sched_start(uint32_t todo);
+
+/**
+ * Wait for one queued section, copy it into snap and store it in the
+ * cache. Sections that were not queued are collected right here.
+ *
+ * @return 0 once collected (it may have failed), -1 if the deadline passed
+ *         first: the section is then marked timed out in snap
+ */
+int sysinfo_sched_wait(struct sysinfo_batch *batch, struct sysinfo_snapshot *snap,
+                       enum sysinfo_section section);
+
+// End a batch; collectors still running finish on their own
+void sysinfo_sched_finish(struct sysinfo_batch *batch);
@@ -0,0 +1,151 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary SYSINFO record (SYSINFO FORMAT=bin), shared by client and server.
+//
+// Versioned, little-endian and at fixed offsets, so a consumer can read the
+// fields it needs in place without parsing the rest:
+//
+//   header  := header_len bytes at the offsets below
+//   strings := NUL-terminated strings, located by the header's string table
+//   ifaces  := iface_count records of iface_size bytes, 4-byte aligned
+//   mounts  := mount_count records of mount_size bytes, followed by the
+//              NUL-terminated paths and filesystem types they point to
+//   env     := env_len bytes of "KEY=value\n" lines
+//
+// Readers must use header_len, iface_size, mount_size and the offsets from
+// the header rather than the constants: later versions may append fields.
+
+#define SYSINFO_WIRE_MAGIC       "SYSI"
+#define SYSINFO_WIRE_VERSION     1
+
+// Header fields (byte offsets)
+#define SYSINFO_WIRE_OFF_MAGIC        0   // char[4]
+#define SYSINFO_WIRE_OFF_VERSION      4   // u16
+#define SYSINFO_WIRE_OFF_HEADER_LEN   6   // u16
+#define SYSINFO_WIRE_OFF_TOTAL_LEN    8   // u32, whole record
+#define SYSINFO_WIRE_OFF_COLLECTED    12  // u32, bit per enum sysinfo_section
+#define SYSINFO_WIRE_OFF_FAILED       16  // u32
+#define SYSINFO_WIRE_OFF_ENV_COUNT    20  // u32
+#define SYSINFO_WIRE_OFF_TIME         24  // i64, seconds since the epoch
+#define SYSINFO_WIRE_OFF_UPTIME       32  // i64, seconds
+#define SYSINFO_WIRE_OFF_LOADS        40  // u64[3], load average x 65536
+#define SYSINFO_WIRE_OFF_TOTAL_RAM    64  // u64, bytes
+#define SYSINFO_WIRE_OFF_FREE_RAM     72  // u64
+#define SYSINFO_WIRE_OFF_DISK_TOTAL   80  // u64, bytes, root filesystem
+#define SYSINFO_WIRE_OFF_DISK_FREE    88  // u64
+#define SYSINFO_WIRE_OFF_IFACE_OFF    96  // u32
+#define SYSINFO_WIRE_OFF_IFACE_COUNT  100 // u16
+#define SYSINFO_WIRE_OFF_IFACE_SIZE   102 // u16
+#define SYSINFO_WIRE_OFF_ENV_OFF      104 // u32
+#define SYSINFO_WIRE_OFF_ENV_LEN      108 // u32
+#define SYSINFO_WIRE_OFF_STRINGS      112 // SYSINFO_WIRE_STRINGS x (u16 offset, u16 length)
+#define SYSINFO_WIRE_HEADER_LEN_MIN   144 // headers end here in the first servers
+#define SYSINFO_WIRE_OFF_AVAIL_RAM    144 // u64, bytes, /proc/meminfo
+#define SYSINFO_WIRE_OFF_BUFFER_RAM   152 // u64
+#define SYSINFO_WIRE_OFF_CACHED_RAM   160 // u64
+#define SYSINFO_WIRE_OFF_SNAPSHOT     168 // u64, snapshot version for SYSINFO SINCE
+#define SYSINFO_WIRE_OFF_TIMED_OUT    176 // u32, failed sections that missed their deadline
+#define SYSINFO_WIRE_OFF_MOUNT_OFF    180 // u32
+#define SYSINFO_WIRE_OFF_MOUNT_COUNT  184 // u16
+#define SYSINFO_WIRE_OFF_MOUNT_SIZE   186 // u16
+#define SYSINFO_WIRE_OFF_IFACES_DROPPED 188 // u32, interface entries that did not fit
+#define SYSINFO_WIRE_HEADER_LEN       192
+
+// String table slots
+enum sysinfo_wire_string {
+    SYSINFO_WIRE_HOSTNAME = 0,
+    SYSINFO_WIRE_OS_NAME,
+    SYSINFO_WIRE_OS_RELEASE,
+    SYSINFO_WIRE_OS_VERSION,
+    SYSINFO_WIRE_OS_MACHINE,
+    SYSINFO_WIRE_USER,
+    SYSINFO_WIRE_HOME,
+    SYSINFO_WIRE_STRINGS = 8        // table size; unused slots are zero
+};
+
+// Interface record fields (byte offsets); flags are SYSINFO_IF_* (sysinfo.h)
+#define SYSINFO_WIRE_IF_NAME       0   // char[16], NUL-padded
+#define SYSINFO_WIRE_IF_FAMILY     16  // u16, Linux AF_* value
+#define SYSINFO_WIRE_IF_FLAGS      18  // u16
+#define SYSINFO_WIRE_IF_MAC        20  // u8[6]
+#define SYSINFO_WIRE_IF_MTU        28  // i32
+#define SYSINFO_WIRE_IF_ADDR       32  // u8[4], IPv4 in network order
+#define SYSINFO_WIRE_IF_NETMASK    36  // u8[4]
+#define SYSINFO_WIRE_IF_BROADCAST  40  // u8[4]
+#define SYSINFO_WIRE_IF_SIZE_MIN   44  // records end here in the first servers
+#define SYSINFO_WIRE_IF_INDEX      44  // u32, kernel ifindex, 0 if unknown
+#define SYSINFO_WIRE_IF_RX_BYTES   48  // u64, set with SYSINFO_IF_STATS
+#define SYSINFO_WIRE_IF_TX_BYTES   56  // u64
+#define SYSINFO_WIRE_IF_RX_PACKETS 64  // u64
+#define SYSINFO_WIRE_IF_TX_PACKETS 72  // u64
+#define SYSINFO_WIRE_IF_SIZE       80
+#define SYSINFO_WIRE_IF_NAME_LEN   16
+
+// Mount record fields (byte offsets); flags are SYSINFO_MOUNT_* (sysinfo.h)
+#define SYSINFO_WIRE_MNT_TOTAL     0   // u64, bytes, with SYSINFO_MOUNT_SIZES
+#define SYSINFO_WIRE_MNT_FREE      8   // u64
+#define SYSINFO_WIRE_MNT_AVAIL     16  // u64
+#define SYSINFO_WIRE_MNT_FLAGS     24  // u32
+#define SYSINFO_WIRE_MNT_ERROR     28  // i32, Linux errno, with SYSINFO_MOUNT_ERROR
+#define SYSINFO_WIRE_MNT_PATH      32  // u32, offset of the mount point in the whole record
+#define SYSINFO_WIRE_MNT_FSTYPE    36  // u32, ... of the filesystem type
+#define SYSINFO_WIRE_MNT_SIZE      40
+
+static inline uint16_t sysinfo_wire_get16(const void *buf, size_t off) {
+    const unsigned char *p = (const unsigned char *)buf + off;
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t sysinfo_wire_get32(const void *buf, size_t off) {
+    const unsigned char *p = (const unsigned char *)buf + off;
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t sysinfo_wire_get64(const void *buf, size_t off) {
+    return sysinfo_wire_get32(buf, off) | ((uint64_t)sysinfo_wire_get32(buf, off + 4) << 32);
+}
+
+static inline void sysinfo_wire_put16(void *buf, size_t off, uint16_t v) {
+    unsigned char *p = (unsigned char *)buf + off;
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static inline void sysinfo_wire_put32(void *buf, size_t off, uint32_t v) {
+    sysinfo_wire_put16(buf, off, (uint16_t)v);
+    sysinfo_wire_put16(buf, off + 2, (uint16_t)(v >> 16));
+}
+
+static inline void sysinfo_wire_put64(void *buf, size_t off, uint64_t v) {
+    sysinfo_wire_put32(buf, off, (uint32_t)v);
+    sysinfo_wire_put32(buf, off + 4, (uint32_t)(v >> 32));
+}
+
+/**
+ * Validate a record: magic, version and that every offset stays inside it.
+ *
+ * @return record length (total_len) on success, 0 if buf holds only part of
+ *         a record, -1 if it is not a valid record
+ */
+long sysinfo_wire_check(const void *buf, size_t len);
+
+/**
+ * String slot of a checked record.
+ *
+ * @return pointer into buf ('\0'-terminated), "" for an unused slot
+ */
+const char *sysinfo_wire_string(const void *buf, enum sysinfo_wire_string slot);
+
+// Interface record i of a checked record (i < iface_count)
+const unsigned char *sysinfo_wire_iface(const void *buf, uint32_t i);
+
+// Mount records of a checked record; 0 from servers older than the field
+uint32_t sysinfo_wire_mount_count(const void *buf);
+
+// Mount record i of a checked record (i < sysinfo_wire_mount_count())
+const unsigned char *sysinfo_wire_mount(const void *buf, uint32_t i);
+
+// String field (SYSINFO_WIRE_MNT_PATH or _FSTYPE) of a mount record of buf
+const char *sysinfo_wire_mount_string(const void *buf, const unsigned char *mount, size_t field);
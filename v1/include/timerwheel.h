@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Hashed timing wheel for connection deadlines.
+ *
+ * Timers are intrusive: callers embed a struct timer in their own state and
+ * recover it with container_of-style pointer arithmetic, as with work items.
+ * Each slot holds a doubly linked list, so arming and cancelling are O(1);
+ * a timer further away than one revolution simply stays in its slot until
+ * its tick comes round. Advancing the wheel moves every due timer onto an
+ * expired list that the caller drains in one batch.
+ */
+
+#define TIMER_WHEEL_SLOTS   512     // power of two
+#define TIMER_WHEEL_TICK_MS 100     // resolution of every deadline
+
+struct timer {
+    struct timer *prev;     // NULL while disarmed
+    struct timer *next;
+    uint64_t expires;       // absolute tick
+    int kind;               // free for the caller, e.g. which deadline this is
+};
+
+struct timer_wheel {
+    struct timer slots[TIMER_WHEEL_SLOTS];  // list heads
+    uint64_t current;                       // next tick to sweep
+};
+
+// Empty the wheel; now_ms is the caller's monotonic clock
+void timer_wheel_init(struct timer_wheel *w, uint64_t now_ms);
+
+// Initialise a list head (e.g. the expired list) or a disarmed timer
+void timer_list_init(struct timer *head);
+void timer_init(struct timer *t, int kind);
+
+// (Re)arm t to fire at expires_ms; a deadline already past fires on the next sweep
+void timer_arm(struct timer_wheel *w, struct timer *t, uint64_t expires_ms);
+
+// Disarm t, whether it is in the wheel or on an expired list; no-op if disarmed
+void timer_cancel(struct timer *t);
+
+// @return non-zero if t is in the wheel or on an expired list
+int timer_armed(const struct timer *t);
+
+/**
+ * Sweep every tick up to now_ms and move the due timers to the end of the
+ * expired list. They stay armed until popped, so handling one expiry may
+ * safely cancel another timer that is still on the list.
+ */
+void timer_wheel_expire(struct timer_wheel *w, uint64_t now_ms, struct timer *expired);
+
+// Detach and return the first timer of a list, NULL when it is empty
+struct timer *timer_list_pop(struct timer *head);
@@ -0,0 +1,38 @@
+#pragma once
+
+/**
+ * Fixed-size thread pool used by the event-driven engines to run blocking
+ * command handlers off the I/O loop.
+ *
+ * Work items are intrusive: callers embed a struct work_item in their own
+ * state and recover it with container_of-style pointer arithmetic. Finished
+ * items are moved to a completion list and the pool's eventfd becomes
+ * readable, so the I/O loop can pick them up with workpool_reap().
+ */
+
+struct work_item {
+    void (*run)(struct work_item *item);   // executed on a pool thread
+    struct work_item *next;                // internal list linkage
+};
+
+struct workpool;
+
+// Create a pool with nthreads threads. Returns NULL on failure.
+struct workpool *workpool_create(int nthreads);
+
+// Finish all queued work and join the threads. Completed items can still
+// be collected with workpool_reap() afterwards.
+void workpool_stop(struct workpool *wp);
+
+// Stop the pool (if still running) and free it
+void workpool_destroy(struct workpool *wp);
+
+// Queue an item for execution. Returns 0 on success, -1 on failure.
+int workpool_submit(struct workpool *wp, struct work_item *item);
+
+// eventfd that becomes readable whenever completed items are available
+int workpool_fd(const struct workpool *wp);
+
+// Detach and return the list of completed items (linked through ->next),
+// in completion order. Also drains the eventfd counter.
+struct work_item *workpool_reap(struct workpool *wp);
@@ -0,0 +1,344 @@
+#define _GNU_SOURCE
+#include "admission.h"
+#include "debug.h"
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TABLE_MASK (ADMISSION_TABLE_SIZE - 1)
+// Entry of a connection counted against the global cap only (table full)
+#define ENTRY_NONE (-1)
+
+enum entry_state {
+    ENTRY_EMPTY = 0,        // ends a probe sequence
+    ENTRY_USED,
+    ENTRY_RECYCLED          // tombstone: skipped by lookups, reused by inserts
+};
+
+struct bucket {
+    int64_t tokens_milli;   // thousandths of a token
+    int64_t refilled_ms;
+};
+
+// Entries never move while they have connections, so a lease's entry index
+// stays valid until its connection is released
+struct entry {
+    uint32_t addr;          // IPv4 address in host byte order, 0 for non-IP peers
+    uint32_t state;
+    uint32_t active;        // atomic: open connections from addr
+    int64_t last_seen_ms;   // atomic
+    struct bucket buckets[ADMISSION_CLASSES];
+};
+
+// One admitted connection; the ticket handed out is the lease index
+struct lease {
+    int32_t owner;          // atomic: PID serving the connection, 0 = free
+    int32_t entry;          // address entry, or ENTRY_NONE
+};
+
+struct admission_table {
+    pthread_mutex_t lock;   // process-shared, robust: lookups, inserts, buckets, lease allocation
+    struct admission_config cfg;
+    uint64_t active;        // atomic, like every counter below
+    uint64_t rejected_global;
+    uint64_t rejected_per_ip;
+    uint64_t rate_limited[ADMISSION_CLASSES];
+    struct entry entries[ADMISSION_TABLE_SIZE];
+    // Free leases are taken lowest first, so held ones stay below the
+    // high-water mark and a scan by owner is short
+    uint32_t lease_hint;    // atomic: no free lease below this
+    uint32_t lease_limit;   // atomic: no lease at or above this was ever taken
+    struct lease leases[ADMISSION_MAX_TICKETS];
+};
+
+static struct admission_table *table;
+static __thread int current_ticket = -1;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void table_lock(void) {
+    if (pthread_mutex_lock(&table->lock) == EOWNERDEAD) {
+        // A worker died holding the lock; every update is a single store
+        pthread_mutex_consistent(&table->lock);
+    }
+}
+
+static void table_unlock(void) {
+    pthread_mutex_unlock(&table->lock);
+}
+
+void admission_default_config(struct admission_config *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->max_conns = ADMISSION_DEFAULT_MAX_CONNS;
+    cfg->max_per_ip = ADMISSION_DEFAULT_MAX_PER_IP;
+    cfg->rates[ADMISSION_SYSINFO].rate = 5;
+    cfg->rates[ADMISSION_SYSINFO].burst = 10;
+    cfg->rates[ADMISSION_SENDMAIL].rate = 1;
+    cfg->rates[ADMISSION_SENDMAIL].burst = 5;
+}
+
+int admission_init(const struct admission_config *cfg) {
+    struct admission_table *t = mmap(NULL, sizeof(*t), PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED) {
+        ERROR_LOG(stderr, "mmap() failed for admission table\n");
+        perror("mmap");
+        return -1;
+    }
+    pthread_mutexattr_t ma;
+    int ok = pthread_mutexattr_init(&ma) == 0;
+    ok = ok && pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED) == 0 &&
+         pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST) == 0 &&
+         pthread_mutex_init(&t->lock, &ma) == 0;
+    pthread_mutexattr_destroy(&ma);
+    if (!ok) {
+        ERROR_LOG(stderr, "Failed to initialise admission table lock\n");
+        munmap(t, sizeof(*t));
+        return -1;
+    }
+    t->cfg = *cfg;
+    table = t;
+    return 0;
+}
+
+static uint32_t addr_key(const struct sockaddr *addr) {
+    if (addr != NULL && addr->sa_family == AF_INET) {
+        return ntohl(((const struct sockaddr_in *)addr)->sin_addr.s_addr);
+    }
+    return 0;
+}
+
+static uint32_t addr_hash(uint32_t key) {
+    key ^= key >> 16;
+    key *= 0x45d9f3bu;
+    key ^= key >> 16;
+    return key & TABLE_MASK;
+}
+
+// Find the entry of key or create it; -1 if every slot has connections.
+// Called with the lock held.
+static int lookup(uint32_t key, int64_t now) {
+    uint32_t h = addr_hash(key);
+    int free_slot = -1;
+    for (int i = 0; i < ADMISSION_TABLE_SIZE; i++) {
+        int idx = (int)((h + (uint32_t)i) & TABLE_MASK);
+        struct entry *e = &table->entries[idx];
+        if (e->state == ENTRY_EMPTY) {
+            if (free_slot < 0) {
+                free_slot = idx;
+            }
+            break;
+        }
+        if (e->state == ENTRY_USED && e->addr == key) {
+            return idx;
+        }
+        if (e->state == ENTRY_USED && free_slot < 0 &&
+            __atomic_load_n(&e->active, __ATOMIC_RELAXED) == 0 &&
+            now - __atomic_load_n(&e->last_seen_ms, __ATOMIC_RELAXED) >= ADMISSION_ENTRY_TTL_MS) {
+            e->state = ENTRY_RECYCLED;
+        }
+        if (e->state == ENTRY_RECYCLED && free_slot < 0) {
+            free_slot = idx;
+        }
+    }
+    if (free_slot < 0) {
+        return -1;
+    }
+    struct entry *e = &table->entries[free_slot];
+    e->addr = key;
+    e->state = ENTRY_USED;
+    e->active = 0;
+    e->last_seen_ms = now;
+    for (int c = 0; c < ADMISSION_CLASSES; c++) {
+        e->buckets[c].tokens_milli = (int64_t)table->cfg.rates[c].burst * 1000;
+        e->buckets[c].refilled_ms = now;
+    }
+    return free_slot;
+}
+
+// Take the lowest free lease; -1 if all are held. Called with the lock held.
+static int lease_take(int entry) {
+    uint32_t hint = __atomic_load_n(&table->lease_hint, __ATOMIC_RELAXED);
+    for (uint32_t n = 0; n < ADMISSION_MAX_TICKETS; n++) {
+        // Releases are lock-free and may lower the hint meanwhile: wrap around
+        uint32_t i = (hint + n) % ADMISSION_MAX_TICKETS;
+        struct lease *l = &table->leases[i];
+        if (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != 0) {
+            continue;
+        }
+        l->entry = entry;
+        __atomic_store_n(&l->owner, (int32_t)getpid(), __ATOMIC_RELEASE);
+        __atomic_compare_exchange_n(&table->lease_hint, &hint, i + 1, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        if (i + 1 > __atomic_load_n(&table->lease_limit, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&table->lease_limit, i + 1, __ATOMIC_RELAXED);
+        }
+        return (int)i;
+    }
+    return -1;
+}
+
+int admission_acquire(const struct sockaddr *addr, int *ticket) {
+    *ticket = -1;
+    if (table == NULL) {
+        return ADMISSION_OK;
+    }
+    int64_t now = now_ms();
+    int rc = ADMISSION_OK;
+    struct entry *e = NULL;
+    table_lock();
+    if (table->cfg.max_conns > 0 &&
+        __atomic_load_n(&table->active, __ATOMIC_RELAXED) >= (uint64_t)table->cfg.max_conns) {
+        rc = ADMISSION_REJECT_GLOBAL;
+    } else {
+        // idx < 0: table full of busy addresses, only the global cap applies
+        int idx = lookup(addr_key(addr), now);
+        if (idx >= 0) {
+            e = &table->entries[idx];
+            if (table->cfg.max_per_ip > 0 &&
+                __atomic_load_n(&e->active, __ATOMIC_RELAXED) >= (uint32_t)table->cfg.max_per_ip) {
+                rc = ADMISSION_REJECT_PER_IP;
+            }
+        }
+        if (rc == ADMISSION_OK) {
+            *ticket = lease_take(idx >= 0 ? idx : ENTRY_NONE);
+            if (*ticket < 0) {
+                rc = ADMISSION_REJECT_GLOBAL;
+            }
+        }
+    }
+    if (rc == ADMISSION_OK) {
+        if (e != NULL) {
+            __atomic_fetch_add(&e->active, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&e->last_seen_ms, now, __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_add(&table->active, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(rc == ADMISSION_REJECT_PER_IP ? &table->rejected_per_ip
+                                                         : &table->rejected_global,
+                           1, __ATOMIC_RELAXED);
+    }
+    table_unlock();
+    return rc;
+}
+
+void admission_release(int ticket) {
+    if (table == NULL || ticket < 0) {
+        return;
+    }
+    // Lock-free, so it may run in a signal handler
+    struct lease *l = &table->leases[ticket];
+    int32_t entry = l->entry;
+    if (__atomic_exchange_n(&l->owner, 0, __ATOMIC_ACQ_REL) == 0) {
+        return;     // already released
+    }
+    __atomic_fetch_sub(&table->active, 1, __ATOMIC_RELAXED);
+    if (entry != ENTRY_NONE) {
+        struct entry *e = &table->entries[entry];
+        __atomic_store_n(&e->last_seen_ms, now_ms(), __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&e->active, 1, __ATOMIC_RELAXED);
+    }
+    uint32_t hint = __atomic_load_n(&table->lease_hint, __ATOMIC_RELAXED);
+    while ((uint32_t)ticket < hint &&
+           !__atomic_compare_exchange_n(&table->lease_hint, &hint, (uint32_t)ticket, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void admission_set_owner(int ticket, pid_t owner) {
+    if (table == NULL || ticket < 0) {
+        return;
+    }
+    // The new owner may already have released it: never revive a free lease
+    int32_t self = (int32_t)getpid();
+    __atomic_compare_exchange_n(&table->leases[ticket].owner, &self, (int32_t)owner, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+int admission_release_owner(pid_t owner) {
+    if (table == NULL || owner <= 0) {
+        return 0;
+    }
+    int released = 0;
+    uint32_t limit = __atomic_load_n(&table->lease_limit, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < limit; i++) {
+        // A reaped PID is not reused until then, so no new lease can carry it
+        if (__atomic_load_n(&table->leases[i].owner, __ATOMIC_ACQUIRE) == (int32_t)owner) {
+            admission_release((int)i);
+            released++;
+        }
+    }
+    return released;
+}
+
+void admission_reject(int fd, int reason) {
+    static const char global_msg[] = "Error: Too many connections\n";
+    static const char per_ip_msg[] = "Error: Too many connections from your address\n";
+    const char *msg = reason == ADMISSION_REJECT_PER_IP ? per_ip_msg : global_msg;
+    size_t len = reason == ADMISSION_REJECT_PER_IP ? sizeof(per_ip_msg) - 1 : sizeof(global_msg) - 1;
+    // Best effort: a fresh socket's send buffer is empty, never wait for the peer
+    if (send(fd, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+        DEBUG_LOG(stderr, "admission: could not send rejection on fd %d\n", fd);
+    }
+    close(fd);
+}
+
+void admission_set_current(int ticket) {
+    current_ticket = ticket;
+}
+
+int admission_take(enum admission_class cls) {
+    if (table == NULL || current_ticket < 0 || table->cfg.rates[cls].rate <= 0) {
+        return 0;
+    }
+    int entry = table->leases[current_ticket].entry;
+    if (entry == ENTRY_NONE) {
+        return 0;
+    }
+    const struct admission_rate *r = &table->cfg.rates[cls];
+    int64_t now = now_ms();
+    int rc = 0;
+    table_lock();
+    struct bucket *b = &table->entries[entry].buckets[cls];
+    // rate tokens per second is rate thousandths per millisecond
+    b->tokens_milli += (now - b->refilled_ms) * r->rate;
+    if (b->tokens_milli > (int64_t)r->burst * 1000) {
+        b->tokens_milli = (int64_t)r->burst * 1000;
+    }
+    b->refilled_ms = now;
+    if (b->tokens_milli >= 1000) {
+        b->tokens_milli -= 1000;
+    } else {
+        __atomic_fetch_add(&table->rate_limited[cls], 1, __ATOMIC_RELAXED);
+        rc = -1;
+    }
+    table_unlock();
+    return rc;
+}
+
+void admission_get_stats(struct admission_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (table == NULL) {
+        return;
+    }
+    stats->active = __atomic_load_n(&table->active, __ATOMIC_RELAXED);
+    stats->rejected_global = __atomic_load_n(&table->rejected_global, __ATOMIC_RELAXED);
+    stats->rejected_per_ip = __atomic_load_n(&table->rejected_per_ip, __ATOMIC_RELAXED);
+    for (int i = 0; i < ADMISSION_CLASSES; i++) {
+        stats->rate_limited[i] = __atomic_load_n(&table->rate_limited[i], __ATOMIC_RELAXED);
+    }
+}
+
+const char *admission_class_name(enum admission_class cls) {
+    static const char *names[ADMISSION_CLASSES] = { "sysinfo", "sendmail", "other" };
+    return cls < ADMISSION_CLASSES ? names[cls] : "unknown";
+}
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "command.h"
+
+// Load generator: N concurrent clients, each doing one command per
+// connection (connect, send, read until EOF, close), or with --keepalive
+// all of its commands on one connection, and reports throughput and
+// latency percentiles. --unix PATH goes through the server's AF_UNIX
+// socket instead of loopback TCP.
+
+#define DEFAULT_PORT 9734
+
+struct bench_config {
+    int clients;
+    int requests;           // per client
+    const char *command;
+    int port;
+    int keepalive;          // one connection per client, framed responses
+    const char *unix_path;  // connect to this AF_UNIX socket instead of TCP
+};
+
+struct bench_worker {
+    pthread_t thread;
+    const struct bench_config *cfg;
+    double *latency_us;     // one entry per successful request
+    int done;
+    int errors;
+};
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_server(const struct bench_config *cfg) {
+    if (cfg->unix_path != NULL) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, cfg->unix_path, sizeof(addr.sun_path) - 1);
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(cfg->port);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Keep-alive: send one line and read until the end-of-response marker
+static int framed_request(int fd, const char *line, size_t line_len) {
+    if (write(fd, line, line_len) != (ssize_t)line_len) {
+        return -1;
+    }
+    static const char marker[] = "\n" KEEPALIVE_END_MARKER;
+    size_t mlen = sizeof(marker) - 1;
+    char buf[4096];
+    size_t have = 0;    // bytes kept from the previous read to catch a split marker
+    ssize_t n;
+    while ((n = read(fd, buf + have, sizeof(buf) - have)) > 0) {
+        have += (size_t)n;
+        if (have >= mlen && memcmp(buf + have - mlen, marker, mlen) == 0) {
+            return 0;
+        }
+        if (have > mlen) {
+            memmove(buf, buf + have - mlen, mlen);
+            have = mlen;
+        }
+    }
+    return -1;
+}
+
+static int one_request(const struct bench_config *cfg, const char *line, size_t line_len) {
+    int fd = connect_server(cfg);
+    if (fd < 0) {
+        return -1;
+    }
+    if (write(fd, line, line_len) != (ssize_t)line_len) {
+        close(fd);
+        return -1;
+    }
+    char buf[4096];
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        total += (size_t)n;
+    }
+    close(fd);
+    return (n < 0 || total == 0) ? -1 : 0;
+}
+
+static void *bench_thread(void *arg) {
+    struct bench_worker *w = arg;
+    char line[512];
+    int len = snprintf(line, sizeof(line), "%s\n", w->cfg->command);
+    int fd = -1;
+    if (w->cfg->keepalive) {
+        fd = connect_server(w->cfg);
+        if (fd < 0 || framed_request(fd, KEEPALIVE_COMMAND "\n", strlen(KEEPALIVE_COMMAND) + 1) < 0) {
+            w->errors = w->cfg->requests;
+            if (fd >= 0) {
+                close(fd);
+            }
+            return NULL;
+        }
+    }
+    for (int i = 0; i < w->cfg->requests; i++) {
+        double start = now_us();
+        int rc = fd >= 0 ? framed_request(fd, line, (size_t)len)
+                         : one_request(w->cfg, line, (size_t)len);
+        if (rc < 0) {
+            w->errors++;
+            continue;
+        }
+        w->latency_us[w->done++] = now_us() - start;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--clients N] [--requests N] [--command CMD] [--port P] [--unix PATH] [--keepalive]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_config cfg = { 16, 1000, "PING", DEFAULT_PORT, 0, NULL };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--keepalive") == 0) {
+            cfg.keepalive = 1;
+        } else if (i + 1 < argc && strcmp(argv[i], "--clients") == 0) {
+            cfg.clients = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--requests") == 0) {
+            cfg.requests = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--command") == 0) {
+            cfg.command = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--port") == 0) {
+            cfg.port = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--unix") == 0) {
+            cfg.unix_path = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.clients <= 0 || cfg.requests <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct bench_worker *workers = calloc((size_t)cfg.clients, sizeof(*workers));
+    if (workers == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    double start = now_us();
+    for (int i = 0; i < cfg.clients; i++) {
+        workers[i].cfg = &cfg;
+        workers[i].latency_us = calloc((size_t)cfg.requests, sizeof(double));
+        if (workers[i].latency_us == NULL ||
+            pthread_create(&workers[i].thread, NULL, bench_thread, &workers[i]) != 0) {
+            perror("bench worker");
+            return 1;
+        }
+    }
+
+    size_t total = 0;
+    int errors = 0;
+    for (int i = 0; i < cfg.clients; i++) {
+        pthread_join(workers[i].thread, NULL);
+        total += (size_t)workers[i].done;
+        errors += workers[i].errors;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    double *all = malloc((total > 0 ? total : 1) * sizeof(double));
+    if (all == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    size_t k = 0;
+    for (int i = 0; i < cfg.clients; i++) {
+        memcpy(all + k, workers[i].latency_us, (size_t)workers[i].done * sizeof(double));
+        k += (size_t)workers[i].done;
+        free(workers[i].latency_us);
+    }
+    free(workers);
+    qsort(all, total, sizeof(double), cmp_double);
+
+    printf("command:   %s\n", cfg.command);
+    printf("clients:   %d x %d requests%s%s\n", cfg.clients, cfg.requests,
+           cfg.keepalive ? " (keep-alive)" : "", cfg.unix_path != NULL ? " (unix socket)" : "");
+    printf("completed: %zu (errors: %d) in %.3f s\n", total, errors, elapsed);
+    printf("rps:       %.0f\n", elapsed > 0 ? total / elapsed : 0.0);
+    if (total > 0) {
+        printf("latency:   p50 %.0f us, p99 %.0f us, max %.0f us\n",
+               all[total / 2], all[(total * 99) / 100], all[total - 1]);
+    }
+    free(all);
+    return errors > 0 ? 2 : 0;
+}
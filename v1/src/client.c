@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -7,11 +8,464 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include "debug.h"
+#include "command.h"
+#include "protocol.h"
+#include "sysinfo.h"
+#include "sysinfo_wire.h"
 
 #define PORT 9734
 #define BUFFER_SIZE 2048
 
+// Print one JSON string token (p at the opening quote) with escapes decoded
+static const char *json_print_string(const char *p, const char *end) {
+    for (p++; p < end && *p != '"'; p++) {
+        if (*p != '\\' || p + 1 >= end) {
+            putchar(*p);
+            continue;
+        }
+        p++;
+        if (*p == 'n') {
+            putchar('\n');
+        } else if (*p == 't') {
+            putchar('\t');
+        } else if (*p == 'u' && end - p > 4) {
+            // The server escapes control characters only
+            unsigned int c = 0;
+            sscanf(p + 1, "%4x", &c);
+            putchar(c < 0x100 ? (int)c : '?');
+            p += 4;
+        } else {
+            putchar(*p);
+        }
+    }
+    return p < end ? p + 1 : end;
+}
+
+static const char *json_skip_space(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        p++;
+    }
+    return p;
+}
+
+// Print every scalar of a JSON value as "path: value", one per line
+static const char *json_print_value(const char *p, const char *end, char *path, size_t path_len) {
+    p = json_skip_space(p, end);
+    if (p >= end) {
+        return NULL;
+    }
+    if (*p == '{' || *p == '[') {
+        char close = *p == '{' ? '}' : ']';
+        int index = 0;
+        p = json_skip_space(p + 1, end);
+        while (p != NULL && p < end && *p != close) {
+            size_t len = path_len;
+            if (close == '}') {
+                // "key": append ".key" to the path
+                const char *key = p + 1;
+                const char *q = memchr(key, '"', (size_t)(end - key));
+                if (*p != '"' || q == NULL) {
+                    return NULL;
+                }
+                len += (size_t)snprintf(path + len, BUFFER_SIZE - len, "%s%.*s",
+                                        path_len > 0 ? "." : "", (int)(q - key), key);
+                p = json_skip_space(q + 1, end);
+                if (p >= end || *p != ':') {
+                    return NULL;
+                }
+                p++;
+            } else {
+                len += (size_t)snprintf(path + len, BUFFER_SIZE - len, "[%d]", index++);
+            }
+            if (len >= BUFFER_SIZE) {
+                len = BUFFER_SIZE - 1;
+            }
+            p = json_print_value(p, end, path, len);
+            path[path_len] = '\0';
+            p = p != NULL ? json_skip_space(p, end) : NULL;
+            if (p != NULL && p < end && *p == ',') {
+                p = json_skip_space(p + 1, end);
+            }
+        }
+        return p != NULL && p < end ? p + 1 : NULL;
+    }
+    printf("%s: ", path);
+    if (*p == '"') {
+        p = json_print_string(p, end);
+    } else {
+        const char *start = p;
+        while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != '\n') {
+            p++;
+        }
+        fwrite(start, 1, (size_t)(p - start), stdout);
+    }
+    putchar('\n');
+    return p;
+}
+
+static void print_ipv4(const char *label, const unsigned char *a) {
+    printf("  %s: %u.%u.%u.%u\n", label, a[0], a[1], a[2], a[3]);
+}
+
+// Decode a binary SYSINFO record (sysinfo_wire.h) into readable lines
+static void print_sysinfo_record(const char *rec) {
+    uint32_t collected = sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_COLLECTED);
+    uint32_t ok = collected & ~sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_FAILED);
+    printf("SYSINFO record v%u, %u bytes, sections collected 0x%x, ok 0x%x\n",
+           sysinfo_wire_get16(rec, SYSINFO_WIRE_OFF_VERSION),
+           sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_TOTAL_LEN), collected, ok);
+    if (sysinfo_wire_get16(rec, SYSINFO_WIRE_OFF_HEADER_LEN) >= SYSINFO_WIRE_OFF_TIMED_OUT + 4 &&
+        sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_TIMED_OUT) != 0) {
+        printf("Sections timed out 0x%x\n", sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_TIMED_OUT));
+    }
+    if (ok & SYSINFO_SECTION_BIT(SYSINFO_HOSTNAME)) {
+        printf("Hostname: %s\n", sysinfo_wire_string(rec, SYSINFO_WIRE_HOSTNAME));
+    }
+    if (ok & SYSINFO_SECTION_BIT(SYSINFO_TIME)) {
+        time_t t = (time_t)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_TIME);
+        struct tm tm;
+        char buf[64];
+        if (localtime_r(&t, &tm) != NULL && asctime_r(&tm, buf) != NULL) {
+            printf("Local Time: %s", buf);
+        }
+    }
+    if (ok & SYSINFO_SECTION_BIT(SYSINFO_OS)) {
+        printf("OS: %s %s %s\n", sysinfo_wire_string(rec, SYSINFO_WIRE_OS_NAME),
+               sysinfo_wire_string(rec, SYSINFO_WIRE_OS_RELEASE),
+               sysinfo_wire_string(rec, SYSINFO_WIRE_OS_MACHINE));
+        printf("Version: %s\n", sysinfo_wire_string(rec, SYSINFO_WIRE_OS_VERSION));
+    }
+    if (ok & SYSINFO_SECTION_BIT(SYSINFO_MEMORY)) {
+        printf("Uptime: %llu seconds\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_UPTIME));
+        printf("Load Avg: %.2f %.2f %.2f\n",
+               sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_LOADS) / 65536.0,
+               sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_LOADS + 8) / 65536.0,
+               sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_LOADS + 16) / 65536.0);
+        printf("Total RAM: %llu bytes\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_TOTAL_RAM));
+        printf("Free RAM: %llu bytes\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_FREE_RAM));
+        // Page cache figures follow the first header layout; older servers send none
+        if (sysinfo_wire_get16(rec, SYSINFO_WIRE_OFF_HEADER_LEN) >= SYSINFO_WIRE_OFF_CACHED_RAM + 8) {
+            printf("Available: %llu bytes\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_AVAIL_RAM));
+            printf("Buffers: %llu bytes\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_BUFFER_RAM));
+            printf("Cached: %llu bytes\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_CACHED_RAM));
+        }
+    }
+    if (ok & SYSINFO_SECTION_BIT(SYSINFO_USER)) {
+        printf("User: %s\n", sysinfo_wire_string(rec, SYSINFO_WIRE_USER));
+        printf("Home: %s\n", sysinfo_wire_string(rec, SYSINFO_WIRE_HOME));
+    }
+    if (ok & SYSINFO_SECTION_BIT(SYSINFO_DISK)) {
+        printf("Total Space: %llu bytes\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_DISK_TOTAL));
+        printf("Free Space: %llu bytes\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_DISK_FREE));
+        for (uint32_t i = 0; i < sysinfo_wire_mount_count(rec); i++) {
+            const unsigned char *m = sysinfo_wire_mount(rec, i);
+            uint32_t flags = sysinfo_wire_get32(m, SYSINFO_WIRE_MNT_FLAGS);
+            printf("  %s (%s): ", sysinfo_wire_mount_string(rec, m, SYSINFO_WIRE_MNT_PATH),
+                   sysinfo_wire_mount_string(rec, m, SYSINFO_WIRE_MNT_FSTYPE));
+            if (flags & SYSINFO_MOUNT_ERROR) {
+                printf("Error: %s\n", strerror((int32_t)sysinfo_wire_get32(m, SYSINFO_WIRE_MNT_ERROR)));
+            } else if (flags & SYSINFO_MOUNT_SIZES) {
+                printf("total %llu, free %llu, available %llu bytes%s\n",
+                       (unsigned long long)sysinfo_wire_get64(m, SYSINFO_WIRE_MNT_TOTAL),
+                       (unsigned long long)sysinfo_wire_get64(m, SYSINFO_WIRE_MNT_FREE),
+                       (unsigned long long)sysinfo_wire_get64(m, SYSINFO_WIRE_MNT_AVAIL),
+                       (flags & SYSINFO_MOUNT_TIMED_OUT) ? " (timed out, last known)" : "");
+            } else {
+                printf("Timed out\n");
+            }
+        }
+    }
+    uint32_t ifaces = sysinfo_wire_get16(rec, SYSINFO_WIRE_OFF_IFACE_COUNT);
+    // Counters follow the first record layout; older servers send none
+    int has_stats = sysinfo_wire_get16(rec, SYSINFO_WIRE_OFF_IFACE_SIZE) >= SYSINFO_WIRE_IF_SIZE;
+    for (uint32_t i = 0; i < ifaces; i++) {
+        const unsigned char *r = sysinfo_wire_iface(rec, i);
+        uint16_t flags = sysinfo_wire_get16(r, SYSINFO_WIRE_IF_FLAGS);
+        printf("%.*s (family %u)\n", SYSINFO_WIRE_IF_NAME_LEN, (const char *)r + SYSINFO_WIRE_IF_NAME,
+               sysinfo_wire_get16(r, SYSINFO_WIRE_IF_FAMILY));
+        if (sysinfo_wire_get16(r, SYSINFO_WIRE_IF_FAMILY) == AF_INET) {
+            print_ipv4("Address", r + SYSINFO_WIRE_IF_ADDR);
+        }
+        if (flags & SYSINFO_IF_MAC) {
+            const unsigned char *m = r + SYSINFO_WIRE_IF_MAC;
+            printf("  MAC Address: %02X:%02X:%02X:%02X:%02X:%02X\n", m[0], m[1], m[2], m[3], m[4], m[5]);
+        }
+        if (flags & SYSINFO_IF_MTU) {
+            printf("  MTU: %d\n", (int32_t)sysinfo_wire_get32(r, SYSINFO_WIRE_IF_MTU));
+        }
+        if (flags & SYSINFO_IF_NETMASK) {
+            print_ipv4("Netmask", r + SYSINFO_WIRE_IF_NETMASK);
+        }
+        if (flags & SYSINFO_IF_BROADCAST) {
+            print_ipv4("Broadcast", r + SYSINFO_WIRE_IF_BROADCAST);
+        }
+        if (has_stats && (flags & SYSINFO_IF_STATS)) {
+            printf("  RX: %llu bytes, %llu packets\n",
+                   (unsigned long long)sysinfo_wire_get64(r, SYSINFO_WIRE_IF_RX_BYTES),
+                   (unsigned long long)sysinfo_wire_get64(r, SYSINFO_WIRE_IF_RX_PACKETS));
+            printf("  TX: %llu bytes, %llu packets\n",
+                   (unsigned long long)sysinfo_wire_get64(r, SYSINFO_WIRE_IF_TX_BYTES),
+                   (unsigned long long)sysinfo_wire_get64(r, SYSINFO_WIRE_IF_TX_PACKETS));
+        }
+    }
+    // Older servers do not send the count
+    if (sysinfo_wire_get16(rec, SYSINFO_WIRE_OFF_HEADER_LEN) >= SYSINFO_WIRE_OFF_IFACES_DROPPED + 4 &&
+        sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_IFACES_DROPPED) > 0) {
+        printf("(%u more interface entries not listed)\n", sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_IFACES_DROPPED));
+    }
+    uint32_t env_len = sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_ENV_LEN);
+    if (env_len > 0) {
+        printf("Environment (%u variables):\n", sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_ENV_COUNT));
+        fwrite(rec + sysinfo_wire_get32(rec, SYSINFO_WIRE_OFF_ENV_OFF), 1, env_len, stdout);
+    }
+    if (sysinfo_wire_get16(rec, SYSINFO_WIRE_OFF_HEADER_LEN) >= SYSINFO_WIRE_OFF_SNAPSHOT + 8) {
+        printf("Snapshot: %llu\n", (unsigned long long)sysinfo_wire_get64(rec, SYSINFO_WIRE_OFF_SNAPSHOT));
+    }
+}
+
+// Print a reply; SYSINFO FORMAT=bin records and FORMAT=json objects are decoded
+static void print_reply(const char *buf, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (buf[0] == '{') {
+        char path[BUFFER_SIZE] = "";
+        if (json_print_value(buf, buf + len, path, 0) != NULL) {
+            return;
+        }
+        printf("(malformed JSON reply)\n");
+        return;
+    }
+    long rec_len = sysinfo_wire_check(buf, len);
+    if (rec_len > 0) {
+        print_sysinfo_record(buf);
+        return;
+    }
+    if (rec_len == 0) {
+        printf("(truncated SYSINFO record: %zu bytes)\n", len);
+        return;
+    }
+    fwrite(buf, 1, len, stdout);
+}
+
+// Append n bytes to a growing reply buffer; -1 if out of memory
+static int reply_append(char **buf, size_t *len, size_t *cap, const char *data, size_t n) {
+    if (*len + n > *cap) {
+        size_t new_cap = *cap > 0 ? *cap : BUFFER_SIZE;
+        while (new_cap < *len + n) {
+            new_cap *= 2;
+        }
+        char *p = realloc(*buf, new_cap);
+        if (p == NULL) {
+            return -1;
+        }
+        *buf = p;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, data, n);
+    *len += n;
+    return 0;
+}
+
+// Read one keep-alive response (up to the end marker) and print it
+static int read_framed_response(FILE *server_fp) {
+    char *line = NULL;
+    size_t line_cap = 0;
+    char *reply = NULL;
+    size_t len = 0, cap = 0;
+    ssize_t n;
+    int rc = -1;
+    // getline(): a binary SYSINFO record may contain '\0' bytes
+    while ((n = getline(&line, &line_cap, server_fp)) > 0) {
+        if (strcmp(line, KEEPALIVE_END_MARKER) == 0) {
+            rc = 0;
+            break;
+        }
+        // Undo dot-stuffing: a leading '.' was doubled by the server
+        int stuffed = line[0] == '.';
+        if (reply_append(&reply, &len, &cap, line + stuffed, (size_t)n - stuffed) < 0) {
+            ERROR_LOG(stderr, "Out of memory for the reply\n");
+            break;
+        }
+    }
+    print_reply(reply, len);
+    free(reply);
+    free(line);
+    return rc;
+}
+
+// Keep-alive mode: send every command pipelined on one connection, then
+// print the responses in order
+static int run_keepalive(FILE *server_fp, int sockfd, char **cmds, int ncmds) {
+    static char *default_cmd[] = { "SYSINFO" };
+    if (ncmds == 0) {
+        cmds = default_cmd;
+        ncmds = 1;
+    }
+    // Responses can arrive as one batch: allow the per-reply timeout for each command
+    struct timeval timeout;
+    timeout.tv_sec = 10 * (ncmds + 1);
+    timeout.tv_usec = 0;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        WARN_LOG(stderr, "setsockopt(SO_RCVTIMEO) failed\n");
+        perror("setsockopt");
+    }
+
+    INFO_LOG(stderr, "Sending %d pipelined commands\n", ncmds);
+    if (fprintf(server_fp, "%s\n", KEEPALIVE_COMMAND) < 0) {
+        ERROR_LOG(stderr, "Failed to send command to server\n");
+        return -1;
+    }
+    for (int i = 0; i < ncmds; i++) {
+        // The server skips empty lines without replying, so never send one
+        if (cmds[i][0] == '\0') {
+            continue;
+        }
+        if (fprintf(server_fp, "%s\n", cmds[i]) < 0) {
+            ERROR_LOG(stderr, "Failed to send command to server\n");
+            return -1;
+        }
+    }
+    if (fflush(server_fp) != 0) {
+        ERROR_LOG(stderr, "fflush() failed\n");
+        return -1;
+    }
+    // Half-close: the server answers what it has and then ends the session
+    if (shutdown(sockfd, SHUT_WR) < 0) {
+        WARN_LOG(stderr, "shutdown() failed\n");
+        perror("shutdown");
+    }
+
+    // The first response acknowledges the KEEPALIVE line itself
+    char ack[BUFFER_SIZE];
+    if (fgets(ack, sizeof(ack), server_fp) == NULL || strncmp(ack, "OK", 2) != 0) {
+        ERROR_LOG(stderr, "Server did not accept keep-alive mode\n");
+        fprintf(stderr, "Error: server does not support keep-alive mode\n");
+        return -1;
+    }
+    if (read_framed_response(server_fp) < 0) {
+        ERROR_LOG(stderr, "Error reading from server\n");
+        return -1;
+    }
+
+    printf("\nServer reply:\n");
+    for (int i = 0; i < ncmds; i++) {
+        if (cmds[i][0] == '\0') {
+            continue;
+        }
+        printf("---------------------------------------- [%d] %s\n", i + 1, cmds[i]);
+        if (read_framed_response(server_fp) < 0) {
+            ERROR_LOG(stderr, "Error reading from server\n");
+            printf("(connection closed before the response was complete)\n");
+            return -1;
+        }
+    }
+    printf("----------------------------------------\n");
+    return 0;
+}
+
+// Binary mode: send one framed request (fields may contain '|' and newlines)
+// and print the response payload
+static int run_binary(FILE *server_fp, char **args, int nargs) {
+    const char *name = nargs > 0 ? args[0] : "SYSINFO";
+    uint16_t opcode;
+    if (strcmp(name, "PING") == 0) {
+        opcode = PROTO_OP_PING;
+    } else if (strcmp(name, "SYSINFO") == 0) {
+        opcode = PROTO_OP_SYSINFO;
+    } else if (strcmp(name, "SENDMAIL") == 0) {
+        opcode = PROTO_OP_SENDMAIL;
+    } else if (strcmp(name, "SENDMAIL_MULTI") == 0) {
+        opcode = PROTO_OP_SENDMAIL_MULTI;
+    } else if (strcmp(name, "STATUS") == 0 && nargs > 1) {
+        opcode = PROTO_OP_STATUS;
+    } else {
+        fprintf(stderr, "Error: binary mode supports PING, SYSINFO, SENDMAIL, SENDMAIL_MULTI and STATUS <id>\n");
+        return -1;
+    }
+
+    const char *to = nargs > 1 ? args[1] : "qwe638853@gmail.com";
+    const char *subject = nargs > 2 ? args[2] : "Test Subject";
+    const char *body = nargs > 3 ? args[3] : "Hello from socket client";
+    // SYSINFO [memory,disk] [FORMAT=json|bin] [SINCE <version>]: the FORMAT,
+    // SECTIONS and SINCE fields
+    const char *format = NULL;
+    const char *sections = NULL;
+    const char *since = NULL;
+    for (int i = 1; opcode == PROTO_OP_SYSINFO && i < nargs; i++) {
+        if (strncmp(args[i], "FORMAT=", 7) == 0) {
+            format = args[i] + 7;
+        } else if (strcmp(args[i], "SINCE") == 0 && i + 1 < nargs) {
+            since = args[++i];
+        } else {
+            sections = args[i];
+        }
+    }
+    uint32_t payload_len = 0;
+    uint16_t nfields = 0;
+    if (opcode == PROTO_OP_SYSINFO) {
+        payload_len = (format != NULL ? proto_field_size(format) : 0) +
+                      (sections != NULL ? proto_field_size(sections) : 0) +
+                      (since != NULL ? proto_field_size(since) : 0);
+        nfields = (uint16_t)((format != NULL) + (sections != NULL) + (since != NULL));
+    } else if (opcode == PROTO_OP_SENDMAIL || opcode == PROTO_OP_SENDMAIL_MULTI) {
+        payload_len = proto_field_size(to) + proto_field_size(subject) + proto_field_size(body);
+        nfields = 3;
+    } else if (opcode == PROTO_OP_STATUS) {
+        payload_len = proto_field_size(args[1]);
+        nfields = 1;
+    }
+    if (PROTO_HEADER_LEN + payload_len > PROTO_MAX_FRAME) {
+        fprintf(stderr, "Error: request exceeds %d bytes\n", PROTO_MAX_FRAME);
+        return -1;
+    }
+
+    INFO_LOG(stderr, "Sending binary %s request (%u payload bytes)\n", name, payload_len);
+    if (fwrite(PROTO_MAGIC, 1, PROTO_MAGIC_LEN, server_fp) != PROTO_MAGIC_LEN ||
+        proto_write_header(server_fp, payload_len, opcode, nfields) < 0 ||
+        ((opcode == PROTO_OP_SENDMAIL || opcode == PROTO_OP_SENDMAIL_MULTI) &&
+         (proto_write_field(server_fp, PROTO_FIELD_TO, to) < 0 ||
+          proto_write_field(server_fp, PROTO_FIELD_SUBJECT, subject) < 0 ||
+          proto_write_field(server_fp, PROTO_FIELD_BODY, body) < 0)) ||
+        (opcode == PROTO_OP_STATUS && proto_write_field(server_fp, PROTO_FIELD_JOB, args[1]) < 0) ||
+        (format != NULL && proto_write_field(server_fp, PROTO_FIELD_FORMAT, format) < 0) ||
+        (sections != NULL && proto_write_field(server_fp, PROTO_FIELD_SECTIONS, sections) < 0) ||
+        (since != NULL && proto_write_field(server_fp, PROTO_FIELD_SINCE, since) < 0) ||
+        fflush(server_fp) != 0) {
+        ERROR_LOG(stderr, "Failed to send data to server\n");
+        return -1;
+    }
+
+    char hdr[PROTO_HEADER_LEN];
+    if (fread(hdr, 1, sizeof(hdr), server_fp) != sizeof(hdr)) {
+        ERROR_LOG(stderr, "Error reading from server\n");
+        return -1;
+    }
+    uint32_t resp_len;
+    uint16_t status, resp_opcode;
+    proto_get_header(hdr, &resp_len, &status, &resp_opcode);
+    DEBUG_LOG(stderr, "Response: opcode %u, status %u, %u bytes\n", resp_opcode, status, resp_len);
+
+    printf("\nServer reply (%s):\n", status == PROTO_STATUS_OK ? "ok" : "error");
+    printf("----------------------------------------\n");
+    char *payload = malloc(resp_len > 0 ? resp_len : 1);
+    if (payload == NULL) {
+        ERROR_LOG(stderr, "Out of memory for the reply\n");
+        return -1;
+    }
+    if (fread(payload, 1, resp_len, server_fp) != resp_len) {
+        ERROR_LOG(stderr, "Error reading from server\n");
+        free(payload);
+        return -1;
+    }
+    print_reply(payload, resp_len);
+    free(payload);
+    printf("----------------------------------------\n");
+    return status == PROTO_STATUS_OK ? 0 : -1;
+}
+
 int main(int argc, char *argv[]) {
     // Runtime debug log control: check environment variable
     const char *debug_env = getenv("DEBUG_LOG");
@@ -47,9 +501,23 @@ int main(int argc, char *argv[]) {
     INFO_LOG(stderr, "Client starting...\n");
     int sockfd;
     struct sockaddr_in address;
+    struct sockaddr_un unix_address;
+
+    // Same-host clients may use the server's AF_UNIX socket instead of TCP
+    const char *unix_path = NULL;
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--unix") == 0) {
+            unix_path = argv[i + 1];
+            break;
+        }
+    }
+    if (unix_path != NULL && strlen(unix_path) >= sizeof(unix_address.sun_path)) {
+        fprintf(stderr, "Error: unix socket path too long\n");
+        exit(1);
+    }
 
     // Step 1: Create socket
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockfd = socket(unix_path != NULL ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
         ERROR_LOG(stderr, "socket() failed\n");
         perror("socket");
@@ -57,6 +525,11 @@ int main(int argc, char *argv[]) {
     }
     DEBUG_LOG(stderr, "Socket created: fd %d\n", sockfd);
 
+    memset(&unix_address, 0, sizeof(unix_address));
+    unix_address.sun_family = AF_UNIX;
+    if (unix_path != NULL) {
+        strcpy(unix_address.sun_path, unix_path);
+    }
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = inet_addr("127.0.0.1");
     if(address.sin_addr.s_addr == INADDR_NONE){
@@ -80,8 +553,15 @@ int main(int argc, char *argv[]) {
     }
 
     // Step 2: Connect
-    INFO_LOG(stderr, "Connecting to server 127.0.0.1:%d...\n", PORT);
-    if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    int rc_connect;
+    if (unix_path != NULL) {
+        INFO_LOG(stderr, "Connecting to server unix:%s...\n", unix_path);
+        rc_connect = connect(sockfd, (struct sockaddr *)&unix_address, sizeof(unix_address));
+    } else {
+        INFO_LOG(stderr, "Connecting to server 127.0.0.1:%d...\n", PORT);
+        rc_connect = connect(sockfd, (struct sockaddr *)&address, sizeof(address));
+    }
+    if (rc_connect < 0) {
         ERROR_LOG(stderr, "connect() failed\n");
         perror("connect");
         close(sockfd);
@@ -89,7 +569,11 @@ int main(int argc, char *argv[]) {
     }
     INFO_LOG(stderr, "Connected to server\n");
 
-    printf("Connected to server 127.0.0.1:%d\n", PORT);
+    if (unix_path != NULL) {
+        printf("Connected to server unix:%s\n", unix_path);
+    } else {
+        printf("Connected to server 127.0.0.1:%d\n", PORT);
+    }
 
     // Step 3: Convert socket to FILE* for fprintf/fgets usage
     FILE *server_fp = fdopen(sockfd, "r+");
@@ -103,8 +587,22 @@ int main(int argc, char *argv[]) {
 
     // Step 4: Determine what to send based on command line arguments (skip debug arguments)
     // Find first non-debug argument
-    int cmd_idx = 1;
+    int cmd_idx = argc;
+    int keepalive = 0;
+    int binary = 0;
     for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--keepalive") == 0) {
+            keepalive = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--binary") == 0) {
+            binary = 1;
+            continue;
+        }
+        if (strcmp(argv[i], "--unix") == 0) {
+            i++; // Skip the socket path
+            continue;
+        }
         if (strcmp(argv[i], "--debug") == 0 || strcmp(argv[i], "-d") == 0 ||
             strcmp(argv[i], "--debug-disable") == 0) {
             i++; // Skip this and possibly next (if level was specified)
@@ -120,9 +618,28 @@ int main(int argc, char *argv[]) {
         break;
     }
     
-    if (cmd_idx < argc && strcmp(argv[cmd_idx], "SENDMAIL") == 0) {
-        // Send email mode
-        INFO_LOG(stderr, "Sending SENDMAIL command\n");
+    if (binary) {
+        // Same arguments as the text mode: PING, SYSINFO or SENDMAIL[_MULTI] to subject body
+        int rc = run_binary(server_fp, argv + cmd_idx, argc - cmd_idx);
+        if (fclose(server_fp) != 0) {
+            WARN_LOG(stderr, "fclose() failed\n");
+        }
+        return rc < 0 ? 1 : 0;
+    }
+
+    if (keepalive) {
+        // Every remaining argument is one command line, e.g. "SENDMAIL|to|subject|body"
+        int rc = run_keepalive(server_fp, sockfd, argv + cmd_idx, argc - cmd_idx);
+        if (fclose(server_fp) != 0) {
+            WARN_LOG(stderr, "fclose() failed\n");
+        }
+        return rc < 0 ? 1 : 0;
+    }
+
+    if (cmd_idx < argc && (strcmp(argv[cmd_idx], "SENDMAIL") == 0 || strcmp(argv[cmd_idx], "SENDMAIL_MULTI") == 0)) {
+        // Send email mode; SENDMAIL_MULTI takes comma-separated recipients
+        const char *name = argv[cmd_idx];
+        INFO_LOG(stderr, "Sending %s command\n", name);
         const char *to = (cmd_idx + 1 < argc) ? argv[cmd_idx + 1] : "qwe638853@gmail.com";
         const char *subject = (cmd_idx + 2 < argc) ? argv[cmd_idx + 2] : "Test Subject";
         const char *body = (cmd_idx + 3 < argc) ? argv[cmd_idx + 3] : "Hello from socket client";
@@ -131,7 +648,7 @@ int main(int argc, char *argv[]) {
 
         // Send all parameters in one line, separated by | (pipe character)
         // Format: SENDMAIL|to|subject|body
-        if(fprintf(server_fp, "SENDMAIL|%s|%s|%s\n", to, subject, body) < 0){
+        if(fprintf(server_fp, "%s|%s|%s|%s\n", name, to, subject, body) < 0){
             ERROR_LOG(stderr, "Failed to send data to server\n");
             fclose(server_fp);
             exit(1);
@@ -141,7 +658,7 @@ int main(int argc, char *argv[]) {
             fclose(server_fp);
             exit(1);
         }
-        DEBUG_LOG(stderr, "SENDMAIL command sent\n");
+        DEBUG_LOG(stderr, "%s command sent\n", name);
 
         printf("Sent mail request:\n");
         printf("  To: %s\n", to);
@@ -150,7 +667,29 @@ int main(int argc, char *argv[]) {
 
     } else {
         // Default mode: get system information (send other command or empty line)
-        if (cmd_idx < argc) {
+        if (cmd_idx + 1 < argc && strcmp(argv[cmd_idx], "STATUS") == 0) {
+            // Query an asynchronous SENDMAIL job: STATUS <id>
+            INFO_LOG(stderr, "Sending STATUS command for job %s\n", argv[cmd_idx + 1]);
+            if(fprintf(server_fp, "STATUS %s\n", argv[cmd_idx + 1]) < 0){
+                ERROR_LOG(stderr, "Failed to send command to server\n");
+                fclose(server_fp);
+                exit(1);
+            }
+        } else if (cmd_idx + 1 < argc &&
+                   (strcmp(argv[cmd_idx], "SYSINFO") == 0 || strcmp(argv[cmd_idx], "HISTORY") == 0)) {
+            // SYSINFO [memory,disk] [FORMAT=json|bin] [SINCE <version>], HISTORY <metric> <window>:
+            // arguments go on one line, the reply is decoded below
+            INFO_LOG(stderr, "Sending %s with %d arguments\n", argv[cmd_idx], argc - cmd_idx - 1);
+            int rc = fprintf(server_fp, "%s", argv[cmd_idx]);
+            for (int i = cmd_idx + 1; i < argc && rc >= 0; i++) {
+                rc = fprintf(server_fp, " %s", argv[i]);
+            }
+            if(rc < 0 || fprintf(server_fp, "\n") < 0){
+                ERROR_LOG(stderr, "Failed to send command to server\n");
+                fclose(server_fp);
+                exit(1);
+            }
+        } else if (cmd_idx < argc) {
             // Send custom command
             INFO_LOG(stderr, "Sending custom command: %s\n", argv[cmd_idx]);
             if(fprintf(server_fp, "%s\n", argv[cmd_idx]) < 0){
@@ -180,17 +719,24 @@ int main(int argc, char *argv[]) {
     printf("\nServer reply:\n");
     printf("----------------------------------------\n");
     
+    // Read everything first: JSON and binary SYSINFO replies are decoded whole
     char buffer[BUFFER_SIZE];
-    int line_count = 0;
-    while (fgets(buffer, sizeof(buffer), server_fp) != NULL) {
-        printf("%s", buffer);
-        line_count++;
+    char *reply = NULL;
+    size_t reply_len = 0, reply_cap = 0;
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), server_fp)) > 0) {
+        if (reply_append(&reply, &reply_len, &reply_cap, buffer, n) < 0) {
+            ERROR_LOG(stderr, "Out of memory for the reply\n");
+            break;
+        }
     }
     // Check if ended due to error
     if(ferror(server_fp)){
         ERROR_LOG(stderr, "Error reading from server\n");
     }
-    DEBUG_LOG(stderr, "Received %d lines from server\n", line_count);
+    DEBUG_LOG(stderr, "Received %zu bytes from server\n", reply_len);
+    print_reply(reply, reply_len);
+    free(reply);
     
     printf("----------------------------------------\n");
 
@@ -0,0 +1,744 @@
+#define _GNU_SOURCE
+#include "command.h"
+#include "protocol.h"
+#include "linereader.h"
+#include "response.h"
+#include "sysinfo.h"
+#include "sysinfo_cache.h"
+#include "sysinfo_sched.h"
+#include "diskinfo.h"
+#include "procfs.h"
+#include "history.h"
+#include "deadline.h"
+#include "admission.h"
+#include "smtp.h"
+#include "mailq.h"
+#include "debug.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+
+// Shared function to send system information. The collectors of the
+// sections the cache cannot serve run in parallel (sysinfo_sched.h);
+// sections are taken back in order, and text or JSON output is flushed after
+// each one, so a streaming client sees the first sections while later
+// collectors still run. With delta set only the sections that changed after
+// snapshot version since are sent (SYSINFO SINCE).
+static void send_system_info(enum sysinfo_format format, uint32_t sections, int delta, uint64_t since,
+                             struct response *out) {
+    // One snapshot per thread, allocated on first use and reused: it is
+    // too large for a worker stack and nothing keeps it after rendering
+    static __thread struct sysinfo_snapshot *snap;
+    if (snap == NULL) {
+        snap = malloc(sizeof(*snap));
+        if (snap == NULL) {
+            ERROR_LOG(stderr, "malloc() failed for SYSINFO snapshot\n");
+            response_puts(out, "Error: Out of memory\n");
+            return;
+        }
+    }
+    uint32_t todo = sysinfo_cache_begin(snap, sections, deadline_ms(DEADLINE_COLLECTOR));
+    // Still being collected for the first time by another request
+    uint32_t pending = sections & ~todo & ~snap->collected;
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        if (pending & SYSINFO_SECTION_BIT(i)) {
+            deadline_count(DEADLINE_COLLECTOR);
+        }
+    }
+    sysinfo_mark_timed_out(snap, pending);
+    struct sysinfo_batch *batch = sysinfo_sched_start(todo);
+    if (since > snap->version) {
+        // Not from this server (or from before a clock step): send everything
+        since = 0;
+    }
+    int stream = format != SYSINFO_FORMAT_BIN;
+    // The text header waits for the first changed section: a delta with
+    // none is answered "Not Modified" instead
+    int header = format == SYSINFO_FORMAT_TEXT && !delta;
+    if (header) {
+        response_puts(out, "System Info:\n");
+    }
+    sysinfo_render_open(format, out);
+    uint32_t sent = 0;
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        uint32_t bit = SYSINFO_SECTION_BIT(i);
+        if (todo & bit) {
+            sysinfo_sched_wait(batch, snap, (enum sysinfo_section)i);
+        }
+        // Version 0: no shared cache, so nothing is known to be unchanged.
+        // A timed out section is always reported.
+        if (!(sections & bit) ||
+            (delta && snap->version != 0 && snap->changed[i] <= since && !(snap->timed_out & bit))) {
+            continue;
+        }
+        sent |= bit;
+        if (stream) {
+            if (format == SYSINFO_FORMAT_TEXT && !header) {
+                response_puts(out, "System Info:\n");
+                header = 1;
+            }
+            sysinfo_render_section(snap, (enum sysinfo_section)i, format, out);
+            response_flush(out);
+        }
+    }
+    sysinfo_sched_finish(batch);
+    if (stream) {
+        if (format == SYSINFO_FORMAT_TEXT && delta) {
+            if (sent == 0) {
+                response_puts(out, "Not Modified\n");
+            }
+            response_printf(out, "Snapshot: %llu\n", (unsigned long long)snap->version);
+        }
+        sysinfo_render_close(snap, format, out);
+    } else {
+        // Unchanged sections are left out of the record like uncollected ones
+        snap->collected &= sent;
+        snap->failed &= sent;
+        snap->timed_out &= sent;
+        sysinfo_render_bin(snap, out);
+    }
+}
+
+/**
+ * Add the sections of a comma-separated list such as "memory,disk" to mask.
+ *
+ * @return 0, or -1 after writing an error to out if a name is unknown
+ */
+static int parse_sysinfo_sections(const char *list, uint32_t *mask, struct response *out) {
+    while (*list != '\0') {
+        const char *comma = strchr(list, ',');
+        size_t len = comma != NULL ? (size_t)(comma - list) : strlen(list);
+        if (len > 0) {
+            int section = sysinfo_section_by_name(list, len);
+            if (section < 0) {
+                WARN_LOG(stderr, "Unknown SYSINFO section: %.*s\n", (int)len, list);
+                response_printf(out, "Error: Unknown SYSINFO section: %.*s\n", (int)len, list);
+                return -1;
+            }
+            *mask |= SYSINFO_SECTION_BIT(section);
+        }
+        list += len + (comma != NULL);
+    }
+    return 0;
+}
+
+// Parse a FORMAT value: "text", "json" or "bin"; -1 if unknown
+static int parse_sysinfo_format(const char *name) {
+    if (strcmp(name, "text") == 0) {
+        return SYSINFO_FORMAT_TEXT;
+    }
+    if (strcmp(name, "json") == 0) {
+        return SYSINFO_FORMAT_JSON;
+    }
+    if (strcmp(name, "bin") == 0) {
+        return SYSINFO_FORMAT_BIN;
+    }
+    return -1;
+}
+
+// Parse a SINCE version: decimal digits only; -1 if invalid
+static int parse_sysinfo_since(const char *arg, uint64_t *since) {
+    if (arg == NULL || *arg < '0' || *arg > '9') {
+        return -1;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(arg, &end, 10);
+    if (errno != 0 || *end != '\0') {
+        return -1;
+    }
+    *since = v;
+    return 0;
+}
+
+// SYSINFO [section,section,...] [FORMAT=text|json|bin] [SINCE <version>]
+static void handle_sysinfo(char *args, struct response *out) {
+    int format = SYSINFO_FORMAT_TEXT;
+    uint32_t sections = 0;
+    int delta = 0;
+    uint64_t since = 0;
+    char *saveptr = NULL;
+    for (char *arg = strtok_r(args, " ", &saveptr); arg != NULL; arg = strtok_r(NULL, " ", &saveptr)) {
+        if (strcmp(arg, "SINCE") == 0) {
+            char *version = strtok_r(NULL, " ", &saveptr);
+            if (parse_sysinfo_since(version, &since) < 0) {
+                WARN_LOG(stderr, "Invalid SYSINFO version: %s\n", version != NULL ? version : "");
+                response_printf(out, "Error: Invalid SYSINFO version: %s\n", version != NULL ? version : "");
+                return;
+            }
+            delta = 1;
+        } else if (strchr(arg, '=') == NULL) {
+            if (parse_sysinfo_sections(arg, &sections, out) < 0) {
+                return;
+            }
+        } else if (strncmp(arg, "FORMAT=", 7) != 0 || (format = parse_sysinfo_format(arg + 7)) < 0) {
+            WARN_LOG(stderr, "Invalid SYSINFO argument: %s\n", arg);
+            response_printf(out, "Error: Invalid SYSINFO argument: %s\n", arg);
+            return;
+        }
+    }
+    send_system_info((enum sysinfo_format)format, sections != 0 ? sections : SYSINFO_ALL, delta, since, out);
+}
+
+// Server counters, one "name: value" line each
+static void send_stats(struct response *out) {
+    struct sysinfo_cache_stats cs;
+    sysinfo_cache_get_stats(&cs);
+    response_printf(out, "sysinfo_collections: %llu\n", (unsigned long long)cs.collections);
+    response_printf(out, "sysinfo_cache_hits: %llu\n", (unsigned long long)cs.hits);
+    response_printf(out, "sysinfo_cache_stale_hits: %llu\n", (unsigned long long)cs.stale_hits);
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        response_printf(out, "sysinfo_runs_%s: %llu\n", sysinfo_section_name((enum sysinfo_section)i),
+                (unsigned long long)cs.runs[i]);
+    }
+    struct diskinfo_stats ds;
+    diskinfo_get_stats(&ds);
+    response_printf(out, "disk_scans: %llu\n", (unsigned long long)ds.scans);
+    response_printf(out, "disk_probes: %llu\n", (unsigned long long)ds.probes);
+    response_printf(out, "disk_cache_hits: %llu\n", (unsigned long long)ds.cache_hits);
+    response_printf(out, "disk_timeouts: %llu\n", (unsigned long long)ds.timeouts);
+    response_printf(out, "disk_errors: %llu\n", (unsigned long long)ds.errors);
+    struct mailq_stats ms;
+    mailq_get_stats(&ms);
+    response_printf(out, "mail_retries: %llu\n", (unsigned long long)ms.retries);
+    response_printf(out, "mail_dispatcher_restarts: %llu\n", (unsigned long long)ms.dispatcher_restarts);
+    response_printf(out, "mail_journal_appends: %llu\n", (unsigned long long)ms.journal_appends);
+    response_printf(out, "mail_journal_syncs: %llu\n", (unsigned long long)ms.journal_syncs);
+    response_printf(out, "mail_journal_compactions: %llu\n", (unsigned long long)ms.journal_compactions);
+    uint64_t timeouts[DEADLINE_KINDS];
+    deadline_get_stats(timeouts);
+    for (int i = 0; i < DEADLINE_KINDS; i++) {
+        response_printf(out, "timeouts_%s: %llu\n", deadline_name((enum deadline_kind)i),
+                (unsigned long long)timeouts[i]);
+    }
+    // The process answering this request (a fork-engine child, or the
+    // whole server with the event-driven engines)
+    struct procfs_self self;
+    if (procfs_self(&self) == 0) {
+        long hz = sysconf(_SC_CLK_TCK);
+        response_printf(out, "process_cpu_ms: %llu\n",
+                (unsigned long long)((self.utime + self.stime) * 1000 / (uint64_t)(hz > 0 ? hz : 100)));
+        response_printf(out, "process_rss_bytes: %llu\n", (unsigned long long)self.rss);
+        response_printf(out, "process_threads: %u\n", self.threads);
+    }
+    struct admission_stats as;
+    admission_get_stats(&as);
+    response_printf(out, "connections_active: %llu\n", (unsigned long long)as.active);
+    response_printf(out, "rejected_global: %llu\n", (unsigned long long)as.rejected_global);
+    response_printf(out, "rejected_per_ip: %llu\n", (unsigned long long)as.rejected_per_ip);
+    for (int i = 0; i < ADMISSION_CLASSES; i++) {
+        response_printf(out, "rate_limited_%s: %llu\n", admission_class_name((enum admission_class)i),
+                (unsigned long long)as.rate_limited[i]);
+    }
+}
+
+// HISTORY window: seconds, or a count with an s, m or h suffix; -1 if invalid
+static int64_t parse_window_ms(const char *s) {
+    char *end;
+    errno = 0;
+    long long v = strtoll(s, &end, 10);
+    if (end == s || errno != 0 || v <= 0) {
+        return -1;
+    }
+    int64_t unit = 1000;
+    if (*end == 's') {
+        end++;
+    } else if (*end == 'm') {
+        unit = 60 * 1000;
+        end++;
+    } else if (*end == 'h') {
+        unit = 3600 * 1000;
+        end++;
+    }
+    if (*end != '\0' || v > INT64_MAX / unit) {
+        return -1;
+    }
+    return v * unit;
+}
+
+// HISTORY <metric> <window>: one "time_ms value" line per sample, oldest first
+static void handle_history(char *args, struct response *out) {
+    if (!history_enabled()) {
+        response_puts(out, "Error: History disabled (start the server with --history-interval=MS)\n");
+        return;
+    }
+    char *saveptr = NULL;
+    char *name = strtok_r(args, " ", &saveptr);
+    char *window = strtok_r(NULL, " ", &saveptr);
+    if (name == NULL || window == NULL || strtok_r(NULL, " ", &saveptr) != NULL) {
+        response_puts(out, "Error: Usage: HISTORY <metric> <window>, metrics:");
+        for (int i = 0; i < HISTORY_METRICS; i++) {
+            response_printf(out, " %s", history_metric_name((enum history_metric)i));
+        }
+        response_puts(out, "\n");
+        return;
+    }
+    int metric = history_metric_by_name(name);
+    if (metric < 0) {
+        response_printf(out, "Error: Unknown HISTORY metric: %s\n", name);
+        return;
+    }
+    int64_t window_ms = parse_window_ms(window);
+    if (window_ms < 0) {
+        response_printf(out, "Error: Invalid HISTORY window: %s\n", window);
+        return;
+    }
+    int64_t *times = malloc(HISTORY_CAPACITY * sizeof(*times));
+    double *values = malloc(HISTORY_CAPACITY * sizeof(*values));
+    int n = times != NULL && values != NULL ?
+            history_read((enum history_metric)metric, window_ms, times, values, HISTORY_CAPACITY) : -1;
+    if (n < 0) {
+        ERROR_LOG(stderr, "malloc() failed for HISTORY\n");
+        response_puts(out, "Error: Out of memory\n");
+    } else {
+        // Loads and CPU are fractional, the rest are byte and packet counts
+        int decimals = metric <= HISTORY_CPU_BUSY ? 2 : 0;
+        response_printf(out, "metric: %s\ninterval_ms: %d\nsamples: %d\n",
+                        name, history_interval_ms(), n);
+        for (int i = 0; i < n; i++) {
+            if (isnan(values[i])) {
+                response_printf(out, "%lld n/a\n", (long long)times[i]);
+            } else {
+                response_printf(out, "%lld %.*f\n", (long long)times[i], decimals, values[i]);
+            }
+        }
+    }
+    free(times);
+    free(values);
+}
+
+// Charge a command to its client's token bucket; when the bucket is empty
+// the error is written to out and the command must not run
+static int rate_limited(enum admission_class cls, struct response *out) {
+    if (admission_take(cls) == 0) {
+        return 0;
+    }
+    WARN_LOG(stderr, "Rate limit exceeded for %s commands\n", admission_class_name(cls));
+    response_puts(out, "Error: Rate limit exceeded\n");
+    return 1;
+}
+
+// Echo the request, send it and report the outcome; shared by both protocols
+static int run_sendmail(const char *to, const char *subject, const char *body, struct response *out) {
+    if(response_puts(out, "Command: SENDMAIL\n") < 0 ||
+       response_printf(out, "To: %s\n", to) < 0 ||
+       response_printf(out, "Subject: %s\n", subject) < 0 ||
+       response_printf(out, "Body: %s\n", body) < 0){
+        WARN_LOG(stderr, "Failed to write response to client\n");
+    }
+
+    if (mailq_enabled()) {
+        // Asynchronous mode: reply with the job ID, the dispatcher delivers
+        uint64_t id;
+        int rc = mailq_submit(to, subject, body, &id);
+        if (rc == -2) {
+            response_puts(out, "Error: Mail journal write failed\n");
+            return -1;
+        }
+        if (rc == -3) {
+            response_puts(out, "Error: Mail dispatcher not running\n");
+            return -1;
+        }
+        if (rc < 0) {
+            response_puts(out, "Error: Mail queue full\n");
+            return -1;
+        }
+        INFO_LOG(stderr, "Queued email to %s as job %llu\n", to, (unsigned long long)id);
+        response_printf(out, "Queued: job %llu\n", (unsigned long long)id);
+        return 0;
+    }
+
+    INFO_LOG(stderr, "Sending email to %s\n", to);
+    if(send_email(to, subject, body) < 0){
+        ERROR_LOG(stderr, "Failed to send email to %s\n", to);
+        response_puts(out, "Error: Failed to send email\n");
+        return -1;
+    }
+    INFO_LOG(stderr, "Email sent successfully to %s\n", to);
+    response_puts(out, "Email sent successfully\n");
+    return 0;
+}
+
+// One message to a comma-separated recipient list, reporting each
+// recipient's outcome; always synchronous, as the reply carries them.
+// Returns -1 unless every recipient was accepted.
+static int run_sendmail_multi(const char *list, const char *subject, const char *body, struct response *out) {
+    char *copy = strdup(list);
+    // Upper bound: one recipient per comma
+    int max = 1;
+    for (const char *p = list; *p != '\0'; p++) {
+        max += *p == ',';
+    }
+    const char **recipients = malloc((size_t)max * sizeof(*recipients));
+    int *http_codes = malloc((size_t)max * sizeof(*http_codes));
+    if (copy == NULL || recipients == NULL || http_codes == NULL) {
+        ERROR_LOG(stderr, "malloc() failed for SENDMAIL_MULTI recipients\n");
+        response_puts(out, "Error: Internal error\n");
+        free(copy);
+        free(recipients);
+        free(http_codes);
+        return -1;
+    }
+    int count = 0;
+    char *saveptr = NULL;
+    for (char *token = strtok_r(copy, ",", &saveptr); token != NULL; token = strtok_r(NULL, ",", &saveptr)) {
+        // Tolerate "a@x, b@y"
+        while (*token == ' ') {
+            token++;
+        }
+        size_t len = strlen(token);
+        while (len > 0 && token[len - 1] == ' ') {
+            token[--len] = '\0';
+        }
+        if (len > 0) {
+            recipients[count++] = token;
+        }
+    }
+
+    if(response_puts(out, "Command: SENDMAIL_MULTI\n") < 0 ||
+       response_printf(out, "Recipients: %d\n", count) < 0 ||
+       response_printf(out, "Subject: %s\n", subject) < 0 ||
+       response_printf(out, "Body: %s\n", body) < 0){
+        WARN_LOG(stderr, "Failed to write response to client\n");
+    }
+    int sent = -1;
+    if (count == 0) {
+        response_puts(out, "Error: Missing recipient\n");
+    } else if ((sent = send_email_to_multiple_recipients(recipients, count, subject, body, http_codes)) < 0) {
+        ERROR_LOG(stderr, "Failed to send email to %d recipients\n", count);
+        response_puts(out, "Error: Failed to send email\n");
+    } else {
+        for (int i = 0; i < count; i++) {
+            if (http_codes[i] == 202) {
+                response_printf(out, "%s: sent (HTTP 202)\n", recipients[i]);
+            } else if (http_codes[i] == SMTP_INVALID_RECIPIENT) {
+                response_printf(out, "%s: invalid address\n", recipients[i]);
+            } else if (http_codes[i] != 0) {
+                response_printf(out, "%s: failed (HTTP %d)\n", recipients[i], http_codes[i]);
+            } else {
+                response_printf(out, "%s: failed (no HTTP response)\n", recipients[i]);
+            }
+        }
+        response_printf(out, "Sent: %d of %d\n", sent, count);
+    }
+    free(copy);
+    free(recipients);
+    free(http_codes);
+    return sent == count ? 0 : -1;
+}
+
+// Report the state of an asynchronous SENDMAIL job; -1 if the ID is unknown
+static int report_job_status(const char *arg, struct response *out) {
+    char *end;
+    errno = 0;
+    unsigned long long id = strtoull(arg, &end, 10);
+    struct mail_job_status st;
+    if (*arg == '\0' || *end != '\0' || errno != 0 || mailq_status(id, &st) < 0) {
+        response_printf(out, "Job %s: unknown\n", arg);
+        return -1;
+    }
+    if (st.state == MAIL_JOB_SENT || st.state == MAIL_JOB_FAILED) {
+        if (st.http_code != 0) {
+            response_printf(out, "Job %llu: %s (HTTP %d)\n", id, mailq_state_name(st.state), st.http_code);
+        } else {
+            response_printf(out, "Job %llu: %s (no HTTP response)\n", id, mailq_state_name(st.state));
+        }
+    } else {
+        response_printf(out, "Job %llu: %s\n", id, mailq_state_name(st.state));
+    }
+    return 0;
+}
+
+static void handle_sendmail(char *command, struct response *out) {
+    char to[256] = {0};
+    char subject[256] = {0};
+    char body[1024] = {0};
+
+    INFO_LOG(stderr, "Processing SENDMAIL command\n");
+    // Parse parameters from command line (format: SENDMAIL|to|subject|body)
+    char *saveptr = NULL;
+    char *token = strtok_r(command, "|", &saveptr);
+    if (token != NULL && strcmp(token, "SENDMAIL") == 0) {
+        // Parse 'to'
+        token = strtok_r(NULL, "|", &saveptr);
+        if (token != NULL) {
+            strncpy(to, token, sizeof(to) - 1);
+            DEBUG_LOG(stderr, "To: %s\n", to);
+        }
+        // Parse 'subject'
+        token = strtok_r(NULL, "|", &saveptr);
+        if (token != NULL) {
+            strncpy(subject, token, sizeof(subject) - 1);
+            DEBUG_LOG(stderr, "Subject: %s\n", subject);
+        }
+        // Parse 'body'
+        token = strtok_r(NULL, "|", &saveptr);
+        if (token != NULL) {
+            strncpy(body, token, sizeof(body) - 1);
+            DEBUG_LOG(stderr, "Body length: %zu\n", strlen(body));
+        }
+    }
+
+    run_sendmail(to, subject, body, out);
+}
+
+// SENDMAIL_MULTI|to1,to2,...|subject|body
+static void handle_sendmail_multi(char *command, struct response *out) {
+    INFO_LOG(stderr, "Processing SENDMAIL_MULTI command\n");
+    char *fields[3] = { "", "", "" };
+    char *saveptr = NULL;
+    strtok_r(command, "|", &saveptr);
+    for (int i = 0; i < 3; i++) {
+        char *token = strtok_r(NULL, "|", &saveptr);
+        if (token == NULL) {
+            break;
+        }
+        fields[i] = token;
+    }
+    run_sendmail_multi(fields[0], fields[1], fields[2], out);
+}
+
+int command_execute(char *command, struct response *out) {
+    INFO_LOG(stderr, "Received command: %s\n", command);
+
+    if (strncmp(command, "SENDMAIL_MULTI", 14) == 0) {
+        if (!rate_limited(ADMISSION_SENDMAIL, out)) {
+            handle_sendmail_multi(command, out);
+        }
+        return 0;
+    }
+    if (strncmp(command, "SENDMAIL", 8) == 0) {
+        if (!rate_limited(ADMISSION_SENDMAIL, out)) {
+            handle_sendmail(command, out);
+        }
+        return 0;
+    }
+    if (strcmp(command, "PING") == 0) {
+        // Cheapest round trip: used for health checks and benchmarking
+        if (!rate_limited(ADMISSION_OTHER, out)) {
+            response_puts(out, "PONG\n");
+        }
+        return 0;
+    }
+    if (strcmp(command, "SYSINFO") == 0 || strncmp(command, "SYSINFO ", 8) == 0) {
+        INFO_LOG(stderr, "Processing SYSINFO command\n");
+        if (!rate_limited(ADMISSION_SYSINFO, out)) {
+            handle_sysinfo(command + 7, out);
+        }
+        return 0;
+    }
+    if (strcmp(command, "STATS") == 0) {
+        if (!rate_limited(ADMISSION_OTHER, out)) {
+            send_stats(out);
+        }
+        return 0;
+    }
+    if (strncmp(command, "STATUS ", 7) == 0) {
+        if (!rate_limited(ADMISSION_OTHER, out)) {
+            report_job_status(command + 7, out);
+        }
+        return 0;
+    }
+    if (strcmp(command, "HISTORY") == 0 || strncmp(command, "HISTORY ", 8) == 0) {
+        if (!rate_limited(ADMISSION_OTHER, out)) {
+            handle_history(command + 7, out);
+        }
+        return 0;
+    }
+    WARN_LOG(stderr, "Unknown command: %s\n", command);
+    return -1;
+}
+
+int command_is_keepalive(const char *buf, size_t len) {
+    size_t n = strlen(KEEPALIVE_COMMAND);
+    if (len <= n || memcmp(buf, KEEPALIVE_COMMAND, n) != 0) {
+        return 0;
+    }
+    return buf[n] == '\n' || (buf[n] == '\r' && len > n + 1 && buf[n + 1] == '\n');
+}
+
+// Move a response to out with dot-stuffing, then terminate it with the marker
+static void write_framed(struct response *resp, struct response *out) {
+    size_t len;
+    char *buf = response_flatten(resp, &len);
+    if (buf == NULL && response_len(resp) > 0) {
+        ERROR_LOG(stderr, "malloc() failed for framed response\n");
+        response_printf(out, "Error: Internal error\n%s", KEEPALIVE_END_MARKER);
+        return;
+    }
+    int stuffing = 0;
+    for (size_t off = 0; off < len && !stuffing; ) {
+        stuffing = buf[off] == '.';
+        const char *nl = line_find_newline(buf + off, len - off);
+        off = nl != NULL ? (size_t)(nl - buf) + 1 : len;
+    }
+    int newline = len == 0 || buf[len - 1] == '\n';
+    if (!stuffing) {
+        // Nothing to escape (the usual case): hand the buffer over as is
+        if (len > 0) {
+            response_attach(out, buf, len);
+        } else {
+            free(buf);
+        }
+    } else {
+        size_t off = 0;
+        while (off < len) {
+            const char *nl = line_find_newline(buf + off, len - off);
+            size_t line_len = nl != NULL ? (size_t)(nl - (buf + off)) + 1 : len - off;
+            if (buf[off] == '.') {
+                response_write(out, ".", 1);
+            }
+            response_write(out, buf + off, line_len);
+            off += line_len;
+        }
+        free(buf);
+    }
+    if (!newline) {
+        response_write(out, "\n", 1);
+    }
+    response_puts(out, KEEPALIVE_END_MARKER);
+}
+
+// Execute one command into its own builder so its response can be framed
+static void execute_framed(char *command, struct response *out) {
+    struct response resp;
+    response_init(&resp);
+    if (strcmp(command, KEEPALIVE_COMMAND) == 0) {
+        response_puts(&resp, "OK keep-alive\n");
+    } else if (command_execute(command, &resp) < 0) {
+        response_puts(&resp, "Error: Unknown command\n");
+    }
+    write_framed(&resp, out);
+    response_free(&resp);
+}
+
+void command_execute_line(char *line, size_t len, struct response *out) {
+    if (len == 0) {
+        return;
+    }
+    if (len >= COMMAND_MAX_LEN) {
+        WARN_LOG(stderr, "Command too long (%zu bytes), skipping\n", len);
+        command_reject_line(out);
+        return;
+    }
+    line[len] = '\0';
+    execute_framed(line, out);
+}
+
+void command_reject_line(struct response *out) {
+    response_printf(out, "Error: Command too long\n%s", KEEPALIVE_END_MARKER);
+}
+
+size_t command_execute_pipeline(char *buf, size_t len, struct response *out) {
+    size_t off = 0;
+    const char *newline;
+    while (off < len && (newline = line_find_newline(buf + off, len - off)) != NULL) {
+        char *line = buf + off;
+        size_t line_len = (size_t)(newline - line);
+        off += line_len + 1;
+        if (line_len > 0 && line[line_len - 1] == '\r') {
+            line_len--;
+        }
+        command_execute_line(line, line_len, out);
+    }
+    return off;
+}
+
+// Field value as a C string: the '\0' travels inside the frame
+static const char *frame_field(const struct proto_request *req, int tag) {
+    return req->fields[tag].data != NULL ? req->fields[tag].data : "";
+}
+
+// Token bucket charged for a binary opcode
+static enum admission_class frame_class(uint16_t opcode) {
+    if (opcode == PROTO_OP_SYSINFO) {
+        return ADMISSION_SYSINFO;
+    }
+    if (opcode == PROTO_OP_SENDMAIL || opcode == PROTO_OP_SENDMAIL_MULTI) {
+        return ADMISSION_SENDMAIL;
+    }
+    return ADMISSION_OTHER;
+}
+
+// Execute one binary request and write the response frame to out
+static void execute_frame(const char *frame, size_t len, struct response *out) {
+    struct proto_request req;
+    struct response resp;
+    response_init(&resp);
+
+    int status = PROTO_STATUS_OK;
+    if (proto_parse_request(frame, len, &req) < 0) {
+        WARN_LOG(stderr, "Malformed binary request\n");
+        response_puts(&resp, "Error: Malformed request\n");
+        status = PROTO_STATUS_ERROR;
+    } else if (req.opcode >= PROTO_OP_PING && req.opcode <= PROTO_OP_SENDMAIL_MULTI &&
+               rate_limited(frame_class(req.opcode), &resp)) {
+        status = PROTO_STATUS_ERROR;
+    } else if (req.opcode == PROTO_OP_PING) {
+        response_puts(&resp, "PONG\n");
+    } else if (req.opcode == PROTO_OP_SYSINFO) {
+        INFO_LOG(stderr, "Processing SYSINFO command (binary)\n");
+        int format = SYSINFO_FORMAT_TEXT;
+        uint32_t sections = 0;
+        uint64_t since = 0;
+        if (req.fields[PROTO_FIELD_FORMAT].data != NULL &&
+            (format = parse_sysinfo_format(req.fields[PROTO_FIELD_FORMAT].data)) < 0) {
+            response_puts(&resp, "Error: Unknown format\n");
+            status = PROTO_STATUS_ERROR;
+        } else if (parse_sysinfo_sections(frame_field(&req, PROTO_FIELD_SECTIONS), &sections, &resp) < 0) {
+            status = PROTO_STATUS_ERROR;
+        } else if (req.fields[PROTO_FIELD_SINCE].data != NULL &&
+                   parse_sysinfo_since(req.fields[PROTO_FIELD_SINCE].data, &since) < 0) {
+            response_puts(&resp, "Error: Invalid SYSINFO version\n");
+            status = PROTO_STATUS_ERROR;
+        } else {
+            send_system_info((enum sysinfo_format)format, sections != 0 ? sections : SYSINFO_ALL,
+                             req.fields[PROTO_FIELD_SINCE].data != NULL, since, &resp);
+        }
+    } else if (req.opcode == PROTO_OP_SENDMAIL) {
+        INFO_LOG(stderr, "Processing SENDMAIL command (binary)\n");
+        if (req.fields[PROTO_FIELD_TO].data == NULL) {
+            response_puts(&resp, "Error: Missing recipient\n");
+            status = PROTO_STATUS_ERROR;
+        } else if (run_sendmail(frame_field(&req, PROTO_FIELD_TO),
+                                frame_field(&req, PROTO_FIELD_SUBJECT),
+                                frame_field(&req, PROTO_FIELD_BODY), &resp) < 0) {
+            status = PROTO_STATUS_ERROR;
+        }
+    } else if (req.opcode == PROTO_OP_SENDMAIL_MULTI) {
+        INFO_LOG(stderr, "Processing SENDMAIL_MULTI command (binary)\n");
+        if (run_sendmail_multi(frame_field(&req, PROTO_FIELD_TO), frame_field(&req, PROTO_FIELD_SUBJECT),
+                               frame_field(&req, PROTO_FIELD_BODY), &resp) < 0) {
+            status = PROTO_STATUS_ERROR;
+        }
+    } else if (req.opcode == PROTO_OP_STATUS) {
+        if (report_job_status(frame_field(&req, PROTO_FIELD_JOB), &resp) < 0) {
+            status = PROTO_STATUS_ERROR;
+        }
+    } else {
+        WARN_LOG(stderr, "Unknown binary opcode: %u\n", req.opcode);
+        response_puts(&resp, "Error: Unknown command\n");
+        status = PROTO_STATUS_ERROR;
+    }
+    // The payload is already built, so its length is known for the header
+    char hdr[PROTO_HEADER_LEN];
+    proto_encode_header(hdr, (uint32_t)response_len(&resp), (uint16_t)status, req.opcode);
+    response_write(out, hdr, sizeof(hdr));
+    response_splice(out, &resp);
+    response_free(&resp);
+}
+
+size_t command_execute_frames(const char *buf, size_t len, struct response *out) {
+    size_t off = 0;
+    for (;;) {
+        ssize_t size = proto_frame_size(buf + off, len - off);
+        if (size <= 0 || (size_t)size > len - off) {
+            return off;
+        }
+        execute_frame(buf + off, (size_t)size, out);
+        off += (size_t)size;
+    }
+}
@@ -0,0 +1,75 @@
+#include "deadline.h"
+#include "debug.h"
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static struct deadline_config config = {
+    DEADLINE_DEFAULT_READ_IDLE_MS, DEADLINE_DEFAULT_WRITE_IDLE_MS, DEADLINE_DEFAULT_REQUEST_MS,
+    DEADLINE_DEFAULT_COLLECTOR_MS
+};
+
+// Shared with every forked worker; updated with atomics, no lock needed
+static uint64_t *counts_shared;
+
+int deadline_init(const struct deadline_config *cfg) {
+    config = *cfg;
+    uint64_t *c = mmap(NULL, DEADLINE_KINDS * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED) {
+        ERROR_LOG(stderr, "mmap() failed for timeout counters\n");
+        perror("mmap");
+        return -1;
+    }
+    counts_shared = c;
+    return 0;
+}
+
+int deadline_ms(enum deadline_kind kind) {
+    switch (kind) {
+    case DEADLINE_READ_IDLE:
+        return config.read_idle_ms;
+    case DEADLINE_WRITE_IDLE:
+        return config.write_idle_ms;
+    case DEADLINE_REQUEST:
+        return config.request_ms;
+    case DEADLINE_COLLECTOR:
+        return config.collector_ms;
+    default:
+        return 0;
+    }
+}
+
+void deadline_count(enum deadline_kind kind) {
+    if (counts_shared != NULL && kind < DEADLINE_KINDS) {
+        __atomic_fetch_add(&counts_shared[kind], 1, __ATOMIC_RELAXED);
+    }
+}
+
+void deadline_get_stats(uint64_t counts[DEADLINE_KINDS]) {
+    for (int i = 0; i < DEADLINE_KINDS; i++) {
+        counts[i] = counts_shared != NULL ? __atomic_load_n(&counts_shared[i], __ATOMIC_RELAXED) : 0;
+    }
+}
+
+const char *deadline_name(enum deadline_kind kind) {
+    static const char *names[DEADLINE_KINDS] = { "read_idle", "write_idle", "request", "collector" };
+    return kind < DEADLINE_KINDS ? names[kind] : "unknown";
+}
+
+uint64_t deadline_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+void deadline_arm(struct timer_wheel *w, struct timer *t, enum deadline_kind kind) {
+    int ms = deadline_ms(kind);
+    t->kind = kind;
+    if (ms > 0) {
+        timer_arm(w, t, deadline_now_ms() + (uint64_t)ms);
+    } else {
+        timer_cancel(t);
+    }
+}
@@ -0,0 +1,534 @@
+#define _GNU_SOURCE
+#include "diskinfo.h"
+#include "procfs.h"
+#include "debug.h"
+#include "jobpool.h"
+#include <sys/mman.h>
+#include <sys/statvfs.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TABLE_SIZE   (2 * SYSINFO_MAX_MOUNTS)  // power of two
+#define TABLE_PROBE  8                          // slots tried per mount
+#define POLL_MS      5      // re-check interval for probes run by other processes
+#define MOUNTINFO_BUF 16384 // longer lines (huge overlay options) are skipped
+
+// What we know about one mount, kept across scans and processes
+struct disk_entry {
+    uint32_t dev;               // major << 20 | minor; with path the key
+    int32_t error;              // errno of the last answer, 0 on success
+    uint64_t answers;           // bumped by every answer
+    int64_t answered_ms;        // CLOCK_MONOTONIC; 0: never answered
+    int64_t probe_ms;           // a probe is running since; 0: none
+    int64_t missed_ms;          // a scan gave up on it; 0 once it answers
+    int64_t used_ms;            // last scan that listed it, for eviction
+    pid_t prober;               // process running the probe
+    uint64_t total, free, avail;
+    char path[SYSINFO_MOUNT_PATH_LEN];  // "": free slot
+};
+
+struct disk_table {
+    pthread_mutex_t lock;       // process-shared, robust
+    int timeout_ms;
+    int cache_ms;
+    struct diskinfo_stats stats;
+    struct disk_entry entries[TABLE_SIZE];
+};
+
+static struct disk_table *table;
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+struct probe_job {
+    struct jobpool_job job;     // first: the pool hands this back
+    int slot;
+    uint32_t dev;
+    char path[SYSINFO_MOUNT_PATH_LEN];
+};
+
+static struct jobpool pool;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+// Not storage: nothing to report, or no sizes at all
+static const char *const pseudo_fstypes[] = {
+    "autofs", "binfmt_misc", "bpf", "cgroup", "cgroup2", "configfs", "debugfs",
+    "devpts", "devtmpfs", "efivarfs", "fusectl", "hugetlbfs", "mqueue", "nsfs",
+    "proc", "pstore", "ramfs", "rpc_pipefs", "securityfs", "selinuxfs", "sysfs",
+    "tracefs",
+};
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void table_lock(void) {
+    if (pthread_mutex_lock(&table->lock) == EOWNERDEAD) {
+        // A worker died while updating an entry; at worst one mount is
+        // mixed, and it is replaced by its next answer
+        pthread_mutex_consistent(&table->lock);
+    }
+}
+
+static void table_unlock(void) {
+    pthread_mutex_unlock(&table->lock);
+}
+
+int diskinfo_init(int timeout_ms, int cache_ms) {
+    struct disk_table *t = mmap(NULL, sizeof(*t), PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (t == MAP_FAILED) {
+        ERROR_LOG(stderr, "mmap() failed for disk mount table\n");
+        perror("mmap");
+        return -1;
+    }
+    pthread_mutexattr_t ma;
+    int ok = pthread_mutexattr_init(&ma) == 0;
+    ok = ok && pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED) == 0 &&
+         pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST) == 0 &&
+         pthread_mutex_init(&t->lock, &ma) == 0;
+    pthread_mutexattr_destroy(&ma);
+    if (!ok) {
+        ERROR_LOG(stderr, "Failed to initialise disk mount table lock\n");
+        munmap(t, sizeof(*t));
+        return -1;
+    }
+    t->timeout_ms = timeout_ms;
+    t->cache_ms = cache_ms;
+    table = t;
+    return 0;
+}
+
+static void table_default_init(void) {
+    if (table == NULL) {
+        diskinfo_init(DISKINFO_DEFAULT_TIMEOUT_MS, DISKINFO_DEFAULT_CACHE_MS);
+    }
+}
+
+void diskinfo_get_stats(struct diskinfo_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (table == NULL) {
+        return;
+    }
+    table_lock();
+    *stats = table->stats;
+    table_unlock();
+}
+
+// Mount table
+
+static int is_pseudo(const char *fstype) {
+    for (size_t i = 0; i < sizeof(pseudo_fstypes) / sizeof(pseudo_fstypes[0]); i++) {
+        if (strcmp(fstype, pseudo_fstypes[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Next space-separated field of a line, '\0'-terminated in place; NULL at the end
+static char *next_field(char **pp, char *end) {
+    char *p = *pp;
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    if (p == end) {
+        return NULL;
+    }
+    char *start = p;
+    while (p < end && *p != ' ') {
+        p++;
+    }
+    if (p < end) {
+        *p++ = '\0';
+    }
+    *pp = p;
+    return start;
+}
+
+// Zero-filled to the end: entries hash as bytes
+static void copy_fstype(struct sysinfo_mount *m, const char *fstype) {
+    memset(m->fstype, 0, sizeof(m->fstype));
+    memcpy(m->fstype, fstype, strnlen(fstype, sizeof(m->fstype) - 1));
+}
+
+// Copy a mountinfo path, undoing the kernel's octal escapes ("\040" for ' ')
+static void copy_unescaped(char *dst, size_t cap, const char *src) {
+    size_t n = 0;
+    while (*src != '\0' && n + 1 < cap) {
+        if (src[0] == '\\' && src[1] >= '0' && src[1] <= '3' && src[2] >= '0' && src[2] <= '7' &&
+            src[3] >= '0' && src[3] <= '7') {
+            dst[n++] = (char)(((src[1] - '0') << 6) | ((src[2] - '0') << 3) | (src[3] - '0'));
+            src += 4;
+        } else {
+            dst[n++] = *src++;
+        }
+    }
+    dst[n] = '\0';
+}
+
+// "id parent major:minor root mountpoint options [optional...] - fstype source superoptions"
+static void parse_mount_line(char *line, char *end, struct sysinfo_snapshot *snap, uint32_t *devs) {
+    char *p = line;
+    char *fields[5];
+    for (int i = 0; i < 5; i++) {
+        if ((fields[i] = next_field(&p, end)) == NULL) {
+            return;
+        }
+    }
+    char *f;
+    while ((f = next_field(&p, end)) != NULL && strcmp(f, "-") != 0) {
+        // optional fields (shared:N, master:N, ...)
+    }
+    char *fstype = f != NULL ? next_field(&p, end) : NULL;
+    if (fstype == NULL || is_pseudo(fstype)) {
+        return;
+    }
+    char *colon;
+    unsigned long major = strtoul(fields[2], &colon, 10);
+    if (*colon != ':') {
+        return;
+    }
+    uint32_t dev = (uint32_t)(major << 20) | (uint32_t)(strtoul(colon + 1, NULL, 10) & 0xfffff);
+    char path[SYSINFO_MOUNT_PATH_LEN] = "";     // zero-filled: entries hash as bytes
+    copy_unescaped(path, sizeof(path), fields[4]);
+    for (uint32_t i = 0; i < snap->mount_count; i++) {
+        // A mount over another hides it: statvfs() would report the top one twice
+        if (strcmp(snap->mounts[i].path, path) == 0) {
+            copy_fstype(&snap->mounts[i], fstype);
+            devs[i] = dev;
+            return;
+        }
+        // A device mounted twice (bind mounts) is listed once, at its shortest path
+        if (devs[i] == dev) {
+            if (strlen(path) < strlen(snap->mounts[i].path)) {
+                memcpy(snap->mounts[i].path, path, sizeof(path));
+            }
+            return;
+        }
+    }
+    if (snap->mount_count == SYSINFO_MAX_MOUNTS) {
+        snap->mounts_dropped++;
+        return;
+    }
+    struct sysinfo_mount *m = &snap->mounts[snap->mount_count];
+    memset(m, 0, sizeof(*m));
+    memcpy(m->path, path, sizeof(path));
+    copy_fstype(m, fstype);
+    devs[snap->mount_count++] = dev;
+}
+
+static int read_mounts(struct sysinfo_snapshot *snap, uint32_t *devs) {
+    char buf[MOUNTINFO_BUF];
+    size_t have = 0;
+    off_t off = 0;
+    int skipping = 0;       // inside a line that did not fit in buf
+    for (;;) {
+        ssize_t n = procfs_read_at(PROCFS_SELF_MOUNTINFO, buf + have, sizeof(buf) - have, off);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            return 0;       // a last line without '\n' is incomplete: dropped
+        }
+        off += n;
+        char *p = buf;
+        char *end = buf + have + n;
+        char *nl;
+        while ((nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+            if (!skipping) {
+                parse_mount_line(p, nl, snap, devs);
+            }
+            skipping = 0;
+            p = nl + 1;
+        }
+        have = (size_t)(end - p);
+        if (have == sizeof(buf) - 1) {
+            skipping = 1;
+            have = 0;
+        }
+        memmove(buf, p, have);
+    }
+}
+
+// Table lookup; called with the table lock held
+
+static uint32_t key_hash(uint32_t dev, const char *path) {
+    uint32_t h = 2166136261u ^ dev;
+    for (const char *p = path; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 16777619u;
+    }
+    return h;
+}
+
+static int entry_matches(const struct disk_entry *e, uint32_t dev, const char *path) {
+    return e->dev == dev && strcmp(e->path, path) == 0;
+}
+
+static int probe_running(const struct disk_entry *e) {
+    if (e->probe_ms == 0) {
+        return 0;
+    }
+    // A fork engine child exits with its probes: theirs are over
+    return e->prober == getpid() || kill(e->prober, 0) == 0 || errno == EPERM;
+}
+
+// Slot of a mount, taking a free or the least recently used idle slot for a
+// new one; -1 if every candidate is being probed
+static int table_slot(uint32_t dev, const char *path, int64_t now) {
+    uint32_t h = key_hash(dev, path);
+    int victim = -1;
+    for (int i = 0; i < TABLE_PROBE; i++) {
+        int slot = (int)((h + (uint32_t)i) & (TABLE_SIZE - 1));
+        struct disk_entry *e = &table->entries[slot];
+        if (entry_matches(e, dev, path)) {
+            return slot;
+        }
+        if (probe_running(e)) {
+            continue;
+        }
+        if (victim < 0 || e->used_ms < table->entries[victim].used_ms) {
+            victim = slot;
+        }
+    }
+    if (victim >= 0) {
+        struct disk_entry *e = &table->entries[victim];
+        memset(e, 0, sizeof(*e));
+        e->dev = dev;
+        memcpy(e->path, path, sizeof(e->path));
+        e->used_ms = now;
+    }
+    return victim;
+}
+
+// Probes
+
+static void store_answer(int slot, uint32_t dev, const char *path, int err, const struct statvfs *st) {
+    table_lock();
+    struct disk_entry *e = &table->entries[slot];
+    if (entry_matches(e, dev, path)) {
+        e->error = err;
+        if (err == 0) {
+            e->total = (uint64_t)st->f_blocks * st->f_frsize;
+            e->free = (uint64_t)st->f_bfree * st->f_frsize;
+            e->avail = (uint64_t)st->f_bavail * st->f_frsize;
+        } else {
+            e->total = e->free = e->avail = 0;
+            table->stats.errors++;
+        }
+        e->answers++;
+        e->answered_ms = now_ms();
+        e->probe_ms = 0;
+        e->missed_ms = 0;
+    }
+    table_unlock();
+}
+
+static void run_probe(struct probe_job *job) {
+    struct statvfs st;
+    int err = statvfs(job->path, &st) < 0 ? errno : 0;
+    if (err != 0) {
+        WARN_LOG(stderr, "statvfs(%s) failed: %s\n", job->path, strerror(err));
+    }
+    store_answer(job->slot, job->dev, job->path, err, &st);
+}
+
+static void run_pooled_probe(struct jobpool_job *job, void *ctx) {
+    (void)ctx;
+    run_probe((struct probe_job *)job);
+    free(job);
+}
+
+static void pool_init(void) {
+    jobpool_init(&pool, "Disk probe", DISKINFO_PROBE_THREADS, NULL);
+}
+
+// Queue a probe; -1 if there is no thread to run it
+static int queue_probe(int slot, uint32_t dev, const char *path) {
+    struct probe_job *job = malloc(sizeof(*job));
+    if (job == NULL) {
+        ERROR_LOG(stderr, "malloc() failed for disk probe\n");
+        return -1;
+    }
+    job->job.run = run_pooled_probe;
+    job->job.next = NULL;
+    job->slot = slot;
+    job->dev = dev;
+    memcpy(job->path, path, sizeof(job->path));
+    if (jobpool_submit(&pool, &job->job) < 0) {
+        free(job);
+        return -1;
+    }
+    return 0;
+}
+
+// Scan
+
+enum mount_state {
+    MOUNT_READY = 0,    // answer in the table
+    MOUNT_WAIT,         // probe running, worth waiting for
+    MOUNT_LATE          // no answer expected within this scan
+};
+
+static void fill_sizes(struct sysinfo_mount *m, const struct disk_entry *e) {
+    if (e->error != 0) {
+        m->flags |= SYSINFO_MOUNT_ERROR;
+        m->error = e->error;
+        return;
+    }
+    m->flags |= SYSINFO_MOUNT_SIZES;
+    m->total = e->total;
+    m->free = e->free;
+    m->avail = e->avail;
+}
+
+// No shared table: statvfs() each mount in turn, without a budget
+static void collect_inline(struct sysinfo_snapshot *snap) {
+    for (uint32_t i = 0; i < snap->mount_count; i++) {
+        struct disk_entry e;
+        struct statvfs st;
+        memset(&e, 0, sizeof(e));
+        if (statvfs(snap->mounts[i].path, &st) < 0) {
+            e.error = errno;
+        } else {
+            e.total = (uint64_t)st.f_blocks * st.f_frsize;
+            e.free = (uint64_t)st.f_bfree * st.f_frsize;
+            e.avail = (uint64_t)st.f_bavail * st.f_frsize;
+        }
+        fill_sizes(&snap->mounts[i], &e);
+    }
+}
+
+int diskinfo_collect(struct sysinfo_snapshot *snap) {
+    uint32_t devs[SYSINFO_MAX_MOUNTS];
+    snap->mount_count = snap->mounts_dropped = 0;
+    if (read_mounts(snap, devs) < 0) {
+        ERROR_LOG(stderr, "Failed to read /proc/self/mountinfo\n");
+        snap->mount_count = snap->mounts_dropped = 0;
+        return -1;
+    }
+    pthread_once(&table_once, table_default_init);
+    if (table == NULL) {
+        collect_inline(snap);
+        return 0;
+    }
+    pthread_once(&pool_once, pool_init);
+
+    int slots[SYSINFO_MAX_MOUNTS];
+    uint64_t answers[SYSINFO_MAX_MOUNTS];   // as of the start of the scan
+    uint8_t state[SYSINFO_MAX_MOUNTS];
+    uint8_t queue[SYSINFO_MAX_MOUNTS];      // probes this scan starts
+    int64_t start = now_ms();
+    table_lock();
+    int timeout_ms = table->timeout_ms;
+    table->stats.scans++;
+    for (uint32_t i = 0; i < snap->mount_count; i++) {
+        queue[i] = 0;
+        slots[i] = table_slot(devs[i], snap->mounts[i].path, start);
+        if (slots[i] < 0) {
+            state[i] = MOUNT_LATE;
+            continue;
+        }
+        struct disk_entry *e = &table->entries[slots[i]];
+        e->used_ms = start;
+        answers[i] = e->answers;
+        if (e->answered_ms != 0 && start - e->answered_ms < table->cache_ms) {
+            state[i] = MOUNT_READY;
+            table->stats.cache_hits++;
+            continue;
+        }
+        if (!probe_running(e)) {
+            e->probe_ms = start;
+            e->prober = getpid();
+            queue[i] = 1;
+            table->stats.probes++;
+        }
+        // Missed the budget recently, or probed for longer than a whole
+        // budget already (another scan is waiting out a hung mount): this
+        // scan does not wait for it
+        int suspect = (e->missed_ms != 0 && start - e->missed_ms < DISKINFO_RETRY_MS) ||
+                      (timeout_ms > 0 && start - e->probe_ms >= timeout_ms);
+        state[i] = suspect ? MOUNT_LATE : MOUNT_WAIT;
+    }
+    table_unlock();
+
+    int waiting = 0;
+    for (uint32_t i = 0; i < snap->mount_count; i++) {
+        if (queue[i] && queue_probe(slots[i], devs[i], snap->mounts[i].path) < 0) {
+            // No pool: probe right here
+            struct probe_job job = { .slot = slots[i], .dev = devs[i] };
+            memcpy(job.path, snap->mounts[i].path, sizeof(job.path));
+            run_probe(&job);
+        }
+        waiting += state[i] == MOUNT_WAIT;
+    }
+
+    int64_t deadline = start + timeout_ms;
+    while (waiting > 0) {
+        uint64_t finished = jobpool_finished(&pool);
+        // Probes of other processes do not signal this one: poll for them
+        int foreign = 0;
+        table_lock();
+        for (uint32_t i = 0; i < snap->mount_count; i++) {
+            if (state[i] != MOUNT_WAIT) {
+                continue;
+            }
+            const struct disk_entry *e = &table->entries[slots[i]];
+            if (!entry_matches(e, devs[i], snap->mounts[i].path) || e->answers != answers[i] ||
+                !probe_running(e)) {
+                state[i] = MOUNT_READY;
+                waiting--;
+            } else if (e->prober != getpid()) {
+                foreign = 1;
+            }
+        }
+        table_unlock();
+        int64_t now = now_ms();
+        if (waiting == 0 || (timeout_ms > 0 && now >= deadline)) {
+            break;
+        }
+        int64_t wake = timeout_ms > 0 ? deadline : INT64_MAX;
+        if (foreign && now + POLL_MS < wake) {
+            wake = now + POLL_MS;
+        }
+        struct timespec ts = { .tv_sec = wake / 1000, .tv_nsec = (long)(wake % 1000) * 1000000 };
+        jobpool_wait(&pool, finished, wake == INT64_MAX ? NULL : &ts);
+    }
+
+    int64_t now = now_ms();
+    uint32_t missed = 0;
+    table_lock();
+    for (uint32_t i = 0; i < snap->mount_count; i++) {
+        struct sysinfo_mount *m = &snap->mounts[i];
+        const struct disk_entry *e = slots[i] >= 0 ? &table->entries[slots[i]] : NULL;
+        if (e != NULL && !entry_matches(e, devs[i], m->path)) {
+            e = NULL;       // evicted meanwhile
+        }
+        int answered = e != NULL && e->answered_ms != 0 &&
+                       (e->answers != answers[i] || start - e->answered_ms < table->cache_ms);
+        if (answered) {
+            fill_sizes(m, e);
+            continue;
+        }
+        m->flags |= SYSINFO_MOUNT_TIMED_OUT;
+        if (e != NULL && e->answered_ms != 0 && e->error == 0) {
+            fill_sizes(m, e);
+        }
+        if (e != NULL && state[i] == MOUNT_WAIT) {
+            table->entries[slots[i]].missed_ms = now;
+        }
+        table->stats.timeouts++;
+        missed++;
+    }
+    table_unlock();
+    if (missed > 0) {
+        WARN_LOG(stderr, "%u of %u mounts did not answer within %d ms\n", missed, snap->mount_count, timeout_ms);
+    }
+    INFO_LOG(stderr, "Listed %u mounts in %lld ms\n", snap->mount_count, (long long)(now - start));
+    return 0;
+}
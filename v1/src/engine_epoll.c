@@ -0,0 +1,557 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "command.h"
+#include "protocol.h"
+#include "response.h"
+#include "linereader.h"
+#include "workpool.h"
+#include "deadline.h"
+#include "admission.h"
+#include "timerwheel.h"
+#include "debug.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EPOLL_MAX_EVENTS 64
+#define EPOLL_TICK_MS    TIMER_WHEEL_TICK_MS
+
+// Connection life cycle: one command per connection, as in the fork engine,
+// unless the client opens with KEEPALIVE or the binary preamble; then
+// WRITING returns to READING
+enum conn_state {
+    CONN_READING,   // accumulating the command line(s)
+    CONN_RUNNING,   // command handed to the worker pool
+    CONN_WRITING,   // flushing the response
+    CONN_CLOSED     // fd closed; freed after the current event batch
+};
+
+struct conn {
+    int fd;
+    enum conn_state state;
+    char *in;               // KEEPALIVE_BUF_LEN, grown for large binary frames
+    size_t in_cap;
+    size_t in_len;
+    int keepalive;          // several requests per connection
+    int binary;             // length-prefixed frames instead of text lines
+    int discarding;         // keep-alive: dropping an over-long line up to its '\n'
+    size_t consumed;        // input bytes answered by the current batch
+    struct response out;    // built by the worker, sent with sendmsg()
+    struct timer idle;      // read-idle while READING, write-idle while WRITING
+    struct timer request;   // first byte of a request until its response is written
+    int timed_out;          // request deadline passed while RUNNING
+    int ticket;             // admission control handle
+    struct conn *prev;      // open connections not owned by a worker
+    struct conn *next;      // also links closed ones until they are freed
+    struct work_item work;
+};
+
+#define CONN_OF(item) ((struct conn *)((char *)(item) - offsetof(struct conn, work)))
+#define CONN_OF_TIMER(t) ((struct conn *)((char *)(t) - ((t)->kind == DEADLINE_REQUEST ? \
+                          offsetof(struct conn, request) : offsetof(struct conn, idle))))
+
+struct epoll_engine {
+    int epfd;
+    struct listener_set listeners;
+    struct workpool *pool;
+    struct conn *head;      // READING/WRITING connections
+    struct conn *tail;
+    struct conn *closed;    // closed during the current batch; later events may still name them
+    struct timer_wheel wheel;   // every connection deadline
+    struct timer expired;       // due timers of the current sweep
+};
+
+// Sentinels stored in epoll_event.data.ptr for the non-connection fds
+static char listener_tags[SERVER_MAX_LISTENERS];
+static char pool_tag;
+
+// Listener index of an epoll tag, -1 if it is not a listener
+static int listener_index(const void *tag) {
+    for (int i = 0; i < SERVER_MAX_LISTENERS; i++) {
+        if (tag == &listener_tags[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void list_remove(struct epoll_engine *e, struct conn *c) {
+    if (c->prev) c->prev->next = c->next; else e->head = c->next;
+    if (c->next) c->next->prev = c->prev; else e->tail = c->prev;
+    c->prev = c->next = NULL;
+}
+
+static void list_append(struct epoll_engine *e, struct conn *c) {
+    c->prev = e->tail;
+    c->next = NULL;
+    if (e->tail) e->tail->next = c; else e->head = c;
+    e->tail = c;
+}
+
+// Record progress: restart the idle deadline of the current direction
+static void conn_touch(struct epoll_engine *e, struct conn *c) {
+    deadline_arm(&e->wheel, &c->idle,
+                 c->state == CONN_WRITING ? DEADLINE_WRITE_IDLE : DEADLINE_READ_IDLE);
+}
+
+static void conn_close(struct epoll_engine *e, struct conn *c) {
+    DEBUG_LOG(stderr, "epoll: closing fd %d\n", c->fd);
+    if (c->state != CONN_RUNNING) {
+        list_remove(e, c);
+    }
+    timer_cancel(&c->idle);
+    timer_cancel(&c->request);
+    epoll_ctl(e->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    admission_release(c->ticket);
+    response_free(&c->out);
+    free(c->in);
+    c->in = NULL;
+    c->state = CONN_CLOSED;
+    c->next = e->closed;
+    e->closed = c;
+}
+
+static void free_closed(struct epoll_engine *e) {
+    while (e->closed != NULL) {
+        struct conn *c = e->closed;
+        e->closed = c->next;
+        free(c);
+    }
+}
+
+// Runs on a pool thread: execute the command into the response builder
+static void conn_run(struct work_item *item) {
+    struct conn *c = CONN_OF(item);
+    struct response *out = &c->out;
+    admission_set_current(c->ticket);
+    if (c->binary) {
+        c->consumed = command_execute_frames(c->in, c->in_len, out);
+    } else if (c->keepalive) {
+        // Every complete line received so far: one batch, one write
+        c->consumed = command_execute_pipeline(c->in, c->in_len, out);
+    } else {
+        command_execute(c->in, out);
+    }
+}
+
+static void conn_read(struct epoll_engine *e, struct conn *c);
+
+// Keep-alive: drop the answered lines and go back to reading
+static void conn_next_batch(struct epoll_engine *e, struct conn *c) {
+    response_reset(&c->out);
+    c->in_len -= c->consumed;
+    memmove(c->in, c->in + c->consumed, c->in_len);
+    c->consumed = 0;
+    c->state = CONN_READING;
+    conn_touch(e, c);
+    // A pipelined request that already arrived is running against the clock
+    timer_cancel(&c->request);
+    if (c->in_len > 0) {
+        deadline_arm(&e->wheel, &c->request, DEADLINE_REQUEST);
+    }
+    // Edge-triggered: data that arrived while the batch ran is already
+    // signalled, so drain the socket now instead of waiting for EPOLLIN
+    conn_read(e, c);
+}
+
+// Write as much of the response as the socket accepts; close when done
+static void conn_flush(struct epoll_engine *e, struct conn *c) {
+    while (response_pending(&c->out) > 0) {
+        ssize_t n = response_send_some(&c->out, c->fd);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;   // wait for EPOLLOUT
+            WARN_LOG(stderr, "sendmsg() failed on fd %d\n", c->fd);
+            conn_close(e, c);
+            return;
+        }
+        conn_touch(e, c);
+    }
+    if (c->keepalive) {
+        conn_next_batch(e, c);
+        return;
+    }
+    conn_close(e, c);
+}
+
+// Hand the completed command line to the worker pool
+static void conn_dispatch(struct epoll_engine *e, struct conn *c) {
+    if (!c->keepalive && c->in[0] == '\0') {
+        WARN_LOG(stderr, "No command received: empty command or connection issue\n");
+        conn_close(e, c);
+        return;
+    }
+    list_remove(e, c);
+    timer_cancel(&c->idle);
+    c->state = CONN_RUNNING;
+    c->work.run = conn_run;
+    if (workpool_submit(e->pool, &c->work) < 0) {
+        ERROR_LOG(stderr, "workpool_submit() failed\n");
+        c->state = CONN_READING;
+        list_append(e, c);
+        conn_close(e, c);
+    }
+}
+
+// Keep-alive: drop the n bytes just read while discarding, up to the '\n'
+// that ends the over-long line. Its head stays in the buffer, so the worker
+// answers it with "Error: Command too long" in order with the others.
+static void conn_discard(struct conn *c, size_t n) {
+    char *fresh = c->in + c->in_len - n;
+    const char *newline = line_find_newline(fresh, n);
+    if (newline == NULL) {
+        c->in_len -= n;
+        return;
+    }
+    size_t rest = (size_t)(c->in + c->in_len - newline);
+    memmove(fresh, newline, rest);
+    c->in_len = (size_t)(fresh - c->in) + rest;
+    c->discarding = 0;
+}
+
+// Keep-alive: dispatch the complete lines buffered so far
+static void conn_read_pipelined(struct epoll_engine *e, struct conn *c, int eof) {
+    if (line_find_newline(c->in, c->in_len) != NULL) {
+        conn_dispatch(e, c);
+    } else if (c->in_len > COMMAND_MAX_LEN) {
+        // One byte past the limit (two with a '\r') is enough to tell:
+        // keep that much and drop the rest as it arrives
+        WARN_LOG(stderr, "Command too long, skipping to the next line\n");
+        if (eof) {
+            conn_close(e, c);
+            return;
+        }
+        c->in_len = COMMAND_MAX_LEN + 1;
+        c->discarding = 1;
+        // The buffer may have filled before the socket was drained, and
+        // edge-triggered epoll will not signal those bytes again
+        conn_read(e, c);
+    } else if (eof) {
+        if (c->in_len == 0) {
+            conn_close(e, c);
+            return;
+        }
+        // Peer half-closed after an unterminated command: run it
+        c->in[c->in_len++] = '\n';
+        conn_dispatch(e, c);
+    }
+}
+
+// Binary: dispatch once the frames buffered so far include a complete one
+static void conn_read_binary(struct epoll_engine *e, struct conn *c, int eof) {
+    ssize_t size = proto_frame_size(c->in, c->in_len);
+    if (size < 0) {
+        WARN_LOG(stderr, "Binary frame exceeds %d bytes, closing connection\n", PROTO_MAX_FRAME);
+        conn_close(e, c);
+    } else if (size > 0 && (size_t)size <= c->in_len) {
+        conn_dispatch(e, c);
+    } else if (eof) {
+        if (c->in_len > 0) {
+            WARN_LOG(stderr, "Connection closed in the middle of a frame\n");
+        }
+        conn_close(e, c);
+    }
+}
+
+// Binary: make room for the whole frame at the head of the buffer
+// @return 1 if the buffer grew, 0 otherwise
+static int conn_grow(struct conn *c) {
+    ssize_t size = proto_frame_size(c->in, c->in_len);
+    if (size <= 0 || (size_t)size + 2 <= c->in_cap) {
+        return 0;
+    }
+    char *in = realloc(c->in, (size_t)size + 2);
+    if (in == NULL) {
+        ERROR_LOG(stderr, "realloc() failed for frame buffer\n");
+        return 0;
+    }
+    c->in = in;
+    c->in_cap = (size_t)size + 2;
+    return 1;
+}
+
+// Drain the socket (edge-triggered) and dispatch once a full line arrived
+static void conn_read(struct epoll_engine *e, struct conn *c) {
+    int eof = 0;
+    // Keep one byte for the '\n' appended at EOF and one for the '\0'
+    while (c->in_len < c->in_cap - 2 || (c->binary && conn_grow(c))) {
+        ssize_t n = read(c->fd, c->in + c->in_len, c->in_cap - 2 - c->in_len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            WARN_LOG(stderr, "Failed to read command or connection closed\n");
+            conn_close(e, c);
+            return;
+        }
+        if (n == 0) {
+            eof = 1;
+            break;
+        }
+        c->in_len += (size_t)n;
+        conn_touch(e, c);
+        if (c->discarding) {
+            conn_discard(c, (size_t)n);
+            if (c->discarding) {
+                continue;
+            }
+        }
+        if (!timer_armed(&c->request)) {
+            deadline_arm(&e->wheel, &c->request, DEADLINE_REQUEST);
+        }
+        if (!c->keepalive && proto_preamble(c->in, c->in_len) > 0) {
+            c->keepalive = 1;
+            c->binary = 1;
+            c->in_len -= PROTO_MAGIC_LEN;
+            memmove(c->in, c->in + PROTO_MAGIC_LEN, c->in_len);
+        }
+        if (!c->keepalive) {
+            if (command_is_keepalive(c->in, c->in_len)) {
+                c->keepalive = 1;
+            } else if (line_find_newline(c->in + c->in_len - n, (size_t)n) != NULL ||
+                       c->in_len >= COMMAND_MAX_LEN - 1) {
+                break;
+            }
+        }
+    }
+    c->in[c->in_len] = '\0';
+    if (c->binary) {
+        conn_read_binary(e, c, eof);
+        return;
+    }
+    if (c->discarding) {
+        // Still inside an over-long line: wait for its '\n'
+        if (eof) {
+            conn_close(e, c);
+        }
+        return;
+    }
+    if (c->keepalive) {
+        conn_read_pipelined(e, c, eof);
+        return;
+    }
+
+    const char *newline = line_find_newline(c->in, c->in_len);
+    if (newline == NULL || newline - c->in >= COMMAND_MAX_LEN - 1) {
+        if (c->in_len >= COMMAND_MAX_LEN - 1) {
+            WARN_LOG(stderr, "Large data stream detected without newline, closing connection\n");
+            conn_close(e, c);
+        } else if (eof) {
+            if (c->in_len == 0) {
+                conn_close(e, c);
+            } else {
+                // Peer half-closed after an unterminated command: run it
+                conn_dispatch(e, c);
+            }
+        }
+        return;
+    }
+    // The command ends at the first '\r' or '\n'
+    c->in[line_find_eol(c->in, (size_t)(newline - c->in) + 1) - c->in] = '\0';
+    conn_dispatch(e, c);
+}
+
+static void accept_clients(struct epoll_engine *e, int listen_fd) {
+    for (;;) {
+        struct sockaddr_storage cli;
+        socklen_t clilen = sizeof(cli);
+        char peer[64];
+        int cfd = accept4(listen_fd, (struct sockaddr *)&cli, &clilen,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (cfd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ERROR_LOG(stderr, "accept() failed\n");
+                perror("accept");
+            }
+            return;
+        }
+        listener_peer_name(&cli, peer, sizeof(peer));
+        INFO_LOG(stderr, "Client connected from %s\n", peer);
+
+        int ticket;
+        int verdict = admission_acquire((struct sockaddr *)&cli, &ticket);
+        if (verdict != ADMISSION_OK) {
+            WARN_LOG(stderr, "Connection from %s rejected by admission control\n", peer);
+            admission_reject(cfd, verdict);
+            continue;
+        }
+        struct conn *c = calloc(1, sizeof(*c));
+        if (c == NULL) {
+            ERROR_LOG(stderr, "calloc() failed for connection\n");
+            admission_release(ticket);
+            close(cfd);
+            continue;
+        }
+        c->in = malloc(KEEPALIVE_BUF_LEN);
+        if (c->in == NULL) {
+            ERROR_LOG(stderr, "malloc() failed for connection buffer\n");
+            admission_release(ticket);
+            free(c);
+            close(cfd);
+            continue;
+        }
+        c->in_cap = KEEPALIVE_BUF_LEN;
+        c->ticket = ticket;
+        c->fd = cfd;
+        c->state = CONN_READING;
+        timer_init(&c->idle, DEADLINE_READ_IDLE);
+        timer_init(&c->request, DEADLINE_REQUEST);
+        list_append(e, c);
+        conn_touch(e, c);
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = c;
+        if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, cfd, &ev) < 0) {
+            ERROR_LOG(stderr, "epoll_ctl(ADD) failed\n");
+            perror("epoll_ctl");
+            conn_close(e, c);
+        }
+    }
+}
+
+static void reap_completed(struct epoll_engine *e) {
+    struct work_item *item = workpool_reap(e->pool);
+    while (item != NULL) {
+        struct work_item *next = item->next;
+        struct conn *c = CONN_OF(item);
+        if (c->timed_out) {
+            conn_close(e, c);
+            item = next;
+            continue;
+        }
+        c->state = CONN_WRITING;
+        list_append(e, c);
+        conn_touch(e, c);
+        conn_flush(e, c);
+        item = next;
+    }
+}
+
+// Close every connection whose deadline passed since the last sweep
+static void expire_deadlines(struct epoll_engine *e) {
+    timer_wheel_expire(&e->wheel, deadline_now_ms(), &e->expired);
+    struct timer *t;
+    while ((t = timer_list_pop(&e->expired)) != NULL) {
+        struct conn *c = CONN_OF_TIMER(t);
+        deadline_count((enum deadline_kind)t->kind);
+        WARN_LOG(stderr, "fd %d exceeded its %s deadline, closing\n", c->fd, deadline_name((enum deadline_kind)t->kind));
+        if (c->state == CONN_RUNNING) {
+            // The worker owns the connection: drop it when the command returns
+            c->timed_out = 1;
+            continue;
+        }
+        conn_close(e, c);
+    }
+}
+
+static int epoll_add(int epfd, int fd, void *tag) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = tag;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int epoll_engine_run(const struct listener_set *ls, int nthreads, volatile sig_atomic_t *should_exit) {
+    struct epoll_engine e;
+    memset(&e, 0, sizeof(e));
+    e.listeners = *ls;
+    timer_wheel_init(&e.wheel, deadline_now_ms());
+    timer_list_init(&e.expired);
+
+    for (int i = 0; i < ls->count; i++) {
+        int flags = fcntl(ls->fds[i], F_GETFL, 0);
+        if (flags < 0 || fcntl(ls->fds[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+            ERROR_LOG(stderr, "fcntl(O_NONBLOCK) failed on listening socket\n");
+            perror("fcntl");
+            return -1;
+        }
+    }
+    e.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (e.epfd < 0) {
+        ERROR_LOG(stderr, "epoll_create1() failed\n");
+        perror("epoll_create1");
+        return -1;
+    }
+    e.pool = workpool_create(nthreads);
+    if (e.pool == NULL) {
+        close(e.epfd);
+        return -1;
+    }
+    int added = epoll_add(e.epfd, workpool_fd(e.pool), &pool_tag) == 0;
+    for (int i = 0; added && i < ls->count; i++) {
+        added = epoll_add(e.epfd, ls->fds[i], &listener_tags[i]) == 0;
+    }
+    if (!added) {
+        ERROR_LOG(stderr, "epoll_ctl(ADD) failed\n");
+        perror("epoll_ctl");
+        workpool_destroy(e.pool);
+        close(e.epfd);
+        return -1;
+    }
+    INFO_LOG(stderr, "epoll engine running with %d worker threads\n", nthreads);
+
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    while (!*should_exit) {
+        int n = epoll_wait(e.epfd, events, EPOLL_MAX_EVENTS, EPOLL_TICK_MS);
+        if (n < 0) {
+            if (errno == EINTR) {
+                // SIGQUIT interrupts the wait; the loop condition checks the flag
+                continue;
+            }
+            ERROR_LOG(stderr, "epoll_wait() failed\n");
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            int index = listener_index(tag);
+            if (index >= 0) {
+                accept_clients(&e, e.listeners.fds[index]);
+            } else if (tag == &pool_tag) {
+                reap_completed(&e);
+            } else {
+                struct conn *c = tag;
+                if (c->state == CONN_READING &&
+                    (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                    conn_read(&e, c);
+                } else if (c->state == CONN_WRITING && (events[i].events & (EPOLLOUT | EPOLLERR))) {
+                    conn_flush(&e, c);
+                }
+                // CONN_RUNNING: the worker owns the command; the result is
+                // delivered through the pool eventfd. CONN_CLOSED: closed
+                // earlier in this batch, e.g. by reap_completed()
+            }
+        }
+        expire_deadlines(&e);
+        free_closed(&e);
+    }
+
+    INFO_LOG(stderr, "epoll engine shutting down\n");
+    while (e.head != NULL) {
+        conn_close(&e, e.head);
+    }
+    // Let in-flight commands finish, then drop their connections
+    workpool_stop(e.pool);
+    for (struct work_item *item = workpool_reap(e.pool); item != NULL; ) {
+        struct work_item *next = item->next;
+        conn_close(&e, CONN_OF(item));
+        item = next;
+    }
+    free_closed(&e);
+    workpool_destroy(e.pool);
+    close(e.epfd);
+    return 0;
+}
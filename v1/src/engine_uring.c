@@ -0,0 +1,874 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "command.h"
+#include "protocol.h"
+#include "response.h"
+#include "linereader.h"
+#include "workpool.h"
+#include "deadline.h"
+#include "admission.h"
+#include "timerwheel.h"
+#include "debug.h"
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define URING_ENTRIES    256
+#define URING_MAX_CONNS  1024
+// Registered per-connection area: command buffer followed by write buffer;
+// responses larger than the write buffer are sent from the builder's
+// segments with IORING_OP_SENDMSG instead
+#define URING_WBUF_SIZE  (16 * 1024)
+// A keep-alive line one byte past COMMAND_MAX_LEN (two with a '\r') is
+// known to be too long; plus the '\n' appended at EOF and the '\0'
+#define URING_RBUF_SIZE  (COMMAND_MAX_LEN + 3)
+#define URING_SLOT_SIZE  (URING_RBUF_SIZE + URING_WBUF_SIZE)
+
+// Operation tag in the low byte of user_data, connection slot above it
+enum uring_op {
+    OP_ACCEPT = 1,
+    OP_READ,
+    OP_WRITE,
+    OP_CLOSE,
+    OP_POOL_POLL,
+    OP_TICK
+};
+
+#define UDATA(op, slot)  (((uint64_t)(slot) << 8) | (uint64_t)(op))
+#define UDATA_OP(u)      ((enum uring_op)((u) & 0xff))
+#define UDATA_SLOT(u)    ((int)((u) >> 8))
+
+// Minimal io_uring wrapper over the raw syscalls (no liburing dependency)
+struct uring {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    void *ring_ptr;
+    size_t ring_size;
+    size_t sqes_size;
+    unsigned pending;       // SQEs queued but not yet submitted
+};
+
+enum uconn_state {
+    UCONN_FREE,
+    UCONN_READING,
+    UCONN_RUNNING,
+    UCONN_WRITING,
+    UCONN_CLOSING
+};
+
+struct uconn {
+    int fd;
+    enum uconn_state state;
+    char *rbuf;             // registered: command line
+    char *wbuf;             // registered: small responses
+    size_t in_len;
+    int keepalive;          // several requests: writes are not linked to close
+    int binary;             // length-prefixed frames, read into the heap buffer
+    int discarding;         // keep-alive: dropping an over-long line up to its '\n'
+    char *frames;           // binary mode input (grown up to PROTO_MAX_FRAME)
+    size_t frames_cap;
+    size_t consumed;        // input bytes answered by the current batch
+    struct response out;    // built by the worker
+    struct msghdr msg;      // IORING_OP_SENDMSG of a large response
+    int write_failed;
+    int timed_out;          // a deadline passed: close instead of continuing
+    int ticket;             // admission control handle
+    struct timer idle;      // read-idle while READING, write-idle while WRITING
+    struct timer request;   // first byte of a request until its response is written
+    int next_free;
+    struct work_item work;
+};
+
+#define UCONN_OF(item) ((struct uconn *)((char *)(item) - offsetof(struct uconn, work)))
+#define UCONN_OF_TIMER(t) ((struct uconn *)((char *)(t) - ((t)->kind == DEADLINE_REQUEST ? \
+                           offsetof(struct uconn, request) : offsetof(struct uconn, idle))))
+
+struct uring_engine {
+    struct uring ring;
+    struct listener_set listeners;
+    int multishot;          // multishot accept accepted by the kernel
+    struct workpool *pool;
+    char *buffers;          // URING_MAX_CONNS * URING_SLOT_SIZE, registered
+    struct uconn conns[URING_MAX_CONNS];
+    int free_head;
+    struct timer_wheel wheel;   // every connection deadline
+    struct timer expired;       // due timers of the current sweep
+};
+
+static const struct __kernel_timespec tick_interval = { 0, TIMER_WHEEL_TICK_MS * 1000000L };
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int uring_init(struct uring *r, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(*r));
+    r->fd = sys_io_uring_setup(entries, &p);
+    if (r->fd < 0) {
+        return -1;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP)) {
+        close(r->fd);
+        errno = ENOTSUP;
+        return -1;
+    }
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ring_size = sq_size > cq_size ? sq_size : cq_size;
+    r->ring_ptr = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       r->fd, IORING_OFF_SQ_RING);
+    if (r->ring_ptr == MAP_FAILED) {
+        close(r->fd);
+        return -1;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        munmap(r->ring_ptr, r->ring_size);
+        close(r->fd);
+        return -1;
+    }
+    char *base = r->ring_ptr;
+    r->sq_head = (unsigned *)(base + p.sq_off.head);
+    r->sq_tail = (unsigned *)(base + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(base + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(base + p.sq_off.array);
+    r->cq_head = (unsigned *)(base + p.cq_off.head);
+    r->cq_tail = (unsigned *)(base + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(base + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_exit(struct uring *r) {
+    munmap(r->sqes, r->sqes_size);
+    munmap(r->ring_ptr, r->ring_size);
+    close(r->fd);
+}
+
+// Check that every opcode the engine relies on is implemented
+static int uring_probe(struct uring *r) {
+    static const int required[] = {
+        IORING_OP_ACCEPT, IORING_OP_READ_FIXED, IORING_OP_READ, IORING_OP_WRITE_FIXED, IORING_OP_SENDMSG,
+        IORING_OP_CLOSE, IORING_OP_POLL_ADD, IORING_OP_TIMEOUT
+    };
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (probe == NULL) {
+        return -1;
+    }
+    int ok = sys_io_uring_register(r->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(required) / sizeof(required[0]); i++) {
+        ok = required[i] <= probe->last_op && (probe->ops[required[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return ok ? 0 : -1;
+}
+
+static int uring_submit(struct uring *r, unsigned wait_nr) {
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int ret = sys_io_uring_enter(r->fd, r->pending, wait_nr, flags);
+    if (ret >= 0) {
+        r->pending -= (unsigned)ret < r->pending ? (unsigned)ret : r->pending;
+    }
+    return ret;
+}
+
+// Make room for n SQEs that must be submitted together (linked chains)
+static int uring_reserve(struct uring *r, unsigned n) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_mask + 1 - (*r->sq_tail - head) >= n) {
+        return 0;
+    }
+    return uring_submit(r, 0) < 0 ? -1 : 0;
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail;
+    if (tail - head > r->sq_mask) {
+        // Ring full: hand what we have to the kernel first
+        if (uring_submit(r, 0) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head > r->sq_mask) {
+            return NULL;
+        }
+    }
+    unsigned idx = tail & r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->pending++;
+    return sqe;
+}
+
+// Accept on listener index (the slot bits of user_data carry the index)
+static void queue_accept(struct uring_engine *e, int index) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&e->ring);
+    if (sqe == NULL) {
+        ERROR_LOG(stderr, "io_uring: submission queue full, cannot arm accept\n");
+        return;
+    }
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = e->listeners.fds[index];
+    sqe->accept_flags = SOCK_CLOEXEC;
+    if (e->multishot) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    }
+    sqe->user_data = UDATA(OP_ACCEPT, index);
+}
+
+static void queue_pool_poll(struct uring_engine *e) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&e->ring);
+    if (sqe == NULL) {
+        ERROR_LOG(stderr, "io_uring: submission queue full, cannot arm pool poll\n");
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = workpool_fd(e->pool);
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = UDATA(OP_POOL_POLL, 0);
+}
+
+// Periodic timeout: advances the deadline wheel and re-checks the SIGQUIT flag
+static void queue_tick(struct uring_engine *e) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&e->ring);
+    if (sqe == NULL) {
+        return;
+    }
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)&tick_interval;
+    sqe->len = 1;
+    sqe->user_data = UDATA(OP_TICK, 0);
+}
+
+static int conn_slot(struct uring_engine *e, struct uconn *c) {
+    return (int)(c - e->conns);
+}
+
+static void conn_release(struct uring_engine *e, struct uconn *c) {
+    timer_cancel(&c->idle);
+    timer_cancel(&c->request);
+    response_reset(&c->out);
+    free(c->frames);
+    c->frames = NULL;
+    admission_release(c->ticket);
+    c->ticket = -1;
+    c->fd = -1;
+    c->state = UCONN_FREE;
+    c->next_free = e->free_head;
+    e->free_head = conn_slot(e, c);
+}
+
+static void queue_close(struct uring_engine *e, struct uconn *c) {
+    c->state = UCONN_CLOSING;
+    timer_cancel(&c->idle);
+    timer_cancel(&c->request);
+    struct io_uring_sqe *sqe = uring_get_sqe(&e->ring);
+    if (sqe == NULL) {
+        close(c->fd);
+        conn_release(e, c);
+        return;
+    }
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = c->fd;
+    sqe->user_data = UDATA(OP_CLOSE, conn_slot(e, c));
+}
+
+// Read into the registered command buffer (binary frames: the heap buffer);
+// the read-idle deadline in the wheel bounds how long it may stay pending
+static void queue_read(struct uring_engine *e, struct uconn *c) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&e->ring);
+    if (sqe == NULL) {
+        ERROR_LOG(stderr, "io_uring: submission queue full, dropping client\n");
+        close(c->fd);
+        conn_release(e, c);
+        return;
+    }
+    deadline_arm(&e->wheel, &c->idle, DEADLINE_READ_IDLE);
+    int slot = conn_slot(e, c);
+    if (c->binary) {
+        sqe->opcode = IORING_OP_READ;
+        sqe->addr = (uint64_t)(uintptr_t)(c->frames + c->in_len);
+        sqe->len = (unsigned)(c->frames_cap - c->in_len);
+    } else {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t)(uintptr_t)(c->rbuf + c->in_len);
+        size_t limit = c->keepalive ? URING_RBUF_SIZE - 2 : COMMAND_MAX_LEN - 1;
+        sqe->len = (unsigned)(limit - c->in_len);
+        sqe->buf_index = (uint16_t)slot;
+    }
+    sqe->fd = c->fd;
+    sqe->user_data = UDATA(OP_READ, slot);
+}
+
+// Write the rest of the response, linked to the close of the socket
+// (keep-alive connections write alone and read again afterwards)
+static void queue_write(struct uring_engine *e, struct uconn *c) {
+    int link_close = !c->keepalive;
+    uring_reserve(&e->ring, link_close ? 2 : 1);
+    struct io_uring_sqe *sqe = uring_get_sqe(&e->ring);
+    struct io_uring_sqe *cls = sqe != NULL && link_close ? uring_get_sqe(&e->ring) : NULL;
+    if (sqe == NULL || (link_close && cls == NULL)) {
+        if (sqe != NULL) {
+            sqe->opcode = IORING_OP_NOP;
+        }
+        close(c->fd);
+        conn_release(e, c);
+        return;
+    }
+    int slot = conn_slot(e, c);
+    if (response_len(&c->out) <= URING_WBUF_SIZE) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = (uint64_t)(uintptr_t)(c->wbuf + response_len(&c->out) - response_pending(&c->out));
+        sqe->len = (unsigned)response_pending(&c->out);
+        sqe->buf_index = (uint16_t)slot;
+    } else {
+        const struct iovec *iov;
+        memset(&c->msg, 0, sizeof(c->msg));
+        c->msg.msg_iovlen = (size_t)response_iov(&c->out, &iov);
+        c->msg.msg_iov = (struct iovec *)iov;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uint64_t)(uintptr_t)&c->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    sqe->fd = c->fd;
+    sqe->user_data = UDATA(OP_WRITE, slot);
+    c->state = UCONN_WRITING;
+    deadline_arm(&e->wheel, &c->idle, DEADLINE_WRITE_IDLE);
+    if (!link_close) {
+        return;
+    }
+    sqe->flags = IOSQE_IO_LINK;
+
+    cls->opcode = IORING_OP_CLOSE;
+    cls->fd = c->fd;
+    cls->user_data = UDATA(OP_CLOSE, slot);
+}
+
+// Runs on a pool thread: execute the command into the response builder
+static void uconn_run(struct work_item *item) {
+    struct uconn *c = UCONN_OF(item);
+    struct response *out = &c->out;
+    admission_set_current(c->ticket);
+    if (c->binary) {
+        c->consumed = command_execute_frames(c->frames, c->in_len, out);
+    } else if (c->keepalive) {
+        // Every complete line received so far: one batch, one write
+        c->consumed = command_execute_pipeline(c->rbuf, c->in_len, out);
+    } else {
+        command_execute(c->rbuf, out);
+    }
+}
+
+static void conn_dispatch(struct uring_engine *e, struct uconn *c) {
+    if (!c->keepalive && c->rbuf[0] == '\0') {
+        WARN_LOG(stderr, "No command received: empty command or connection issue\n");
+        queue_close(e, c);
+        return;
+    }
+    c->state = UCONN_RUNNING;
+    timer_cancel(&c->idle);
+    c->work.run = uconn_run;
+    if (workpool_submit(e->pool, &c->work) < 0) {
+        ERROR_LOG(stderr, "workpool_submit() failed\n");
+        queue_close(e, c);
+    }
+}
+
+// Keep-alive: dispatch the complete lines buffered so far, or read more
+static void conn_continue(struct uring_engine *e, struct uconn *c) {
+    if (line_find_newline(c->rbuf, c->in_len) != NULL) {
+        conn_dispatch(e, c);
+    } else {
+        if (c->in_len > COMMAND_MAX_LEN) {
+            WARN_LOG(stderr, "Command too long, skipping to the next line\n");
+            c->in_len = 0;
+            c->discarding = 1;
+        }
+        c->state = UCONN_READING;
+        queue_read(e, c);
+    }
+}
+
+// Keep-alive: res bytes read while discarding. Once the over-long line
+// ends, answer it and go on with what followed it.
+static void conn_discard(struct uring_engine *e, struct uconn *c, int res) {
+    const char *newline = line_find_newline(c->rbuf, (size_t)res);
+    if (newline == NULL) {
+        queue_read(e, c);
+        return;
+    }
+    c->discarding = 0;
+    c->in_len = (size_t)(c->rbuf + res - newline) - 1;
+    memmove(c->rbuf, newline + 1, c->in_len);
+    c->rbuf[c->in_len] = '\0';
+    command_reject_line(&c->out);
+    response_copy(&c->out, 0, c->wbuf, URING_WBUF_SIZE);
+    c->consumed = 0;
+    queue_write(e, c);
+}
+
+// Binary: dispatch once a complete frame is buffered, or read more
+static void conn_continue_binary(struct uring_engine *e, struct uconn *c) {
+    ssize_t size = proto_frame_size(c->frames, c->in_len);
+    if (size < 0) {
+        WARN_LOG(stderr, "Binary frame exceeds %d bytes, closing connection\n", PROTO_MAX_FRAME);
+        queue_close(e, c);
+        return;
+    }
+    if (size > 0 && (size_t)size <= c->in_len) {
+        conn_dispatch(e, c);
+        return;
+    }
+    if ((size_t)size > c->frames_cap) {
+        char *frames = realloc(c->frames, (size_t)size);
+        if (frames == NULL) {
+            ERROR_LOG(stderr, "realloc() failed for frame buffer\n");
+            queue_close(e, c);
+            return;
+        }
+        c->frames = frames;
+        c->frames_cap = (size_t)size;
+    }
+    c->state = UCONN_READING;
+    queue_read(e, c);
+}
+
+// Switch to binary frames: move what follows the preamble to the heap buffer
+static void conn_start_binary(struct uring_engine *e, struct uconn *c) {
+    c->frames = malloc(KEEPALIVE_BUF_LEN);
+    if (c->frames == NULL) {
+        ERROR_LOG(stderr, "malloc() failed for frame buffer\n");
+        queue_close(e, c);
+        return;
+    }
+    c->frames_cap = KEEPALIVE_BUF_LEN;
+    c->keepalive = 1;
+    c->binary = 1;
+    c->in_len -= PROTO_MAGIC_LEN;
+    memcpy(c->frames, c->rbuf + PROTO_MAGIC_LEN, c->in_len);
+    conn_continue_binary(e, c);
+}
+
+// Keep-alive: the batch is written, drop the answered requests
+static void conn_next_batch(struct uring_engine *e, struct uconn *c) {
+    response_reset(&c->out);
+    c->in_len -= c->consumed;
+    // A pipelined request that already arrived is running against the clock
+    timer_cancel(&c->request);
+    if (c->in_len > 0) {
+        deadline_arm(&e->wheel, &c->request, DEADLINE_REQUEST);
+    }
+    if (c->binary) {
+        memmove(c->frames, c->frames + c->consumed, c->in_len);
+        c->consumed = 0;
+        conn_continue_binary(e, c);
+        return;
+    }
+    memmove(c->rbuf, c->rbuf + c->consumed, c->in_len);
+    c->rbuf[c->in_len] = '\0';
+    c->consumed = 0;
+    conn_continue(e, c);
+}
+
+static void on_accept(struct uring_engine *e, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        if (cqe->res == -EINVAL && e->multishot) {
+            // Kernel without multishot accept: re-arm one accept at a time
+            INFO_LOG(stderr, "io_uring: multishot accept unsupported, using single-shot\n");
+            e->multishot = 0;
+        }
+        queue_accept(e, UDATA_SLOT(cqe->user_data));
+    }
+    if (cqe->res < 0) {
+        if (cqe->res != -EINVAL) {
+            ERROR_LOG(stderr, "accept() failed: %s\n", strerror(-cqe->res));
+        }
+        return;
+    }
+    int fd = cqe->res;
+    // Multishot accept shares one address buffer, so ask for the peer instead
+    struct sockaddr_storage cli;
+    socklen_t clilen = sizeof(cli);
+    memset(&cli, 0, sizeof(cli));
+    if (getpeername(fd, (struct sockaddr *)&cli, &clilen) < 0) {
+        DEBUG_LOG(stderr, "io_uring: getpeername() failed on fd %d\n", fd);
+    }
+    int ticket;
+    int verdict = admission_acquire((struct sockaddr *)&cli, &ticket);
+    if (verdict != ADMISSION_OK) {
+        WARN_LOG(stderr, "io_uring: connection rejected by admission control\n");
+        admission_reject(fd, verdict);
+        return;
+    }
+    if (e->free_head < 0) {
+        ERROR_LOG(stderr, "io_uring: connection table full, rejecting client\n");
+        admission_release(ticket);
+        close(fd);
+        return;
+    }
+    struct uconn *c = &e->conns[e->free_head];
+    e->free_head = c->next_free;
+    c->fd = fd;
+    c->ticket = ticket;
+    c->state = UCONN_READING;
+    c->in_len = 0;
+    c->keepalive = 0;
+    c->binary = 0;
+    c->discarding = 0;
+    c->consumed = 0;
+    response_reset(&c->out);
+    c->write_failed = 0;
+    c->timed_out = 0;
+    timer_init(&c->idle, DEADLINE_READ_IDLE);
+    timer_init(&c->request, DEADLINE_REQUEST);
+    DEBUG_LOG(stderr, "io_uring: accepted fd %d into slot %d\n", fd, conn_slot(e, c));
+    queue_read(e, c);
+}
+
+static void on_read(struct uring_engine *e, struct uconn *c, int res) {
+    if (c->timed_out) {
+        queue_close(e, c);
+        return;
+    }
+    if (res < 0) {
+        WARN_LOG(stderr, "Failed to read command or connection closed\n");
+        queue_close(e, c);
+        return;
+    }
+    if (res > 0 && !timer_armed(&c->request)) {
+        deadline_arm(&e->wheel, &c->request, DEADLINE_REQUEST);
+    }
+    if (c->binary) {
+        if (res == 0) {
+            if (c->in_len > 0) {
+                WARN_LOG(stderr, "Connection closed in the middle of a frame\n");
+            }
+            queue_close(e, c);
+            return;
+        }
+        c->in_len += (size_t)res;
+        conn_continue_binary(e, c);
+        return;
+    }
+    if (c->discarding) {
+        if (res == 0) {
+            queue_close(e, c);
+        } else {
+            conn_discard(e, c, res);
+        }
+        return;
+    }
+    if (res == 0) {
+        if (c->in_len == 0) {
+            queue_close(e, c);
+            return;
+        }
+        // Peer half-closed after an unterminated command: run it
+        if (c->keepalive) {
+            c->rbuf[c->in_len++] = '\n';
+        }
+        c->rbuf[c->in_len] = '\0';
+        conn_dispatch(e, c);
+        return;
+    }
+    c->in_len += (size_t)res;
+    c->rbuf[c->in_len] = '\0';
+    if (!c->keepalive && proto_preamble(c->rbuf, c->in_len) > 0) {
+        conn_start_binary(e, c);
+        return;
+    }
+    if (!c->keepalive && command_is_keepalive(c->rbuf, c->in_len)) {
+        c->keepalive = 1;
+    }
+    if (c->keepalive) {
+        conn_continue(e, c);
+        return;
+    }
+    const char *newline = line_find_newline(c->rbuf, c->in_len);
+    if (newline == NULL) {
+        if (c->in_len == COMMAND_MAX_LEN - 1) {
+            WARN_LOG(stderr, "Large data stream detected without newline, closing connection\n");
+            queue_close(e, c);
+        } else {
+            queue_read(e, c);
+        }
+        return;
+    }
+    // The command ends at the first '\r' or '\n'
+    c->rbuf[line_find_eol(c->rbuf, (size_t)(newline - c->rbuf) + 1) - c->rbuf] = '\0';
+    conn_dispatch(e, c);
+}
+
+static void on_pool_ready(struct uring_engine *e, struct io_uring_cqe *cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        queue_pool_poll(e);
+    }
+    struct work_item *item = workpool_reap(e->pool);
+    while (item != NULL) {
+        struct work_item *next = item->next;
+        struct uconn *c = UCONN_OF(item);
+        if (c->timed_out) {
+            queue_close(e, c);
+        } else if (c->keepalive && response_len(&c->out) == 0) {
+            conn_next_batch(e, c);
+        } else if (response_len(&c->out) == 0) {
+            queue_close(e, c);
+        } else {
+            if (response_len(&c->out) <= URING_WBUF_SIZE) {
+                // Small: gather into the registered buffer for WRITE_FIXED
+                response_copy(&c->out, 0, c->wbuf, URING_WBUF_SIZE);
+            }
+            queue_write(e, c);
+        }
+        item = next;
+    }
+}
+
+static void on_write(struct uring_engine *e, struct uconn *c, int res) {
+    if (res < 0) {
+        WARN_LOG(stderr, "write failed: %s\n", strerror(-res));
+        c->write_failed = 1;
+        if (c->keepalive) {
+            queue_close(e, c);
+        }
+        return;
+    }
+    response_consume(&c->out, (size_t)res);
+    if (!c->keepalive) {
+        return;     // the linked close (or its cancellation) follows
+    }
+    if (c->timed_out) {
+        queue_close(e, c);
+    } else if (response_pending(&c->out) > 0) {
+        queue_write(e, c);
+    } else {
+        conn_next_batch(e, c);
+    }
+}
+
+static void on_close(struct uring_engine *e, struct uconn *c, int res) {
+    if (res == -ECANCELED && c->state == UCONN_WRITING) {
+        // A short or failed write severed the link before the close ran
+        if (!c->write_failed && response_pending(&c->out) > 0) {
+            queue_write(e, c);
+        } else {
+            queue_close(e, c);
+        }
+        return;
+    }
+    conn_release(e, c);
+}
+
+// Fail every connection whose deadline passed since the last sweep. Pending
+// reads and writes are ended with shutdown(); their completions see
+// timed_out and close the socket.
+static void expire_deadlines(struct uring_engine *e) {
+    timer_wheel_expire(&e->wheel, deadline_now_ms(), &e->expired);
+    struct timer *t;
+    while ((t = timer_list_pop(&e->expired)) != NULL) {
+        struct uconn *c = UCONN_OF_TIMER(t);
+        if (c->timed_out) {
+            continue;
+        }
+        deadline_count((enum deadline_kind)t->kind);
+        WARN_LOG(stderr, "fd %d exceeded its %s deadline, closing\n", c->fd, deadline_name((enum deadline_kind)t->kind));
+        c->timed_out = 1;
+        timer_cancel(&c->idle);
+        timer_cancel(&c->request);
+        if (c->state == UCONN_READING || c->state == UCONN_WRITING) {
+            shutdown(c->fd, SHUT_RDWR);
+        }
+        // UCONN_RUNNING: the worker owns the slot, closed when it returns
+    }
+}
+
+static void handle_cqe(struct uring_engine *e, struct io_uring_cqe *cqe) {
+    uint64_t ud = cqe->user_data;
+    int slot = UDATA_SLOT(ud);
+    switch (UDATA_OP(ud)) {
+    case OP_ACCEPT:
+        on_accept(e, cqe);
+        break;
+    case OP_READ:
+        on_read(e, &e->conns[slot], cqe->res);
+        break;
+    case OP_WRITE:
+        on_write(e, &e->conns[slot], cqe->res);
+        break;
+    case OP_CLOSE:
+        on_close(e, &e->conns[slot], cqe->res);
+        break;
+    case OP_POOL_POLL:
+        on_pool_ready(e, cqe);
+        break;
+    case OP_TICK:
+        expire_deadlines(e);
+        queue_tick(e);
+        break;
+    }
+}
+
+static int engine_setup(struct uring_engine *e, const struct listener_set *ls, int nthreads) {
+    memset(e, 0, sizeof(*e));
+    e->listeners = *ls;
+    e->multishot = 1;
+    timer_wheel_init(&e->wheel, deadline_now_ms());
+    timer_list_init(&e->expired);
+    if (uring_init(&e->ring, URING_ENTRIES) < 0) {
+        INFO_LOG(stderr, "io_uring_setup() failed: %s\n", strerror(errno));
+        return URING_UNSUPPORTED;
+    }
+    if (uring_probe(&e->ring) < 0) {
+        INFO_LOG(stderr, "io_uring: required operations not supported by this kernel\n");
+        uring_exit(&e->ring);
+        return URING_UNSUPPORTED;
+    }
+
+    e->buffers = mmap(NULL, (size_t)URING_MAX_CONNS * URING_SLOT_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct iovec *iov = calloc(URING_MAX_CONNS, sizeof(*iov));
+    if (e->buffers == MAP_FAILED || iov == NULL) {
+        ERROR_LOG(stderr, "io_uring: failed to allocate connection buffers\n");
+        free(iov);
+        if (e->buffers != MAP_FAILED) {
+            munmap(e->buffers, (size_t)URING_MAX_CONNS * URING_SLOT_SIZE);
+        }
+        uring_exit(&e->ring);
+        return -1;
+    }
+    e->free_head = -1;
+    for (int i = URING_MAX_CONNS - 1; i >= 0; i--) {
+        struct uconn *c = &e->conns[i];
+        c->fd = -1;
+        c->ticket = -1;
+        c->state = UCONN_FREE;
+        c->rbuf = e->buffers + (size_t)i * URING_SLOT_SIZE;
+        c->wbuf = c->rbuf + URING_RBUF_SIZE;
+        c->next_free = e->free_head;
+        e->free_head = i;
+        iov[i].iov_base = c->rbuf;
+        iov[i].iov_len = URING_SLOT_SIZE;
+    }
+    int rc = sys_io_uring_register(e->ring.fd, IORING_REGISTER_BUFFERS, iov, URING_MAX_CONNS);
+    free(iov);
+    if (rc < 0) {
+        // Typically RLIMIT_MEMLOCK: treat like a kernel without support
+        INFO_LOG(stderr, "io_uring: buffer registration failed: %s\n", strerror(errno));
+        munmap(e->buffers, (size_t)URING_MAX_CONNS * URING_SLOT_SIZE);
+        uring_exit(&e->ring);
+        return URING_UNSUPPORTED;
+    }
+
+    e->pool = workpool_create(nthreads);
+    if (e->pool == NULL) {
+        munmap(e->buffers, (size_t)URING_MAX_CONNS * URING_SLOT_SIZE);
+        uring_exit(&e->ring);
+        return -1;
+    }
+    return 0;
+}
+
+int uring_engine_run(const struct listener_set *ls, int nthreads, volatile sig_atomic_t *should_exit) {
+    static struct uring_engine engine;   // large (connection table): keep off the stack
+    struct uring_engine *e = &engine;
+    int rc = engine_setup(e, ls, nthreads);
+    if (rc < 0) {
+        return rc;
+    }
+    INFO_LOG(stderr, "io_uring engine running with %d worker threads\n", nthreads);
+
+    for (int i = 0; i < ls->count; i++) {
+        // io_uring honours O_NONBLOCK: the accept would fail with EAGAIN
+        // instead of waiting for a connection
+        int flags = fcntl(ls->fds[i], F_GETFL, 0);
+        if (flags >= 0 && (flags & O_NONBLOCK)) {
+            fcntl(ls->fds[i], F_SETFL, flags & ~O_NONBLOCK);
+        }
+        queue_accept(e, i);
+    }
+    queue_pool_poll(e);
+    queue_tick(e);
+
+    while (!*should_exit) {
+        if (uring_submit(&e->ring, 1) < 0) {
+            if (errno == EINTR) {
+                continue;   // SIGQUIT: loop condition checks the flag
+            }
+            ERROR_LOG(stderr, "io_uring_enter() failed\n");
+            perror("io_uring_enter");
+            break;
+        }
+        unsigned head = *e->ring.cq_head;
+        unsigned tail = __atomic_load_n(e->ring.cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe cqe = e->ring.cqes[head & e->ring.cq_mask];
+            head++;
+            // Release the slot before handling so new SQEs never wait on us
+            __atomic_store_n(e->ring.cq_head, head, __ATOMIC_RELEASE);
+            handle_cqe(e, &cqe);
+            tail = __atomic_load_n(e->ring.cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    INFO_LOG(stderr, "io_uring engine shutting down\n");
+    // Let in-flight commands finish, then drop every connection; closing
+    // the ring cancels whatever is still queued in the kernel
+    workpool_stop(e->pool);
+    workpool_reap(e->pool);
+    for (int i = 0; i < URING_MAX_CONNS; i++) {
+        if (e->conns[i].state != UCONN_FREE) {
+            if (e->conns[i].state != UCONN_CLOSING) {
+                close(e->conns[i].fd);
+            }
+            free(e->conns[i].frames);
+            admission_release(e->conns[i].ticket);
+        }
+        // Free slots keep their builder's buffers for the next connection
+        response_free(&e->conns[i].out);
+    }
+    workpool_destroy(e->pool);
+    uring_exit(&e->ring);
+    munmap(e->buffers, (size_t)URING_MAX_CONNS * URING_SLOT_SIZE);
+    return 0;
+}
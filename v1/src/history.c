@@ -0,0 +1,333 @@
+#define _GNU_SOURCE
+#include "history.h"
+#include "procfs.h"
+#include "sysinfo.h"
+#include "debug.h"
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HISTORY_MAGIC "SIHIST1"
+
+// The whole ring is one fixed-size mapping: anonymous, or a file that is
+// reused when its header matches this layout
+struct history_ring {
+    char magic[8];
+    uint32_t capacity;
+    uint32_t metrics;
+    uint32_t interval_ms;       // of the server that wrote the latest samples
+    uint32_t reserved;
+    uint64_t head;              // samples written so far; the newest is head - 1
+    int64_t time_ms[HISTORY_CAPACITY];
+    double values[HISTORY_METRICS][HISTORY_CAPACITY];
+};
+
+static struct history_ring *ring;
+static int interval;
+static pid_t sampler_pid = -1;
+
+// Set in the sampler process by SIGQUIT (history_stop(), Ctrl+\ or parent death)
+static volatile sig_atomic_t sampler_exit = 0;
+
+static const char *const metric_names[HISTORY_METRICS] = {
+    [HISTORY_LOAD1]         = "load1",
+    [HISTORY_LOAD5]         = "load5",
+    [HISTORY_LOAD15]        = "load15",
+    [HISTORY_CPU_BUSY]      = "cpu_busy",
+    [HISTORY_MEM_USED]      = "mem_used",
+    [HISTORY_MEM_AVAILABLE] = "mem_available",
+    [HISTORY_DISK_USED]     = "disk_used",
+    [HISTORY_DISK_FREE]     = "disk_free",
+    [HISTORY_RX_BYTES]      = "rx_bytes",
+    [HISTORY_TX_BYTES]      = "tx_bytes",
+    [HISTORY_RX_PACKETS]    = "rx_packets",
+    [HISTORY_TX_PACKETS]    = "tx_packets",
+};
+
+static int64_t wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void sampler_sigquit(int sig) {
+    (void)sig;
+    sampler_exit = 1;
+}
+
+// One value per metric; NAN where a source could not be read
+static void take_sample(struct sysinfo_snapshot *snap, struct procfs_cpu *prev_cpu, double *v) {
+    for (int i = 0; i < HISTORY_METRICS; i++) {
+        v[i] = NAN;
+    }
+    struct procfs_loadavg la;
+    if (procfs_loadavg(&la) == 0) {
+        v[HISTORY_LOAD1] = la.loads[0] / 65536.0;
+        v[HISTORY_LOAD5] = la.loads[1] / 65536.0;
+        v[HISTORY_LOAD15] = la.loads[2] / 65536.0;
+    }
+    struct procfs_cpu cpu;
+    if (procfs_cpu(&cpu) == 0) {
+        uint64_t idle = cpu.idle + cpu.iowait;
+        uint64_t busy = cpu.user + cpu.nice + cpu.system + cpu.irq + cpu.softirq + cpu.steal;
+        uint64_t prev_idle = prev_cpu->idle + prev_cpu->iowait;
+        uint64_t prev_busy = prev_cpu->user + prev_cpu->nice + prev_cpu->system +
+                             prev_cpu->irq + prev_cpu->softirq + prev_cpu->steal;
+        if (busy + idle > prev_busy + prev_idle && busy >= prev_busy) {
+            v[HISTORY_CPU_BUSY] = 100.0 * (double)(busy - prev_busy) / (double)(busy + idle - prev_busy - prev_idle);
+        }
+        *prev_cpu = cpu;
+    }
+    struct procfs_meminfo mi;
+    if (procfs_meminfo(&mi) == 0) {
+        v[HISTORY_MEM_USED] = (double)(mi.total - mi.free);
+        v[HISTORY_MEM_AVAILABLE] = (double)mi.available;
+    }
+    // Same figures as get_disk_info()
+    struct statvfs st;
+    if (statvfs("/", &st) == 0) {
+        uint64_t total = (uint64_t)st.f_blocks * st.f_frsize;
+        uint64_t free = (uint64_t)st.f_bfree * st.f_frsize;
+        v[HISTORY_DISK_USED] = (double)(total - free);
+        v[HISTORY_DISK_FREE] = (double)free;
+    }
+    if (get_network_info(snap) == 0) {
+        uint64_t sum[4] = {0, 0, 0, 0};
+        for (uint32_t i = 0; i < snap->iface_count; i++) {
+            const struct sysinfo_iface *iface = &snap->ifaces[i];
+            if ((iface->flags & SYSINFO_IF_STATS) && !(iface->flags & SYSINFO_IF_LOOPBACK)) {
+                sum[0] += iface->rx_bytes;
+                sum[1] += iface->tx_bytes;
+                sum[2] += iface->rx_packets;
+                sum[3] += iface->tx_packets;
+            }
+        }
+        v[HISTORY_RX_BYTES] = (double)sum[0];
+        v[HISTORY_TX_BYTES] = (double)sum[1];
+        v[HISTORY_RX_PACKETS] = (double)sum[2];
+        v[HISTORY_TX_PACKETS] = (double)sum[3];
+    }
+}
+
+static void record(const double *v) {
+    uint64_t head = ring->head;     // the sampler is the only writer
+    size_t slot = head % HISTORY_CAPACITY;
+    // Readers must see the previous head before any store to this slot
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ring->time_ms[slot] = wall_ms();
+    for (int i = 0; i < HISTORY_METRICS; i++) {
+        ring->values[i][slot] = v[i];
+    }
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void sampler_main(pid_t parent) {
+    // Exit with the server, even if it is killed without a chance to call history_stop()
+    if (prctl(PR_SET_PDEATHSIG, SIGQUIT) < 0 || getppid() != parent) {
+        exit(0);
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sampler_sigquit;
+    if (sigaction(SIGQUIT, &sa, NULL) < 0) {
+        WARN_LOG(stderr, "sigaction(SIGQUIT) failed in history sampler\n");
+        perror("sigaction");
+    }
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGPIPE, &sa, NULL);
+
+    // Only the interface array is used, but the collectors fill a snapshot
+    struct sysinfo_snapshot *snap = malloc(sizeof(*snap));
+    if (snap == NULL) {
+        ERROR_LOG(stderr, "malloc() failed for history sampler\n");
+        exit(1);
+    }
+    struct procfs_cpu prev_cpu;
+    memset(&prev_cpu, 0, sizeof(prev_cpu));
+    procfs_cpu(&prev_cpu);
+    INFO_LOG(stderr, "history: sampler running every %d ms (PID %d)\n", interval, getpid());
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!sampler_exit) {
+        // Sleep first: the CPU figure needs one interval since the baseline
+        next.tv_sec += interval / 1000;
+        next.tv_nsec += (long)(interval % 1000) * 1000000;
+        if (next.tv_nsec >= 1000000000) {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000;
+        }
+        while (!sampler_exit && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR) {
+        }
+        if (sampler_exit) {
+            break;
+        }
+        double v[HISTORY_METRICS];
+        take_sample(snap, &prev_cpu, v);
+        record(v);
+        // After a stall (suspend, SIGSTOP) continue from now instead of catching up
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > next.tv_sec + 1) {
+            next = now;
+        }
+    }
+    INFO_LOG(stderr, "history: sampler exiting\n");
+    free(snap);
+    exit(0);
+}
+
+static void ring_reset(struct history_ring *r) {
+    memset(r, 0, sizeof(*r));
+    memcpy(r->magic, HISTORY_MAGIC, sizeof(r->magic));
+    r->capacity = HISTORY_CAPACITY;
+    r->metrics = HISTORY_METRICS;
+}
+
+static struct history_ring *ring_map(const char *path) {
+    if (path == NULL) {
+        struct history_ring *r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (r == MAP_FAILED) {
+            ERROR_LOG(stderr, "mmap() failed for history ring\n");
+            perror("mmap");
+            return NULL;
+        }
+        ring_reset(r);
+        return r;
+    }
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ERROR_LOG(stderr, "Cannot open history file %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    int keep = fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(struct history_ring);
+    if (!keep && ftruncate(fd, (off_t)sizeof(struct history_ring)) < 0) {
+        ERROR_LOG(stderr, "Cannot size history file %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    struct history_ring *r = mmap(NULL, sizeof(*r), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED) {
+        ERROR_LOG(stderr, "mmap() failed for history file %s\n", path);
+        perror("mmap");
+        return NULL;
+    }
+    if (keep && memcmp(r->magic, HISTORY_MAGIC, sizeof(r->magic)) == 0 &&
+        r->capacity == HISTORY_CAPACITY && r->metrics == HISTORY_METRICS) {
+        INFO_LOG(stderr, "history: kept %llu samples from %s\n", (unsigned long long)r->head, path);
+    } else {
+        if (st.st_size > 0) {
+            WARN_LOG(stderr, "history: %s has another layout, starting over\n", path);
+        }
+        ring_reset(r);
+    }
+    return r;
+}
+
+int history_start(int interval_ms, const char *path) {
+    struct history_ring *r = ring_map(path);
+    if (r == NULL) {
+        return -1;
+    }
+    r->interval_ms = (uint32_t)interval_ms;
+    ring = r;
+    interval = interval_ms;
+
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        ERROR_LOG(stderr, "fork() failed for history sampler\n");
+        perror("fork");
+        ring = NULL;
+        munmap(r, sizeof(*r));
+        return -1;
+    }
+    if (pid == 0) {
+        sampler_main(parent);
+    }
+    sampler_pid = pid;
+    INFO_LOG(stderr, "History sampler started (PID %d)\n", pid);
+    return 0;
+}
+
+void history_stop(void) {
+    if (sampler_pid > 0) {
+        kill(sampler_pid, SIGQUIT);
+        sampler_pid = -1;
+    }
+}
+
+int history_enabled(void) {
+    return ring != NULL;
+}
+
+int history_interval_ms(void) {
+    return interval;
+}
+
+const char *history_metric_name(enum history_metric metric) {
+    return metric >= 0 && metric < HISTORY_METRICS ? metric_names[metric] : "unknown";
+}
+
+int history_metric_by_name(const char *name) {
+    for (int i = 0; i < HISTORY_METRICS; i++) {
+        if (strcmp(name, metric_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int history_read(enum history_metric metric, int64_t window_ms, int64_t *times_ms, double *values, int max) {
+    if (ring == NULL) {
+        return -1;
+    }
+    int64_t cutoff = wall_ms() - window_ms;
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t oldest = head > HISTORY_CAPACITY ? head - HISTORY_CAPACITY : 0;
+    // Newest first, reversed below
+    int n = 0;
+    for (uint64_t i = head; i > oldest && n < max; i--) {
+        size_t slot = (i - 1) % HISTORY_CAPACITY;
+        int64_t t = ring->time_ms[slot];
+        if (t < cutoff) {
+            break;
+        }
+        times_ms[n] = t;
+        values[n] = ring->values[metric][slot];
+        n++;
+    }
+    // Samples the sampler may have overwritten meanwhile are the oldest
+    // ones copied: sample i is intact only while i + capacity > head
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now_head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint64_t first = head - (uint64_t)n;
+    if (now_head >= HISTORY_CAPACITY && first + HISTORY_CAPACITY <= now_head) {
+        uint64_t stale = now_head - HISTORY_CAPACITY + 1 - first;
+        n = stale >= (uint64_t)n ? 0 : n - (int)stale;
+    }
+    for (int a = 0, b = n - 1; a < b; a++, b--) {
+        int64_t t = times_ms[a];
+        times_ms[a] = times_ms[b];
+        times_ms[b] = t;
+        double v = values[a];
+        values[a] = values[b];
+        values[b] = v;
+    }
+    return n;
+}
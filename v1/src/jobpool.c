@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include "jobpool.h"
+#include "debug.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+
+struct thread_start {
+    struct jobpool *pool;
+    void *ctx;
+};
+
+// Every pool set up in this process, for the fork handler
+static struct jobpool *pools;
+static pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void init_locks(struct jobpool *pool) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->finished_cond, &ca);
+    pthread_condattr_destroy(&ca);
+}
+
+static void jobpool_atfork_child(void) {
+    // Only the forking thread is left: a lock held by any other thread at
+    // fork() would never be released, so all of them start over
+    pthread_mutex_init(&pools_lock, NULL);
+    for (struct jobpool *pool = pools; pool != NULL; pool = pool->next_pool) {
+        init_locks(pool);
+        pool->head = pool->tail = NULL;
+        pool->finished = 0;
+        pool->running = 0;
+        pool->started = 0;
+    }
+}
+
+static void register_atfork(void) {
+    pthread_atfork(NULL, NULL, jobpool_atfork_child);
+}
+
+void jobpool_init(struct jobpool *pool, const char *name, int threads, void *(*thread_ctx)(void)) {
+    pthread_once(&atfork_once, register_atfork);
+    init_locks(pool);
+    pool->head = pool->tail = NULL;
+    pool->finished = 0;
+    pool->name = name;
+    pool->thread_ctx = thread_ctx;
+    pool->threads = threads;
+    pool->running = 0;
+    pool->started = 0;
+    pthread_mutex_lock(&pools_lock);
+    pool->next_pool = pools;
+    pools = pool;
+    pthread_mutex_unlock(&pools_lock);
+}
+
+static void *jobpool_thread(void *arg) {
+    struct thread_start start = *(struct thread_start *)arg;
+    struct jobpool *pool = start.pool;
+    free(arg);
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->head == NULL) {
+            pthread_cond_wait(&pool->queued, &pool->lock);
+        }
+        struct jobpool_job *job = pool->head;
+        pool->head = job->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        job->next = NULL;
+        job->run(job, start.ctx);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->finished++;
+        pthread_cond_broadcast(&pool->finished_cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+int jobpool_spawn(void *(*fn)(void *), void *arg) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t thread;
+    int rc = pthread_create(&thread, &attr, fn, arg);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    return rc == 0 ? 0 : -1;
+}
+
+// Start the threads; called with pool->lock held
+static void pool_start(struct jobpool *pool) {
+    pool->started = 1;
+    for (int i = 0; i < pool->threads; i++) {
+        struct thread_start *start = malloc(sizeof(*start));
+        if (start == NULL) {
+            ERROR_LOG(stderr, "malloc() failed for %s thread\n", pool->name);
+            break;
+        }
+        start->pool = pool;
+        start->ctx = NULL;
+        if (pool->thread_ctx != NULL && (start->ctx = pool->thread_ctx()) == NULL) {
+            free(start);
+            break;
+        }
+        if (jobpool_spawn(jobpool_thread, start) < 0) {
+            ERROR_LOG(stderr, "pthread_create() failed for %s thread\n", pool->name);
+            free(start->ctx);
+            free(start);
+            break;
+        }
+        pool->running++;
+    }
+    DEBUG_LOG(stderr, "%s pool: started %d threads\n", pool->name, pool->running);
+}
+
+int jobpool_submit(struct jobpool *pool, struct jobpool_job *jobs) {
+    if (jobs == NULL) {
+        return 0;
+    }
+    struct jobpool_job *last = jobs;
+    while (last->next != NULL) {
+        last = last->next;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (!pool->started) {
+        pool_start(pool);
+    }
+    if (pool->running == 0) {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+    if (pool->tail != NULL) {
+        pool->tail->next = jobs;
+    } else {
+        pool->head = jobs;
+    }
+    pool->tail = last;
+    if (jobs == last) {
+        pthread_cond_signal(&pool->queued);
+    } else {
+        pthread_cond_broadcast(&pool->queued);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+uint64_t jobpool_finished(struct jobpool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    uint64_t finished = pool->finished;
+    pthread_mutex_unlock(&pool->lock);
+    return finished;
+}
+
+int jobpool_wait(struct jobpool *pool, uint64_t seen, const struct timespec *until) {
+    int rc = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (pool->finished == seen) {
+        if (until == NULL) {
+            pthread_cond_wait(&pool->finished_cond, &pool->lock);
+        } else if (pthread_cond_timedwait(&pool->finished_cond, &pool->lock, until) == ETIMEDOUT) {
+            rc = pool->finished == seen ? -1 : 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return rc;
+}
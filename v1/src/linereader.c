@@ -0,0 +1,195 @@
+#include "linereader.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LINE_SCAN_X86 1
+#endif
+
+#define NO_CUT ((size_t)-1)
+
+// First byte equal to a or b in [p, end)
+typedef const char *(*scan_fn)(const char *p, const char *end, char a, char b);
+
+static const char *scan_scalar(const char *p, const char *end, char a, char b) {
+    for (; p < end; p++) {
+        if (*p == a || *p == b) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+#ifdef LINE_SCAN_X86
+__attribute__((target("sse2")))
+static const char *scan_sse2(const char *p, const char *end, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned)mask);
+        }
+    }
+    return scan_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *p, const char *end, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    for (; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    return scan_sse2(p, end, a, b);
+}
+#endif
+
+static scan_fn scan = scan_scalar;
+
+// Pick the widest scanner the CPU supports when the library is loaded
+__attribute__((constructor))
+static void scan_select(void) {
+#ifdef LINE_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scan = scan_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        scan = scan_sse2;
+    }
+#endif
+}
+
+const char *line_find_newline(const char *p, size_t len) {
+    return scan(p, p + len, '\n', '\n');
+}
+
+const char *line_find_eol(const char *p, size_t len) {
+    return scan(p, p + len, '\r', '\n');
+}
+
+int line_reader_init(struct line_reader *r, int fd, size_t cap, size_t max_line) {
+    memset(r, 0, sizeof(*r));
+    r->buf = malloc(cap + 1);
+    if (r->buf == NULL) {
+        return -1;
+    }
+    r->fd = fd;
+    r->cap = cap;
+    r->max_line = max_line < cap ? max_line : cap;
+    r->cut = NO_CUT;
+    return 0;
+}
+
+void line_reader_destroy(struct line_reader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+ssize_t line_reader_fill(struct line_reader *r) {
+    if (r->head == r->tail) {
+        r->head = r->tail = 0;
+    } else if (r->tail == r->cap && r->head > 0) {
+        memmove(r->buf, r->buf + r->head, r->tail - r->head);
+        r->tail -= r->head;
+        r->head = 0;
+    }
+    if (r->tail == r->cap) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = read(r->fd, r->buf + r->tail, r->cap - r->tail);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) {
+        r->tail += (size_t)n;
+    }
+    return n;
+}
+
+// Forget the line being assembled
+static void line_reset(struct line_reader *r) {
+    r->scanned = 0;
+    r->cut = NO_CUT;
+}
+
+int line_reader_next(struct line_reader *r, struct line_slice *line) {
+    for (;;) {
+        char *start = r->buf + r->head;
+        size_t avail = r->tail - r->head;
+        if (r->discarding) {
+            const char *nl = line_find_newline(start, avail);
+            if (nl == NULL) {
+                r->head = r->tail;
+                return LINE_NEED_MORE;
+            }
+            r->head += (size_t)(nl - start) + 1;
+            r->discarding = 0;
+            line_reset(r);
+            continue;
+        }
+
+        const char *hit = line_find_eol(start + r->scanned, avail - r->scanned);
+        if (hit != NULL && *hit == '\r') {
+            if (r->cut == NO_CUT) {
+                r->cut = (size_t)(hit - start);
+            }
+            r->scanned = (size_t)(hit - start) + 1;
+            continue;
+        }
+        if (hit == NULL) {
+            r->scanned = avail;
+            if (avail < r->max_line) {
+                return LINE_NEED_MORE;
+            }
+            // No terminator within max_line bytes: skip the line
+            r->head = r->tail;
+            r->discarding = 1;
+            line_reset(r);
+            return LINE_TOO_LONG;
+        }
+
+        size_t end = (size_t)(hit - start);
+        size_t len = r->cut != NO_CUT ? r->cut : end;
+        r->head += end + 1;
+        line_reset(r);
+        if (end + 1 > r->max_line) {
+            return LINE_TOO_LONG;
+        }
+        start[len] = '\0';
+        line->data = start;
+        line->len = len;
+        return LINE_OK;
+    }
+}
+
+int line_reader_rest(struct line_reader *r, struct line_slice *line) {
+    if (r->discarding || r->head == r->tail) {
+        return 0;
+    }
+    char *start = r->buf + r->head;
+    const char *cr = line_find_eol(start, r->tail - r->head);
+    size_t len = cr != NULL ? (size_t)(cr - start) : r->tail - r->head;
+    // buf has one spare byte past cap for this '\0'
+    start[len] = '\0';
+    r->head = r->tail;
+    line_reset(r);
+    line->data = start;
+    line->len = len;
+    return len > 0;
+}
+
+const char *line_reader_pending(const struct line_reader *r, size_t *len) {
+    *len = r->tail - r->head;
+    return r->buf + r->head;
+}
@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "debug.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+int listener_open(const char *addr, int port, int backlog, int reuseport) {
+    /*  create a socket for the server */
+    struct sockaddr_in server_address;
+
+    int server_sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_sockfd < 0) {
+        ERROR_LOG(stderr, "socket() failed\n");
+        perror("socket");
+        return -1;
+    }
+    DEBUG_LOG(stderr, "Socket created: fd %d\n", server_sockfd);
+
+    // Allow restarting while old connections sit in TIME_WAIT
+    int one = 1;
+    if (setsockopt(server_sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) {
+        WARN_LOG(stderr, "setsockopt(SO_REUSEADDR) failed\n");
+        perror("setsockopt");
+    }
+    if (reuseport && setsockopt(server_sockfd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        ERROR_LOG(stderr, "setsockopt(SO_REUSEPORT) failed\n");
+        perror("setsockopt");
+        close(server_sockfd);
+        return -1;
+    }
+
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_addr.s_addr = inet_addr(addr);
+    if(server_address.sin_addr.s_addr == INADDR_NONE){
+        ERROR_LOG(stderr, "inet_addr() failed: invalid address\n");
+        close(server_sockfd);
+        return -1;
+    }
+    server_address.sin_port = htons(port);
+
+    if (bind(server_sockfd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) {
+        ERROR_LOG(stderr, "bind() failed\n");
+        perror("bind");
+        close(server_sockfd);
+        return -1;
+    }
+    INFO_LOG(stderr, "Socket bound to %s:%d\n", addr, port);
+
+    if (listen(server_sockfd, backlog) < 0) {
+        ERROR_LOG(stderr, "listen() failed\n");
+        perror("listen");
+        close(server_sockfd);
+        return -1;
+    }
+    DEBUG_LOG(stderr, "Listening with backlog %d\n", backlog);
+    return server_sockfd;
+}
+
+int listener_open_unix(const char *path, int backlog) {
+    struct sockaddr_un server_address;
+    if (strlen(path) >= sizeof(server_address.sun_path)) {
+        ERROR_LOG(stderr, "Unix socket path too long: %s\n", path);
+        return -1;
+    }
+    int server_sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_sockfd < 0) {
+        ERROR_LOG(stderr, "socket(AF_UNIX) failed\n");
+        perror("socket");
+        return -1;
+    }
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sun_family = AF_UNIX;
+    strcpy(server_address.sun_path, path);
+
+    // A socket file left behind by a previous run would make bind() fail
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+    if (bind(server_sockfd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0) {
+        ERROR_LOG(stderr, "bind(%s) failed\n", path);
+        perror("bind");
+        close(server_sockfd);
+        return -1;
+    }
+    if (listen(server_sockfd, backlog) < 0) {
+        ERROR_LOG(stderr, "listen() failed on %s\n", path);
+        perror("listen");
+        close(server_sockfd);
+        unlink(path);
+        return -1;
+    }
+    INFO_LOG(stderr, "Listening on unix:%s\n", path);
+    return server_sockfd;
+}
+
+const char *listener_peer_name(const struct sockaddr_storage *peer, char *buf, size_t len) {
+    if (peer->ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)peer;
+        char ip[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip)) == NULL) {
+            strcpy(ip, "?");
+        }
+        snprintf(buf, len, "%s:%d", ip, ntohs(in->sin_port));
+    } else if (peer->ss_family == AF_UNIX) {
+        snprintf(buf, len, "unix socket");
+    } else {
+        snprintf(buf, len, "unknown peer");
+    }
+    return buf;
+}
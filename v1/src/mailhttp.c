@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include "mailhttp.h"
+#include "debug.h"
+#include "jobpool.h"
+#include <curl/curl.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#define IDLE_HANDLES 16     // easy handles kept for reuse
+#define POLL_MS      1000   // upper bound of one wait; submits wake it earlier
+
+struct mailhttp_req {
+    struct mailhttp_req *next;      // submit queue linkage
+    struct curl_slist *headers;
+    char *payload;
+    size_t len;
+    mailhttp_done_fn done;
+    void *arg;
+    char errbuf[CURL_ERROR_SIZE];
+};
+
+// Transport of the current process; a forked child sets up its own on its
+// first post (see transport_atfork_child())
+static struct {
+    pthread_mutex_t lock;
+    struct mailhttp_req *head;      // submitted, not yet handed to curl (FIFO)
+    struct mailhttp_req *tail;
+    CURLM *multi;                   // set before the thread starts
+    int started;                    // start attempted in this process
+    int running;
+    const char *url;
+    const char *ca_file;
+    // Transport thread only
+    CURL *idle[IDLE_HANDLES];
+    int idle_count;
+} xp = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static void transport_atfork_child(void) {
+    // The parent's multi handle, its connections and queued requests stay
+    // with the parent: never touched here, not even to clean them up
+    pthread_mutex_init(&xp.lock, NULL);
+    xp.head = xp.tail = NULL;
+    xp.multi = NULL;
+    xp.started = 0;
+    xp.running = 0;
+    xp.idle_count = 0;
+}
+
+static void register_atfork(void) {
+    pthread_atfork(NULL, NULL, transport_atfork_child);
+}
+
+static void free_req(struct mailhttp_req *req) {
+    curl_slist_free_all(req->headers);
+    free(req->payload);
+    free(req);
+}
+
+static void finish(struct mailhttp_req *req, int rc, int http_code) {
+    req->done(req->arg, rc, http_code);
+    free_req(req);
+}
+
+static void start_request(struct mailhttp_req *req) {
+    CURL *easy;
+    if (xp.idle_count > 0) {
+        easy = xp.idle[--xp.idle_count];
+        // Options only: the multi handle keeps connections and DNS entries
+        curl_easy_reset(easy);
+    } else if ((easy = curl_easy_init()) == NULL) {
+        ERROR_LOG(stderr, "curl_easy_init() failed\n");
+        finish(req, -1, 0);
+        return;
+    }
+    curl_easy_setopt(easy, CURLOPT_URL, xp.url);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, req->headers);
+    curl_easy_setopt(easy, CURLOPT_POST, 1L);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDS, req->payload);
+    curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, (long)req->len);
+    curl_easy_setopt(easy, CURLOPT_ERRORBUFFER, req->errbuf);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT, (long)MAILHTTP_TIMEOUT_S);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, (long)MAILHTTP_CONNECT_TIMEOUT_S);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    // Queue behind a connection that may multiplex rather than open another
+    curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(easy, CURLOPT_PRIVATE, req);
+    if (xp.ca_file != NULL) {
+        curl_easy_setopt(easy, CURLOPT_CAINFO, xp.ca_file);
+    }
+    if (curl_multi_add_handle(xp.multi, easy) != CURLM_OK) {
+        ERROR_LOG(stderr, "curl_multi_add_handle() failed\n");
+        curl_easy_cleanup(easy);
+        finish(req, -1, 0);
+    }
+}
+
+static void end_request(CURL *easy, CURLcode result) {
+    struct mailhttp_req *req = NULL;
+    long http_code = 0, connects = 0;
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&req);
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &http_code);
+    curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &connects);
+    curl_multi_remove_handle(xp.multi, easy);
+    if (xp.idle_count < IDLE_HANDLES) {
+        xp.idle[xp.idle_count++] = easy;
+    } else {
+        curl_easy_cleanup(easy);
+    }
+    if (result != CURLE_OK) {
+        ERROR_LOG(stderr, "Mail API request failed: %s\n",
+                  req->errbuf[0] != '\0' ? req->errbuf : curl_easy_strerror(result));
+        finish(req, -1, 0);
+        return;
+    }
+    DEBUG_LOG(stderr, "Mail API request: HTTP %ld, %s connection\n", http_code, connects > 0 ? "new" : "reused");
+    finish(req, 0, (int)http_code);
+}
+
+static void *transport_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&xp.lock);
+        struct mailhttp_req *list = xp.head;
+        xp.head = xp.tail = NULL;
+        pthread_mutex_unlock(&xp.lock);
+        while (list != NULL) {
+            struct mailhttp_req *next = list->next;
+            start_request(list);
+            list = next;
+        }
+        int active;
+        curl_multi_perform(xp.multi, &active);
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(xp.multi, &left)) != NULL) {
+            if (msg->msg == CURLMSG_DONE) {
+                end_request(msg->easy_handle, msg->data.result);
+            }
+        }
+        // Sleeps until a socket is ready, a curl timer fires or
+        // mailhttp_post() calls curl_multi_wakeup()
+        curl_multi_poll(xp.multi, NULL, 0, POLL_MS, NULL);
+    }
+    return NULL;
+}
+
+// Create the multi handle and start the thread; called with xp.lock held
+static void transport_start(void) {
+    xp.started = 1;
+    CURLM *multi = curl_multi_init();
+    if (multi == NULL) {
+        ERROR_LOG(stderr, "curl_multi_init() failed\n");
+        return;
+    }
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)MAILHTTP_MAX_CONNECTIONS);
+    const char *url = getenv("SENDGRID_API_URL");
+    xp.url = url != NULL && url[0] != '\0' ? url : MAILHTTP_DEFAULT_URL;
+    const char *ca_file = getenv("SENDGRID_CA_FILE");
+    xp.ca_file = ca_file != NULL && ca_file[0] != '\0' ? ca_file : NULL;
+    xp.multi = multi;
+
+    if (jobpool_spawn(transport_thread, NULL) < 0) {
+        ERROR_LOG(stderr, "pthread_create() failed for mail transport\n");
+    } else {
+        xp.running = 1;
+        INFO_LOG(stderr, "Mail transport started for %s\n", xp.url);
+    }
+}
+
+int mailhttp_post(const char *auth, char *payload, size_t len, mailhttp_done_fn done, void *arg) {
+    pthread_once(&atfork_once, register_atfork);
+    struct mailhttp_req *req = calloc(1, sizeof(*req));
+    if (req == NULL) {
+        ERROR_LOG(stderr, "calloc() failed for mail request\n");
+        free(payload);
+        return -1;
+    }
+    req->payload = payload;
+    req->len = len;
+    req->done = done;
+    req->arg = arg;
+    struct curl_slist *h = curl_slist_append(NULL, auth);
+    if (h == NULL || (req->headers = curl_slist_append(h, "Content-Type: application/json")) == NULL) {
+        ERROR_LOG(stderr, "curl_slist_append() failed for mail request headers\n");
+        curl_slist_free_all(h);
+        free_req(req);
+        return -1;
+    }
+
+    pthread_mutex_lock(&xp.lock);
+    if (!xp.started) {
+        transport_start();
+    }
+    if (!xp.running) {
+        pthread_mutex_unlock(&xp.lock);
+        free_req(req);
+        return -1;
+    }
+    if (xp.tail != NULL) {
+        xp.tail->next = req;
+    } else {
+        xp.head = req;
+    }
+    xp.tail = req;
+    pthread_mutex_unlock(&xp.lock);
+    curl_multi_wakeup(xp.multi);
+    return 0;
+}
+
+struct waiter {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int done;
+    int rc;
+    int http_code;
+};
+
+static void wake_waiter(void *arg, int rc, int http_code) {
+    struct waiter *w = arg;
+    pthread_mutex_lock(&w->lock);
+    w->rc = rc;
+    w->http_code = http_code;
+    w->done = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int mailhttp_post_wait(const char *auth, char *payload, size_t len, int *http_code) {
+    struct waiter w = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+    *http_code = 0;
+    if (mailhttp_post(auth, payload, len, wake_waiter, &w) < 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&w.lock);
+    while (!w.done) {
+        pthread_cond_wait(&w.cond, &w.lock);
+    }
+    pthread_mutex_unlock(&w.lock);
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.lock);
+    *http_code = w.http_code;
+    return w.rc;
+}
+
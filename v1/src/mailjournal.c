@@ -0,0 +1,521 @@
+#define _GNU_SOURCE
+#include "mailjournal.h"
+#include "debug.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAILJ_MAGIC     "MAILJ1"
+#define REC_MAGIC       0x31524a4du     // "MJR1"
+#define HEADER_SIZE     4096            // file header; the ring follows it
+#define REC_ALIGN       8
+#define MAX_RECORD      (MAILJ_SIZE / 4)
+#define FLUSH_POLL_MS   100             // recheck of a flusher that may have died
+
+// First page of the file
+struct jheader {
+    char magic[8];
+    uint64_t size;          // ring bytes
+    uint64_t head;          // logical offset of the oldest record replay must read
+    uint64_t next_id;       // job IDs below it were used
+};
+
+// Every record starts with this header; MESSAGE records are followed by
+// their three strings, '\0' included, and all records are padded to
+// REC_ALIGN. A record is valid only at the logical offset stored in it, so
+// leftovers of an earlier lap around the ring end the replay.
+struct jrec {
+    uint32_t magic;
+    uint16_t type;          // enum mailj_type
+    uint16_t state;         // DONE: final job state
+    uint32_t len;           // whole record, header included
+    int32_t http_code;      // DONE: last SendGrid status
+    uint64_t off;           // logical offset the record was written at
+    uint64_t check;         // FNV-1a of the record, taken with check = 0
+    uint64_t id;            // mail job
+    uint32_t to_len;        // MESSAGE: string lengths
+    uint32_t subject_len;
+    uint32_t body_len;
+    uint32_t reserved;
+};
+
+// Appenders' and flushers' state, in anonymous shared memory: it describes
+// this run, not the file. Waiters sleep on a semaphore rather than a
+// process-shared condition variable, which a waiter killed inside
+// pthread_cond_wait() (a fork child's request deadline) leaves unusable.
+struct jstate {
+    pthread_mutex_t lock;
+    sem_t flushed;              // posted once per waiter when a flush ends
+    uint32_t waiters;
+    uint64_t tail;              // logical offset of the next record
+    uint64_t synced;            // records below it are on disk
+    int flushing;               // an msync() is running ...
+    pid_t flusher;              // ... in this process
+    struct mailj_stats stats;
+};
+
+static struct jheader *hdr;     // the file mapping
+static char *ring;              // hdr + HEADER_SIZE
+static struct jstate *js;
+static int (*live_fn)(uint64_t id);
+
+static void js_lock(void) {
+    if (pthread_mutex_lock(&js->lock) == EOWNERDEAD) {
+        // tail only moves after a record is complete: a record torn by the
+        // dead owner is overwritten by the next append
+        pthread_mutex_consistent(&js->lock);
+    }
+}
+
+static void js_unlock(void) {
+    pthread_mutex_unlock(&js->lock);
+}
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t rec_check(const struct jrec *r) {
+    static const uint64_t zero = 0;
+    size_t after = offsetof(struct jrec, check) + sizeof(r->check);
+    uint64_t h = fnv1a(0xcbf29ce484222325ULL, r, offsetof(struct jrec, check));
+    h = fnv1a(h, &zero, sizeof(zero));
+    return fnv1a(h, (const char *)r + after, r->len - after);
+}
+
+static uint32_t rec_len(size_t payload) {
+    return (uint32_t)((sizeof(struct jrec) + payload + REC_ALIGN - 1) & ~(size_t)(REC_ALIGN - 1));
+}
+
+// Records never wrap: one that does not fit before the end of the ring
+// starts the next lap. Returns the logical offset it goes to.
+static uint64_t place(uint64_t off, uint32_t len) {
+    uint64_t room = MAILJ_SIZE - off % MAILJ_SIZE;
+    return room >= len ? off : off + room;
+}
+
+// Mark the end of a lap from off to next; a gap too small for a header is
+// skipped by readers without one
+static void pad(uint64_t off, uint64_t next) {
+    uint64_t room = next - off;
+    if (room < sizeof(struct jrec)) {
+        return;
+    }
+    struct jrec *p = (struct jrec *)(ring + off % MAILJ_SIZE);
+    memset(p, 0, sizeof(*p));
+    p->magic = REC_MAGIC;
+    p->type = MAILJ_PAD;
+    p->len = (uint32_t)room;
+    p->off = off;
+    p->check = rec_check(p);
+}
+
+// The record at logical offset off, or NULL if none was written there (end
+// of the log, a torn write, or a record of an earlier lap)
+static struct jrec *rec_at(uint64_t off) {
+    uint64_t phys = off % MAILJ_SIZE;
+    if (MAILJ_SIZE - phys < sizeof(struct jrec)) {
+        return NULL;
+    }
+    struct jrec *r = (struct jrec *)(ring + phys);
+    if (r->magic != REC_MAGIC || r->off != off || r->len < sizeof(*r) ||
+        r->len % REC_ALIGN != 0 || r->len > MAILJ_SIZE - phys) {
+        return NULL;
+    }
+    if (r->type == MAILJ_MESSAGE) {
+        const char *s = (const char *)(r + 1);
+        uint64_t strings = (uint64_t)r->to_len + r->subject_len + r->body_len;
+        if (r->to_len == 0 || r->subject_len == 0 || r->body_len == 0 || strings > r->len - sizeof(*r) ||
+            s[r->to_len - 1] != '\0' || s[r->to_len + r->subject_len - 1] != '\0' || s[strings - 1] != '\0') {
+            return NULL;
+        }
+    } else if (r->type != MAILJ_PAD && r->type != MAILJ_DONE) {
+        return NULL;
+    }
+    return rec_check(r) == r->check ? r : NULL;
+}
+
+// Offset of the record after the one at off; gaps too small for a header
+// are skipped
+static uint64_t rec_next(uint64_t off, const struct jrec *r) {
+    off += r->len;
+    uint64_t room = MAILJ_SIZE - off % MAILJ_SIZE;
+    return room < sizeof(struct jrec) ? off + room : off;
+}
+
+static uint64_t first_rec(uint64_t off) {
+    uint64_t room = MAILJ_SIZE - off % MAILJ_SIZE;
+    return room < sizeof(struct jrec) ? off + room : off;
+}
+
+// msync() the file pages holding ring bytes [from, to) (physical offsets)
+static int flush_pages(uint64_t from, uint64_t to) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)(ring + from)) & ~(page - 1);
+    js->stats.syncs++;
+    return msync((void *)start, (uintptr_t)(ring + to) - start, MS_SYNC);
+}
+
+// Flush the records between logical offsets from and to, which may wrap
+// around the end of the ring
+static int flush_ring(uint64_t from, uint64_t to) {
+    if (to <= from) {
+        return 0;
+    }
+    if (to - from >= MAILJ_SIZE) {
+        return flush_pages(0, MAILJ_SIZE);
+    }
+    uint64_t a = from % MAILJ_SIZE;
+    uint64_t b = to % MAILJ_SIZE;
+    if (a < b) {
+        return flush_pages(a, b);
+    }
+    if (flush_pages(a, MAILJ_SIZE) < 0) {
+        return -1;
+    }
+    return b > 0 ? flush_pages(0, b) : 0;
+}
+
+static int flush_header(void) {
+    js->stats.syncs++;
+    return msync(hdr, HEADER_SIZE, MS_SYNC);
+}
+
+// Copy the records of pending jobs to the tail and move the head past
+// everything else; called with js->lock held. msync() orders nothing
+// between pages, so there are two steps: the copies (and whatever else
+// is not yet on disk) are flushed first, and only then is the new head
+// stored and the header page flushed. A crash in between leaves the old
+// head, whose records are still intact; a failed flush keeps it, so its
+// space is not reused.
+static void compact(void) {
+    uint64_t stop = js->tail;
+    uint64_t off = first_rec(hdr->head);
+    uint64_t *copied = NULL;
+    size_t ncopied = 0, cap = 0;
+    int ok = 1;
+    while (off < stop) {
+        struct jrec *r = rec_at(off);
+        if (r == NULL) {
+            ERROR_LOG(stderr, "mail journal: unreadable record at %llu, not compacting\n", (unsigned long long)off);
+            ok = 0;
+            break;
+        }
+        int keep = r->type == MAILJ_MESSAGE && live_fn(r->id);
+        // A crash during an earlier compaction can leave two copies
+        for (size_t i = 0; keep && i < ncopied; i++) {
+            keep = copied[i] != r->id;
+        }
+        if (keep) {
+            uint64_t dst = place(js->tail, r->len);
+            if (dst + r->len - hdr->head > MAILJ_SIZE) {
+                ERROR_LOG(stderr, "mail journal: no room to compact\n");
+                ok = 0;
+                break;
+            }
+            if (ncopied == cap) {
+                size_t ncap = cap > 0 ? cap * 2 : 64;
+                uint64_t *grown = realloc(copied, ncap * sizeof(*copied));
+                if (grown == NULL) {
+                    ERROR_LOG(stderr, "realloc() failed for mail journal compaction\n");
+                    ok = 0;
+                    break;
+                }
+                copied = grown;
+                cap = ncap;
+            }
+            copied[ncopied++] = r->id;
+            pad(js->tail, dst);
+            struct jrec *c = (struct jrec *)(ring + dst % MAILJ_SIZE);
+            memmove(c, r, r->len);
+            c->off = dst;
+            c->check = rec_check(c);
+            js->tail = dst + c->len;
+        }
+        off = rec_next(off, r);
+    }
+    free(copied);
+    if (flush_ring(js->synced, js->tail) < 0) {
+        ERROR_LOG(stderr, "mail journal: msync() failed during compaction: %s\n", strerror(errno));
+        return;
+    }
+    js->synced = js->tail;
+    // On failure the head stays: the copies made are duplicates, which
+    // replay tolerates
+    if (!ok) {
+        return;
+    }
+    uint64_t old_head = hdr->head;
+    hdr->head = off;
+    if (flush_header() < 0) {
+        ERROR_LOG(stderr, "mail journal: msync() of the header failed during compaction: %s\n", strerror(errno));
+        hdr->head = old_head;
+        return;
+    }
+    js->stats.compactions++;
+    DEBUG_LOG(stderr, "mail journal: compacted, %zu pending messages kept, %llu bytes in use\n",
+              ncopied, (unsigned long long)(js->tail - hdr->head));
+}
+
+// Write a record at the tail; called with js->lock held
+static int append(struct jrec *rec, const char *const strs[], const uint32_t lens[], int nstrs, uint64_t *end) {
+    size_t payload = 0;
+    for (int i = 0; i < nstrs; i++) {
+        payload += lens[i];
+    }
+    if (payload > MAX_RECORD) {
+        ERROR_LOG(stderr, "mail journal: record of %zu bytes too large\n", payload);
+        return -1;
+    }
+    uint32_t len = rec_len(payload);
+    if (place(js->tail, len) + len - hdr->head > MAILJ_SIZE / 2) {
+        compact();
+    }
+    uint64_t off = place(js->tail, len);
+    if (off + len - hdr->head > MAILJ_SIZE) {
+        ERROR_LOG(stderr, "mail journal: full\n");
+        return -1;
+    }
+    pad(js->tail, off);
+    struct jrec *r = (struct jrec *)(ring + off % MAILJ_SIZE);
+    *r = *rec;
+    r->magic = REC_MAGIC;
+    r->len = len;
+    r->off = off;
+    char *p = (char *)(r + 1);
+    for (int i = 0; i < nstrs; i++) {
+        memcpy(p, strs[i], lens[i]);
+        p += lens[i];
+    }
+    memset(p, 0, (size_t)((char *)r + len - p));
+    r->check = rec_check(r);
+    js->tail = off + len;
+    js->stats.appends++;
+    if (end != NULL) {
+        *end = js->tail;
+    }
+    return 0;
+}
+
+int mailj_append_message(uint64_t id, const char *to, const char *subject, const char *body, uint64_t *end) {
+    if (js == NULL) {
+        return -1;
+    }
+    struct jrec rec = { .type = MAILJ_MESSAGE, .id = id };
+    const char *strs[3] = { to, subject, body };
+    uint32_t lens[3];
+    for (int i = 0; i < 3; i++) {
+        lens[i] = (uint32_t)strlen(strs[i]) + 1;
+    }
+    rec.to_len = lens[0];
+    rec.subject_len = lens[1];
+    rec.body_len = lens[2];
+    js_lock();
+    int rc = append(&rec, strs, lens, 3, end);
+    if (rc == 0 && id >= hdr->next_id) {
+        hdr->next_id = id + 1;
+    }
+    js_unlock();
+    return rc;
+}
+
+int mailj_append_done(uint64_t id, int state, int http_code) {
+    if (js == NULL) {
+        return -1;
+    }
+    struct jrec rec = { .type = MAILJ_DONE, .id = id, .state = (uint16_t)state, .http_code = http_code };
+    js_lock();
+    int rc = append(&rec, NULL, NULL, 0, NULL);
+    js_unlock();
+    return rc;
+}
+
+int mailj_sync(uint64_t end) {
+    if (js == NULL) {
+        return -1;
+    }
+    int rc = 0;
+    js_lock();
+    while (js->synced < end && rc == 0) {
+        if (js->flushing && js->flusher != getpid() && kill(js->flusher, 0) < 0 && errno == ESRCH) {
+            // Its records are still in the page cache: the next flush covers them
+            WARN_LOG(stderr, "mail journal: flusher %d died, taking over\n", js->flusher);
+            js->flushing = 0;
+        }
+        if (js->flushing) {
+            // Group commit: the running flush may already cover end; if not,
+            // the next one takes everything appended meanwhile
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += FLUSH_POLL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            js->waiters++;
+            js_unlock();
+            // A waiter that timed out leaves a surplus post: one extra round
+            sem_clockwait(&js->flushed, CLOCK_MONOTONIC, &deadline);
+            js_lock();
+            continue;
+        }
+        js->flushing = 1;
+        js->flusher = getpid();
+        uint64_t target = js->tail;
+        js_unlock();
+        rc = msync(hdr, HEADER_SIZE + MAILJ_SIZE, MS_SYNC);
+        js_lock();
+        js->flushing = 0;
+        js->stats.syncs++;
+        if (rc == 0 && target > js->synced) {
+            js->synced = target;
+        }
+        for (; js->waiters > 0; js->waiters--) {
+            sem_post(&js->flushed);
+        }
+    }
+    js_unlock();
+    if (rc < 0) {
+        ERROR_LOG(stderr, "mail journal: msync() failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int init_state(struct jstate *s) {
+    pthread_mutexattr_t ma;
+    if (pthread_mutexattr_init(&ma) != 0) {
+        return -1;
+    }
+    int rc = pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED) == 0 &&
+             pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST) == 0 &&
+             pthread_mutex_init(&s->lock, &ma) == 0 ? 0 : -1;
+    pthread_mutexattr_destroy(&ma);
+    if (rc < 0) {
+        return -1;
+    }
+    return sem_init(&s->flushed, 1, 0);
+}
+
+static struct jheader *map_file(const char *path) {
+    const size_t total = HEADER_SIZE + MAILJ_SIZE;
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ERROR_LOG(stderr, "Cannot open mail journal %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size != 0 && st.st_size != (off_t)total)) {
+        ERROR_LOG(stderr, "Mail journal %s has another layout, not using it\n", path);
+        close(fd);
+        return NULL;
+    }
+    int fresh = st.st_size == 0;
+    if (fresh && ftruncate(fd, (off_t)total) < 0) {
+        ERROR_LOG(stderr, "Cannot size mail journal %s: %s\n", path, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    struct jheader *h = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+        ERROR_LOG(stderr, "mmap() failed for mail journal %s\n", path);
+        perror("mmap");
+        return NULL;
+    }
+    if (fresh) {
+        memset(h, 0, sizeof(*h));
+        memcpy(h->magic, MAILJ_MAGIC, sizeof(MAILJ_MAGIC));
+        h->size = MAILJ_SIZE;
+        h->next_id = 1;
+        INFO_LOG(stderr, "mail journal: created %s\n", path);
+    } else if (memcmp(h->magic, MAILJ_MAGIC, sizeof(MAILJ_MAGIC)) != 0 || h->size != MAILJ_SIZE) {
+        ERROR_LOG(stderr, "Mail journal %s has another layout, not using it\n", path);
+        munmap(h, total);
+        return NULL;
+    }
+    return h;
+}
+
+int mailj_open(const char *path, int (*live)(uint64_t id),
+               void (*replay)(const struct mailj_record *rec), uint64_t *next_id) {
+    struct jheader *h = map_file(path);
+    if (h == NULL) {
+        return -1;
+    }
+    struct jstate *s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (s == MAP_FAILED || init_state(s) < 0) {
+        ERROR_LOG(stderr, "Failed to set up mail journal state\n");
+        if (s != MAP_FAILED) {
+            munmap(s, sizeof(*s));
+        }
+        munmap(h, HEADER_SIZE + MAILJ_SIZE);
+        return -1;
+    }
+    hdr = h;
+    ring = (char *)h + HEADER_SIZE;
+    live_fn = live;
+
+    // At most one lap: the first invalid record is the end of the log
+    uint64_t off = first_rec(h->head);
+    uint64_t max_id = 0, records = 0;
+    while (off - h->head < MAILJ_SIZE) {
+        struct jrec *r = rec_at(off);
+        if (r == NULL) {
+            break;
+        }
+        if (r->type != MAILJ_PAD) {
+            const char *str = (const char *)(r + 1);
+            struct mailj_record rec = {
+                .type = (enum mailj_type)r->type,
+                .id = r->id,
+                .state = r->state,
+                .http_code = r->http_code,
+            };
+            if (r->type == MAILJ_MESSAGE) {
+                rec.to = str;
+                rec.subject = str + r->to_len;
+                rec.body = str + r->to_len + r->subject_len;
+            }
+            replay(&rec);
+            records++;
+            if (r->id > max_id) {
+                max_id = r->id;
+            }
+        }
+        off = rec_next(off, r);
+    }
+    s->tail = off;
+    s->synced = off;
+    js = s;
+    *next_id = h->next_id > max_id + 1 ? h->next_id : max_id + 1;
+    INFO_LOG(stderr, "mail journal: replayed %llu records from %s\n", (unsigned long long)records, path);
+    return 0;
+}
+
+int mailj_enabled(void) {
+    return js != NULL;
+}
+
+void mailj_get_stats(struct mailj_stats *stats) {
+    if (js == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    js_lock();
+    *stats = js->stats;
+    js_unlock();
+}
@@ -0,0 +1,572 @@
+#define _GNU_SOURCE
+#include "mailq.h"
+#include "mailjournal.h"
+#include "smtp.h"
+#include "debug.h"
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct mail_job {
+    uint64_t id;
+    enum mail_job_state state;
+    int http_code;
+    int attempts;               // deliveries started
+    int64_t retry_at_ms;        // MAIL_JOB_RETRY: CLOCK_MONOTONIC time of the next attempt
+    pid_t submitter;            // MAIL_JOB_RESERVED: process waiting for the journal flush
+    char to[MAILQ_ADDR_MAX];
+    char subject[MAILQ_SUBJECT_MAX];
+    char body[MAILQ_BODY_MAX];
+};
+
+// Lives in a MAP_SHARED mapping inherited by every forked process; the
+// mutex is robust so a worker killed inside a critical section cannot
+// wedge the queue. The dispatcher sleeps on a semaphore, not a condition
+// variable: a waiter killed inside pthread_cond_wait() leaves a
+// process-shared cond that blocks its next signaller for good.
+struct mailq_shared {
+    pthread_mutex_t lock;
+    sem_t ready;                // posted when a job is queued, a delivery ends or on stop
+    uint64_t next_id;           // ID of the next submitted job (IDs start at 1)
+    uint64_t next_dispatch;     // oldest job not yet picked by the dispatcher
+    int stopping;
+    uint64_t retries;           // deliveries rescheduled after a transient failure
+    uint64_t restarts;          // dispatchers respawned by the supervisor
+    int64_t heartbeat_ms;       // CLOCK_MONOTONIC time the dispatcher last went round its loop
+    unsigned int jitter_seed;   // rand_r() state of the backoff jitter
+    struct mail_job jobs[MAILQ_CAPACITY];   // job i lives in slot i % capacity
+};
+
+static struct mailq_shared *q;
+
+// Set in the supervisor and dispatcher processes by SIGQUIT (terminal
+// Ctrl+\ or death of their parent)
+static volatile sig_atomic_t helper_exit = 0;
+
+static void helper_sigquit(int sig) {
+    (void)sig;
+    helper_exit = 1;
+}
+
+static void mailq_lock(void) {
+    if (pthread_mutex_lock(&q->lock) == EOWNERDEAD) {
+        // Previous owner died: the job table is only ever updated with
+        // single stores under the lock, so it is still consistent
+        pthread_mutex_consistent(&q->lock);
+    }
+}
+
+static void mailq_unlock(void) {
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void copy_field(char *dst, size_t size, const char *src) {
+    size_t len = strlen(src);
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+// Deliveries handed to the mail transport and not finished yet; dispatcher
+// process only, under q->lock
+static int in_flight;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Wait for a post on q->ready until CLOCK_MONOTONIC time until_ms; also
+// bounded so a SIGQUIT is noticed without a post. Called with q->lock
+// held, which is dropped meanwhile.
+static void wait_ready(int64_t until_ms) {
+    int64_t now = now_ms();
+    if (until_ms > now + 1000) {
+        until_ms = now + 1000;
+    }
+    struct timespec deadline = { .tv_sec = until_ms / 1000, .tv_nsec = (long)(until_ms % 1000) * 1000000 };
+    mailq_unlock();
+    // Surplus posts only cost an extra round of the caller's loop
+    sem_clockwait(&q->ready, CLOCK_MONOTONIC, &deadline);
+    mailq_lock();
+}
+
+static int job_pending(const struct mail_job *job) {
+    return job->state == MAIL_JOB_QUEUED || job->state == MAIL_JOB_SENDING || job->state == MAIL_JOB_RETRY ||
+           job->state == MAIL_JOB_RESERVED;
+}
+
+// Worth another attempt: no response at all, throttled, or a server error
+static int transient_failure(int http_code) {
+    return http_code == 0 || http_code == 429 || http_code >= 500;
+}
+
+// Exponential backoff with equal jitter: half of the step is fixed, half
+// random, so a burst of failed jobs does not retry in lockstep. Called
+// with q->lock held.
+static int64_t retry_delay_ms(int attempts) {
+    int shift = attempts > 1 ? attempts - 1 : 0;
+    int64_t step = shift < 20 ? (int64_t)MAILQ_RETRY_BASE_MS << shift : MAILQ_RETRY_MAX_MS;
+    if (step > MAILQ_RETRY_MAX_MS) {
+        step = MAILQ_RETRY_MAX_MS;
+    }
+    return step / 2 + rand_r(&q->jitter_seed) % (step / 2 + 1);
+}
+
+// Runs on the mail transport thread
+static void job_done(void *arg, int rc, int http_code) {
+    struct mail_job *job = arg;
+    mailq_lock();
+    job->http_code = http_code;
+    if (rc == 0) {
+        job->state = MAIL_JOB_SENT;
+    } else if (transient_failure(http_code) && job->attempts < MAILQ_MAX_ATTEMPTS) {
+        int64_t delay = retry_delay_ms(job->attempts);
+        job->state = MAIL_JOB_RETRY;
+        job->retry_at_ms = now_ms() + delay;
+        q->retries++;
+        INFO_LOG(stderr, "mailq: job %llu failed (HTTP %d), retry %d in %lld ms\n", (unsigned long long)job->id,
+                 http_code, job->attempts, (long long)delay);
+    } else {
+        job->state = MAIL_JOB_FAILED;
+    }
+    if (job->state != MAIL_JOB_RETRY) {
+        INFO_LOG(stderr, "mailq: job %llu %s (HTTP %d)\n", (unsigned long long)job->id,
+                 mailq_state_name(job->state), http_code);
+        // Not waited for: if it is lost, the message is sent once more
+        // after a restart, which at-least-once delivery allows
+        if (mailj_enabled() && mailj_append_done(job->id, job->state, http_code) < 0) {
+            WARN_LOG(stderr, "mailq: cannot journal the end of job %llu\n", (unsigned long long)job->id);
+        }
+    }
+    in_flight--;
+    mailq_unlock();
+    sem_post(&q->ready);
+}
+
+// The next job to deliver: the retry that is most overdue, else the oldest
+// new job. Lowers *wake_ms to the next retry not due yet. Called with
+// q->lock held.
+static struct mail_job *next_job(int64_t now, int64_t *wake_ms) {
+    struct mail_job *due = NULL;
+    for (int i = 0; i < MAILQ_CAPACITY; i++) {
+        struct mail_job *job = &q->jobs[i];
+        if (job->state != MAIL_JOB_RETRY) {
+            continue;
+        }
+        if (job->retry_at_ms <= now) {
+            if (due == NULL || job->retry_at_ms < due->retry_at_ms) {
+                due = job;
+            }
+        } else if (job->retry_at_ms < *wake_ms) {
+            *wake_ms = job->retry_at_ms;
+        }
+    }
+    if (due != NULL) {
+        return due;
+    }
+    while (q->next_dispatch != q->next_id) {
+        struct mail_job *job = &q->jobs[q->next_dispatch % MAILQ_CAPACITY];
+        if (job->state == MAIL_JOB_RESERVED) {
+            if (kill(job->submitter, 0) == 0 || errno != ESRCH) {
+                // Still being flushed: new jobs keep their order behind it
+                return NULL;
+            }
+            // The submitter died before acknowledging it (request deadline,
+            // SIGKILL). The record is in the journal: deliver it anyway.
+            WARN_LOG(stderr, "mailq: submitter of job %llu died, queuing it\n", (unsigned long long)job->id);
+            job->state = MAIL_JOB_QUEUED;
+        }
+        q->next_dispatch++;
+        if (job->state == MAIL_JOB_QUEUED) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+// Jobs a dead dispatcher was sending: their outcome is unknown, so they
+// are sent again (at least once)
+static void requeue_orphans(void) {
+    int count = 0;
+    mailq_lock();
+    for (int i = 0; i < MAILQ_CAPACITY; i++) {
+        struct mail_job *job = &q->jobs[i];
+        if (job->state == MAIL_JOB_SENDING) {
+            job->state = MAIL_JOB_RETRY;
+            job->retry_at_ms = 0;
+            count++;
+        }
+    }
+    mailq_unlock();
+    if (count > 0) {
+        WARN_LOG(stderr, "mailq: %d jobs of the previous dispatcher queued again\n", count);
+    }
+}
+
+// One thread hands jobs to the mail transport, which keeps up to
+// MAILQ_MAX_IN_FLIGHT of them in flight over its warm connections
+static void dispatch_loop(void) {
+    requeue_orphans();
+    for (;;) {
+        mailq_lock();
+        struct mail_job *job = NULL;
+        while (!q->stopping && !helper_exit) {
+            int64_t now = now_ms();
+            int64_t wake = now + 1000;
+            // wait_ready() returns at least once a second
+            q->heartbeat_ms = now;
+            if (in_flight < MAILQ_MAX_IN_FLIGHT && (job = next_job(now, &wake)) != NULL) {
+                break;
+            }
+            wait_ready(wake);
+        }
+        if (job == NULL) {
+            mailq_unlock();
+            break;
+        }
+        job->state = MAIL_JOB_SENDING;
+        job->attempts++;
+        in_flight++;
+        mailq_unlock();
+
+        // A SENDING slot is never recycled, so the job is stable until job_done()
+        INFO_LOG(stderr, "mailq: delivering job %llu to %s (attempt %d)\n", (unsigned long long)job->id, job->to,
+                 job->attempts);
+        if (send_email_async(job->to, job->subject, job->body, job_done, job) < 0) {
+            job_done(job, -1, 0);
+        }
+    }
+    // Let in-flight deliveries finish before exiting; jobs waiting for a
+    // retry stay in the journal, if there is one
+    mailq_lock();
+    while (in_flight > 0) {
+        wait_ready(now_ms() + 1000);
+    }
+    mailq_unlock();
+}
+
+// Signal setup of the supervisor and the dispatcher
+static void helper_init(pid_t parent) {
+    // Exit with the parent, even if it is killed without a chance to call mailq_stop()
+    if (prctl(PR_SET_PDEATHSIG, SIGQUIT) < 0 || getppid() != parent) {
+        exit(0);
+    }
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    // No SA_RESTART: SIGQUIT interrupts the supervisor's waitpid()
+    sa.sa_handler = helper_sigquit;
+    if (sigaction(SIGQUIT, &sa, NULL) < 0) {
+        WARN_LOG(stderr, "sigaction(SIGQUIT) failed in mail queue process\n");
+        perror("sigaction");
+    }
+    // Like the server itself: Ctrl+C and dead peers must not kill it
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGPIPE, &sa, NULL);
+    // Children are waited for, whatever the server set up
+    sa.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+static void dispatcher_main(pid_t parent) {
+    helper_init(parent);
+    INFO_LOG(stderr, "mailq: dispatcher running, up to %d deliveries in flight (PID %d)\n",
+             MAILQ_MAX_IN_FLIGHT, getpid());
+    dispatch_loop();
+    INFO_LOG(stderr, "mailq: dispatcher exiting\n");
+    exit(0);
+}
+
+static int queue_stopping(void) {
+    mailq_lock();
+    int stopping = q->stopping;
+    mailq_unlock();
+    return stopping;
+}
+
+// Run the dispatcher as a child and start a new one whenever it dies before
+// mailq_stop(), as the pre-fork supervisor does for its workers
+static void supervisor_main(pid_t parent) {
+    helper_init(parent);
+    pid_t self = getpid();
+    while (!helper_exit) {
+        time_t started = time(NULL);
+        pid_t pid = fork();
+        if (pid < 0) {
+            ERROR_LOG(stderr, "fork() failed for mail dispatcher\n");
+            perror("fork");
+        } else if (pid == 0) {
+            dispatcher_main(self);
+        } else {
+            int status;
+            pid_t rc;
+            while ((rc = waitpid(pid, &status, 0)) < 0 && errno == EINTR) {
+                // The server is gone: let the dispatcher finish what is in flight
+                kill(pid, SIGQUIT);
+            }
+            if (rc < 0) {
+                ERROR_LOG(stderr, "waitpid() failed for mail dispatcher\n");
+                perror("waitpid");
+                break;
+            }
+            if (helper_exit || queue_stopping()) {
+                break;
+            }
+            if (WIFSIGNALED(status)) {
+                ERROR_LOG(stderr, "mail dispatcher (PID %d) killed by signal %d, respawning\n",
+                          pid, WTERMSIG(status));
+            } else {
+                ERROR_LOG(stderr, "mail dispatcher (PID %d) exited with status %d, respawning\n",
+                          pid, WEXITSTATUS(status));
+            }
+            mailq_lock();
+            q->restarts++;
+            mailq_unlock();
+        }
+        if (time(NULL) - started < 1) {
+            // Crashing at startup: do not spin
+            struct timespec pause = { 1, 0 };
+            nanosleep(&pause, NULL);
+        }
+    }
+    exit(0);
+}
+
+static int init_sync(struct mailq_shared *shared) {
+    pthread_mutexattr_t ma;
+    if (pthread_mutexattr_init(&ma) != 0) {
+        return -1;
+    }
+    int rc = pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED) == 0 &&
+             pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST) == 0 &&
+             pthread_mutex_init(&shared->lock, &ma) == 0 ? 0 : -1;
+    pthread_mutexattr_destroy(&ma);
+    if (rc < 0) {
+        return -1;
+    }
+    return sem_init(&shared->ready, 1, 0);
+}
+
+// Journal callbacks: run in mailq_start() before the dispatcher exists,
+// and (live) under q->lock when an append compacts the journal
+static int job_live(uint64_t id) {
+    const struct mail_job *job = &q->jobs[id % MAILQ_CAPACITY];
+    return job->id == id && job_pending(job);
+}
+
+static void replay_record(const struct mailj_record *rec) {
+    struct mail_job *job = &q->jobs[rec->id % MAILQ_CAPACITY];
+    if (rec->type == MAILJ_MESSAGE) {
+        if (job->id != rec->id && job_pending(job)) {
+            // Two pending jobs never share a slot while the server runs
+            WARN_LOG(stderr, "mailq: journal job %llu collides with job %llu, keeping the newer\n",
+                     (unsigned long long)rec->id, (unsigned long long)job->id);
+        }
+        job->id = rec->id;
+        // Due at once; "retrying" in STATUS, as it may have been sent before
+        job->state = MAIL_JOB_RETRY;
+        job->retry_at_ms = 0;
+        job->attempts = 0;
+        job->http_code = 0;
+        copy_field(job->to, sizeof(job->to), rec->to);
+        copy_field(job->subject, sizeof(job->subject), rec->subject);
+        copy_field(job->body, sizeof(job->body), rec->body);
+    } else if (rec->type == MAILJ_DONE && job->id == rec->id &&
+               (rec->state == MAIL_JOB_SENT || rec->state == MAIL_JOB_FAILED)) {
+        job->state = (enum mail_job_state)rec->state;
+        job->http_code = rec->http_code;
+    }
+}
+
+int mailq_start(const char *journal_path) {
+    struct mailq_shared *shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        ERROR_LOG(stderr, "mmap() failed for mail queue\n");
+        perror("mmap");
+        return -1;
+    }
+    // Anonymous mappings are zero-filled: every slot starts MAIL_JOB_FREE
+    shared->next_id = 1;
+    shared->next_dispatch = 1;
+    if (init_sync(shared) < 0) {
+        ERROR_LOG(stderr, "Failed to initialise mail queue locks\n");
+        munmap(shared, sizeof(*shared));
+        return -1;
+    }
+    shared->jitter_seed = (unsigned int)getpid() ^ (unsigned int)time(NULL);
+    q = shared;
+    if (journal_path != NULL) {
+        uint64_t next_id;
+        if (mailj_open(journal_path, job_live, replay_record, &next_id) < 0) {
+            q = NULL;
+            munmap(shared, sizeof(*shared));
+            return -1;
+        }
+        // Replayed jobs are picked up as due retries
+        shared->next_id = next_id;
+        shared->next_dispatch = next_id;
+        int pending = 0;
+        for (int i = 0; i < MAILQ_CAPACITY; i++) {
+            pending += shared->jobs[i].state == MAIL_JOB_RETRY;
+        }
+        INFO_LOG(stderr, "mailq: %d undelivered messages recovered from %s\n", pending, journal_path);
+    }
+
+    // Counts as alive until the dispatcher's first round
+    shared->heartbeat_ms = now_ms();
+    pid_t parent = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        ERROR_LOG(stderr, "fork() failed for mail dispatcher supervisor\n");
+        perror("fork");
+        q = NULL;
+        munmap(shared, sizeof(*shared));
+        return -1;
+    }
+    if (pid == 0) {
+        supervisor_main(parent);
+    }
+    INFO_LOG(stderr, "Mail dispatcher supervisor started (PID %d)\n", pid);
+    return 0;
+}
+
+void mailq_stop(void) {
+    if (q == NULL) {
+        return;
+    }
+    mailq_lock();
+    q->stopping = 1;
+    mailq_unlock();
+    sem_post(&q->ready);
+}
+
+int mailq_enabled(void) {
+    return q != NULL;
+}
+
+int mailq_submit(const char *to, const char *subject, const char *body, uint64_t *id) {
+    if (q == NULL) {
+        return -1;
+    }
+    mailq_lock();
+    if (now_ms() - q->heartbeat_ms > MAILQ_STALE_MS) {
+        // Supervisor and dispatcher are both gone: nothing would deliver it
+        mailq_unlock();
+        WARN_LOG(stderr, "mailq: dispatcher not running, rejecting message to %s\n", to);
+        return -3;
+    }
+    struct mail_job *job = &q->jobs[q->next_id % MAILQ_CAPACITY];
+    if (job_pending(job)) {
+        // The oldest slot is still pending: the dispatcher is MAILQ_CAPACITY jobs behind
+        mailq_unlock();
+        WARN_LOG(stderr, "mailq: queue full, rejecting message to %s\n", to);
+        return -1;
+    }
+    job->id = q->next_id;
+    job->http_code = 0;
+    job->attempts = 0;
+    copy_field(job->to, sizeof(job->to), to);
+    copy_field(job->subject, sizeof(job->subject), subject);
+    copy_field(job->body, sizeof(job->body), body);
+    if (!mailj_enabled()) {
+        q->next_id++;
+        job->state = MAIL_JOB_QUEUED;
+        *id = job->id;
+        mailq_unlock();
+        sem_post(&q->ready);
+        return 0;
+    }
+    uint64_t end = 0;
+    if (mailj_append_message(job->id, job->to, job->subject, job->body, &end) < 0) {
+        job->id = 0;
+        job->state = MAIL_JOB_FREE;
+        mailq_unlock();
+        return -2;
+    }
+    // The ID is taken, but the dispatcher must not see the job before the
+    // message is on disk: a failed flush is reported and nothing is sent
+    q->next_id++;
+    job->state = MAIL_JOB_RESERVED;
+    job->submitter = getpid();
+    uint64_t job_id = job->id;
+    mailq_unlock();
+    // Acknowledged only once on disk; concurrent submits share the flush
+    int rc = mailj_sync(end);
+    mailq_lock();
+    if (rc < 0) {
+        job->id = 0;
+        job->state = MAIL_JOB_FREE;
+        // Best effort, so a replay does not send what was refused
+        if (mailj_append_done(job_id, MAIL_JOB_FAILED, 0) < 0) {
+            WARN_LOG(stderr, "mailq: cannot journal the refusal of job %llu\n", (unsigned long long)job_id);
+        }
+    } else if (job->state == MAIL_JOB_RESERVED) {
+        job->state = MAIL_JOB_QUEUED;
+    }
+    mailq_unlock();
+    if (rc < 0) {
+        return -2;
+    }
+    sem_post(&q->ready);
+    *id = job_id;
+    return 0;
+}
+
+int mailq_status(uint64_t id, struct mail_job_status *status) {
+    if (q == NULL || id == 0) {
+        return -1;
+    }
+    int rc = -1;
+    mailq_lock();
+    const struct mail_job *job = &q->jobs[id % MAILQ_CAPACITY];
+    // A reserved job has not been acknowledged to its submitter yet
+    if (id < q->next_id && job->id == id && job->state != MAIL_JOB_RESERVED) {
+        status->state = job->state;
+        status->http_code = job->http_code;
+        rc = 0;
+    }
+    mailq_unlock();
+    return rc;
+}
+
+const char *mailq_state_name(enum mail_job_state state) {
+    switch (state) {
+    case MAIL_JOB_QUEUED:  return "queued";
+    case MAIL_JOB_SENDING: return "sending";
+    case MAIL_JOB_SENT:    return "sent";
+    case MAIL_JOB_FAILED:  return "failed";
+    case MAIL_JOB_RETRY:   return "retrying";
+    default:               return "unknown";
+    }
+}
+
+void mailq_get_stats(struct mailq_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (q == NULL) {
+        return;
+    }
+    mailq_lock();
+    stats->retries = q->retries;
+    stats->dispatcher_restarts = q->restarts;
+    mailq_unlock();
+    struct mailj_stats js;
+    mailj_get_stats(&js);
+    stats->journal_appends = js.appends;
+    stats->journal_syncs = js.syncs;
+    stats->journal_compactions = js.compactions;
+}
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "admission.h"
+#include "debug.h"
+#include <sys/types.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// A worker that dies sooner than this after starting is respawned only
+// after a short pause, so a crash loop cannot spin the supervisor
+#define PREFORK_MIN_LIFETIME_SEC 1
+
+struct worker_slot {
+    pid_t pid;
+    int cpu;            // CPU the worker is pinned to (-1: not pinned)
+    time_t started;
+};
+
+// Collect the CPUs this process may run on, in ascending order
+static int allowed_cpus(int *cpus, int max) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) < 0) {
+        WARN_LOG(stderr, "sched_getaffinity() failed, workers will not be pinned\n");
+        return 0;
+    }
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus[n++] = cpu;
+        }
+    }
+    return n;
+}
+
+static void worker_main(const struct server_options *opt, int index, int cpu,
+                        prefork_serve_fn serve, void *arg) {
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            WARN_LOG(stderr, "worker %d: sched_setaffinity(cpu %d) failed\n", index, cpu);
+        }
+    }
+
+    int listen_fd = listener_open(SERVER_ADDR, SERVER_PORT, opt->backlog, 1);
+    if (listen_fd < 0) {
+        ERROR_LOG(stderr, "worker %d: could not open SO_REUSEPORT listener\n", index);
+        exit(PREFORK_EXIT_SETUP);
+    }
+    INFO_LOG(stderr, "worker %d (PID %d) serving on CPU %d\n", index, getpid(), cpu);
+
+    struct listener_set ls = { { listen_fd, -1 }, 1 };
+    if (opt->unix_fd >= 0) {
+        ls.fds[ls.count++] = opt->unix_fd;
+    }
+    int rc = serve(&ls, arg);
+    close(listen_fd);
+    exit(rc < 0 ? PREFORK_EXIT_SETUP : 0);
+}
+
+static int spawn_worker(const struct server_options *opt, struct worker_slot *slot, int index,
+                        prefork_serve_fn serve, void *arg) {
+    pid_t pid = fork();
+    if (pid < 0) {
+        ERROR_LOG(stderr, "fork() failed for worker %d\n", index);
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        worker_main(opt, index, slot->cpu, serve, arg);
+    }
+    slot->pid = pid;
+    slot->started = time(NULL);
+    DEBUG_LOG(stderr, "Spawned worker %d (PID %d)\n", index, pid);
+    return 0;
+}
+
+int prefork_run(const struct server_options *opt, prefork_serve_fn serve, void *arg,
+                volatile sig_atomic_t *should_exit) {
+    int nworkers = opt->workers;
+    if (nworkers <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = online > 0 ? (int)online : 1;
+    }
+
+    struct worker_slot *slots = calloc((size_t)nworkers, sizeof(*slots));
+    int *cpus = calloc(CPU_SETSIZE, sizeof(int));
+    if (slots == NULL || cpus == NULL) {
+        ERROR_LOG(stderr, "calloc() failed for worker table\n");
+        free(slots);
+        free(cpus);
+        return -1;
+    }
+    int ncpus = allowed_cpus(cpus, CPU_SETSIZE);
+    for (int i = 0; i < nworkers; i++) {
+        slots[i].cpu = ncpus > 0 ? cpus[i % ncpus] : -1;
+    }
+    free(cpus);
+
+    // Connection children of a worker that dies are reparented here rather
+    // than to init, so their admission slots are released when they exit
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0) {
+        WARN_LOG(stderr, "prctl(PR_SET_CHILD_SUBREAPER) failed\n");
+    }
+
+    int rc = 0;
+    for (int i = 0; i < nworkers; i++) {
+        if (spawn_worker(opt, &slots[i], i, serve, arg) < 0) {
+            rc = -1;
+            break;
+        }
+    }
+    INFO_LOG(stderr, "Supervising %d workers\n", nworkers);
+
+    while (rc == 0 && !*should_exit) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;   // SIGQUIT: loop condition checks the flag
+            }
+            ERROR_LOG(stderr, "waitpid() failed\n");
+            perror("waitpid");
+            rc = -1;
+            break;
+        }
+        // A worker killed by SIGKILL, the OOM killer or a crash never
+        // released the connections it was serving
+        int released = admission_release_owner(pid);
+        int index = -1;
+        for (int i = 0; i < nworkers; i++) {
+            if (slots[i].pid == pid) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) {
+            continue;
+        }
+        slots[index].pid = 0;
+        if (*should_exit) {
+            break;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == PREFORK_EXIT_SETUP) {
+            ERROR_LOG(stderr, "worker %d could not start, shutting down\n", index);
+            rc = -1;
+            break;
+        }
+        if (released > 0) {
+            WARN_LOG(stderr, "worker %d (PID %d) held %d connection slots, released\n",
+                     index, pid, released);
+        }
+        if (WIFSIGNALED(status)) {
+            ERROR_LOG(stderr, "worker %d (PID %d) killed by signal %d, respawning\n",
+                      index, pid, WTERMSIG(status));
+        } else {
+            ERROR_LOG(stderr, "worker %d (PID %d) exited with status %d, respawning\n",
+                      index, pid, WEXITSTATUS(status));
+        }
+        if (time(NULL) - slots[index].started < PREFORK_MIN_LIFETIME_SEC) {
+            struct timespec pause = { PREFORK_MIN_LIFETIME_SEC, 0 };
+            nanosleep(&pause, NULL);
+        }
+        if (!*should_exit && spawn_worker(opt, &slots[index], index, serve, arg) < 0) {
+            rc = -1;
+        }
+    }
+
+    // Shutdown: ask every live worker to exit gracefully, then reap them
+    for (int i = 0; i < nworkers; i++) {
+        if (slots[i].pid > 0) {
+            kill(slots[i].pid, SIGQUIT);
+        }
+    }
+    for (int i = 0; i < nworkers; i++) {
+        if (slots[i].pid > 0) {
+            while (waitpid(slots[i].pid, NULL, 0) < 0 && errno == EINTR) {
+            }
+        }
+    }
+    free(slots);
+    INFO_LOG(stderr, "All workers exited\n");
+    return rc;
+}
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include "procfs.h"
+#include "debug.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+static struct {
+    const char *path;
+    int self;               // per process: dropped in the child after fork()
+    int fd;                 // -1 until opened; installed with a CAS
+} files[PROCFS_FILES] = {
+    [PROCFS_MEMINFO]   = {"/proc/meminfo", 0, -1},
+    [PROCFS_LOADAVG]   = {"/proc/loadavg", 0, -1},
+    [PROCFS_STAT]      = {"/proc/stat", 0, -1},
+    [PROCFS_SELF_STAT] = {"/proc/self/stat", 1, -1},
+    [PROCFS_SELF_MOUNTINFO] = {"/proc/self/mountinfo", 1, -1},
+};
+
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+// The child is single-threaded here, so plain stores are enough
+static void drop_self_files(void) {
+    for (int i = 0; i < PROCFS_FILES; i++) {
+        if (files[i].self && files[i].fd >= 0) {
+            close(files[i].fd);
+            files[i].fd = -1;
+        }
+    }
+}
+
+static void register_atfork(void) {
+    pthread_atfork(NULL, NULL, drop_self_files);
+}
+
+static int procfs_fd(enum procfs_file file) {
+    int fd = __atomic_load_n(&files[file].fd, __ATOMIC_ACQUIRE);
+    if (fd >= 0) {
+        return fd;
+    }
+    pthread_once(&atfork_once, register_atfork);
+    fd = open(files[file].path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        WARN_LOG(stderr, "open(%s) failed: %s\n", files[file].path, strerror(errno));
+        return -1;
+    }
+    int expected = -1;
+    if (!__atomic_compare_exchange_n(&files[file].fd, &expected, fd, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        close(fd);          // another thread opened it first
+        fd = expected;
+    }
+    return fd;
+}
+
+void procfs_init(void) {
+    for (int i = 0; i < PROCFS_FILES; i++) {
+        if (!files[i].self) {
+            procfs_fd((enum procfs_file)i);
+        }
+    }
+}
+
+ssize_t procfs_read(enum procfs_file file, char *buf, size_t cap) {
+    return procfs_read_at(file, buf, cap, 0);
+}
+
+ssize_t procfs_read_at(enum procfs_file file, char *buf, size_t cap, off_t off) {
+    int fd = procfs_fd(file);
+    if (fd < 0 || cap == 0) {
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = pread(fd, buf, cap - 1, off);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        WARN_LOG(stderr, "pread(%s) failed: %s\n", files[file].path, strerror(errno));
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+// Skip to the next digit and parse an unsigned decimal, leaving *pp after
+// it. A '-' is skipped like any separator: callers only count fields there.
+static uint64_t parse_u64(const char **pp, const char *end) {
+    const char *p = *pp;
+    while (p < end && (unsigned)(*p - '0') > 9) {
+        p++;
+    }
+    uint64_t v = 0;
+    for (unsigned d; p < end && (d = (unsigned)(*p - '0')) <= 9; p++) {
+        v = v * 10 + d;
+    }
+    *pp = p;
+    return v;
+}
+
+// "0.52" -> 0.52 x 65536
+static uint64_t parse_fixed16(const char **pp, const char *end) {
+    uint64_t whole = parse_u64(pp, end);
+    const char *p = *pp;
+    uint64_t frac = 0, scale = 1;
+    if (p < end && *p == '.') {
+        for (p++; p < end && (unsigned)(*p - '0') <= 9 && scale < 1000000; p++) {
+            frac = frac * 10 + (uint64_t)(*p - '0');
+            scale *= 10;
+        }
+    }
+    *pp = p;
+    return (whole << 16) + (frac << 16) / scale;
+}
+
+static const struct {
+    const char *key;
+    size_t len;
+    size_t off;
+} meminfo_fields[] = {
+    {"MemTotal",     8,  offsetof(struct procfs_meminfo, total)},
+    {"MemFree",      7,  offsetof(struct procfs_meminfo, free)},
+    {"MemAvailable", 12, offsetof(struct procfs_meminfo, available)},
+    {"Buffers",      7,  offsetof(struct procfs_meminfo, buffers)},
+    {"Cached",       6,  offsetof(struct procfs_meminfo, cached)},
+};
+#define MEMINFO_FIELDS (sizeof(meminfo_fields) / sizeof(meminfo_fields[0]))
+
+int procfs_meminfo(struct procfs_meminfo *m) {
+    // The fields we want are the first lines of the file
+    char buf[1024];
+    ssize_t n = procfs_read(PROCFS_MEMINFO, buf, sizeof(buf));
+    if (n < 0) {
+        return -1;
+    }
+    memset(m, 0, sizeof(*m));
+    const char *p = buf, *end = buf + n;
+    unsigned found = 0;
+    while (p < end && found != (1u << MEMINFO_FIELDS) - 1) {
+        const char *colon = memchr(p, ':', (size_t)(end - p));
+        if (colon == NULL) {
+            break;
+        }
+        const char *q = colon + 1;
+        size_t klen = (size_t)(colon - p);
+        for (size_t i = 0; i < MEMINFO_FIELDS; i++) {
+            if (klen == meminfo_fields[i].len && memcmp(p, meminfo_fields[i].key, klen) == 0) {
+                // Values are in kB
+                *(uint64_t *)((char *)m + meminfo_fields[i].off) = parse_u64(&q, end) * 1024;
+                found |= 1u << i;
+                break;
+            }
+        }
+        const char *nl = memchr(q, '\n', (size_t)(end - q));
+        if (nl == NULL) {
+            break;
+        }
+        p = nl + 1;
+    }
+    if (!(found & 1u)) {
+        WARN_LOG(stderr, "MemTotal missing from /proc/meminfo\n");
+        return -1;
+    }
+    return 0;
+}
+
+int procfs_loadavg(struct procfs_loadavg *l) {
+    // "0.52 0.58 0.59 2/345 12345"
+    char buf[128];
+    ssize_t n = procfs_read(PROCFS_LOADAVG, buf, sizeof(buf));
+    if (n < 0) {
+        return -1;
+    }
+    const char *p = buf, *end = buf + n;
+    for (int i = 0; i < 3; i++) {
+        l->loads[i] = parse_fixed16(&p, end);
+    }
+    l->running = (uint32_t)parse_u64(&p, end);
+    l->threads = (uint32_t)parse_u64(&p, end);
+    return 0;
+}
+
+int procfs_cpu(struct procfs_cpu *c) {
+    // Only the first line: "cpu  user nice system idle iowait irq softirq steal ..."
+    char buf[512];
+    ssize_t n = procfs_read(PROCFS_STAT, buf, sizeof(buf));
+    if (n < 4 || memcmp(buf, "cpu ", 4) != 0) {
+        WARN_LOG(stderr, "Unexpected /proc/stat format\n");
+        return -1;
+    }
+    const char *p = buf + 4, *end = buf + n;
+    uint64_t *fields[] = {
+        &c->user, &c->nice, &c->system, &c->idle, &c->iowait, &c->irq, &c->softirq, &c->steal
+    };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        *fields[i] = parse_u64(&p, end);
+    }
+    return 0;
+}
+
+int procfs_self(struct procfs_self *s) {
+    // "pid (comm) state ppid ...": comm may hold spaces and parentheses, so
+    // the fields are counted from the last ')'
+    char buf[1024];
+    ssize_t n = procfs_read(PROCFS_SELF_STAT, buf, sizeof(buf));
+    if (n < 0) {
+        return -1;
+    }
+    const char *p = memrchr(buf, ')', (size_t)n), *end = buf + n;
+    if (p == NULL) {
+        WARN_LOG(stderr, "Unexpected /proc/self/stat format\n");
+        return -1;
+    }
+    // Numeric fields start with ppid (field 4); the state letter is skipped
+    uint64_t rss_pages = 0;
+    for (int field = 4; field <= 24 && p < end; field++) {
+        uint64_t v = parse_u64(&p, end);
+        switch (field) {
+        case 14: s->utime = v; break;
+        case 15: s->stime = v; break;
+        case 20: s->threads = (uint32_t)v; break;
+        case 24: rss_pages = v; break;
+        }
+    }
+    s->rss = rss_pages * (uint64_t)sysconf(_SC_PAGESIZE);
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "protocol.h"
+#include <string.h>
+
+static uint16_t get_u16(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint16_t)((u[0] << 8) | u[1]);
+}
+
+static uint32_t get_u32(const char *p) {
+    const unsigned char *u = (const unsigned char *)p;
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) | ((uint32_t)u[2] << 8) | u[3];
+}
+
+static void put_u16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+int proto_preamble(const char *buf, size_t len) {
+    size_t n = len < PROTO_MAGIC_LEN ? len : PROTO_MAGIC_LEN;
+    if (memcmp(buf, PROTO_MAGIC, n) != 0) {
+        return -1;
+    }
+    return n == PROTO_MAGIC_LEN ? 1 : 0;
+}
+
+ssize_t proto_frame_size(const char *buf, size_t len) {
+    if (len < PROTO_HEADER_LEN) {
+        return 0;
+    }
+    uint32_t payload_len = get_u32(buf);
+    if (payload_len > PROTO_MAX_FRAME - PROTO_HEADER_LEN) {
+        return -1;
+    }
+    return (ssize_t)(PROTO_HEADER_LEN + payload_len);
+}
+
+int proto_parse_request(const char *frame, size_t len, struct proto_request *req) {
+    memset(req, 0, sizeof(*req));
+    if (len < PROTO_HEADER_LEN) {
+        return -1;
+    }
+    req->opcode = get_u16(frame + 4);
+    uint16_t nfields = get_u16(frame + 6);
+    size_t off = PROTO_HEADER_LEN;
+    for (uint16_t i = 0; i < nfields; i++) {
+        if (len - off < PROTO_FIELD_HEADER_LEN) {
+            return -1;
+        }
+        uint16_t tag = get_u16(frame + off);
+        uint32_t flen = get_u32(frame + off + 2);
+        off += PROTO_FIELD_HEADER_LEN;
+        if (flen > len - off) {
+            return -1;
+        }
+        const char *data = frame + off;
+        off += flen;
+        if (tag == 0 || tag >= PROTO_FIELD_COUNT) {
+            continue;
+        }
+        // Only the last byte is checked: an embedded '\0' merely truncates
+        if (flen == 0 || data[flen - 1] != '\0') {
+            return -1;
+        }
+        req->fields[tag].data = data;
+        req->fields[tag].len = flen;
+    }
+    return off == len ? 0 : -1;
+}
+
+void proto_get_header(const char *hdr, uint32_t *payload_len, uint16_t *word1, uint16_t *word2) {
+    *payload_len = get_u32(hdr);
+    *word1 = get_u16(hdr + 4);
+    *word2 = get_u16(hdr + 6);
+}
+
+void proto_encode_header(char *hdr, uint32_t payload_len, uint16_t word1, uint16_t word2) {
+    unsigned char *u = (unsigned char *)hdr;
+    put_u32(u, payload_len);
+    put_u16(u + 4, word1);
+    put_u16(u + 6, word2);
+}
+
+int proto_write_header(FILE *out, uint32_t payload_len, uint16_t word1, uint16_t word2) {
+    char hdr[PROTO_HEADER_LEN];
+    proto_encode_header(hdr, payload_len, word1, word2);
+    return fwrite(hdr, 1, sizeof(hdr), out) == sizeof(hdr) ? 0 : -1;
+}
+
+int proto_write_field(FILE *out, uint16_t tag, const char *value) {
+    unsigned char hdr[PROTO_FIELD_HEADER_LEN];
+    size_t len = strlen(value) + 1;
+    put_u16(hdr, tag);
+    put_u32(hdr + 2, (uint32_t)len);
+    if (fwrite(hdr, 1, sizeof(hdr), out) != sizeof(hdr) ||
+        fwrite(value, 1, len, out) != len) {
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t proto_field_size(const char *value) {
+    return (uint32_t)(PROTO_FIELD_HEADER_LEN + strlen(value) + 1);
+}
@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include "response.h"
+#include <sys/socket.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_MIN 1024
+
+void response_init(struct response *r) {
+    memset(r, 0, sizeof(*r));
+}
+
+static void free_owned(struct response *r) {
+    for (size_t i = 0; i < r->nsegs; i++) {
+        if (r->segs[i].owned) {
+            free((char *)r->segs[i].ref);
+        }
+    }
+}
+
+void response_free(struct response *r) {
+    free_owned(r);
+    free(r->segs);
+    free(r->arena);
+    free(r->iov);
+    memset(r, 0, sizeof(*r));
+}
+
+void response_reset(struct response *r) {
+    free_owned(r);
+    r->nsegs = 0;
+    r->arena_len = 0;
+    r->len = 0;
+    r->sent = 0;
+    r->cur_seg = 0;
+    r->cur_off = 0;
+    r->failed = 0;
+}
+
+size_t response_len(const struct response *r) {
+    return r->len;
+}
+
+size_t response_pending(const struct response *r) {
+    return r->len - r->sent;
+}
+
+static int fail(struct response *r) {
+    r->failed = 1;
+    return -1;
+}
+
+static struct response_seg *new_seg(struct response *r) {
+    if (r->nsegs == r->segs_cap) {
+        size_t cap = r->segs_cap > 0 ? r->segs_cap * 2 : 16;
+        struct response_seg *segs = realloc(r->segs, cap * sizeof(*segs));
+        if (segs == NULL) {
+            return NULL;
+        }
+        r->segs = segs;
+        r->segs_cap = cap;
+    }
+    struct response_seg *s = &r->segs[r->nsegs++];
+    memset(s, 0, sizeof(*s));
+    return s;
+}
+
+// Make room for len more arena bytes
+static int arena_reserve(struct response *r, size_t len) {
+    if (r->arena_cap - r->arena_len >= len) {
+        return 0;
+    }
+    size_t cap = r->arena_cap > 0 ? r->arena_cap : ARENA_MIN;
+    while (cap - r->arena_len < len) {
+        cap *= 2;
+    }
+    char *arena = realloc(r->arena, cap);
+    if (arena == NULL) {
+        return -1;
+    }
+    r->arena = arena;
+    r->arena_cap = cap;
+    return 0;
+}
+
+// Account for len bytes just placed at the end of the arena; they extend
+// the last segment when it ends there
+static int arena_commit(struct response *r, size_t len) {
+    struct response_seg *last = r->nsegs > 0 ? &r->segs[r->nsegs - 1] : NULL;
+    if (last == NULL || last->ref != NULL || last->off + last->len != r->arena_len) {
+        last = new_seg(r);
+        if (last == NULL) {
+            return fail(r);
+        }
+        last->off = r->arena_len;
+    }
+    last->len += len;
+    r->arena_len += len;
+    r->len += len;
+    return 0;
+}
+
+int response_write(struct response *r, const void *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (arena_reserve(r, len) < 0) {
+        return fail(r);
+    }
+    memcpy(r->arena + r->arena_len, data, len);
+    return arena_commit(r, len);
+}
+
+int response_puts(struct response *r, const char *s) {
+    return response_write(r, s, strlen(s));
+}
+
+int response_vprintf(struct response *r, const char *fmt, va_list ap) {
+    va_list retry;
+    va_copy(retry, ap);
+    if (arena_reserve(r, 128) < 0) {
+        va_end(retry);
+        return fail(r);
+    }
+    size_t room = r->arena_cap - r->arena_len;
+    int n = vsnprintf(r->arena + r->arena_len, room, fmt, ap);
+    if (n >= 0 && (size_t)n >= room) {
+        // Too long for the free space: grow and format again
+        if (arena_reserve(r, (size_t)n + 1) < 0) {
+            va_end(retry);
+            return fail(r);
+        }
+        n = vsnprintf(r->arena + r->arena_len, (size_t)n + 1, fmt, retry);
+    }
+    va_end(retry);
+    if (n < 0) {
+        return fail(r);
+    }
+    return arena_commit(r, (size_t)n);
+}
+
+int response_printf(struct response *r, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int rc = response_vprintf(r, fmt, ap);
+    va_end(ap);
+    return rc;
+}
+
+int response_ref(struct response *r, const void *data, size_t len) {
+    if (len < RESPONSE_REF_MIN) {
+        return response_write(r, data, len);
+    }
+    struct response_seg *s = new_seg(r);
+    if (s == NULL) {
+        return fail(r);
+    }
+    s->ref = data;
+    s->len = len;
+    r->len += len;
+    return 0;
+}
+
+int response_attach(struct response *r, char *buf, size_t len) {
+    struct response_seg *s = new_seg(r);
+    if (s == NULL) {
+        free(buf);
+        return fail(r);
+    }
+    s->ref = buf;
+    s->len = len;
+    s->owned = 1;
+    r->len += len;
+    return 0;
+}
+
+int response_splice(struct response *dst, struct response *src) {
+    if (src->failed) {
+        dst->failed = 1;
+    }
+    if (src->len < RESPONSE_REF_MIN) {
+        // Small: one copy into dst's arena, src keeps its buffers
+        if (src->len > 0) {
+            if (arena_reserve(dst, src->len) < 0) {
+                response_reset(src);
+                return fail(dst);
+            }
+            response_copy(src, 0, dst->arena + dst->arena_len, src->len);
+            arena_commit(dst, src->len);
+        }
+        response_reset(src);
+        return 0;
+    }
+    // Large: dst takes over src's segments; arena bytes are referenced and
+    // the arena itself rides along as an empty owned segment
+    for (size_t i = 0; i <= src->nsegs; i++) {
+        struct response_seg *s = new_seg(dst);
+        if (s == NULL) {
+            response_reset(src);
+            return fail(dst);
+        }
+        if (i == src->nsegs) {
+            s->ref = src->arena;
+            s->owned = src->arena != NULL;
+            break;
+        }
+        *s = src->segs[i];
+        if (s->ref == NULL) {
+            s->ref = src->arena + s->off;
+        }
+        dst->len += s->len;
+        src->segs[i].owned = 0;
+    }
+    src->arena = NULL;
+    src->arena_cap = 0;
+    response_reset(src);
+    return 0;
+}
+
+static const char *seg_data(const struct response *r, const struct response_seg *s) {
+    return s->ref != NULL ? s->ref : r->arena + s->off;
+}
+
+size_t response_copy(const struct response *r, size_t off, char *dst, size_t cap) {
+    size_t copied = 0;
+    for (size_t i = 0; i < r->nsegs && copied < cap; i++) {
+        const struct response_seg *s = &r->segs[i];
+        if (off >= s->len) {
+            off -= s->len;
+            continue;
+        }
+        size_t n = s->len - off;
+        if (n > cap - copied) {
+            n = cap - copied;
+        }
+        memcpy(dst + copied, seg_data(r, s) + off, n);
+        copied += n;
+        off = 0;
+    }
+    return copied;
+}
+
+char *response_flatten(const struct response *r, size_t *len) {
+    *len = 0;
+    if (r->len == 0) {
+        return NULL;
+    }
+    char *buf = malloc(r->len);
+    if (buf == NULL) {
+        return NULL;
+    }
+    *len = response_copy(r, 0, buf, r->len);
+    return buf;
+}
+
+int response_iov(struct response *r, const struct iovec **iov) {
+    size_t want = r->nsegs - r->cur_seg;
+    if (want > IOV_MAX) {
+        want = IOV_MAX;
+    }
+    if (want > r->iov_cap) {
+        struct iovec *v = realloc(r->iov, want * sizeof(*v));
+        if (v == NULL) {
+            want = r->iov_cap;      // send fewer segments at a time
+        } else {
+            r->iov = v;
+            r->iov_cap = want;
+        }
+    }
+    int n = 0;
+    size_t off = r->cur_off;
+    for (size_t i = r->cur_seg; i < r->nsegs && (size_t)n < want; i++) {
+        const struct response_seg *s = &r->segs[i];
+        if (s->len > off) {
+            r->iov[n].iov_base = (void *)(seg_data(r, s) + off);
+            r->iov[n].iov_len = s->len - off;
+            n++;
+        }
+        off = 0;
+    }
+    *iov = r->iov;
+    return n;
+}
+
+void response_consume(struct response *r, size_t n) {
+    r->sent += n;
+    while (r->cur_seg < r->nsegs) {
+        size_t left = r->segs[r->cur_seg].len - r->cur_off;
+        if (n < left) {
+            r->cur_off += n;
+            return;
+        }
+        n -= left;
+        r->cur_seg++;
+        r->cur_off = 0;
+    }
+}
+
+ssize_t response_send_some(struct response *r, int fd) {
+    const struct iovec *iov;
+    int n = response_iov(r, &iov);
+    if (n == 0) {
+        if (response_pending(r) == 0) {
+            return 0;
+        }
+        errno = ENOMEM;     // no iovec array for the unsent segments
+        return -1;
+    }
+    size_t bytes = 0;
+    for (int i = 0; i < n; i++) {
+        bytes += iov[i].iov_len;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = (size_t)n;
+    int flags = MSG_NOSIGNAL | (bytes < response_pending(r) ? MSG_MORE : 0);
+    ssize_t sent = sendmsg(fd, &msg, flags);
+    if (sent > 0) {
+        response_consume(r, (size_t)sent);
+    }
+    return sent;
+}
+
+void response_stream(struct response *r, int fd) {
+    r->streaming = 1;
+    r->stream_fd = fd;
+}
+
+int response_flush(struct response *r) {
+    if (!r->streaming || response_pending(r) == 0) {
+        return 0;
+    }
+    return response_send(r, r->stream_fd);
+}
+
+int response_send(struct response *r, int fd) {
+    while (response_pending(r) > 0) {
+        ssize_t n = response_send_some(r, fd);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+    }
+    response_reset(r);
+    return 0;
+}
@@ -11,8 +11,22 @@
 #include <errno.h>
 #include <sys/time.h>
 #include <sys/select.h>
-#include "sysinfo.h"
+#include <poll.h>
+#include "server.h"
+#include "command.h"
+#include "protocol.h"
+#include "linereader.h"
+#include "response.h"
 #include "smtp.h"
+#include "mailq.h"
+#include "sysinfo.h"
+#include "procfs.h"
+#include "history.h"
+#include "sysinfo_cache.h"
+#include "sysinfo_sched.h"
+#include "diskinfo.h"
+#include "deadline.h"
+#include "admission.h"
 #include "env.h"
 #include "debug.h"
 
@@ -26,56 +40,497 @@ static void sigquit_handler(int sig) {
     INFO_LOG(stderr, "Received SIGQUIT, server will exit gracefully\n");
 }
 
-ssize_t read_line(int fd, char *buf, size_t size) {
-    DEBUG_LOG(stderr, "read_line: reading from fd %d, buffer size %zu\n", fd, size);
-    ssize_t n = 0;
-    char c;
-    while (n < (ssize_t)(size - 1)) {
-        ssize_t r = read(fd, &c, 1);
-        if (r <= 0) {
-            DEBUG_LOG(stderr, "read_line: read returned %zd\n", r);
+// Send the built response in one sendmsg(); a send that stalls past
+// SO_SNDTIMEO is a write-idle timeout
+static int flush_client(struct response *resp, int cfd) {
+    if (response_send(resp, cfd) == 0) {
+        return 0;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        deadline_count(DEADLINE_WRITE_IDLE);
+        WARN_LOG(stderr, "Client stalled while receiving response, closing\n");
+    } else {
+        WARN_LOG(stderr, "sendmsg() failed\n");
+    }
+    response_reset(resp);
+    return -1;
+}
+
+// Shared function to cleanup resources and exit
+static void cleanup_and_exit(struct response *resp, int cfd) {
+    flush_client(resp, cfd);
+    response_free(resp);
+    close(cfd);
+    DEBUG_LOG(stderr, "Child process exiting\n");
+    exit(0);
+}
+
+// Wait up to the read-idle deadline for data: >0 readable, 0 timeout
+// (counted), <0 error
+static int wait_readable(int cfd) {
+    int idle_ms = deadline_ms(DEADLINE_READ_IDLE);
+    for (;;) {
+        fd_set readfds;
+        struct timeval select_timeout;
+        FD_ZERO(&readfds);
+        FD_SET(cfd, &readfds);
+        select_timeout.tv_sec = idle_ms / 1000;
+        select_timeout.tv_usec = (idle_ms % 1000) * 1000;
+        int select_result = select(cfd + 1, &readfds, NULL, NULL, idle_ms > 0 ? &select_timeout : NULL);
+        if (select_result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (select_result == 0) {
+            deadline_count(DEADLINE_READ_IDLE);
+        }
+        return select_result;
+    }
+}
+
+// Admission ticket of a fork engine child's connection, released at exit.
+// The parent releases it too when it reaps the child, in case the child
+// never got that far (SIGKILL, OOM killer, crash).
+static int child_ticket = -1;
+
+static void release_child_ticket(void) {
+    admission_release(child_ticket);
+    child_ticket = -1;
+}
+
+// A fork engine child has a single connection, so the request deadline is
+// a process timer: SIGALRM counts the timeout and ends the child
+static void request_deadline_handler(int sig) {
+    (void)sig;
+    deadline_count(DEADLINE_REQUEST);
+    admission_release(child_ticket);
+    _exit(0);
+}
+
+// Start the request deadline (if configured), or stop it with start == 0
+static void request_deadline_set(int start) {
+    int ms = start ? deadline_ms(DEADLINE_REQUEST) : 0;
+    struct itimerval it;
+    memset(&it, 0, sizeof(it));
+    it.it_value.tv_sec = ms / 1000;
+    it.it_value.tv_usec = (ms % 1000) * 1000;
+    setitimer(ITIMER_REAL, &it, NULL);
+}
+
+// Child setup: write-idle deadline as a send timeout, request deadline handler
+static void child_deadlines_init(int cfd) {
+    int write_ms = deadline_ms(DEADLINE_WRITE_IDLE);
+    if (write_ms > 0) {
+        struct timeval tv = { write_ms / 1000, (write_ms % 1000) * 1000 };
+        if (setsockopt(cfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
+            WARN_LOG(stderr, "setsockopt(SO_SNDTIMEO) failed\n");
+        }
+    }
+    struct sigaction sa_alrm;
+    memset(&sa_alrm, 0, sizeof(sa_alrm));
+    sa_alrm.sa_handler = request_deadline_handler;
+    if (sigaction(SIGALRM, &sa_alrm, NULL) < 0) {
+        WARN_LOG(stderr, "sigaction(SIGALRM) failed\n");
+    }
+}
+
+// Binary protocol session in a fork engine child: frames are self-delimiting,
+// so the connection stays open until the client closes it or goes idle
+static void serve_binary(int cfd, struct response *resp, const char *data, size_t len) {
+    char *buf = malloc(PROTO_MAX_FRAME);
+    if (buf == NULL) {
+        ERROR_LOG(stderr, "malloc() failed for frame buffer\n");
+        return;
+    }
+    memcpy(buf, data, len);
+    for (;;) {
+        size_t used = command_execute_frames(buf, len, resp);
+        if (flush_client(resp, cfd) < 0) {
+            break;
+        }
+        len -= used;
+        memmove(buf, buf + used, len);
+        request_deadline_set(len > 0);
+        if (proto_frame_size(buf, len) < 0) {
+            WARN_LOG(stderr, "Binary frame exceeds %d bytes, closing connection\n", PROTO_MAX_FRAME);
+            break;
+        }
+        if (wait_readable(cfd) <= 0) {
+            WARN_LOG(stderr, "Binary connection idle, closing\n");
+            break;
+        }
+        ssize_t n = read(cfd, buf + len, PROTO_MAX_FRAME - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            WARN_LOG(stderr, "Failed to read command or connection closed\n");
+            break;
+        }
+        if (n == 0) {
+            if (len > 0) {
+                WARN_LOG(stderr, "Connection closed in the middle of a frame\n");
+            }
             break;
         }
-        if (c == '\r') continue;
-        if (c == '\n') break;
-        buf[n++] = c;
+        if (len == 0) {
+            request_deadline_set(1);
+        }
+        len += (size_t)n;
+    }
+    free(buf);
+}
+
+// Keep-alive session in a fork engine child: answer pipelined commands in
+// batches until the client closes or exceeds the read-idle deadline
+static void serve_keepalive(int cfd, struct response *resp, struct line_reader *reader) {
+    // Over-long commands get an error response and are skipped up to their
+    // '\n'; one byte past COMMAND_MAX_LEN (two with a '\r') is enough to tell
+    reader->max_line = COMMAND_MAX_LEN + 1;
+    for (;;) {
+        struct line_slice line;
+        int rc;
+        while ((rc = line_reader_next(reader, &line)) != LINE_NEED_MORE) {
+            if (rc == LINE_TOO_LONG) {
+                WARN_LOG(stderr, "Command too long, skipping to the next line\n");
+                command_reject_line(resp);
+                continue;
+            }
+            command_execute_line(line.data, line.len, resp);
+        }
+        // All responses of the batch leave in as few writes as possible
+        if (flush_client(resp, cfd) < 0) {
+            return;
+        }
+        size_t pending;
+        line_reader_pending(reader, &pending);
+        request_deadline_set(pending > 0);
+        if (wait_readable(cfd) <= 0) {
+            WARN_LOG(stderr, "Keep-alive connection idle, closing\n");
+            return;
+        }
+        ssize_t n = line_reader_fill(reader);
+        if (n < 0) {
+            WARN_LOG(stderr, "Failed to read command or connection closed\n");
+            return;
+        }
+        if (n == 0) {
+            // Peer half-closed after an unterminated command: run it
+            if (line_reader_rest(reader, &line)) {
+                command_execute_line(line.data, line.len, resp);
+            }
+            return;
+        }
+        if (pending == 0) {
+            request_deadline_set(1);
+        }
+    }
+}
+
+// Wait until one of the listeners has a connection and accept it
+static int accept_next(const struct listener_set *ls, struct sockaddr_storage *cli, socklen_t *clilen) {
+    if (ls->count == 1) {
+        return accept(ls->fds[0], (struct sockaddr *)cli, clilen);
+    }
+    struct pollfd pfds[SERVER_MAX_LISTENERS];
+    for (int i = 0; i < ls->count; i++) {
+        pfds[i].fd = ls->fds[i];
+        pfds[i].events = POLLIN;
+        pfds[i].revents = 0;
+    }
+    if (poll(pfds, (nfds_t)ls->count, -1) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < ls->count; i++) {
+        if (pfds[i].revents & POLLIN) {
+            // The shared AF_UNIX listener is non-blocking: EAGAIN if another
+            // worker took the connection first
+            return accept(ls->fds[i], (struct sockaddr *)cli, clilen);
+        }
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+// SIGCHLD only interrupts accept() so the fork engine reaps its children
+static void sigchld_handler(int sig) {
+    (void)sig;
+}
+
+// Reap finished children and release the connection slots they still hold
+static void reap_children(void) {
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        int released = admission_release_owner(pid);
+        if (released > 0) {
+            WARN_LOG(stderr, "Child %d died holding its connection slot, released\n", pid);
+        }
+    }
+}
+
+// Fork engine: the parent accepts, each connection is served by a child process
+static void run_fork_engine(const struct listener_set *ls) {
+    // Children are waited for (not auto-reaped) so that one that died
+    // without releasing its admission slot is noticed
+    struct sigaction sa_chld;
+    memset(&sa_chld, 0, sizeof(sa_chld));
+    sa_chld.sa_handler = sigchld_handler;
+    sa_chld.sa_flags = SA_NOCLDSTOP;
+    if (sigaction(SIGCHLD, &sa_chld, NULL) < 0) {
+        WARN_LOG(stderr, "sigaction(SIGCHLD) failed\n");
+        perror("sigaction");
+    }
+    while(!server_should_exit){
+        reap_children();
+        struct sockaddr_storage cli;
+        socklen_t clilen = sizeof(cli);
+        char peer[64];
+        DEBUG_LOG(stderr, "Waiting for client connection...\n");
+        int cfd = accept_next(ls, &cli, &clilen);
+        if (cfd < 0) {
+            // Check if interrupted by SIGQUIT
+            if (errno == EINTR && server_should_exit) {
+                DEBUG_LOG(stderr, "accept() interrupted by SIGQUIT, exiting...\n");
+                break;
+            }
+            // If interrupted by other signal but not exit signal, continue waiting
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+                continue;
+            }
+            ERROR_LOG(stderr, "accept() failed\n");
+            perror("accept");
+            continue;
+        }
+        listener_peer_name(&cli, peer, sizeof(peer));
+        INFO_LOG(stderr, "Client connected from %s\n", peer);
+
+        // Admission control happens before the fork: a flood costs no processes.
+        // A child that died since the last reap must not count against the caps.
+        reap_children();
+        int ticket;
+        int verdict = admission_acquire((struct sockaddr *)&cli, &ticket);
+        if (verdict != ADMISSION_OK) {
+            WARN_LOG(stderr, "Connection from %s rejected by admission control\n", peer);
+            admission_reject(cfd, verdict);
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            ERROR_LOG(stderr, "fork() failed\n");
+            perror("fork");
+            admission_release(ticket);
+            close(cfd);
+            continue;
+        }
+        if (pid == 0) {
+            // child: don't need listening socket
+            DEBUG_LOG(stderr, "Child process started (PID: %d)\n", getpid());
+            for (int i = 0; i < ls->count; i++) {
+                close(ls->fds[i]);
+            }
+            child_ticket = ticket;
+            admission_set_current(ticket);
+            if (atexit(release_child_ticket) != 0) {
+                WARN_LOG(stderr, "atexit() failed, connection slot may leak\n");
+            }
+            
+            // Responses are gathered here and leave with one sendmsg() each
+            struct response client_resp;
+            struct response *resp = &client_resp;
+            response_init(resp);
+            child_deadlines_init(cfd);
+            
+            // One buffered reader per connection: a read() takes whatever
+            // the socket holds, lines are parsed in place
+            struct line_reader reader;
+            if (line_reader_init(&reader, cfd, KEEPALIVE_BUF_LEN, COMMAND_MAX_LEN - 1) < 0) {
+                ERROR_LOG(stderr, "malloc() failed for line buffer\n");
+                cleanup_and_exit(resp, cfd);
+            }
+            
+            // Use select() to check if socket is readable (read-idle deadline)
+            int select_result = wait_readable(cfd);
+            if (select_result <= 0) {
+                // Timeout or error
+                if (select_result == 0) {
+                    WARN_LOG(stderr, "No command received: timeout waiting for data\n");
+                } else {
+                    WARN_LOG(stderr, "No command received: select() error\n");
+                    perror("select");
+                }
+                cleanup_and_exit(resp, cfd);
+            }
+        
+            if (line_reader_fill(&reader) <= 0) {
+                WARN_LOG(stderr, "Failed to read command or connection closed\n");
+                cleanup_and_exit(resp, cfd);
+            }
+            request_deadline_set(1);
+
+            size_t pending;
+            const char *data = line_reader_pending(&reader, &pending);
+            // The preamble may arrive split across reads
+            while (proto_preamble(data, pending) == 0) {
+                if (wait_readable(cfd) <= 0 || line_reader_fill(&reader) <= 0) {
+                    WARN_LOG(stderr, "Connection closed or timed out inside the binary preamble\n");
+                    cleanup_and_exit(resp, cfd);
+                }
+                data = line_reader_pending(&reader, &pending);
+            }
+            if (proto_preamble(data, pending) > 0) {
+                INFO_LOG(stderr, "Client uses the binary protocol\n");
+                serve_binary(cfd, resp, data + PROTO_MAGIC_LEN, pending - PROTO_MAGIC_LEN);
+                cleanup_and_exit(resp, cfd);
+            }
+            if (command_is_keepalive(data, pending)) {
+                INFO_LOG(stderr, "Client switched to keep-alive mode\n");
+                serve_keepalive(cfd, resp, &reader);
+                cleanup_and_exit(resp, cfd);
+            }
+            
+            // Wait for the end of the command line; at most COMMAND_MAX_LEN - 1
+            // bytes are accepted to stop large data stream attacks
+            struct line_slice line;
+            int rc;
+            while ((rc = line_reader_next(&reader, &line)) == LINE_NEED_MORE) {
+                if (wait_readable(cfd) <= 0) {
+                    WARN_LOG(stderr, "No command received: timeout waiting for newline\n");
+                    cleanup_and_exit(resp, cfd);
+                }
+                ssize_t n = line_reader_fill(&reader);
+                if (n <= 0) {
+                    // Peer half-closed after an unterminated command: run it
+                    if (n == 0 && line_reader_rest(&reader, &line)) {
+                        rc = LINE_OK;
+                    }
+                    break;
+                }
+            }
+            if (rc == LINE_TOO_LONG) {
+                WARN_LOG(stderr, "Large data stream detected without newline, closing connection\n");
+                cleanup_and_exit(resp, cfd);
+            }
+            
+            if (rc == LINE_OK && line.len > 0) {
+                // A single command owns the connection: slow producers
+                // (SYSINFO) may send their output as it is ready
+                response_stream(resp, cfd);
+                command_execute(line.data, resp);
+                cleanup_and_exit(resp, cfd);
+            } else {
+                // If no command received (client may have disconnected or timeout)
+                WARN_LOG(stderr, "No command received: empty command or connection issue\n");
+                cleanup_and_exit(resp, cfd);
+            }
+        } else {
+            // parent: the child's slot is released when it is reaped
+            admission_set_owner(ticket, pid);
+            // parent: no need to client socket
+            DEBUG_LOG(stderr, "Parent process: closing client socket, continuing to listen\n");
+            close(cfd);
+        }
     }
-    buf[n] = '\0';
-    DEBUG_LOG(stderr, "read_line: read %zd bytes\n", n);
-    return n;
 }
 
-// Shared function to send system information
-static void send_system_info(FILE *client_fp) {
-    if(fprintf(client_fp, "System Info:\n") < 0){
-        WARN_LOG(stderr, "Failed to write to client\n");
+// Run the configured connection engine on the listening sockets
+static int serve_connections(const struct listener_set *ls, void *arg) {
+    const struct server_options *opts = arg;
+    if (opts->engine == ENGINE_URING) {
+        int rc = uring_engine_run(ls, opts->threads, &server_should_exit);
+        if (rc != URING_UNSUPPORTED) {
+            return rc;
+        }
+        // Old kernel, seccomp filter or memlock limit: use the existing path
+        fprintf(stderr, "io_uring not available, falling back to the fork engine\n");
+        run_fork_engine(ls);
+        return 0;
+    }
+    if (opts->engine == ENGINE_EPOLL) {
+        if (epoll_engine_run(ls, opts->threads, &server_should_exit) < 0) {
+            ERROR_LOG(stderr, "epoll engine failed to start\n");
+            return -1;
+        }
+        return 0;
+    }
+    run_fork_engine(ls);
+    return 0;
+}
+
+// Close the AF_UNIX listener and remove its socket file
+static void close_unix_listener(const struct server_options *opts) {
+    if (opts->unix_fd < 0) {
         return;
     }
-    if(fflush(client_fp) != 0){
-        WARN_LOG(stderr, "fflush() failed\n");
-    }
-    sleep(10);
-    get_hostname(client_fp);
-    get_local_time(client_fp);
-    get_os_info(client_fp);
-    get_memory_usage(client_fp);
-    get_user_info(client_fp);
-    get_disk_info(client_fp);
-    get_env_info(client_fp);
-    get_network_info(client_fp);
+    close(opts->unix_fd);
+    if (unlink(opts->unix_path) < 0) {
+        WARN_LOG(stderr, "unlink(%s) failed\n", opts->unix_path);
+    }
 }
 
-// Shared function to cleanup resources and exit
-static void cleanup_and_exit(FILE *client_fp, int cfd) {
-    if(fflush(client_fp) != 0){
-        WARN_LOG(stderr, "fflush() failed\n");
+// Parse a deadline in milliseconds (0 disables it); -1 if out of range
+static int parse_timeout_ms(const char *arg, int *ms) {
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < 0 || value > 3600 * 1000) {
+        return -1;
     }
-    if(fclose(client_fp) != 0){
-        WARN_LOG(stderr, "fclose() failed\n");
+    *ms = (int)value;
+    return 0;
+}
+
+// Parse a connection cap (0 = unlimited); -1 if invalid
+static int parse_count(const char *arg, int *count) {
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < 0 || value > 1000000) {
+        return -1;
     }
-    close(cfd);
-    DEBUG_LOG(stderr, "Child process exiting\n");
-    exit(0);
+    *count = (int)value;
+    return 0;
+}
+
+// Parse RATE[:BURST] tokens per second (rate 0 = unlimited, burst defaults
+// to rate); -1 if invalid
+static int parse_rate(const char *arg, struct admission_rate *rate) {
+    char *end;
+    long r = strtol(arg, &end, 10);
+    long burst = r;
+    if (end == arg || r < 0 || r > 1000000) {
+        return -1;
+    }
+    if (*end == ':') {
+        const char *b = end + 1;
+        burst = strtol(b, &end, 10);
+        if (end == b || burst < 1 || burst > 1000000) {
+            return -1;
+        }
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    rate->rate = (int)r;
+    rate->burst = (int)burst;
+    return 0;
+}
+
+// Parse SECTION:MS[,SECTION:MS...] and install the SYSINFO test delays;
+// -1 if a section name or delay is invalid
+static int parse_sysinfo_delays(const char *arg) {
+    while (*arg != '\0') {
+        const char *colon = strchr(arg, ':');
+        if (colon == NULL) {
+            return -1;
+        }
+        int section = sysinfo_section_by_name(arg, (size_t)(colon - arg));
+        char *end;
+        long ms = strtol(colon + 1, &end, 10);
+        if (section < 0 || end == colon + 1 || ms < 0 || ms > 60 * 1000 || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        sysinfo_set_delay((enum sysinfo_section)section, (int)ms);
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[]){
@@ -92,7 +547,23 @@ int main(int argc, char *argv[]){
         }
     }
     
-    // Runtime debug log control: check command line arguments
+    struct server_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.engine = ENGINE_FORK;
+    opts.threads = 8;
+    opts.backlog = SERVER_DEFAULT_BACKLOG;
+    opts.sysinfo_ttl_ms = SYSINFO_CACHE_DEFAULT_TTL_MS;
+    opts.deadlines.read_idle_ms = DEADLINE_DEFAULT_READ_IDLE_MS;
+    opts.deadlines.write_idle_ms = DEADLINE_DEFAULT_WRITE_IDLE_MS;
+    opts.deadlines.request_ms = DEADLINE_DEFAULT_REQUEST_MS;
+    opts.deadlines.collector_ms = DEADLINE_DEFAULT_COLLECTOR_MS;
+    opts.sysinfo_threads = SYSINFO_SCHED_DEFAULT_THREADS;
+    opts.disk_timeout_ms = DISKINFO_DEFAULT_TIMEOUT_MS;
+    opts.disk_cache_ms = DISKINFO_DEFAULT_CACHE_MS;
+    admission_default_config(&opts.admission);
+    opts.unix_fd = -1;
+
+    // Runtime debug log control and server options: check command line arguments
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--debug") == 0 || strcmp(argv[i], "-d") == 0) {
             debug_log_enable();
@@ -105,48 +576,201 @@ int main(int argc, char *argv[]){
             }
         } else if (strcmp(argv[i], "--debug-disable") == 0) {
             debug_log_disable();
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            const char *name = argv[i] + 9;
+            if (strcmp(name, "fork") == 0) {
+                opts.engine = ENGINE_FORK;
+            } else if (strcmp(name, "epoll") == 0) {
+                opts.engine = ENGINE_EPOLL;
+            } else if (strcmp(name, "uring") == 0) {
+                opts.engine = ENGINE_URING;
+            } else {
+                fprintf(stderr, "Error: unknown engine '%s' (expected fork, epoll or uring)\n", name);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            opts.threads = atoi(argv[i] + 10);
+            if (opts.threads <= 0) {
+                fprintf(stderr, "Error: --threads must be a positive number\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--prefork") == 0) {
+            opts.prefork = 1;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            opts.prefork = 1;
+            opts.workers = atoi(argv[i] + 10);
+            if (opts.workers <= 0) {
+                fprintf(stderr, "Error: --workers must be a positive number\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--sysinfo-ttl=", 14) == 0) {
+            char *end;
+            long ttl = strtol(argv[i] + 14, &end, 10);
+            if (argv[i][14] == '\0' || *end != '\0' || ttl < 0 || ttl > 3600 * 1000) {
+                fprintf(stderr, "Error: --sysinfo-ttl must be 0..3600000 milliseconds\n");
+                return 1;
+            }
+            opts.sysinfo_ttl_ms = (int)ttl;
+        } else if (strncmp(argv[i], "--sysinfo-delay=", 16) == 0) {
+            // Test hook: simulate slow collectors, e.g. network:500
+            if (parse_sysinfo_delays(argv[i] + 16) < 0) {
+                fprintf(stderr, "Error: --sysinfo-delay must be SECTION:MS[,SECTION:MS...] with MS 0..60000\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--sysinfo-threads=", 18) == 0) {
+            char *end;
+            long n = strtol(argv[i] + 18, &end, 10);
+            if (argv[i][18] == '\0' || *end != '\0' || n < 0 || n > SYSINFO_SCHED_MAX_THREADS) {
+                fprintf(stderr, "Error: --sysinfo-threads must be 0..%d\n", SYSINFO_SCHED_MAX_THREADS);
+                return 1;
+            }
+            opts.sysinfo_threads = (int)n;
+        } else if (strncmp(argv[i], "--sysinfo-timeout=", 18) == 0) {
+            if (parse_timeout_ms(argv[i] + 18, &opts.deadlines.collector_ms) < 0) {
+                fprintf(stderr, "Error: --sysinfo-timeout must be 0..3600000 milliseconds\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--disk-timeout=", 15) == 0) {
+            if (parse_timeout_ms(argv[i] + 15, &opts.disk_timeout_ms) < 0) {
+                fprintf(stderr, "Error: --disk-timeout must be 0..3600000 milliseconds\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--disk-cache=", 13) == 0) {
+            if (parse_timeout_ms(argv[i] + 13, &opts.disk_cache_ms) < 0) {
+                fprintf(stderr, "Error: --disk-cache must be 0..3600000 milliseconds\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--read-timeout=", 15) == 0) {
+            if (parse_timeout_ms(argv[i] + 15, &opts.deadlines.read_idle_ms) < 0) {
+                fprintf(stderr, "Error: --read-timeout must be 0..3600000 milliseconds\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--write-timeout=", 16) == 0) {
+            if (parse_timeout_ms(argv[i] + 16, &opts.deadlines.write_idle_ms) < 0) {
+                fprintf(stderr, "Error: --write-timeout must be 0..3600000 milliseconds\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--request-timeout=", 18) == 0) {
+            if (parse_timeout_ms(argv[i] + 18, &opts.deadlines.request_ms) < 0) {
+                fprintf(stderr, "Error: --request-timeout must be 0..3600000 milliseconds\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--max-conns=", 12) == 0) {
+            if (parse_count(argv[i] + 12, &opts.admission.max_conns) < 0) {
+                fprintf(stderr, "Error: --max-conns must be a non-negative number\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--max-conns-per-ip=", 19) == 0) {
+            if (parse_count(argv[i] + 19, &opts.admission.max_per_ip) < 0) {
+                fprintf(stderr, "Error: --max-conns-per-ip must be a non-negative number\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--rate-sysinfo=", 15) == 0) {
+            if (parse_rate(argv[i] + 15, &opts.admission.rates[ADMISSION_SYSINFO]) < 0) {
+                fprintf(stderr, "Error: --rate-sysinfo must be RATE[:BURST] per second\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--rate-sendmail=", 16) == 0) {
+            if (parse_rate(argv[i] + 16, &opts.admission.rates[ADMISSION_SENDMAIL]) < 0) {
+                fprintf(stderr, "Error: --rate-sendmail must be RATE[:BURST] per second\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--rate-other=", 13) == 0) {
+            if (parse_rate(argv[i] + 13, &opts.admission.rates[ADMISSION_OTHER]) < 0) {
+                fprintf(stderr, "Error: --rate-other must be RATE[:BURST] per second\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--unix=", 7) == 0) {
+            opts.unix_path = argv[i] + 7;
+            if (opts.unix_path[0] == '\0') {
+                fprintf(stderr, "Error: --unix needs a socket path\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--async-mail") == 0) {
+            opts.async_mail = 1;
+        } else if (strncmp(argv[i], "--mail-journal=", 15) == 0) {
+            opts.mail_journal = argv[i] + 15;
+            if (opts.mail_journal[0] == '\0') {
+                fprintf(stderr, "Error: --mail-journal needs a path\n");
+                return 1;
+            }
+            // A journal is only useful to the queue
+            opts.async_mail = 1;
+        } else if (strncmp(argv[i], "--history-interval=", 19) == 0) {
+            char *end;
+            long ms = strtol(argv[i] + 19, &end, 10);
+            if (argv[i][19] == '\0' || *end != '\0' ||
+                (ms != 0 && (ms < HISTORY_MIN_INTERVAL_MS || ms > 3600 * 1000))) {
+                fprintf(stderr, "Error: --history-interval must be 0 or %d..3600000 milliseconds\n",
+                        HISTORY_MIN_INTERVAL_MS);
+                return 1;
+            }
+            opts.history_interval_ms = (int)ms;
+        } else if (strncmp(argv[i], "--history-file=", 15) == 0) {
+            opts.history_file = argv[i] + 15;
+            if (opts.history_file[0] == '\0') {
+                fprintf(stderr, "Error: --history-file needs a path\n");
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--backlog=", 10) == 0) {
+            opts.backlog = atoi(argv[i] + 10);
+            if (opts.backlog <= 0) {
+                fprintf(stderr, "Error: --backlog must be a positive number\n");
+                return 1;
+            }
         }
     }
     
     INFO_LOG(stderr, "Server starting...\n");
-    int server_sockfd;
-    int server_len;
-    /*  create a socket for the server */
-    struct sockaddr_in server_address;
-
-    server_sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_sockfd < 0) {
-        ERROR_LOG(stderr, "socket() failed\n");
-        perror("socket");
-        return 1;
+    // Worker threads of the event-driven engines share libcurl and the
+    // environment, so initialise both once before any thread exists
+    if (smtp_global_init() < 0) {
+        WARN_LOG(stderr, "smtp_global_init() failed, SENDMAIL may not work\n");
     }
-    DEBUG_LOG(stderr, "Socket created: fd %d\n", server_sockfd);
-    
-    server_address.sin_family = AF_INET;
-    server_address.sin_addr.s_addr = inet_addr("127.0.0.1");
-    if(server_address.sin_addr.s_addr == INADDR_NONE){
-        ERROR_LOG(stderr, "inet_addr() failed: invalid address\n");
-        close(server_sockfd);
-        return 1;
+    // Shared regions and /proc descriptors must exist before workers are
+    // forked so all inherit them
+    procfs_init();
+    if (sysinfo_cache_init(opts.sysinfo_ttl_ms) < 0) {
+        WARN_LOG(stderr, "sysinfo_cache_init() failed, SYSINFO will not be cached\n");
     }
-    server_address.sin_port = htons(9734);
-    server_len = sizeof(server_address);
-    
-    if (bind(server_sockfd, (struct sockaddr *)&server_address, server_len) < 0) {
-        ERROR_LOG(stderr, "bind() failed\n");
-        perror("bind");
-        close(server_sockfd);
-        return 1;
+    sysinfo_sched_init(opts.sysinfo_threads);
+    if (diskinfo_init(opts.disk_timeout_ms, opts.disk_cache_ms) < 0) {
+        WARN_LOG(stderr, "diskinfo_init() failed, each worker keeps its own mount table\n");
     }
-    INFO_LOG(stderr, "Socket bound to 127.0.0.1:9734\n");
-
-    if (listen(server_sockfd, 10) < 0) {
-        ERROR_LOG(stderr, "listen() failed\n");
-        perror("listen");
-        close(server_sockfd);
-        return 1;
+    if (deadline_init(&opts.deadlines) < 0) {
+        WARN_LOG(stderr, "deadline_init() failed, timeouts will not be counted\n");
+    }
+    if (admission_init(&opts.admission) < 0) {
+        WARN_LOG(stderr, "admission_init() failed, connections will not be limited\n");
+    }
+    // The dispatcher and the sampler are forked before the listener exists
+    // so they hold no client-facing sockets
+    if (opts.history_interval_ms > 0 && history_start(opts.history_interval_ms, opts.history_file) < 0) {
+        WARN_LOG(stderr, "history_start() failed, HISTORY is unavailable\n");
+        fprintf(stderr, "Warning: metric history unavailable\n");
+    }
+    if (opts.async_mail && mailq_start(opts.mail_journal) < 0) {
+        WARN_LOG(stderr, "mailq_start() failed, SENDMAIL stays synchronous\n");
+        fprintf(stderr, "Warning: asynchronous mail unavailable, SENDMAIL stays synchronous\n");
+    }
+    // In pre-fork mode every worker opens its own SO_REUSEPORT listener
+    int server_sockfd = -1;
+    if (!opts.prefork) {
+        server_sockfd = listener_open(SERVER_ADDR, SERVER_PORT, opts.backlog, 0);
+        if (server_sockfd < 0) {
+            return 1;
+        }
+    }
+    // The AF_UNIX listener is opened once; pre-forked workers share it
+    if (opts.unix_path != NULL) {
+        opts.unix_fd = listener_open_unix(opts.unix_path, opts.backlog);
+        if (opts.unix_fd < 0) {
+            if (server_sockfd >= 0) {
+                close(server_sockfd);
+            }
+            return 1;
+        }
     }
-    DEBUG_LOG(stderr, "Listening with backlog 10\n");
 
     
     struct sigaction sa; 
@@ -154,6 +778,10 @@ int main(int argc, char *argv[]){
     memset(&sa, 0, sizeof(sa));
     sa.sa_handler = SIG_DFL;
     sa.sa_flags = SA_RESTART | SA_NOCLDSTOP | SA_NOCLDWAIT;
+    if (opts.prefork) {
+        // The supervisor must waitpid() its workers to notice crashes
+        sa.sa_flags &= ~SA_NOCLDWAIT;
+    }
     if(sigaction(SIGCHLD, &sa, NULL) < 0){
         WARN_LOG(stderr, "sigaction(SIGCHLD) failed\n");
         perror("sigaction");
@@ -194,184 +822,44 @@ int main(int argc, char *argv[]){
     DEBUG_LOG(stderr, "Signal handlers configured\n");
     INFO_LOG(stderr, "Press Ctrl+/ (SIGQUIT) to exit server, Ctrl+C (SIGINT) is ignored\n");
     
-    printf("server listening on 127.0.0.1:9734\n");
+    printf("server listening on %s:%d\n", SERVER_ADDR, SERVER_PORT);
+    if (opts.unix_path != NULL) {
+        printf("server listening on unix:%s\n", opts.unix_path);
+    }
     printf("Press Ctrl+/ to exit server (Ctrl+C is ignored)\n");
+    static const char *engine_names[] = { "fork", "epoll", "uring" };
+    printf("connection engine: %s\n", engine_names[opts.engine]);
+    if (mailq_enabled()) {
+        printf("SENDMAIL: asynchronous (reply with job ID, query with STATUS <id>)\n");
+    }
+    if (history_enabled()) {
+        printf("HISTORY: sampling every %d ms\n", history_interval_ms());
+    }
+    // Flush before forking so children do not inherit (and repeat) buffered output
+    fflush(stdout);
 
+    if (opts.prefork) {
+        int rc = prefork_run(&opts, serve_connections, &opts, &server_should_exit);
+        mailq_stop();
+        history_stop();
+        close_unix_listener(&opts);
+        INFO_LOG(stderr, "Server exited\n");
+        return rc < 0 ? 1 : 0;
+    }
 
-    while(!server_should_exit){
-        struct sockaddr_in cli;
-        socklen_t clilen = sizeof(cli);
-        DEBUG_LOG(stderr, "Waiting for client connection...\n");
-        int cfd = accept(server_sockfd, (struct sockaddr *)&cli, &clilen);
-        if (cfd < 0) {
-            // Check if interrupted by SIGQUIT
-            if (errno == EINTR && server_should_exit) {
-                DEBUG_LOG(stderr, "accept() interrupted by SIGQUIT, exiting...\n");
-                break;
-            }
-            // If interrupted by other signal but not exit signal, continue waiting
-            if (errno == EINTR) {
-                continue;
-            }
-            ERROR_LOG(stderr, "accept() failed\n");
-            perror("accept");
-            continue;
-        }
-        INFO_LOG(stderr, "Client connected from %s:%d\n", inet_ntoa(cli.sin_addr), ntohs(cli.sin_port));
-
-        pid_t pid = fork();
-        if (pid < 0) {
-            ERROR_LOG(stderr, "fork() failed\n");
-            perror("fork");
-            close(cfd);
-            continue;
-        }
-        if (pid == 0) {
-            // child: don't need listening socket
-            DEBUG_LOG(stderr, "Child process started (PID: %d)\n", getpid());
-            close(server_sockfd);
-            
-            // Convert socket file descriptor to FILE* for fgets usage
-            FILE *client_fp = fdopen(cfd, "r+");
-            if (client_fp == NULL) {
-                ERROR_LOG(stderr, "fdopen() failed\n");
-                perror("fdopen");
-                close(cfd);
-                exit(1);
-            }
-            DEBUG_LOG(stderr, "Client file stream opened\n");
-            
-            // Use fgets to read client data
-            char command[256];
-            char to[256];
-            char subject[256];
-            char body[1024];
-            
-            // Use select() to check if socket is readable (implement timeout)
-            fd_set readfds;
-            struct timeval select_timeout;
-            FD_ZERO(&readfds);
-            FD_SET(cfd, &readfds);
-            select_timeout.tv_sec = 30;
-            select_timeout.tv_usec = 0;
-            
-            int select_result = select(cfd + 1, &readfds, NULL, NULL, &select_timeout);
-            if (select_result <= 0) {
-                // Timeout or error
-                if (select_result == 0) {
-                    WARN_LOG(stderr, "No command received: timeout waiting for data\n");
-                } else {
-                    WARN_LOG(stderr, "No command received: select() error\n");
-                    perror("select");
-                }
-                cleanup_and_exit(client_fp, cfd);
-            }
-        
-            // Limit data read to prevent large data stream attacks
-            // Use read() directly, read at most 256 bytes (command buffer size)
-            char temp_buf[256];
-            ssize_t bytes_read = read(cfd, temp_buf, sizeof(temp_buf) - 1);
-            if (bytes_read <= 0) {
-                WARN_LOG(stderr, "Failed to read command or connection closed\n");
-                cleanup_and_exit(client_fp, cfd);
-            }
-            temp_buf[bytes_read] = '\0';
-            
-            // Check if newline character exists
-            char *newline = strchr(temp_buf, '\n');
-            
-            if (newline == NULL && bytes_read == sizeof(temp_buf) - 1) {
-                // No newline and buffer full, likely a large data stream attack
-                WARN_LOG(stderr, "Large data stream detected without newline, closing connection\n");
-                cleanup_and_exit(client_fp, cfd);
-            }
-            
-            // Copy data to command buffer
-            if (newline != NULL) {
-                *newline = '\0';
-            }
-            // Remove carriage return
-            char *carriage = strchr(temp_buf, '\r');
-            if (carriage != NULL) {
-                *carriage = '\0';
-            }
-            strncpy(command, temp_buf, sizeof(command) - 1);
-            command[sizeof(command) - 1] = '\0';
-            
-            // Read command (socket is readable, safe to call fgets)
-            if (strlen(command) > 0) {
-                INFO_LOG(stderr, "Received command: %s\n", command);
-                
-                // Process according to command
-                if (strncmp(command, "SENDMAIL", 8) == 0) {
-                    INFO_LOG(stderr, "Processing SENDMAIL command\n");
-                    // Parse parameters from command line (format: SENDMAIL|to|subject|body)
-                    char *token = strtok(command, "|");
-                    if (token != NULL && strcmp(token, "SENDMAIL") == 0) {
-                        // Parse 'to'
-                        token = strtok(NULL, "|");
-                        if (token != NULL) {
-                            strncpy(to, token, sizeof(to) - 1);
-                            to[sizeof(to) - 1] = '\0';
-                            DEBUG_LOG(stderr, "To: %s\n", to);
-                        }
-                        // Parse 'subject'
-                        token = strtok(NULL, "|");
-                        if (token != NULL) {
-                            strncpy(subject, token, sizeof(subject) - 1);
-                            subject[sizeof(subject) - 1] = '\0';
-                            DEBUG_LOG(stderr, "Subject: %s\n", subject);
-                        }
-                        // Parse 'body'
-                        token = strtok(NULL, "|");
-                        if (token != NULL) {
-                            strncpy(body, token, sizeof(body) - 1);
-                            body[sizeof(body) - 1] = '\0';
-                            DEBUG_LOG(stderr, "Body length: %zu\n", strlen(body));
-                        }
-                    }
-                    
-                    // Process email sending (can call send_email function here)
-                    if(fprintf(client_fp, "Command: SENDMAIL\n") < 0 ||
-                       fprintf(client_fp, "To: %s\n", to) < 0 ||
-                       fprintf(client_fp, "Subject: %s\n", subject) < 0 ||
-                       fprintf(client_fp, "Body: %s\n", body) < 0){
-                        WARN_LOG(stderr, "Failed to write response to client\n");
-                    }
-                    
-                    INFO_LOG(stderr, "Sending email to %s\n", to);
-                    if(send_email(to, subject, body) < 0){
-                        ERROR_LOG(stderr, "Failed to send email to %s\n", to);
-                        fprintf(client_fp, "Error: Failed to send email\n");
-                    } else {
-                        INFO_LOG(stderr, "Email sent successfully to %s\n", to);
-                        fprintf(client_fp, "Email sent successfully\n");
-                    }
-                    // Close connection
-                    cleanup_and_exit(client_fp, cfd);
-                } else if (strcmp(command, "SYSINFO") == 0) {
-                    // Explicitly handle SYSINFO command
-                    INFO_LOG(stderr, "Processing SYSINFO command\n");
-                    send_system_info(client_fp);
-                    cleanup_and_exit(client_fp, cfd);
-                } else {
-                    // Other unknown commands
-                    WARN_LOG(stderr, "Unknown command: %s\n", command);
-                    cleanup_and_exit(client_fp, cfd);
-                }
-            } else {
-                // If no command received (client may have disconnected or timeout)
-                WARN_LOG(stderr, "No command received: empty command or connection issue\n");
-                cleanup_and_exit(client_fp, cfd);
-            }
-        } else {
-            // parent: no need to client socket
-            DEBUG_LOG(stderr, "Parent process: closing client socket, continuing to listen\n");
-            close(cfd);
-        }
-        
+    struct listener_set ls = { { server_sockfd, -1 }, 1 };
+    if (opts.unix_fd >= 0) {
+        ls.fds[ls.count++] = opts.unix_fd;
     }
-    
+    int rc = serve_connections(&ls, &opts);
+    mailq_stop();
+    history_stop();
+    close_unix_listener(&opts);
+    if (rc < 0) {
+        close(server_sockfd);
+        return 1;
+    }
+
     // Graceful exit: close listening socket
     INFO_LOG(stderr, "Server shutting down gracefully...\n");
     if(close(server_sockfd) < 0){
@@ -380,5 +868,4 @@ int main(int argc, char *argv[]){
     }
     INFO_LOG(stderr, "Server exited\n");
     return 0;
-
-}
\ No newline at end of file
+}
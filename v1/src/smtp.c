@@ -1,12 +1,45 @@
 #include "smtp.h"
 #include "env.h"
 #include "debug.h"
+#include "mailhttp.h"
 #include <curl/curl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <stdint.h>
+#include <pthread.h>
+
+// Serialises .env loading: setenv() is not safe against concurrent callers
+static pthread_mutex_t env_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Load .env file from project root directory
+// Try loading common .env locations, succeed if any one works, otherwise return error
+static int load_sendgrid_env(void){
+    const char *env_paths[] = { "../../.env", "../.env", ".env" };
+    int found = 0;
+    DEBUG_LOG(stderr, "send_email: Looking for .env file...\n");
+    pthread_mutex_lock(&env_lock);
+    for (size_t i = 0; i < sizeof(env_paths)/sizeof(env_paths[0]); ++i) {
+        DEBUG_LOG(stderr, "  Trying: %s\n", env_paths[i]);
+        if (load_env_file(env_paths[i]) == 0) {
+            found = 1;
+            INFO_LOG(stderr, "  Found .env file at: %s\n", env_paths[i]);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&env_lock);
+    return found ? 0 : -1;
+}
+
+int smtp_global_init(void){
+    if(curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK){
+        ERROR_LOG(stderr, "curl_global_init() failed\n");
+        return -1;
+    }
+    // Preload credentials so later per-request loads never add new variables
+    return load_sendgrid_env();
+}
 
 static char *json_escape(const char *str){
     DEBUG_LOG(stderr, "json_escape: escaping string (length: %zu)\n", str ? strlen(str) : 0);
@@ -57,32 +90,66 @@ static char *json_escape(const char *str){
     return escaped;
     }
 int send_email(const char *recipient, const char *subject, const char *body){
+    int http_code;
+    return send_email_http(recipient, subject, body, &http_code);
+}
+
+// JSON personalizations, one per recipient so none of them sees the others
+static char *build_personalizations(const char *const recipients[], int count){
+    const char *fmt = "%s{\"to\":[{\"email\":\"%s\"}]}";
+    size_t cap = 1;
+    for(int i = 0; i < count; i++){
+        if(recipients[i] == NULL){
+            return NULL;
+        }
+        // Worst case escaping plus the JSON around each address
+        cap += strlen(recipients[i]) * 6 + strlen(fmt) + 1;
+    }
+    char *out = malloc(cap);
+    if(out == NULL){
+        ERROR_LOG(stderr, "malloc() failed for personalizations\n");
+        return NULL;
+    }
+    size_t len = 0;
+    out[0] = '\0';
+    for(int i = 0; i < count; i++){
+        char *escaped = json_escape(recipients[i]);
+        if(escaped == NULL){
+            free(out);
+            return NULL;
+        }
+        int n = snprintf(out + len, cap - len, fmt, i > 0 ? "," : "", escaped);
+        free(escaped);
+        if(n < 0 || (size_t)n >= cap - len){
+            ERROR_LOG(stderr, "snprintf() failed for personalizations (truncated or error)\n");
+            free(out);
+            return NULL;
+        }
+        len += (size_t)n;
+    }
+    return out;
+}
+
+// Credentials and JSON body of one message to count recipients: fills
+// auth_header and returns the malloc()ed payload, or NULL on error
+static char *prepare_request(const char *const recipients[], int count, const char *subject, const char *body,
+                             char *auth_header, size_t auth_size){
     // Parameter validation
-    if(recipient == NULL || subject == NULL || body == NULL){
+    if(recipients == NULL || count <= 0 || recipients[0] == NULL || subject == NULL || body == NULL){
         ERROR_LOG(stderr, "send_email: NULL parameter (recipient, subject, or body)\n");
         fprintf(stderr, "Error: recipient, subject, and body cannot be NULL\n");
-        return -1;
+        return NULL;
     }
     
-    INFO_LOG(stderr, "send_email: Preparing to send email to %s\n", recipient);
-    // Load .env file from project root directory
-    // Try loading common .env locations, succeed if any one works, otherwise return error
-    
-    const char *env_paths[] = { "../../.env", "../.env", ".env" };
-    int found = 0;
-    DEBUG_LOG(stderr, "send_email: Looking for .env file...\n");
-    for (size_t i = 0; i < sizeof(env_paths)/sizeof(env_paths[0]); ++i) {
-        DEBUG_LOG(stderr, "  Trying: %s\n", env_paths[i]);
-        if (load_env_file(env_paths[i]) == 0) {
-            found = 1;
-            INFO_LOG(stderr, "  Found .env file at: %s\n", env_paths[i]);
-            break;
-        }
+    if(count == 1){
+        INFO_LOG(stderr, "send_email: Preparing to send email to %s\n", recipients[0]);
+    } else {
+        INFO_LOG(stderr, "send_email: Preparing to send email to %d recipients\n", count);
     }
-    if (!found) {
+    if (load_sendgrid_env() < 0) {
         ERROR_LOG(stderr, "Cannot find .env file in project root directory or parent directories\n");
         fprintf(stderr, "Error: Cannot find .env file in project root directory or parent directories\n");
-        return -1;
+        return NULL;
     }
     const char *sendgrid_api_key = getenv("SENDGRID_API_KEY");
     const char *from_email = getenv("SENDGRID_FROM");
@@ -90,25 +157,27 @@ int send_email(const char *recipient, const char *subject, const char *body){
     if (sendgrid_api_key == NULL || from_email == NULL) {
         ERROR_LOG(stderr, "SENDGRID_API_KEY or SENDGRID_FROM not set in .env file\n");
         fprintf(stderr, "Error: SENDGRID_API_KEY or SENDGRID_FROM not set in .env file\n");
-        return -1;
+        return NULL;
     }
     DEBUG_LOG(stderr, "send_email: Environment variables loaded, from: %s\n", from_email);
 
     DEBUG_LOG(stderr, "send_email: Escaping JSON strings\n");
     char *escaped_subject = json_escape(subject);
     char *escaped_body = json_escape(body);
-    if(!escaped_subject|| !escaped_body){
+    char *personalizations = build_personalizations(recipients, count);
+    if(!escaped_subject|| !escaped_body || !personalizations){
         ERROR_LOG(stderr, "json_escape() failed\n");
         perror("json_escape");
         free(escaped_subject);
         free(escaped_body);
-        return -1;
+        free(personalizations);
+        return NULL;
     }
 
     // Check string length to avoid overflow
     size_t subject_len = strlen(escaped_subject);
     size_t body_len = strlen(escaped_body);
-    size_t recipient_len = strlen(recipient);
+    size_t recipient_len = strlen(personalizations);
     size_t from_len = strlen(from_email);
     
     // Check for overflow (check if sum exceeds SIZE_MAX)
@@ -118,7 +187,8 @@ int send_email(const char *recipient, const char *subject, const char *body){
         ERROR_LOG(stderr, "String length too large, potential overflow\n");
         free(escaped_subject);
         free(escaped_body);
-        return -1;
+        free(personalizations);
+        return NULL;
     }
     
     size_t payload_size = subject_len + body_len + recipient_len + from_len + 256;
@@ -128,7 +198,8 @@ int send_email(const char *recipient, const char *subject, const char *body){
         ERROR_LOG(stderr, "Payload size calculation overflow\n");
         free(escaped_subject);
         free(escaped_body);
-        return -1;
+        free(personalizations);
+        return NULL;
     }
     
     DEBUG_LOG(stderr, "send_email: Allocating payload buffer (size: %zu)\n", payload_size);
@@ -138,106 +209,215 @@ int send_email(const char *recipient, const char *subject, const char *body){
         perror("malloc");
         free(escaped_subject);
         free(escaped_body);
-        return -1;
+        free(personalizations);
+        return NULL;
     }
     int snprintf_result = snprintf(payload, payload_size,
         "{"
-          "\"personalizations\":[{\"to\":[{\"email\":\"%s\"}]}],"
+          "\"personalizations\":[%s],"
           "\"from\":{\"email\":\"%s\"},"
           "\"subject\":\"%s\","
           "\"content\":[{\"type\":\"text/plain\",\"value\":\"%s\"}]"
         "}",
-        recipient, from_email, escaped_subject, escaped_body
+        personalizations, from_email, escaped_subject, escaped_body
     );
     if(snprintf_result < 0 || snprintf_result >= (int)payload_size){
         ERROR_LOG(stderr, "snprintf() failed for payload (truncated or error)\n");
         free(payload);
         free(escaped_subject);
         free(escaped_body);
-        return -1;
+        free(personalizations);
+        return NULL;
     }
 
     free(escaped_subject); 
     free(escaped_body);
+    free(personalizations);
 
-    INFO_LOG(stderr, "send_email: Initializing CURL\n");
-    CURL *curl = curl_easy_init();
-    if(curl == NULL){
-        ERROR_LOG(stderr, "curl_easy_init() failed\n");
-        perror("curl_easy_init");
+    snprintf_result = snprintf(auth_header, auth_size, "Authorization: Bearer %s", sendgrid_api_key);
+    if(snprintf_result < 0 || snprintf_result >= (int)auth_size){
+        ERROR_LOG(stderr, "snprintf() failed for auth header (truncated or error)\n");
         free(payload);
-        return -1;
+        return NULL;
     }
+    return payload;
+}
 
-    struct curl_slist *headers = NULL;
-    char auth_header[512];
-    snprintf_result = snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", sendgrid_api_key);
-    if(snprintf_result < 0 || snprintf_result >= (int)sizeof(auth_header)){
-        ERROR_LOG(stderr, "snprintf() failed for auth header (truncated or error)\n");
-        curl_easy_cleanup(curl);
-        free(payload);
+// Map a transport result to send_email_http()'s: only 202 is a success
+static int check_response(int rc, int http_code){
+    if (rc < 0) {
         return -1;
     }
-    headers = curl_slist_append(headers, auth_header);
-    if(headers == NULL){
-        ERROR_LOG(stderr, "curl_slist_append() failed for auth header\n");
-        curl_easy_cleanup(curl);
-        free(payload);
+    INFO_LOG(stderr, "send_email: HTTP response code: %d\n", http_code);
+    if (http_code != 202) {
+        ERROR_LOG(stderr, "SendGrid API returned error: %d\n", http_code);
+        fprintf(stderr, "SendGrid API returned error: %d\n", http_code);
         return -1;
     }
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    if(headers == NULL){
-        ERROR_LOG(stderr, "curl_slist_append() failed for Content-Type header\n");
-        curl_slist_free_all(headers);
-        curl_easy_cleanup(curl);
-        free(payload);
+    INFO_LOG(stderr, "send_email: Email sent successfully\n");
+    return 0;
+}
+
+int send_email_http(const char *recipient, const char *subject, const char *body, int *http_code_out){
+    *http_code_out = 0;
+    char auth_header[512];
+    char *payload = prepare_request(&recipient, 1, subject, body, auth_header, sizeof(auth_header));
+    if (payload == NULL) {
         return -1;
     }
-    DEBUG_LOG(stderr, "send_email: HTTP headers configured\n");
+    // Through the process's mail transport, on one of its warm connections
+    int rc = mailhttp_post_wait(auth_header, payload, strlen(payload), http_code_out);
+    return check_response(rc, *http_code_out);
+}
 
-    char errbuf[CURL_ERROR_SIZE] = {0};
+struct async_send {
+    send_email_done_fn done;
+    void *arg;
+};
 
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.sendgrid.com/v3/mail/send");
-    curl_easy_setopt(curl, CURLOPT_POST, 1L);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)strlen(payload));
-    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 20L);
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
-    DEBUG_LOG(stderr, "send_email: CURL options set, sending request...\n");
+static void async_send_done(void *arg, int rc, int http_code){
+    struct async_send *a = arg;
+    a->done(a->arg, check_response(rc, http_code), http_code);
+    free(a);
+}
 
-    CURLcode res = curl_easy_perform(curl);
-    
-    int http_code = 0;
-    if (res != CURLE_OK){
-        ERROR_LOG(stderr, "curl_easy_perform failed: %s\n", errbuf);
-        fprintf(stderr, "curl_easy_perform failed: %s\n", errbuf);
-    } else {
-        CURLcode getinfo_res = curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
-        if(getinfo_res != CURLE_OK){
-            WARN_LOG(stderr, "curl_easy_getinfo() failed, using default http_code 0\n");
-            http_code = 0;
-        } else {
-            INFO_LOG(stderr, "send_email: HTTP response code: %d\n", http_code);
+int send_email_async(const char *recipient, const char *subject, const char *body,
+                     send_email_done_fn done, void *arg){
+    char auth_header[512];
+    struct async_send *a = malloc(sizeof(*a));
+    if (a == NULL) {
+        ERROR_LOG(stderr, "malloc() failed for mail request\n");
+        return -1;
+    }
+    a->done = done;
+    a->arg = arg;
+    char *payload = prepare_request(&recipient, 1, subject, body, auth_header, sizeof(auth_header));
+    if (payload == NULL || mailhttp_post(auth_header, payload, strlen(payload), async_send_done, a) < 0) {
+        free(a);
+        return -1;
+    }
+    return 0;
+}
+
+// Plausible address: text on both sides of one '@' and nothing that could
+// make SendGrid reject the whole batch it travels in
+static int valid_recipient(const char *addr){
+    size_t len = strlen(addr);
+    const char *at = strchr(addr, '@');
+    if(len < 3 || len > SMTP_ADDR_MAX || at == NULL || at == addr || at[1] == '\0' ||
+       strchr(at + 1, '@') != NULL){
+        return 0;
+    }
+    for(const char *p = addr; *p != '\0'; p++){
+        unsigned char c = (unsigned char)*p;
+        if(c <= ' ' || c == 0x7f || strchr("\"\\,;<>()[]", c) != NULL){
+            return 0;
         }
     }
+    return 1;
+}
 
-    curl_easy_cleanup(curl);
-    curl_slist_free_all(headers);
-    free(payload);
+// Recipients of one send_email_to_multiple_recipients() call
+struct multi_send {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;   // signalled as batches finish
+    int pending;                // batches not finished yet
+    int *http_codes;            // the caller's, indexed by recipient
+};
 
-    if (res != CURLE_OK) {
-        return -1;
+struct multi_batch {
+    struct multi_send *ms;
+    const int *index;           // the batch's recipients, as caller indexes
+    int count;
+};
+
+// Runs on the mail transport thread
+static void multi_batch_done(void *arg, int rc, int http_code){
+    struct multi_batch *b = arg;
+    struct multi_send *ms = b->ms;
+    if(rc < 0){
+        http_code = 0;
     }
+    if(http_code != 202){
+        ERROR_LOG(stderr, "SendGrid API returned error for a batch of %d recipients: %d\n", b->count, http_code);
+    }
+    pthread_mutex_lock(&ms->lock);
+    for(int i = 0; i < b->count; i++){
+        ms->http_codes[b->index[i]] = http_code;
+    }
+    ms->pending--;
+    pthread_cond_signal(&ms->done_cond);
+    pthread_mutex_unlock(&ms->lock);
+}
 
-    if (http_code != 202) {
-        ERROR_LOG(stderr, "SendGrid API returned error: %d\n", http_code);
-        fprintf(stderr, "SendGrid API returned error: %d\n", http_code);
+int send_email_to_multiple_recipients(const char *recipients[], int num_recipients, const char *subject, const char *body,
+                                      int *http_codes){
+    if(recipients == NULL || num_recipients <= 0 || http_codes == NULL){
+        ERROR_LOG(stderr, "send_email_to_multiple_recipients: no recipients\n");
+        return -1;
+    }
+    // Valid recipients, in order, and where each one came from
+    const char **valid = malloc((size_t)num_recipients * sizeof(*valid));
+    int *index = malloc((size_t)num_recipients * sizeof(*index));
+    int nbatches_max = (num_recipients + SMTP_MAX_BATCH - 1) / SMTP_MAX_BATCH;
+    struct multi_batch *batches = malloc((size_t)nbatches_max * sizeof(*batches));
+    if(valid == NULL || index == NULL || batches == NULL){
+        ERROR_LOG(stderr, "malloc() failed for recipient batches\n");
+        free(valid);
+        free(index);
+        free(batches);
         return -1;
     }
+    int nvalid = 0;
+    for(int i = 0; i < num_recipients; i++){
+        if(recipients[i] != NULL && valid_recipient(recipients[i])){
+            valid[nvalid] = recipients[i];
+            index[nvalid++] = i;
+            http_codes[i] = 0;
+        } else {
+            WARN_LOG(stderr, "send_email: skipping invalid recipient %s\n", recipients[i] ? recipients[i] : "(null)");
+            http_codes[i] = SMTP_INVALID_RECIPIENT;
+        }
+    }
 
-    INFO_LOG(stderr, "send_email: Email sent successfully\n");
-    return 0;
-    
+    struct multi_send ms = { .lock = PTHREAD_MUTEX_INITIALIZER, .done_cond = PTHREAD_COND_INITIALIZER,
+                             .http_codes = http_codes };
+    char auth_header[512];
+    // Every batch is queued before any answer is awaited: the transport
+    // sends them side by side on its warm connections
+    for(int first = 0, nb = 0; first < nvalid; first += SMTP_MAX_BATCH, nb++){
+        struct multi_batch *b = &batches[nb];
+        b->ms = &ms;
+        b->index = index + first;
+        b->count = nvalid - first < SMTP_MAX_BATCH ? nvalid - first : SMTP_MAX_BATCH;
+        char *payload = prepare_request(valid + first, b->count, subject, body, auth_header, sizeof(auth_header));
+        if(payload == NULL){
+            continue;
+        }
+        pthread_mutex_lock(&ms.lock);
+        ms.pending++;
+        pthread_mutex_unlock(&ms.lock);
+        if(mailhttp_post(auth_header, payload, strlen(payload), multi_batch_done, b) < 0){
+            pthread_mutex_lock(&ms.lock);
+            ms.pending--;
+            pthread_mutex_unlock(&ms.lock);
+        }
+    }
+    pthread_mutex_lock(&ms.lock);
+    while(ms.pending > 0){
+        pthread_cond_wait(&ms.done_cond, &ms.lock);
+    }
+    pthread_mutex_unlock(&ms.lock);
+    pthread_cond_destroy(&ms.done_cond);
+    pthread_mutex_destroy(&ms.lock);
+
+    int sent = 0;
+    for(int i = 0; i < num_recipients; i++){
+        sent += http_codes[i] == 202;
+    }
+    INFO_LOG(stderr, "send_email: %d of %d recipients accepted\n", sent, num_recipients);
+    free(valid);
+    free(index);
+    free(batches);
+    return sent;
 }
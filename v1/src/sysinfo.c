@@ -1,263 +1,785 @@
 #define _GNU_SOURCE
 #include "../include/sysinfo.h"
+#include "../include/procfs.h"
+#include "../include/diskinfo.h"
 
 #include <sys/utsname.h>
 #include <sys/sysinfo.h>
 #include <sys/statvfs.h>
 #include <sys/ioctl.h>  // for ioctl
-#include <ifaddrs.h>
+#include <sys/socket.h>
+#include <ifaddrs.h>    // for getifaddrs
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>  // for struct rtnl_link_stats64
 #include <netdb.h>
-#include <net/if.h>    // for IFNAMSIZ
+#include <net/if.h>     // for IFNAMSIZ, SIOCGIFFLAGS, SIOCGIFMTU, SIOCGIFNETMASK, SIOCGIFBRDADDR
 #include <arpa/inet.h>
 #include <netpacket/packet.h>
 #include <pwd.h>
 #include <unistd.h>
 #include <time.h>
+#include <errno.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <net/if.h>    // for SIOCGIFFLAGS, SIOCGIFMTU, SIOCGIFNETMASK, SIOCGIFBRDADDR
-#include <ifaddrs.h> // for getifaddrs
-
-int get_hostname(FILE *fp){
-    INFO_LOG(fp, "Getting hostname...\n");
-    fprintf(fp, "=== Hostname ===\n");
-    char hostname[256] = {0};
-    if(gethostname(hostname, sizeof(hostname)) < 0){
-        ERROR_LOG(fp, "gethostname() failed\n");
+
+// Collectors only fill the snapshot; text, JSON etc. are the renderers' job.
+// Logs always go to stderr, never into a client stream.
+
+// Copy a string into a fixed-size field, truncating if needed
+static void copy_field(char *dst, size_t cap, const char *src) {
+    snprintf(dst, cap, "%s", src);
+}
+
+int get_hostname(struct sysinfo_snapshot *snap){
+    INFO_LOG(stderr, "Getting hostname...\n");
+    if(gethostname(snap->hostname, sizeof(snap->hostname)) < 0){
+        ERROR_LOG(stderr, "gethostname() failed\n");
         perror("gethostname");
+        snap->hostname[0] = '\0';
         return -1;
     }
-    DEBUG_LOG(fp, "Hostname retrieved: %s\n", hostname);
-    fprintf(fp, "Hostname: %s\n", hostname);
+    snap->hostname[sizeof(snap->hostname) - 1] = '\0';
+    DEBUG_LOG(stderr, "Hostname retrieved: %s\n", snap->hostname);
     return 0;
 }
 
-// single thread
-int get_local_time(FILE *fp){
-    INFO_LOG(fp, "Getting local time...\n");
-    fprintf(fp, "=== Local Time ===\n");
+// Collectors use the reentrant libc variants (getpwuid_r, ...) because the
+// epoll engine runs them on worker threads
+int get_local_time(struct sysinfo_snapshot *snap){
+    INFO_LOG(stderr, "Getting local time...\n");
     time_t now = time(NULL);
     if(now == (time_t)-1){
-        ERROR_LOG(fp, "time() failed\n");
+        ERROR_LOG(stderr, "time() failed\n");
         perror("time");
         return -1;
     }
-    struct tm *local_time = localtime(&now);
-    if(local_time == NULL){
-        ERROR_LOG(fp, "localtime() failed\n");
-        perror("localtime");
-        return -1;
-    }
-    DEBUG_LOG(fp, "Time retrieved: %ld\n", now);
-    fprintf(fp, "Local Time: %s\n", asctime(local_time));
+    DEBUG_LOG(stderr, "Time retrieved: %ld\n", now);
+    snap->time = now;
     return 0;
 }
 
-int get_os_info(FILE *fp){
-    INFO_LOG(fp, "Getting OS information...\n");
-    fprintf(fp, "=== Operating System ===\n");
+int get_os_info(struct sysinfo_snapshot *snap){
+    INFO_LOG(stderr, "Getting OS information...\n");
     struct utsname name;
     if(uname(&name) < 0){
-        ERROR_LOG(fp, "uname() failed\n");
+        ERROR_LOG(stderr, "uname() failed\n");
         perror("uname");
         return -1;
     }
-    INFO_LOG(fp, "OS: %s, Release: %s, Machine: %s\n", name.sysname, name.release, name.machine);
-    fprintf(fp, "OS: %s\n", name.sysname);
-    fprintf(fp, "Release: %s\n", name.release);
-    fprintf(fp, "Version: %s\n", name.version);
-    fprintf(fp, "Machine: %s\n", name.machine);
+    INFO_LOG(stderr, "OS: %s, Release: %s, Machine: %s\n", name.sysname, name.release, name.machine);
+    copy_field(snap->os_name, sizeof(snap->os_name), name.sysname);
+    copy_field(snap->os_release, sizeof(snap->os_release), name.release);
+    copy_field(snap->os_version, sizeof(snap->os_version), name.version);
+    copy_field(snap->os_machine, sizeof(snap->os_machine), name.machine);
     return 0;
 }
 
-int get_memory_usage(FILE *fp){
-    INFO_LOG(fp, "Getting memory usage...\n");
-    fprintf(fp, "=== System Resources ===\n");
+int get_memory_usage(struct sysinfo_snapshot *snap){
+    INFO_LOG(stderr, "Getting memory usage...\n");
     struct sysinfo info;
     if(sysinfo(&info) < 0){
-        ERROR_LOG(fp, "sysinfo() failed\n");
+        ERROR_LOG(stderr, "sysinfo() failed\n");
         perror("sysinfo");
         return -1;
     }
-    // Check for division by zero
-    if(info.totalram == 0){
-        ERROR_LOG(fp, "sysinfo() returned zero total RAM\n");
-        fprintf(fp, "Error: Invalid system information (zero total RAM)\n");
+    snap->uptime = info.uptime;
+    for(int i = 0; i < 3; i++){
+        snap->loads[i] = info.loads[i];
+    }
+    snap->total_ram = (uint64_t)info.totalram * info.mem_unit;
+    snap->free_ram = (uint64_t)info.freeram * info.mem_unit;
+    // The page cache figures exist only in /proc/meminfo; without them the
+    // section is still valid
+    struct procfs_meminfo mi;
+    if(procfs_meminfo(&mi) == 0){
+        snap->available_ram = mi.available;
+        snap->buffer_ram = mi.buffers;
+        snap->cached_ram = mi.cached;
+    }
+    // Renderers must not divide by zero
+    if(snap->total_ram == 0){
+        ERROR_LOG(stderr, "sysinfo() returned zero total RAM\n");
         return -1;
     }
-    float mem_usage = (float)(info.totalram - info.freeram) / info.totalram * 100;
-    INFO_LOG(fp, "Memory usage: %.2f%%, Uptime: %ld seconds\n", mem_usage, info.uptime);
-    fprintf(fp, "Uptime:      %ld seconds\n", info.uptime);
-    fprintf(fp, "Load Avg:    %.2f %.2f %.2f (1/5/15 min)\n", 
-               info.loads[0] / 65536.0, 
-               info.loads[1] / 65536.0, 
-               info.loads[2] / 65536.0);
-    fprintf(fp, "Total RAM:   %ld bytes\n", info.totalram);
-    fprintf(fp, "Free RAM:    %ld bytes\n", info.freeram);
-    fprintf(fp, "Used RAM:    %ld bytes\n", info.totalram - info.freeram);
-    fprintf(fp, "Memory Usage: %f%%\n", mem_usage);
+    INFO_LOG(stderr, "Total RAM: %llu bytes, Uptime: %ld seconds\n",
+              (unsigned long long)snap->total_ram, info.uptime);
     return 0;
 }
 
-int get_user_info(FILE *fp){
-    INFO_LOG(fp, "Getting user information...\n");
-    fprintf(fp, "=== User Information ===\n");
+int get_user_info(struct sysinfo_snapshot *snap){
+    INFO_LOG(stderr, "Getting user information...\n");
     uid_t uid = getuid();
-    DEBUG_LOG(fp, "Current UID: %d\n", uid);
-    struct passwd *pw = getpwuid(uid);
-    if(pw == NULL){
-        ERROR_LOG(fp, "getpwuid() failed for UID: %d\n", uid);
+    DEBUG_LOG(stderr, "Current UID: %d\n", uid);
+    struct passwd pw_buf;
+    struct passwd *pw = NULL;
+    char pw_strings[1024];
+    if(getpwuid_r(uid, &pw_buf, pw_strings, sizeof(pw_strings), &pw) != 0 || pw == NULL){
+        ERROR_LOG(stderr, "getpwuid() failed for UID: %d\n", uid);
         perror("getpwuid");
         return -1;
     }
-    INFO_LOG(fp, "User: %s, Home: %s\n", pw->pw_name, pw->pw_dir);
-    fprintf(fp, "User: %s\n", pw->pw_name);
-    fprintf(fp, "Home: %s\n", pw->pw_dir);
+    INFO_LOG(stderr, "User: %s, Home: %s\n", pw->pw_name, pw->pw_dir);
+    copy_field(snap->user, sizeof(snap->user), pw->pw_name);
+    copy_field(snap->home, sizeof(snap->home), pw->pw_dir);
     return 0;
 }
 
-int get_disk_info(FILE *fp){
-    INFO_LOG(fp, "Getting disk information for root filesystem...\n");
-    fprintf(fp, "=== Disk Usage ===\n");
+int get_disk_info(struct sysinfo_snapshot *snap){
+    INFO_LOG(stderr, "Getting disk information for root filesystem...\n");
     struct statvfs info;
     if(statvfs("/", &info) < 0){
-        ERROR_LOG(fp, "statvfs() failed for /\n");
+        ERROR_LOG(stderr, "statvfs() failed for /\n");
         perror("statvfs");
         return -1;
     }
-    unsigned long long total_bytes = (unsigned long long)info.f_blocks * info.f_frsize;
-    unsigned long long free_bytes  = (unsigned long long)info.f_bfree  * info.f_frsize;
-    unsigned long long used_bytes  = total_bytes - free_bytes;
-
-    // Check for division by zero
-    if(total_bytes == 0){
-        ERROR_LOG(fp, "statvfs() returned zero total disk space\n");
-        fprintf(fp, "Error: Invalid filesystem information (zero total space)\n");
+    snap->disk_total = (uint64_t)info.f_blocks * info.f_frsize;
+    snap->disk_free  = (uint64_t)info.f_bfree  * info.f_frsize;
+    // Renderers must not divide by zero
+    if(snap->disk_total == 0){
+        ERROR_LOG(stderr, "statvfs() returned zero total disk space\n");
         return -1;
     }
-
-    double usage = (double)used_bytes / (double)total_bytes * 100.0;
-    INFO_LOG(fp, "Disk usage: %.2f%%, Total: %llu bytes, Free: %llu bytes\n", 
-              usage, total_bytes, free_bytes);
-
-    fprintf(fp, "Disk Usage : %.2f%%\n", usage);
-    fprintf(fp, "Total Space: %llu bytes\n", total_bytes);
-    fprintf(fp, "Free Space : %llu bytes\n", free_bytes);
-    fprintf(fp, "Used Space : %llu bytes\n", used_bytes);
+    INFO_LOG(stderr, "Disk total: %llu bytes, Free: %llu bytes\n",
+              (unsigned long long)snap->disk_total, (unsigned long long)snap->disk_free);
+    // The other mounts are extra: without them the root figures still stand
+    if(diskinfo_collect(snap) < 0){
+        WARN_LOG(stderr, "Mount list unavailable, reporting the root filesystem only\n");
+    }
     return 0;
 }
 
 extern char **environ;
 
-int get_env_info(FILE *fp){
-    INFO_LOG(fp, "Getting environment variables...\n");
-    int count = 0;
+int get_env_info(struct sysinfo_snapshot *snap){
+    INFO_LOG(stderr, "Getting environment variables...\n");
+    size_t len = 0;
     for (char **env = environ; *env != NULL; env++) {
-        count++;
+        size_t n = strlen(*env);
+        if (n + 1 > sizeof(snap->env) - len) {
+            snap->env_dropped++;
+            continue;
+        }
+        memcpy(snap->env + len, *env, n);
+        snap->env[len + n] = '\n';
+        len += n + 1;
+        snap->env_count++;
+    }
+    snap->env_len = (uint32_t)len;
+    INFO_LOG(stderr, "Found %u environment variables\n", snap->env_count + snap->env_dropped);
+    if (snap->env_dropped > 0) {
+        WARN_LOG(stderr, "%u environment variables did not fit in the snapshot\n", snap->env_dropped);
     }
-    INFO_LOG(fp, "Found %d environment variables\n", count);
-    fprintf(fp, "=== Environment Variables ===\n");
+    return 0;
+}
 
-    for (char **env = environ; *env != NULL; env++) {
-        fprintf(fp, "%s\n", *env);
+// rtnetlink socket kept open between collections. One per thread, so the
+// dumps of two workers never interleave; a child of fork() opens its own.
+static __thread int nl_fd = -1;
+static __thread pid_t nl_owner;
+static __thread uint32_t nl_seq;
+
+static int nl_socket(void) {
+    pid_t pid = getpid();
+    if(nl_fd >= 0 && nl_owner == pid){
+        return nl_fd;
+    }
+    if(nl_fd >= 0){
+        close(nl_fd);       // inherited from the parent
+    }
+    nl_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    nl_owner = pid;
+    if(nl_fd < 0){
+        WARN_LOG(stderr, "  Failed to open rtnetlink socket: %s\n", strerror(errno));
+    }
+    return nl_fd;
+}
+
+static void nl_close(void) {
+    if(nl_fd >= 0){
+        close(nl_fd);
+        nl_fd = -1;
+    }
+}
+
+// Entry of the link with the given ifindex, listed earlier in this snapshot
+static const struct sysinfo_iface *find_link(const struct sysinfo_snapshot *snap, uint32_t index){
+    for(uint32_t i = 0; i < snap->iface_count; i++){
+        if(snap->ifaces[i].family == AF_PACKET && snap->ifaces[i].index == index){
+            return &snap->ifaces[i];
+        }
+    }
+    return NULL;
+}
+
+// RTM_NEWLINK: name, MAC, MTU and counters of one link
+static void nl_link(const struct nlmsghdr *nh, struct sysinfo_snapshot *snap){
+    const struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    struct sysinfo_iface *iface = &snap->ifaces[snap->iface_count];
+    memset(iface, 0, sizeof(*iface));
+    iface->family = AF_PACKET;
+    iface->index = (uint32_t)ifi->ifi_index;
+    if(ifi->ifi_flags & IFF_LOOPBACK){
+        iface->flags |= SYSINFO_IF_LOOPBACK;
+    }
+    // The kernel's struct is 32-bit aligned: the 64-bit counters are copied out
+    struct rtnl_link_stats64 st64;
+    struct rtnl_link_stats st32;
+    int have64 = 0, have32 = 0;
+    int len = (int)IFLA_PAYLOAD(nh);
+    for(const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)){
+        size_t n = RTA_PAYLOAD(rta);
+        switch(rta->rta_type){
+        case IFLA_IFNAME:
+            copy_field(iface->name, sizeof(iface->name), RTA_DATA(rta));
+            break;
+        case IFLA_ADDRESS:
+            // Shorter hardware addresses are zero-padded, longer ones cut, as SIOCGIFHWADDR does
+            memcpy(iface->mac, RTA_DATA(rta), n < sizeof(iface->mac) ? n : sizeof(iface->mac));
+            iface->flags |= SYSINFO_IF_MAC;
+            break;
+        case IFLA_MTU:
+            if(n >= sizeof(uint32_t)){
+                uint32_t mtu;
+                memcpy(&mtu, RTA_DATA(rta), sizeof(mtu));
+                iface->mtu = (int32_t)mtu;
+                iface->flags |= SYSINFO_IF_MTU;
+            }
+            break;
+        case IFLA_STATS64:
+            if(n >= sizeof(st64)){
+                memcpy(&st64, RTA_DATA(rta), sizeof(st64));
+                have64 = 1;
+            }
+            break;
+        case IFLA_STATS:
+            if(n >= sizeof(st32)){
+                memcpy(&st32, RTA_DATA(rta), sizeof(st32));
+                have32 = 1;
+            }
+            break;
+        }
     }
+    if(have64){
+        iface->rx_bytes = st64.rx_bytes;
+        iface->tx_bytes = st64.tx_bytes;
+        iface->rx_packets = st64.rx_packets;
+        iface->tx_packets = st64.tx_packets;
+        iface->flags |= SYSINFO_IF_STATS;
+    } else if(have32){
+        iface->rx_bytes = st32.rx_bytes;
+        iface->tx_bytes = st32.tx_bytes;
+        iface->rx_packets = st32.rx_packets;
+        iface->tx_packets = st32.tx_packets;
+        iface->flags |= SYSINFO_IF_STATS;
+    }
+    snap->iface_count++;
+}
 
+// RTM_NEWADDR: one IPv4 or IPv6 address; MAC and MTU come from its link
+static void nl_addr(const struct nlmsghdr *nh, struct sysinfo_snapshot *snap){
+    const struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+    if(ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6){
+        return;
+    }
+    struct sysinfo_iface *iface = &snap->ifaces[snap->iface_count];
+    memset(iface, 0, sizeof(*iface));
+    iface->family = ifa->ifa_family;
+    iface->index = ifa->ifa_index;
+    const void *local = NULL, *address = NULL, *broadcast = NULL;
+    const char *label = NULL;
+    int len = (int)IFA_PAYLOAD(nh);
+    for(const struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)){
+        switch(rta->rta_type){
+        case IFA_LOCAL:     local = RTA_DATA(rta); break;
+        case IFA_ADDRESS:   address = RTA_DATA(rta); break;
+        case IFA_BROADCAST: broadcast = RTA_DATA(rta); break;
+        case IFA_LABEL:     label = RTA_DATA(rta); break;
+        }
+    }
+    const struct sysinfo_iface *link = find_link(snap, iface->index);
+    if(link != NULL){
+        copy_field(iface->name, sizeof(iface->name), label != NULL ? label : link->name);
+        memcpy(iface->mac, link->mac, sizeof(iface->mac));
+        iface->mtu = link->mtu;
+        iface->flags = link->flags & (SYSINFO_IF_MAC | SYSINFO_IF_MTU | SYSINFO_IF_LOOPBACK);
+    } else if(label != NULL){
+        copy_field(iface->name, sizeof(iface->name), label);
+    } else if(if_indextoname(iface->index, iface->name) == NULL){
+        snprintf(iface->name, sizeof(iface->name), "if%u", iface->index);
+    }
+    if(iface->family == AF_INET){
+        // As getifaddrs(): the local address, which differs from IFA_ADDRESS
+        // only on point-to-point links
+        const void *addr = local != NULL ? local : address;
+        if(addr != NULL){
+            memcpy(&iface->addr, addr, sizeof(iface->addr));
+        }
+        iface->netmask = ifa->ifa_prefixlen == 0 ? 0 : htonl(0xffffffffu << (32 - ifa->ifa_prefixlen));
+        // SIOCGIFBRDADDR reports 0.0.0.0 for addresses without a broadcast
+        if(broadcast != NULL){
+            memcpy(&iface->broadcast, broadcast, sizeof(iface->broadcast));
+        }
+        iface->flags |= SYSINFO_IF_NETMASK | SYSINFO_IF_BROADCAST;
+    }
+    snap->iface_count++;
+}
+
+/**
+ * Send one rtnetlink dump request and parse the replies in place, in a
+ * stack buffer. Entries past SYSINFO_MAX_IFACES are read but counted in
+ * ifaces_dropped, so the socket is left empty for the next dump.
+ *
+ * @return 0, or -1 on error
+ */
+static int nl_dump(int fd, uint16_t type, struct sysinfo_snapshot *snap,
+                   void (*parse)(const struct nlmsghdr *, struct sysinfo_snapshot *)){
+    struct {
+        struct nlmsghdr nh;
+        union {
+            struct ifinfomsg link;
+            struct ifaddrmsg addr;
+        } body;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = type == RTM_GETLINK ? NLMSG_LENGTH(sizeof(req.body.link))
+                                           : NLMSG_LENGTH(sizeof(req.body.addr));
+    req.nh.nlmsg_type = type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++nl_seq;
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    if(sendto(fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0){
+        WARN_LOG(stderr, "  rtnetlink request failed: %s\n", strerror(errno));
+        return -1;
+    }
+    // The kernel fills dump messages up to the size we read with (max 32 KiB)
+    char buf[32768] __attribute__((aligned(NLMSG_ALIGNTO)));
+    uint16_t reply = type == RTM_GETLINK ? RTM_NEWLINK : RTM_NEWADDR;
+    for(;;){
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            WARN_LOG(stderr, "  rtnetlink recv failed: %s\n", n < 0 ? strerror(errno) : "EOF");
+            return -1;
+        }
+        unsigned int len = (unsigned int)n;
+        for(const struct nlmsghdr *nh = (const struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)){
+            if(nh->nlmsg_seq != req.nh.nlmsg_seq){
+                continue;   // left over from an earlier, abandoned dump
+            }
+            if(nh->nlmsg_type == NLMSG_DONE){
+                return 0;
+            }
+            if(nh->nlmsg_type == NLMSG_ERROR){
+                WARN_LOG(stderr, "  rtnetlink dump failed: %s\n",
+                         strerror(-((const struct nlmsgerr *)NLMSG_DATA(nh))->error));
+                return -1;
+            }
+            if(nh->nlmsg_type != reply){
+                continue;
+            }
+            if(snap->iface_count == SYSINFO_MAX_IFACES){
+                snap->ifaces_dropped++;
+                continue;
+            }
+            parse(nh, snap);
+        }
+    }
+}
+
+// Links, then addresses, from two dumps on the persistent rtnetlink socket
+static int get_network_info_netlink(struct sysinfo_snapshot *snap){
+    int fd = nl_socket();
+    if(fd < 0){
+        return -1;
+    }
+    if(nl_dump(fd, RTM_GETLINK, snap, nl_link) < 0 ||
+       nl_dump(fd, RTM_GETADDR, snap, nl_addr) < 0){
+        // The socket may still hold part of a dump: start over with a new one
+        nl_close();
+        return -1;
+    }
     return 0;
 }
 
-int get_network_info(FILE *fp){
-    INFO_LOG(fp, "Getting network interface information...\n");
-    // initialize ifaddrs
+// Netmask, broadcast, MAC and MTU of one interface, via ioctl on fd
+static void get_iface_details(int fd, const struct ifaddrs *ifa, struct sysinfo_iface *iface){
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, ifa->ifa_name, IFNAMSIZ-1);
+    ifr.ifr_name[IFNAMSIZ-1] = '\0';  // Ensure null-terminated
+
+    if(ioctl(fd, SIOCGIFHWADDR, &ifr) == 0){
+        memcpy(iface->mac, ifr.ifr_hwaddr.sa_data, sizeof(iface->mac));
+        iface->flags |= SYSINFO_IF_MAC;
+    } else {
+        WARN_LOG(stderr, "  Failed to get MAC address for %s\n", ifa->ifa_name);
+    }
+    if(ioctl(fd, SIOCGIFMTU, &ifr) == 0){
+        DEBUG_LOG(stderr, "  MTU: %d\n", ifr.ifr_mtu);
+        iface->mtu = ifr.ifr_mtu;
+        iface->flags |= SYSINFO_IF_MTU;
+    }
+    // Netmask and Broadcast only for IPv4
+    if(iface->family != AF_INET){
+        return;
+    }
+    if(ioctl(fd, SIOCGIFNETMASK, &ifr) == 0){
+        iface->netmask = ((struct sockaddr_in *)&ifr.ifr_netmask)->sin_addr.s_addr;
+        iface->flags |= SYSINFO_IF_NETMASK;
+    }
+    if(ioctl(fd, SIOCGIFBRDADDR, &ifr) == 0){
+        iface->broadcast = ((struct sockaddr_in *)&ifr.ifr_broadaddr)->sin_addr.s_addr;
+        iface->flags |= SYSINFO_IF_BROADCAST;
+    }
+}
+
+// Fallback when rtnetlink is unavailable: getifaddrs() plus up to four
+// ioctls per entry
+static int get_network_info_ifaddrs(struct sysinfo_snapshot *snap){
     struct ifaddrs *ifaddr = NULL, *ifa = NULL;
     if(getifaddrs(&ifaddr) < 0){
-        ERROR_LOG(fp, "getifaddrs() failed\n");
+        ERROR_LOG(stderr, "getifaddrs() failed\n");
         perror("getifaddrs");
         return -1;
     }
-    DEBUG_LOG(fp, "getifaddrs() succeeded\n");
-    fprintf(fp, "=== Network Interfaces ===\n");
+    DEBUG_LOG(stderr, "getifaddrs() succeeded\n");
 
-    int interface_count = 0;
-    // iterate through all interfaces
+    // One socket serves the ioctls of every interface
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(fd < 0){
+        WARN_LOG(stderr, "  Failed to create socket for interface details\n");
+    }
     for(ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next){
         if(!ifa->ifa_addr){
-            DEBUG_LOG(fp, "Skipping interface %s (no address)\n", ifa->ifa_name ? ifa->ifa_name : "unknown");
+            DEBUG_LOG(stderr, "Skipping interface %s (no address)\n", ifa->ifa_name ? ifa->ifa_name : "unknown");
             continue;
         }
-        
-        interface_count++;
-        DEBUG_LOG(fp, "Processing interface: %s (family: %d)\n", ifa->ifa_name, ifa->ifa_addr->sa_family);
-        
-        // Print interface name and IPv4 address first (if available)
-        if(ifa->ifa_addr->sa_family == AF_INET){
-            struct sockaddr_in *sa = (struct sockaddr_in *)ifa->ifa_addr;
-            DEBUG_LOG(fp, "  IPv4 address: %s\n", inet_ntoa(sa->sin_addr));
-            fprintf(fp, "%s: %s\n", ifa->ifa_name, inet_ntoa(sa->sin_addr));
-        } else {
-            // Also show interface name for non-IPv4 addresses
-            DEBUG_LOG(fp, "  Non-IPv4 interface\n");
-            fprintf(fp, "%s:\n", ifa->ifa_name);
-        }
-
-        int fd = socket(AF_INET, SOCK_DGRAM, 0);
-        if(fd < 0){
-            WARN_LOG(fp, "  Failed to create socket for interface %s\n", ifa->ifa_name);
+        if(snap->iface_count == SYSINFO_MAX_IFACES){
+            snap->ifaces_dropped++;
             continue;
         }
-        struct ifreq ifr;
-        memset(&ifr, 0, sizeof(ifr));
-        strncpy(ifr.ifr_name, ifa->ifa_name, IFNAMSIZ-1);
-        ifr.ifr_name[IFNAMSIZ-1] = '\0';  // Ensure null-terminated
-        
-        // Get MAC address
-        if(ioctl(fd, SIOCGIFHWADDR, &ifr) == 0){
-            unsigned char *mac_addr = (unsigned char *)ifr.ifr_hwaddr.sa_data;
-            // Check if all zeros
-            int is_zero = 1;
-            for(int i = 0; i < 6; i++){
-                if(mac_addr[i] != 0){
-                    is_zero = 0;
-                    break;
-                }
-            }
-            if(is_zero){
-                DEBUG_LOG(fp, "  MAC Address: all zeros\n");
-                fprintf(fp, "  MAC Address: NA\n");
-            } else {
-                DEBUG_LOG(fp, "  MAC Address: %02X:%02X:%02X:%02X:%02X:%02X\n",
-                       mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-                fprintf(fp, "  MAC Address: %02X:%02X:%02X:%02X:%02X:%02X\n",
-                       mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-            }
-        } else {
-            WARN_LOG(fp, "  Failed to get MAC address for %s\n", ifa->ifa_name);
-        }
-        
-        if(ioctl(fd, SIOCGIFMTU, &ifr) == 0){
-            DEBUG_LOG(fp, "  MTU: %d\n", ifr.ifr_mtu);
-            fprintf(fp, "  MTU: %d\n", ifr.ifr_mtu);
+        DEBUG_LOG(stderr, "Processing interface: %s (family: %d)\n", ifa->ifa_name, ifa->ifa_addr->sa_family);
+        struct sysinfo_iface *iface = &snap->ifaces[snap->iface_count++];
+        memset(iface, 0, sizeof(*iface));
+        copy_field(iface->name, sizeof(iface->name), ifa->ifa_name);
+        iface->family = ifa->ifa_addr->sa_family;
+        if(ifa->ifa_flags & IFF_LOOPBACK){
+            iface->flags |= SYSINFO_IF_LOOPBACK;
         }
-        // Show Netmask and Broadcast only for IPv4
-        if(ifa->ifa_addr->sa_family == AF_INET){
-            if(ioctl(fd, SIOCGIFNETMASK, &ifr) == 0){
-                struct sockaddr_in *mask = (struct sockaddr_in *)&ifr.ifr_netmask;
-                DEBUG_LOG(fp, "  Netmask: %s\n", inet_ntoa(mask->sin_addr));
-                fprintf(fp, "  Netmask: %s\n", inet_ntoa(mask->sin_addr));
-            }
-            if(ioctl(fd, SIOCGIFBRDADDR, &ifr) == 0){
-                struct sockaddr_in *brd = (struct sockaddr_in *)&ifr.ifr_broadaddr;
-                DEBUG_LOG(fp, "  Broadcast: %s\n", inet_ntoa(brd->sin_addr));
-                fprintf(fp, "  Broadcast: %s\n", inet_ntoa(brd->sin_addr));
+        if(iface->family == AF_INET){
+            iface->addr = ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr;
+        } else if(iface->family == AF_PACKET){
+            iface->index = (uint32_t)((struct sockaddr_ll *)ifa->ifa_addr)->sll_ifindex;
+            if(ifa->ifa_data != NULL){
+                const struct rtnl_link_stats *st = ifa->ifa_data;
+                iface->rx_bytes = st->rx_bytes;
+                iface->tx_bytes = st->tx_bytes;
+                iface->rx_packets = st->rx_packets;
+                iface->tx_packets = st->tx_packets;
+                iface->flags |= SYSINFO_IF_STATS;
             }
         }
+        if(fd >= 0){
+            get_iface_details(fd, ifa, iface);
+        }
+    }
+    if(fd >= 0){
         close(fd);
     }
-    
-    INFO_LOG(fp, "Processed %d network interfaces\n", interface_count);
     freeifaddrs(ifaddr);
     return 0;
 }
 
+int get_network_info(struct sysinfo_snapshot *snap){
+    INFO_LOG(stderr, "Getting network interface information...\n");
+    snap->iface_count = snap->ifaces_dropped = 0;
+    if(get_network_info_netlink(snap) < 0){
+        WARN_LOG(stderr, "rtnetlink unavailable, falling back to getifaddrs()\n");
+        snap->iface_count = snap->ifaces_dropped = 0;
+        if(get_network_info_ifaddrs(snap) < 0){
+            return -1;
+        }
+    }
+    INFO_LOG(stderr, "Processed %u network interfaces\n", snap->iface_count);
+    if(snap->ifaces_dropped > 0){
+        WARN_LOG(stderr, "More than %d interface entries, %u not listed\n", SYSINFO_MAX_IFACES,
+                 snap->ifaces_dropped);
+    }
+    return 0;
+}
+
+static int (*const collectors[SYSINFO_SECTIONS])(struct sysinfo_snapshot *) = {
+    [SYSINFO_HOSTNAME] = get_hostname,
+    [SYSINFO_TIME]     = get_local_time,
+    [SYSINFO_OS]       = get_os_info,
+    [SYSINFO_MEMORY]   = get_memory_usage,
+    [SYSINFO_USER]     = get_user_info,
+    [SYSINFO_DISK]     = get_disk_info,
+    [SYSINFO_ENV]      = get_env_info,
+    [SYSINFO_NETWORK]  = get_network_info,
+};
+
+static const char *const section_names[SYSINFO_SECTIONS] = {
+    [SYSINFO_HOSTNAME] = "hostname",
+    [SYSINFO_TIME]     = "time",
+    [SYSINFO_OS]       = "os",
+    [SYSINFO_MEMORY]   = "memory",
+    [SYSINFO_USER]     = "user",
+    [SYSINFO_DISK]     = "disk",
+    [SYSINFO_ENV]      = "env",
+    [SYSINFO_NETWORK]  = "network",
+};
+
+const char *sysinfo_section_name(enum sysinfo_section section){
+    return (unsigned)section < SYSINFO_SECTIONS ? section_names[section] : "unknown";
+}
+
+// Test hook: artificial latency before each collector, 0 by default
+static int section_delay_ms[SYSINFO_SECTIONS];
+
+void sysinfo_set_delay(enum sysinfo_section section, int ms){
+    if((unsigned)section < SYSINFO_SECTIONS){
+        section_delay_ms[section] = ms > 0 ? ms : 0;
+    }
+}
+
+int sysinfo_section_may_block(enum sysinfo_section section){
+    // NSS may ask a directory server, statvfs() may wait for a network
+    // filesystem, and the interface walk is the largest; the rest only read
+    // local kernel state or memory
+    return section == SYSINFO_USER || section == SYSINFO_DISK || section == SYSINFO_NETWORK ||
+           section_delay_ms[section] > 0;
+}
+
+// Drop what an earlier collection left in the fields of one section
+static void clear_section(struct sysinfo_snapshot *snap, enum sysinfo_section section){
+    switch(section){
+    case SYSINFO_HOSTNAME:
+        snap->hostname[0] = '\0';
+        break;
+    case SYSINFO_TIME:
+        snap->time = 0;
+        break;
+    case SYSINFO_OS:
+        snap->os_name[0] = snap->os_release[0] = snap->os_version[0] = snap->os_machine[0] = '\0';
+        break;
+    case SYSINFO_MEMORY:
+        snap->uptime = 0;
+        memset(snap->loads, 0, sizeof(snap->loads));
+        snap->total_ram = snap->free_ram = 0;
+        snap->available_ram = snap->buffer_ram = snap->cached_ram = 0;
+        break;
+    case SYSINFO_USER:
+        snap->user[0] = snap->home[0] = '\0';
+        break;
+    case SYSINFO_DISK:
+        snap->disk_total = snap->disk_free = 0;
+        snap->mount_count = snap->mounts_dropped = 0;
+        break;
+    case SYSINFO_ENV:
+        snap->env_count = snap->env_len = snap->env_dropped = 0;
+        break;
+    case SYSINFO_NETWORK:
+        snap->iface_count = snap->ifaces_dropped = 0;
+        break;
+    case SYSINFO_SECTIONS:
+        break;
+    }
+}
+
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len){
+    const unsigned char *p = data;
+    for(size_t i = 0; i < len; i++){
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
 
+// Strings are hashed up to their terminator: the bytes after it are stale
+static uint64_t fnv1a_str(uint64_t h, const char *s){
+    return fnv1a(h, s, strlen(s) + 1);
+}
 
+uint64_t sysinfo_section_hash(const struct sysinfo_snapshot *snap, enum sysinfo_section section){
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint8_t failed = (snap->failed & SYSINFO_SECTION_BIT(section)) != 0;
+    h = fnv1a(h, &failed, 1);
+    switch(section){
+    case SYSINFO_HOSTNAME:
+        h = fnv1a_str(h, snap->hostname);
+        break;
+    case SYSINFO_TIME:
+        h = fnv1a(h, &snap->time, sizeof(snap->time));
+        break;
+    case SYSINFO_OS:
+        h = fnv1a_str(h, snap->os_name);
+        h = fnv1a_str(h, snap->os_release);
+        h = fnv1a_str(h, snap->os_version);
+        h = fnv1a_str(h, snap->os_machine);
+        break;
+    case SYSINFO_MEMORY:
+        // uptime .. cached_ram are adjacent
+        h = fnv1a(h, &snap->uptime, offsetof(struct sysinfo_snapshot, disk_total) -
+                                    offsetof(struct sysinfo_snapshot, uptime));
+        break;
+    case SYSINFO_USER:
+        h = fnv1a_str(h, snap->user);
+        h = fnv1a_str(h, snap->home);
+        break;
+    case SYSINFO_DISK:
+        h = fnv1a(h, &snap->disk_total, sizeof(snap->disk_total));
+        h = fnv1a(h, &snap->disk_free, sizeof(snap->disk_free));
+        h = fnv1a(h, &snap->mounts_dropped, sizeof(snap->mounts_dropped));
+        h = fnv1a(h, snap->mounts, snap->mount_count * sizeof(snap->mounts[0]));
+        break;
+    case SYSINFO_ENV:
+        h = fnv1a(h, &snap->env_count, sizeof(snap->env_count));
+        h = fnv1a(h, &snap->env_dropped, sizeof(snap->env_dropped));
+        h = fnv1a(h, snap->env, snap->env_len);
+        break;
+    case SYSINFO_NETWORK:
+        h = fnv1a(h, &snap->ifaces_dropped, sizeof(snap->ifaces_dropped));
+        // Entries are zeroed before they are filled, padding included
+        h = fnv1a(h, snap->ifaces, snap->iface_count * sizeof(snap->ifaces[0]));
+        break;
+    case SYSINFO_SECTIONS:
+        break;
+    }
+    return h;
+}
+
+int sysinfo_collect_section(struct sysinfo_snapshot *snap, enum sysinfo_section section){
+    uint32_t bit = SYSINFO_SECTION_BIT(section);
+    clear_section(snap, section);
+    if(section_delay_ms[section] > 0){
+        struct timespec delay = {
+            .tv_sec = section_delay_ms[section] / 1000,
+            .tv_nsec = (long)(section_delay_ms[section] % 1000) * 1000000,
+        };
+        while(nanosleep(&delay, &delay) < 0 && errno == EINTR){
+            // a signal interrupted it: sleep the rest
+        }
+    }
+    snap->collected |= bit;
+    snap->timed_out &= ~bit;
+    int ret = collectors[section](snap);
+    if(ret < 0){
+        snap->failed |= bit;
+    }else{
+        snap->failed &= ~bit;
+    }
+    snap->hash[section] = sysinfo_section_hash(snap, section);
+    return ret < 0 ? -1 : 0;
+}
+
+void sysinfo_mark_timed_out(struct sysinfo_snapshot *snap, uint32_t sections){
+    snap->collected |= sections;
+    snap->failed |= sections;
+    snap->timed_out |= sections;
+}
+
+void sysinfo_collect(struct sysinfo_snapshot *snap, uint32_t sections){
+    // Only the fixed part is cleared; ifaces, mounts and env are valid up
+    // to iface_count, mount_count and env_len
+    memset(snap, 0, offsetof(struct sysinfo_snapshot, ifaces));
+    for(int i = 0; i < SYSINFO_SECTIONS; i++){
+        if(sections & SYSINFO_SECTION_BIT(i)){
+            sysinfo_collect_section(snap, (enum sysinfo_section)i);
+        }
+    }
+}
+
+int sysinfo_section_by_name(const char *name, size_t len){
+    for(int i = 0; i < SYSINFO_SECTIONS; i++){
+        if(strlen(section_names[i]) == len && memcmp(section_names[i], name, len) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+void sysinfo_snapshot_copy(struct sysinfo_snapshot *dst, const struct sysinfo_snapshot *src, uint32_t sections){
+    memcpy(dst, src, offsetof(struct sysinfo_snapshot, ifaces));
+    if(sections & SYSINFO_SECTION_BIT(SYSINFO_NETWORK)){
+        memcpy(dst->ifaces, src->ifaces, src->iface_count * sizeof(dst->ifaces[0]));
+    }else{
+        dst->iface_count = dst->ifaces_dropped = 0;
+    }
+    if(sections & SYSINFO_SECTION_BIT(SYSINFO_DISK)){
+        memcpy(dst->mounts, src->mounts, src->mount_count * sizeof(dst->mounts[0]));
+    }else{
+        dst->mount_count = dst->mounts_dropped = 0;
+    }
+    if(sections & SYSINFO_SECTION_BIT(SYSINFO_ENV)){
+        memcpy(dst->env, src->env, src->env_len);
+    }else{
+        dst->env_count = dst->env_len = dst->env_dropped = 0;
+    }
+    dst->collected &= sections;
+    dst->failed &= sections;
+    dst->timed_out &= sections;
+}
+
+void sysinfo_snapshot_merge(struct sysinfo_snapshot *dst, const struct sysinfo_snapshot *src, uint32_t sections){
+    for(int i = 0; i < SYSINFO_SECTIONS; i++){
+        if(!(sections & SYSINFO_SECTION_BIT(i))){
+            continue;
+        }
+        switch((enum sysinfo_section)i){
+        case SYSINFO_HOSTNAME:
+            memcpy(dst->hostname, src->hostname, sizeof(dst->hostname));
+            break;
+        case SYSINFO_TIME:
+            dst->time = src->time;
+            break;
+        case SYSINFO_OS:
+            memcpy(dst->os_name, src->os_name, sizeof(dst->os_name));
+            memcpy(dst->os_release, src->os_release, sizeof(dst->os_release));
+            memcpy(dst->os_version, src->os_version, sizeof(dst->os_version));
+            memcpy(dst->os_machine, src->os_machine, sizeof(dst->os_machine));
+            break;
+        case SYSINFO_MEMORY:
+            dst->uptime = src->uptime;
+            memcpy(dst->loads, src->loads, sizeof(dst->loads));
+            dst->total_ram = src->total_ram;
+            dst->free_ram = src->free_ram;
+            dst->available_ram = src->available_ram;
+            dst->buffer_ram = src->buffer_ram;
+            dst->cached_ram = src->cached_ram;
+            break;
+        case SYSINFO_USER:
+            memcpy(dst->user, src->user, sizeof(dst->user));
+            memcpy(dst->home, src->home, sizeof(dst->home));
+            break;
+        case SYSINFO_DISK:
+            dst->disk_total = src->disk_total;
+            dst->disk_free = src->disk_free;
+            dst->mount_count = src->mount_count;
+            dst->mounts_dropped = src->mounts_dropped;
+            memcpy(dst->mounts, src->mounts, src->mount_count * sizeof(dst->mounts[0]));
+            break;
+        case SYSINFO_ENV:
+            dst->env_count = src->env_count;
+            dst->env_len = src->env_len;
+            dst->env_dropped = src->env_dropped;
+            memcpy(dst->env, src->env, src->env_len);
+            break;
+        case SYSINFO_NETWORK:
+            dst->iface_count = src->iface_count;
+            dst->ifaces_dropped = src->ifaces_dropped;
+            memcpy(dst->ifaces, src->ifaces, src->iface_count * sizeof(dst->ifaces[0]));
+            break;
+        case SYSINFO_SECTIONS:
+            break;
+        }
+        dst->hash[i] = src->hash[i];
+    }
+    dst->collected |= src->collected & sections;
+    dst->failed = (dst->failed & ~sections) | (src->failed & sections);
+    dst->timed_out = (dst->timed_out & ~sections) | (src->timed_out & sections);
+}
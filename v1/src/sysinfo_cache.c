@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include "sysinfo_cache.h"
+#include "debug.h"
+#include <sys/mman.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+struct sysinfo_cache {
+    pthread_mutex_t lock;           // process-shared, robust
+    pthread_cond_t refreshed;       // broadcast when a section is stored
+    int ttl_ms;
+    uint32_t refreshing;            // sections some caller is collecting right now
+    int64_t refresh_started_ms[SYSINFO_SECTIONS];
+    int64_t collected_ms[SYSINFO_SECTIONS];  // per section; 0: never collected
+    struct sysinfo_cache_stats stats;
+    struct sysinfo_snapshot snap;   // merged result of every collection
+};
+
+static struct sysinfo_cache *cache;
+
+static int64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void cache_lock(void) {
+    if (pthread_mutex_lock(&cache->lock) == EOWNERDEAD) {
+        // A worker died while copying or merging; at worst one section is
+        // mixed, and it is replaced by the next collection
+        pthread_mutex_consistent(&cache->lock);
+    }
+}
+
+static void cache_unlock(void) {
+    pthread_mutex_unlock(&cache->lock);
+}
+
+int sysinfo_cache_init(int ttl_ms) {
+    struct sysinfo_cache *c = mmap(NULL, sizeof(*c), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (c == MAP_FAILED) {
+        ERROR_LOG(stderr, "mmap() failed for SYSINFO cache\n");
+        perror("mmap");
+        return -1;
+    }
+    pthread_mutexattr_t ma;
+    pthread_condattr_t ca;
+    int ok = pthread_mutexattr_init(&ma) == 0;
+    ok = ok && pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED) == 0 &&
+         pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST) == 0 &&
+         pthread_mutex_init(&c->lock, &ma) == 0;
+    pthread_mutexattr_destroy(&ma);
+    ok = ok && pthread_condattr_init(&ca) == 0;
+    ok = ok && pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED) == 0 &&
+         pthread_condattr_setclock(&ca, CLOCK_MONOTONIC) == 0 &&
+         pthread_cond_init(&c->refreshed, &ca) == 0;
+    pthread_condattr_destroy(&ca);
+    if (!ok) {
+        ERROR_LOG(stderr, "Failed to initialise SYSINFO cache locks\n");
+        munmap(c, sizeof(*c));
+        return -1;
+    }
+    c->ttl_ms = ttl_ms;
+    // Versions continue from the start time in microseconds, so a restarted
+    // server never reuses one a client got from the previous run
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    c->snap.version = (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+    cache = c;
+    return 0;
+}
+
+// Count one run of every collector in sections; called with the lock held
+static void count_runs(uint32_t sections) {
+    cache->stats.collections++;
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        if (sections & SYSINFO_SECTION_BIT(i)) {
+            cache->stats.runs[i]++;
+        }
+    }
+}
+
+uint32_t sysinfo_cache_begin(struct sysinfo_snapshot *snap, uint32_t sections, int wait_ms) {
+    snap->collected = snap->failed = snap->timed_out = 0;
+    snap->version = 0;
+    if (cache == NULL) {
+        return sections;
+    }
+    cache_lock();
+    if (cache->ttl_ms <= 0) {
+        count_runs(sections);
+        snap->version = cache->snap.version;
+        cache_unlock();
+        return sections;
+    }
+
+    uint32_t fresh, servable, claim;
+    int64_t give_up = wait_ms > 0 ? now_ms() + wait_ms : INT64_MAX;
+    for (;;) {
+        int64_t now = now_ms();
+        uint32_t have = 0, in_flight = 0;
+        fresh = 0;
+        for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+            uint32_t bit = SYSINFO_SECTION_BIT(i);
+            if (!(sections & bit)) {
+                continue;
+            }
+            if (cache->collected_ms[i] != 0) {
+                have |= bit;
+                if (now - cache->collected_ms[i] < cache->ttl_ms) {
+                    fresh |= bit;
+                }
+            }
+            if ((cache->refreshing & bit) && now - cache->refresh_started_ms[i] < SYSINFO_REFRESH_TIMEOUT_MS) {
+                in_flight |= bit;
+            }
+        }
+        // Fresh sections, and stale ones someone else is recollecting, are
+        // served from the cache
+        servable = fresh | (have & in_flight);
+        claim = sections & ~servable & ~in_flight;
+        if ((sections & ~servable & in_flight) == 0 || now >= give_up) {
+            // Stale or missing, and nobody (alive) is collecting them: this
+            // caller does, and only those. After wait_ms the sections still
+            // being collected for the first time are left out.
+            for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+                if (claim & SYSINFO_SECTION_BIT(i)) {
+                    cache->refresh_started_ms[i] = now;
+                }
+            }
+            break;
+        }
+        // A section that was never collected is being collected: wait for it
+        int64_t until = now + 1000 < give_up ? now + 1000 : give_up;
+        struct timespec deadline = { .tv_sec = until / 1000, .tv_nsec = (until % 1000) * 1000000 };
+        if (pthread_cond_timedwait(&cache->refreshed, &cache->lock, &deadline) == EOWNERDEAD) {
+            pthread_mutex_consistent(&cache->lock);
+        }
+    }
+
+    cache->refreshing |= claim;
+    if (claim != 0) {
+        count_runs(claim);
+    } else if (fresh == sections) {
+        cache->stats.hits++;
+    } else {
+        cache->stats.stale_hits++;
+    }
+    // Copy under the lock, render after it; only the served sections move
+    if (servable != 0) {
+        sysinfo_snapshot_copy(snap, &cache->snap, servable);
+    }
+    snap->version = cache->snap.version;
+    cache_unlock();
+    if (claim != 0) {
+        DEBUG_LOG(stderr, "SYSINFO sections 0x%x expired, collecting\n", claim);
+    }
+    return claim;
+}
+
+void sysinfo_cache_store(struct sysinfo_snapshot *snap, uint32_t sections) {
+    if (cache == NULL || sections == 0) {
+        return;
+    }
+    cache_lock();
+    // Versions are kept even without caching, so SINCE works with any TTL
+    struct sysinfo_snapshot *c = &cache->snap;
+    uint64_t seen = c->version;
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        uint32_t bit = SYSINFO_SECTION_BIT(i);
+        if ((sections & bit) && (!(c->collected & bit) || c->hash[i] != snap->hash[i])) {
+            c->changed[i] = ++c->version;
+        }
+    }
+    if (cache->ttl_ms > 0) {
+        sysinfo_snapshot_merge(c, snap, sections);
+        int64_t now = now_ms();
+        for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+            if (sections & SYSINFO_SECTION_BIT(i)) {
+                cache->collected_ms[i] = now;
+            }
+        }
+        cache->refreshing &= ~sections;
+        pthread_cond_broadcast(&cache->refreshed);
+    } else {
+        for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+            if (sections & SYSINFO_SECTION_BIT(i)) {
+                c->hash[i] = snap->hash[i];
+            }
+        }
+        c->collected |= sections;
+    }
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        if (sections & SYSINFO_SECTION_BIT(i)) {
+            snap->changed[i] = c->changed[i];
+        }
+    }
+    // The caller had every change up to its version; if nobody else changed
+    // anything since, it now has these too. Otherwise it keeps the older
+    // version and a later SINCE resends rather than misses something.
+    if (snap->version == seen) {
+        snap->version = c->version;
+    }
+    cache_unlock();
+}
+
+void sysinfo_cache_release(uint32_t sections) {
+    if (cache == NULL || sections == 0) {
+        return;
+    }
+    cache_lock();
+    cache->refreshing &= ~sections;
+    pthread_cond_broadcast(&cache->refreshed);
+    cache_unlock();
+}
+
+void sysinfo_cache_get_stats(struct sysinfo_cache_stats *stats) {
+    if (cache == NULL) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    cache_lock();
+    *stats = cache->stats;
+    cache_unlock();
+}
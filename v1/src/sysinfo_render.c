@@ -0,0 +1,552 @@
+#define _GNU_SOURCE
+#include "sysinfo.h"
+#include "sysinfo_wire.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Text renderer: the "=== Section ===" format SYSINFO has always sent
+
+static void render_hostname(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_printf(out, "Hostname: %s\n", snap->hostname);
+}
+
+static void render_time(const struct sysinfo_snapshot *snap, struct response *out) {
+    time_t t = (time_t)snap->time;
+    struct tm local_time;
+    char time_buf[64];
+    if (localtime_r(&t, &local_time) == NULL || asctime_r(&local_time, time_buf) == NULL) {
+        return;
+    }
+    response_printf(out, "Local Time: %s\n", time_buf);
+}
+
+static void render_os(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_printf(out, "OS: %s\n", snap->os_name);
+    response_printf(out, "Release: %s\n", snap->os_release);
+    response_printf(out, "Version: %s\n", snap->os_version);
+    response_printf(out, "Machine: %s\n", snap->os_machine);
+}
+
+static void render_memory(const struct sysinfo_snapshot *snap, struct response *out) {
+    uint64_t used = snap->total_ram - snap->free_ram;
+    float mem_usage = (float)used / snap->total_ram * 100;
+    response_printf(out, "Uptime:      %lld seconds\n", (long long)snap->uptime);
+    response_printf(out, "Load Avg:    %.2f %.2f %.2f (1/5/15 min)\n",
+               snap->loads[0] / 65536.0,
+               snap->loads[1] / 65536.0,
+               snap->loads[2] / 65536.0);
+    response_printf(out, "Total RAM:   %llu bytes\n", (unsigned long long)snap->total_ram);
+    response_printf(out, "Free RAM:    %llu bytes\n", (unsigned long long)snap->free_ram);
+    response_printf(out, "Used RAM:    %llu bytes\n", (unsigned long long)used);
+    response_printf(out, "Available:   %llu bytes\n", (unsigned long long)snap->available_ram);
+    response_printf(out, "Buffers:     %llu bytes\n", (unsigned long long)snap->buffer_ram);
+    response_printf(out, "Cached:      %llu bytes\n", (unsigned long long)snap->cached_ram);
+    response_printf(out, "Memory Usage: %f%%\n", mem_usage);
+}
+
+static void render_user(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_printf(out, "User: %s\n", snap->user);
+    response_printf(out, "Home: %s\n", snap->home);
+}
+
+static void render_disk(const struct sysinfo_snapshot *snap, struct response *out) {
+    uint64_t used = snap->disk_total - snap->disk_free;
+    double usage = (double)used / (double)snap->disk_total * 100.0;
+    response_printf(out, "Disk Usage : %.2f%%\n", usage);
+    response_printf(out, "Total Space: %llu bytes\n", (unsigned long long)snap->disk_total);
+    response_printf(out, "Free Space : %llu bytes\n", (unsigned long long)snap->disk_free);
+    response_printf(out, "Used Space : %llu bytes\n", (unsigned long long)used);
+    if (snap->mount_count == 0) {
+        return;
+    }
+    response_printf(out, "Mounts     : %u\n", snap->mount_count + snap->mounts_dropped);
+    for (uint32_t i = 0; i < snap->mount_count; i++) {
+        const struct sysinfo_mount *m = &snap->mounts[i];
+        response_printf(out, "  %s (%s): ", m->path, m->fstype);
+        if (m->flags & SYSINFO_MOUNT_ERROR) {
+            response_printf(out, "Error: %s\n", strerror(m->error));
+        } else if (m->flags & SYSINFO_MOUNT_SIZES) {
+            response_printf(out, "total %llu, free %llu, available %llu bytes%s\n",
+                            (unsigned long long)m->total, (unsigned long long)m->free,
+                            (unsigned long long)m->avail,
+                            (m->flags & SYSINFO_MOUNT_TIMED_OUT) ? " (timed out, last known)" : "");
+        } else {
+            response_puts(out, "Timed out\n");
+        }
+    }
+    if (snap->mounts_dropped > 0) {
+        response_printf(out, "  (%u more not listed)\n", snap->mounts_dropped);
+    }
+}
+
+static void render_env(const struct sysinfo_snapshot *snap, struct response *out) {
+    // Copied, not referenced: the snapshot is reused by the next request
+    response_write(out, snap->env, snap->env_len);
+}
+
+static void render_ipv4(struct response *out, const char *label, uint32_t addr) {
+    char buf[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+    response_printf(out, "  %s: %s\n", label, buf);
+}
+
+static void render_network(const struct sysinfo_snapshot *snap, struct response *out) {
+    for (uint32_t i = 0; i < snap->iface_count; i++) {
+        const struct sysinfo_iface *iface = &snap->ifaces[i];
+        if (iface->family == AF_INET) {
+            char buf[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &iface->addr, buf, sizeof(buf));
+            response_printf(out, "%s: %s\n", iface->name, buf);
+        } else {
+            response_printf(out, "%s:\n", iface->name);
+        }
+        if (iface->flags & SYSINFO_IF_MAC) {
+            static const uint8_t zero[6];
+            const uint8_t *m = iface->mac;
+            if (memcmp(m, zero, sizeof(zero)) == 0) {
+                response_puts(out, "  MAC Address: NA\n");
+            } else {
+                response_printf(out, "  MAC Address: %02X:%02X:%02X:%02X:%02X:%02X\n",
+                       m[0], m[1], m[2], m[3], m[4], m[5]);
+            }
+        }
+        if (iface->flags & SYSINFO_IF_MTU) {
+            response_printf(out, "  MTU: %d\n", iface->mtu);
+        }
+        if (iface->flags & SYSINFO_IF_NETMASK) {
+            render_ipv4(out, "Netmask", iface->netmask);
+        }
+        if (iface->flags & SYSINFO_IF_BROADCAST) {
+            render_ipv4(out, "Broadcast", iface->broadcast);
+        }
+        if (iface->flags & SYSINFO_IF_STATS) {
+            response_printf(out, "  RX: %llu bytes, %llu packets\n",
+                            (unsigned long long)iface->rx_bytes, (unsigned long long)iface->rx_packets);
+            response_printf(out, "  TX: %llu bytes, %llu packets\n",
+                            (unsigned long long)iface->tx_bytes, (unsigned long long)iface->tx_packets);
+        }
+    }
+    if (snap->ifaces_dropped > 0) {
+        response_printf(out, "(%u more interface entries not listed)\n", snap->ifaces_dropped);
+    }
+}
+
+static const struct {
+    const char *header;
+    const char *error;      // printed instead of the body when the collector failed
+    void (*render)(const struct sysinfo_snapshot *, struct response *);
+} text_sections[SYSINFO_SECTIONS] = {
+    [SYSINFO_HOSTNAME] = {"=== Hostname ===\n", NULL, render_hostname},
+    [SYSINFO_TIME]     = {"=== Local Time ===\n", NULL, render_time},
+    [SYSINFO_OS]       = {"=== Operating System ===\n", NULL, render_os},
+    [SYSINFO_MEMORY]   = {"=== System Resources ===\n",
+                          "Error: Invalid system information (zero total RAM)\n", render_memory},
+    [SYSINFO_USER]     = {"=== User Information ===\n", NULL, render_user},
+    [SYSINFO_DISK]     = {"=== Disk Usage ===\n",
+                          "Error: Invalid filesystem information (zero total space)\n", render_disk},
+    [SYSINFO_ENV]      = {"=== Environment Variables ===\n", NULL, render_env},
+    [SYSINFO_NETWORK]  = {"=== Network Interfaces ===\n", NULL, render_network},
+};
+
+static void text_section(const struct sysinfo_snapshot *snap, enum sysinfo_section section,
+                         struct response *out) {
+    response_puts(out, text_sections[section].header);
+    if (snap->timed_out & SYSINFO_SECTION_BIT(section)) {
+        response_puts(out, "Error: Timed out\n");
+    } else if (!(snap->failed & SYSINFO_SECTION_BIT(section))) {
+        text_sections[section].render(snap, out);
+    } else if (text_sections[section].error != NULL) {
+        response_puts(out, text_sections[section].error);
+    }
+}
+
+void sysinfo_render_text(const struct sysinfo_snapshot *snap, struct response *out) {
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        sysinfo_render_section(snap, (enum sysinfo_section)i, SYSINFO_FORMAT_TEXT, out);
+    }
+}
+
+// JSON renderer: one object per snapshot, sections keyed by
+// sysinfo_section_name(); numbers stay raw (bytes, seconds)
+
+// Append len bytes as a JSON string; runs of plain bytes are copied at once
+static void json_string(struct response *out, const char *s, size_t len) {
+    response_write(out, "\"", 1);
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        response_write(out, s + start, i - start);
+        if (c == '"' || c == '\\') {
+            char esc[2] = {'\\', (char)c};
+            response_write(out, esc, 2);
+        } else if (c == '\n') {
+            response_write(out, "\\n", 2);
+        } else {
+            response_printf(out, "\\u%04x", c);
+        }
+        start = i + 1;
+    }
+    response_write(out, s + start, len - start);
+    response_write(out, "\"", 1);
+}
+
+static void json_cstring(struct response *out, const char *s) {
+    json_string(out, s, strlen(s));
+}
+
+static void json_key(struct response *out, const char *key) {
+    response_printf(out, "\"%s\":", key);
+}
+
+static void json_ipv4(struct response *out, const char *key, uint32_t addr) {
+    char buf[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr, buf, sizeof(buf));
+    response_printf(out, ",\"%s\":\"%s\"", key, buf);
+}
+
+static void json_hostname(const struct sysinfo_snapshot *snap, struct response *out) {
+    json_cstring(out, snap->hostname);
+}
+
+static void json_time(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_printf(out, "%lld", (long long)snap->time);
+}
+
+static void json_os(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_puts(out, "{\"name\":");
+    json_cstring(out, snap->os_name);
+    response_puts(out, ",\"release\":");
+    json_cstring(out, snap->os_release);
+    response_puts(out, ",\"version\":");
+    json_cstring(out, snap->os_version);
+    response_puts(out, ",\"machine\":");
+    json_cstring(out, snap->os_machine);
+    response_puts(out, "}");
+}
+
+static void json_memory(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_printf(out, "{\"uptime\":%lld,\"loads\":[%.2f,%.2f,%.2f],"
+                    "\"total_ram\":%llu,\"free_ram\":%llu,\"used_ram\":%llu,"
+                    "\"available_ram\":%llu,\"buffer_ram\":%llu,\"cached_ram\":%llu}",
+                    (long long)snap->uptime,
+                    snap->loads[0] / 65536.0, snap->loads[1] / 65536.0, snap->loads[2] / 65536.0,
+                    (unsigned long long)snap->total_ram, (unsigned long long)snap->free_ram,
+                    (unsigned long long)(snap->total_ram - snap->free_ram),
+                    (unsigned long long)snap->available_ram, (unsigned long long)snap->buffer_ram,
+                    (unsigned long long)snap->cached_ram);
+}
+
+static void json_user(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_puts(out, "{\"name\":");
+    json_cstring(out, snap->user);
+    response_puts(out, ",\"home\":");
+    json_cstring(out, snap->home);
+    response_puts(out, "}");
+}
+
+static void json_disk(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_printf(out, "{\"total\":%llu,\"free\":%llu,\"used\":%llu,\"mounts\":[",
+                    (unsigned long long)snap->disk_total, (unsigned long long)snap->disk_free,
+                    (unsigned long long)(snap->disk_total - snap->disk_free));
+    for (uint32_t i = 0; i < snap->mount_count; i++) {
+        const struct sysinfo_mount *m = &snap->mounts[i];
+        // ok and stale (timed out, last known) carry sizes
+        const char *status = (m->flags & SYSINFO_MOUNT_ERROR) ? "error" :
+                             !(m->flags & SYSINFO_MOUNT_TIMED_OUT) ? "ok" :
+                             (m->flags & SYSINFO_MOUNT_SIZES) ? "stale" : "timed_out";
+        response_puts(out, i == 0 ? "{\"path\":" : ",{\"path\":");
+        json_cstring(out, m->path);
+        response_puts(out, ",\"fstype\":");
+        json_cstring(out, m->fstype);
+        response_printf(out, ",\"status\":\"%s\"", status);
+        if (m->flags & SYSINFO_MOUNT_ERROR) {
+            response_puts(out, ",\"error\":");
+            json_cstring(out, strerror(m->error));
+        } else if (m->flags & SYSINFO_MOUNT_SIZES) {
+            response_printf(out, ",\"total\":%llu,\"free\":%llu,\"available\":%llu",
+                            (unsigned long long)m->total, (unsigned long long)m->free,
+                            (unsigned long long)m->avail);
+        }
+        response_puts(out, "}");
+    }
+    response_printf(out, "],\"mounts_dropped\":%u}", snap->mounts_dropped);
+}
+
+static void json_env(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_puts(out, "{");
+    const char *p = snap->env;
+    const char *end = snap->env + snap->env_len;
+    int first = 1;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t len = nl != NULL ? (size_t)(nl - p) : (size_t)(end - p);
+        const char *eq = memchr(p, '=', len);
+        size_t key_len = eq != NULL ? (size_t)(eq - p) : len;
+        if (!first) {
+            response_puts(out, ",");
+        }
+        first = 0;
+        json_string(out, p, key_len);
+        response_puts(out, ":");
+        json_string(out, p + key_len + (eq != NULL), len - key_len - (eq != NULL));
+        p += len + 1;
+    }
+    response_puts(out, "}");
+}
+
+static const char *family_name(uint16_t family) {
+    switch (family) {
+    case AF_INET:   return "inet";
+    case AF_INET6:  return "inet6";
+    case AF_PACKET: return "packet";
+    default:        return "other";
+    }
+}
+
+static void json_network(const struct sysinfo_snapshot *snap, struct response *out) {
+    response_puts(out, "[");
+    for (uint32_t i = 0; i < snap->iface_count; i++) {
+        const struct sysinfo_iface *iface = &snap->ifaces[i];
+        response_puts(out, i > 0 ? ",{\"name\":" : "{\"name\":");
+        json_cstring(out, iface->name);
+        response_printf(out, ",\"family\":\"%s\"", family_name(iface->family));
+        if (iface->index != 0) {
+            response_printf(out, ",\"index\":%u", iface->index);
+        }
+        if (iface->family == AF_INET) {
+            json_ipv4(out, "addr", iface->addr);
+        }
+        if (iface->flags & SYSINFO_IF_MAC) {
+            const uint8_t *m = iface->mac;
+            response_printf(out, ",\"mac\":\"%02X:%02X:%02X:%02X:%02X:%02X\"",
+                            m[0], m[1], m[2], m[3], m[4], m[5]);
+        }
+        if (iface->flags & SYSINFO_IF_MTU) {
+            response_printf(out, ",\"mtu\":%d", iface->mtu);
+        }
+        if (iface->flags & SYSINFO_IF_NETMASK) {
+            json_ipv4(out, "netmask", iface->netmask);
+        }
+        if (iface->flags & SYSINFO_IF_BROADCAST) {
+            json_ipv4(out, "broadcast", iface->broadcast);
+        }
+        if (iface->flags & SYSINFO_IF_STATS) {
+            response_printf(out, ",\"rx_bytes\":%llu,\"rx_packets\":%llu,\"tx_bytes\":%llu,\"tx_packets\":%llu",
+                            (unsigned long long)iface->rx_bytes, (unsigned long long)iface->rx_packets,
+                            (unsigned long long)iface->tx_bytes, (unsigned long long)iface->tx_packets);
+        }
+        response_puts(out, "}");
+    }
+    // The list stays an array; the count follows it as a key of its own
+    response_printf(out, "],\"ifaces_dropped\":%u", snap->ifaces_dropped);
+}
+
+static void (*const json_sections[SYSINFO_SECTIONS])(const struct sysinfo_snapshot *, struct response *) = {
+    [SYSINFO_HOSTNAME] = json_hostname,
+    [SYSINFO_TIME]     = json_time,
+    [SYSINFO_OS]       = json_os,
+    [SYSINFO_MEMORY]   = json_memory,
+    [SYSINFO_USER]     = json_user,
+    [SYSINFO_DISK]     = json_disk,
+    [SYSINFO_ENV]      = json_env,
+    [SYSINFO_NETWORK]  = json_network,
+};
+
+static void json_section(const struct sysinfo_snapshot *snap, enum sysinfo_section section,
+                         struct response *out) {
+    response_puts(out, ",");
+    json_key(out, sysinfo_section_name(section));
+    if (snap->timed_out & SYSINFO_SECTION_BIT(section)) {
+        response_puts(out, "{\"timed_out\":true}");
+    } else if (snap->failed & SYSINFO_SECTION_BIT(section)) {
+        response_puts(out, "null");
+    } else {
+        json_sections[section](snap, out);
+    }
+}
+
+void sysinfo_render_json(const struct sysinfo_snapshot *snap, struct response *out) {
+    sysinfo_render_open(SYSINFO_FORMAT_JSON, out);
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        sysinfo_render_section(snap, (enum sysinfo_section)i, SYSINFO_FORMAT_JSON, out);
+    }
+    sysinfo_render_close(snap, SYSINFO_FORMAT_JSON, out);
+}
+
+// Binary renderer: encode the layout of sysinfo_wire.h into one buffer
+
+static size_t align4(size_t n) {
+    return (n + 3) & ~(size_t)3;
+}
+
+void sysinfo_render_bin(const struct sysinfo_snapshot *snap, struct response *out) {
+    // Fields of sections that were not collected are left out (strings,
+    // records) or zero (numbers)
+    uint32_t has = snap->collected;
+#define HAS(section) (has & SYSINFO_SECTION_BIT(section))
+    const char *strings[SYSINFO_WIRE_STRINGS] = {
+        [SYSINFO_WIRE_HOSTNAME]   = HAS(SYSINFO_HOSTNAME) ? snap->hostname : NULL,
+        [SYSINFO_WIRE_OS_NAME]    = HAS(SYSINFO_OS) ? snap->os_name : NULL,
+        [SYSINFO_WIRE_OS_RELEASE] = HAS(SYSINFO_OS) ? snap->os_release : NULL,
+        [SYSINFO_WIRE_OS_VERSION] = HAS(SYSINFO_OS) ? snap->os_version : NULL,
+        [SYSINFO_WIRE_OS_MACHINE] = HAS(SYSINFO_OS) ? snap->os_machine : NULL,
+        [SYSINFO_WIRE_USER]       = HAS(SYSINFO_USER) ? snap->user : NULL,
+        [SYSINFO_WIRE_HOME]       = HAS(SYSINFO_USER) ? snap->home : NULL,
+    };
+    uint32_t iface_count = HAS(SYSINFO_NETWORK) ? snap->iface_count : 0;
+    uint32_t mount_count = HAS(SYSINFO_DISK) ? snap->mount_count : 0;
+    uint32_t env_len = HAS(SYSINFO_ENV) ? snap->env_len : 0;
+    size_t strings_len = 0;
+    for (int i = 0; i < SYSINFO_WIRE_STRINGS; i++) {
+        if (strings[i] != NULL) {
+            strings_len += strlen(strings[i]) + 1;
+        }
+    }
+    size_t iface_off = align4(SYSINFO_WIRE_HEADER_LEN + strings_len);
+    size_t mount_off = iface_off + (size_t)iface_count * SYSINFO_WIRE_IF_SIZE;
+    size_t env_off = mount_off + (size_t)mount_count * SYSINFO_WIRE_MNT_SIZE;
+    for (uint32_t i = 0; i < mount_count; i++) {
+        env_off += strlen(snap->mounts[i].path) + strlen(snap->mounts[i].fstype) + 2;
+    }
+    size_t total = env_off + env_len;
+
+    char *buf = calloc(1, total);
+    if (buf == NULL) {
+        ERROR_LOG(stderr, "calloc() failed for binary SYSINFO record\n");
+        out->failed = 1;
+        return;
+    }
+    memcpy(buf + SYSINFO_WIRE_OFF_MAGIC, SYSINFO_WIRE_MAGIC, 4);
+    sysinfo_wire_put16(buf, SYSINFO_WIRE_OFF_VERSION, SYSINFO_WIRE_VERSION);
+    sysinfo_wire_put16(buf, SYSINFO_WIRE_OFF_HEADER_LEN, SYSINFO_WIRE_HEADER_LEN);
+    sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_TOTAL_LEN, (uint32_t)total);
+    sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_COLLECTED, snap->collected);
+    sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_FAILED, snap->failed);
+    sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_SNAPSHOT, snap->version);
+    sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_TIMED_OUT, snap->timed_out);
+    if (HAS(SYSINFO_TIME)) {
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_TIME, (uint64_t)snap->time);
+    }
+    if (HAS(SYSINFO_MEMORY)) {
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_UPTIME, (uint64_t)snap->uptime);
+        for (int i = 0; i < 3; i++) {
+            sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_LOADS + 8 * i, snap->loads[i]);
+        }
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_TOTAL_RAM, snap->total_ram);
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_FREE_RAM, snap->free_ram);
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_AVAIL_RAM, snap->available_ram);
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_BUFFER_RAM, snap->buffer_ram);
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_CACHED_RAM, snap->cached_ram);
+    }
+    if (HAS(SYSINFO_DISK)) {
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_DISK_TOTAL, snap->disk_total);
+        sysinfo_wire_put64(buf, SYSINFO_WIRE_OFF_DISK_FREE, snap->disk_free);
+    }
+    if (HAS(SYSINFO_NETWORK)) {
+        sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_IFACES_DROPPED, snap->ifaces_dropped);
+    }
+#undef HAS
+    sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_IFACE_OFF, (uint32_t)iface_off);
+    sysinfo_wire_put16(buf, SYSINFO_WIRE_OFF_IFACE_COUNT, (uint16_t)iface_count);
+    sysinfo_wire_put16(buf, SYSINFO_WIRE_OFF_IFACE_SIZE, SYSINFO_WIRE_IF_SIZE);
+    sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_MOUNT_OFF, (uint32_t)mount_off);
+    sysinfo_wire_put16(buf, SYSINFO_WIRE_OFF_MOUNT_COUNT, (uint16_t)mount_count);
+    sysinfo_wire_put16(buf, SYSINFO_WIRE_OFF_MOUNT_SIZE, SYSINFO_WIRE_MNT_SIZE);
+    if (env_len > 0) {
+        sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_ENV_COUNT, snap->env_count);
+        sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_ENV_OFF, (uint32_t)env_off);
+        sysinfo_wire_put32(buf, SYSINFO_WIRE_OFF_ENV_LEN, env_len);
+    }
+
+    size_t off = SYSINFO_WIRE_HEADER_LEN;
+    for (int i = 0; i < SYSINFO_WIRE_STRINGS; i++) {
+        if (strings[i] == NULL) {
+            continue;
+        }
+        size_t len = strlen(strings[i]);
+        memcpy(buf + off, strings[i], len + 1);
+        sysinfo_wire_put16(buf, SYSINFO_WIRE_OFF_STRINGS + 4 * i, (uint16_t)off);
+        sysinfo_wire_put16(buf, SYSINFO_WIRE_OFF_STRINGS + 4 * i + 2, (uint16_t)len);
+        off += len + 1;
+    }
+    for (uint32_t i = 0; i < iface_count; i++) {
+        const struct sysinfo_iface *iface = &snap->ifaces[i];
+        char *rec = buf + iface_off + (size_t)i * SYSINFO_WIRE_IF_SIZE;
+        strncpy(rec + SYSINFO_WIRE_IF_NAME, iface->name, SYSINFO_WIRE_IF_NAME_LEN - 1);
+        sysinfo_wire_put16(rec, SYSINFO_WIRE_IF_FAMILY, iface->family);
+        sysinfo_wire_put16(rec, SYSINFO_WIRE_IF_FLAGS, iface->flags);
+        memcpy(rec + SYSINFO_WIRE_IF_MAC, iface->mac, sizeof(iface->mac));
+        sysinfo_wire_put32(rec, SYSINFO_WIRE_IF_MTU, (uint32_t)iface->mtu);
+        // Addresses are already in network order: copied as bytes
+        memcpy(rec + SYSINFO_WIRE_IF_ADDR, &iface->addr, 4);
+        memcpy(rec + SYSINFO_WIRE_IF_NETMASK, &iface->netmask, 4);
+        memcpy(rec + SYSINFO_WIRE_IF_BROADCAST, &iface->broadcast, 4);
+        sysinfo_wire_put32(rec, SYSINFO_WIRE_IF_INDEX, iface->index);
+        sysinfo_wire_put64(rec, SYSINFO_WIRE_IF_RX_BYTES, iface->rx_bytes);
+        sysinfo_wire_put64(rec, SYSINFO_WIRE_IF_TX_BYTES, iface->tx_bytes);
+        sysinfo_wire_put64(rec, SYSINFO_WIRE_IF_RX_PACKETS, iface->rx_packets);
+        sysinfo_wire_put64(rec, SYSINFO_WIRE_IF_TX_PACKETS, iface->tx_packets);
+    }
+    off = mount_off + (size_t)mount_count * SYSINFO_WIRE_MNT_SIZE;
+    for (uint32_t i = 0; i < mount_count; i++) {
+        const struct sysinfo_mount *m = &snap->mounts[i];
+        char *rec = buf + mount_off + (size_t)i * SYSINFO_WIRE_MNT_SIZE;
+        sysinfo_wire_put64(rec, SYSINFO_WIRE_MNT_TOTAL, m->total);
+        sysinfo_wire_put64(rec, SYSINFO_WIRE_MNT_FREE, m->free);
+        sysinfo_wire_put64(rec, SYSINFO_WIRE_MNT_AVAIL, m->avail);
+        sysinfo_wire_put32(rec, SYSINFO_WIRE_MNT_FLAGS, m->flags);
+        sysinfo_wire_put32(rec, SYSINFO_WIRE_MNT_ERROR, (uint32_t)m->error);
+        const char *fields[2] = {m->path, m->fstype};
+        for (int j = 0; j < 2; j++) {
+            size_t len = strlen(fields[j]) + 1;
+            memcpy(buf + off, fields[j], len);
+            sysinfo_wire_put32(rec, j == 0 ? SYSINFO_WIRE_MNT_PATH : SYSINFO_WIRE_MNT_FSTYPE, (uint32_t)off);
+            off += len;
+        }
+    }
+    memcpy(buf + env_off, snap->env, env_len);
+    response_attach(out, buf, total);
+}
+
+// Streaming: text and JSON can be sent section by section
+
+void sysinfo_render_open(enum sysinfo_format format, struct response *out) {
+    if (format == SYSINFO_FORMAT_JSON) {
+        response_printf(out, "{\"version\":%d", SYSINFO_WIRE_VERSION);
+    }
+}
+
+void sysinfo_render_section(const struct sysinfo_snapshot *snap, enum sysinfo_section section,
+                            enum sysinfo_format format, struct response *out) {
+    if (!(snap->collected & SYSINFO_SECTION_BIT(section))) {
+        return;
+    }
+    if (format == SYSINFO_FORMAT_JSON) {
+        json_section(snap, section, out);
+    } else {
+        text_section(snap, section, out);
+    }
+}
+
+void sysinfo_render_close(const struct sysinfo_snapshot *snap, enum sysinfo_format format, struct response *out) {
+    if (format == SYSINFO_FORMAT_JSON) {
+        // One line, so the text protocol's line framing still applies
+        response_printf(out, ",\"snapshot\":%llu}\n", (unsigned long long)snap->version);
+    }
+}
+
+void sysinfo_render(const struct sysinfo_snapshot *snap, enum sysinfo_format format, struct response *out) {
+    if (format == SYSINFO_FORMAT_JSON) {
+        sysinfo_render_json(snap, out);
+    } else if (format == SYSINFO_FORMAT_BIN) {
+        sysinfo_render_bin(snap, out);
+    } else {
+        sysinfo_render_text(snap, out);
+    }
+}
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include "sysinfo_sched.h"
+#include "sysinfo_cache.h"
+#include "deadline.h"
+#include "debug.h"
+#include "jobpool.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct sched_job {
+    struct jobpool_job job;         // first: the pool hands this back
+    struct sysinfo_batch *batch;
+    enum sysinfo_section section;
+};
+
+struct sysinfo_batch {
+    pthread_mutex_t lock;
+    pthread_cond_t done_cond;       // broadcast when a job finishes
+    struct timespec deadline;       // CLOCK_MONOTONIC; tv_sec 0: none
+    uint32_t queued;                // sections handed to the pool
+    uint32_t done;                  // ... whose result is in results
+    uint32_t taken;                 // ... copied into the request's snapshot
+    uint32_t abandoned;             // ... the request no longer waits for
+    int refs;                       // the request plus every queued job
+    // Jobs merge here, not into the request's snapshot, so the request can
+    // render one section while another is being written. Owned by the
+    // requesting thread; jobs touch it only while their section is wanted.
+    struct sysinfo_snapshot *results;
+    struct sched_job jobs[SYSINFO_SECTIONS];
+};
+
+static struct jobpool pool;
+static int pool_threads;            // configured size, 0: no pool
+// Abandoned jobs of this process not finished yet (atomic)
+static int orphans[SYSINFO_SECTIONS];
+
+static void batch_put(struct sysinfo_batch *b) {
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_cond_destroy(&b->done_cond);
+        pthread_mutex_destroy(&b->lock);
+        free(b);
+    }
+}
+
+// Runs on a pool thread; ctx is the thread's own snapshot
+static void run_job(struct jobpool_job *pj, void *ctx) {
+    struct sched_job *job = (struct sched_job *)pj;
+    struct sysinfo_snapshot *scratch = ctx;
+    struct sysinfo_batch *b = job->batch;
+    uint32_t bit = SYSINFO_SECTION_BIT(job->section);
+    sysinfo_collect_section(scratch, job->section);
+    pthread_mutex_lock(&b->lock);
+    int wanted = !(b->abandoned & bit);
+    if (wanted) {
+        sysinfo_snapshot_merge(b->results, scratch, bit);
+        b->done |= bit;
+        pthread_cond_broadcast(&b->done_cond);
+    }
+    pthread_mutex_unlock(&b->lock);
+    if (!wanted) {
+        // Too late for its request: publish it for the next one, which
+        // also releases the claim
+        sysinfo_cache_store(scratch, bit);
+        __atomic_sub_fetch(&orphans[job->section], 1, __ATOMIC_RELAXED);
+    }
+    batch_put(b);
+}
+
+// Each thread collects into its own snapshot
+static void *scratch_alloc(void) {
+    struct sysinfo_snapshot *scratch = malloc(sizeof(*scratch));
+    if (scratch == NULL) {
+        ERROR_LOG(stderr, "malloc() failed for SYSINFO collector thread\n");
+        return NULL;
+    }
+    memset(scratch, 0, offsetof(struct sysinfo_snapshot, ifaces));
+    return scratch;
+}
+
+static void sched_atfork_child(void) {
+    // Those are the parent's jobs, released by the parent
+    memset(orphans, 0, sizeof(orphans));
+}
+
+// A fork engine child exits right after its response: collectors it gave
+// up on die with it, so their claims are handed back instead of blocking
+// the section until SYSINFO_REFRESH_TIMEOUT_MS
+static void sched_release_orphans(void) {
+    uint32_t sections = 0;
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        if (__atomic_load_n(&orphans[i], __ATOMIC_RELAXED) > 0) {
+            sections |= SYSINFO_SECTION_BIT(i);
+        }
+    }
+    sysinfo_cache_release(sections);
+}
+
+void sysinfo_sched_init(int threads) {
+    pool_threads = threads;
+    if (threads > 0) {
+        jobpool_init(&pool, "SYSINFO collector", threads, scratch_alloc);
+    }
+    pthread_atfork(NULL, NULL, sched_atfork_child);
+    if (atexit(sched_release_orphans) != 0) {
+        WARN_LOG(stderr, "atexit() failed, timed out SYSINFO sections may stay claimed\n");
+    }
+}
+
+struct sysinfo_batch *sysinfo_sched_start(uint32_t todo) {
+    // Results of the requesting thread's batches, reused like its snapshot
+    static __thread struct sysinfo_snapshot *results;
+    // A hand-off costs about as much as a quick collector: those run in the
+    // requesting thread while the pool works on the slow ones
+    uint32_t offload = 0;
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        if ((todo & SYSINFO_SECTION_BIT(i)) && sysinfo_section_may_block((enum sysinfo_section)i)) {
+            offload |= SYSINFO_SECTION_BIT(i);
+        }
+    }
+    if (offload == 0 || pool_threads == 0) {
+        return NULL;
+    }
+    if (results == NULL && (results = malloc(sizeof(*results))) == NULL) {
+        ERROR_LOG(stderr, "malloc() failed for SYSINFO batch, collecting inline\n");
+        return NULL;
+    }
+    struct sysinfo_batch *b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        ERROR_LOG(stderr, "calloc() failed for SYSINFO batch, collecting inline\n");
+        return NULL;
+    }
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&b->done_cond, &ca);
+    pthread_condattr_destroy(&ca);
+    pthread_mutex_init(&b->lock, NULL);
+    b->results = results;
+    b->refs = 1;
+    int ms = deadline_ms(DEADLINE_COLLECTOR);
+    if (ms > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &b->deadline);
+        b->deadline.tv_sec += ms / 1000;
+        b->deadline.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (b->deadline.tv_nsec >= 1000000000) {
+            b->deadline.tv_sec++;
+            b->deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    // Queued in section order, so with fewer threads than sections the
+    // first sections to be sent are the first to run
+    struct jobpool_job *list = NULL, **link = &list;
+    int count = 0;
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        if (!(offload & SYSINFO_SECTION_BIT(i))) {
+            continue;
+        }
+        struct sched_job *job = &b->jobs[i];
+        job->job.run = run_job;
+        job->job.next = NULL;
+        job->batch = b;
+        job->section = (enum sysinfo_section)i;
+        *link = &job->job;
+        link = &job->job.next;
+        b->queued |= SYSINFO_SECTION_BIT(i);
+        count++;
+    }
+    // Taken before the jobs can run and drop theirs
+    b->refs += count;
+    if (jobpool_submit(&pool, list) < 0) {
+        // None of them was queued: only the request's reference is left
+        b->refs = 1;
+        batch_put(b);
+        return NULL;
+    }
+    return b;
+}
+
+int sysinfo_sched_wait(struct sysinfo_batch *b, struct sysinfo_snapshot *snap, enum sysinfo_section section) {
+    uint32_t bit = SYSINFO_SECTION_BIT(section);
+    if (b == NULL || !(b->queued & bit)) {
+        sysinfo_collect_section(snap, section);
+        // Publish right away: a slow client must not hold the claim
+        sysinfo_cache_store(snap, bit);
+        return 0;
+    }
+    pthread_mutex_lock(&b->lock);
+    int expired = 0;
+    while (!(b->done & bit) && !expired) {
+        if (b->deadline.tv_sec == 0) {
+            pthread_cond_wait(&b->done_cond, &b->lock);
+        } else {
+            expired = pthread_cond_timedwait(&b->done_cond, &b->lock, &b->deadline) == ETIMEDOUT;
+        }
+    }
+    if (b->done & bit) {
+        sysinfo_snapshot_merge(snap, b->results, bit);
+        b->taken |= bit;
+    } else {
+        b->abandoned |= bit;
+        __atomic_add_fetch(&orphans[section], 1, __ATOMIC_RELAXED);
+    }
+    int taken = (b->taken & bit) != 0;
+    pthread_mutex_unlock(&b->lock);
+    if (!taken) {
+        deadline_count(DEADLINE_COLLECTOR);
+        WARN_LOG(stderr, "SYSINFO %s collector missed its deadline\n", sysinfo_section_name(section));
+        sysinfo_mark_timed_out(snap, bit);
+        return -1;
+    }
+    sysinfo_cache_store(snap, bit);
+    return 0;
+}
+
+void sysinfo_sched_finish(struct sysinfo_batch *b) {
+    if (b == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&b->lock);
+    // Finished but never waited for: still this request's to publish
+    uint32_t unpublished = b->done & ~b->taken;
+    uint32_t orphaned = b->queued & ~b->done & ~b->abandoned;
+    b->abandoned |= orphaned;
+    for (int i = 0; i < SYSINFO_SECTIONS; i++) {
+        if (orphaned & SYSINFO_SECTION_BIT(i)) {
+            __atomic_add_fetch(&orphans[i], 1, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+    if (unpublished != 0) {
+        sysinfo_cache_store(b->results, unpublished);
+    }
+    batch_put(b);
+}
@@ -0,0 +1,91 @@
+#include "sysinfo_wire.h"
+#include <string.h>
+
+long sysinfo_wire_check(const void *buf, size_t len) {
+    const char *p = buf;
+    size_t n = len < 4 ? len : 4;
+    if (memcmp(p, SYSINFO_WIRE_MAGIC, n) != 0) {
+        return -1;
+    }
+    if (len < SYSINFO_WIRE_OFF_COLLECTED) {
+        return 0;
+    }
+    uint16_t version = sysinfo_wire_get16(p, SYSINFO_WIRE_OFF_VERSION);
+    uint32_t header_len = sysinfo_wire_get16(p, SYSINFO_WIRE_OFF_HEADER_LEN);
+    uint32_t total = sysinfo_wire_get32(p, SYSINFO_WIRE_OFF_TOTAL_LEN);
+    if (version < 1 || header_len < SYSINFO_WIRE_HEADER_LEN_MIN || total < header_len) {
+        return -1;
+    }
+    if (len < total) {
+        return 0;
+    }
+    for (int i = 0; i < SYSINFO_WIRE_STRINGS; i++) {
+        uint32_t off = sysinfo_wire_get16(p, SYSINFO_WIRE_OFF_STRINGS + 4 * i);
+        uint32_t slen = sysinfo_wire_get16(p, SYSINFO_WIRE_OFF_STRINGS + 4 * i + 2);
+        if (off == 0) {
+            continue;       // unused slot
+        }
+        if (off < header_len || slen >= total - off || p[off + slen] != '\0') {
+            return -1;
+        }
+    }
+    uint32_t iface_off = sysinfo_wire_get32(p, SYSINFO_WIRE_OFF_IFACE_OFF);
+    uint32_t iface_count = sysinfo_wire_get16(p, SYSINFO_WIRE_OFF_IFACE_COUNT);
+    uint32_t iface_size = sysinfo_wire_get16(p, SYSINFO_WIRE_OFF_IFACE_SIZE);
+    if (iface_count > 0 && (iface_size < SYSINFO_WIRE_IF_SIZE_MIN || iface_off < header_len ||
+                            iface_off > total || (uint64_t)iface_count * iface_size > total - iface_off)) {
+        return -1;
+    }
+    uint32_t env_off = sysinfo_wire_get32(p, SYSINFO_WIRE_OFF_ENV_OFF);
+    uint32_t env_len = sysinfo_wire_get32(p, SYSINFO_WIRE_OFF_ENV_LEN);
+    if (env_len > 0 && (env_off < header_len || env_off > total || env_len > total - env_off)) {
+        return -1;
+    }
+    if (header_len >= SYSINFO_WIRE_OFF_MOUNT_SIZE + 2) {
+        uint32_t mount_off = sysinfo_wire_get32(p, SYSINFO_WIRE_OFF_MOUNT_OFF);
+        uint32_t mount_count = sysinfo_wire_get16(p, SYSINFO_WIRE_OFF_MOUNT_COUNT);
+        uint32_t mount_size = sysinfo_wire_get16(p, SYSINFO_WIRE_OFF_MOUNT_SIZE);
+        if (mount_count > 0 && (mount_size < SYSINFO_WIRE_MNT_SIZE || mount_off < header_len ||
+                                mount_off > total || (uint64_t)mount_count * mount_size > total - mount_off)) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < mount_count; i++) {
+            const char *rec = p + mount_off + (size_t)i * mount_size;
+            for (size_t field = SYSINFO_WIRE_MNT_PATH; field <= SYSINFO_WIRE_MNT_FSTYPE; field += 4) {
+                uint32_t off = sysinfo_wire_get32(rec, field);
+                if (off < header_len || off >= total || memchr(p + off, '\0', total - off) == NULL) {
+                    return -1;
+                }
+            }
+        }
+    }
+    return (long)total;
+}
+
+const char *sysinfo_wire_string(const void *buf, enum sysinfo_wire_string slot) {
+    uint16_t off = sysinfo_wire_get16(buf, SYSINFO_WIRE_OFF_STRINGS + 4 * slot);
+    return off != 0 ? (const char *)buf + off : "";
+}
+
+const unsigned char *sysinfo_wire_iface(const void *buf, uint32_t i) {
+    uint32_t off = sysinfo_wire_get32(buf, SYSINFO_WIRE_OFF_IFACE_OFF);
+    uint32_t size = sysinfo_wire_get16(buf, SYSINFO_WIRE_OFF_IFACE_SIZE);
+    return (const unsigned char *)buf + off + (size_t)i * size;
+}
+
+uint32_t sysinfo_wire_mount_count(const void *buf) {
+    if (sysinfo_wire_get16(buf, SYSINFO_WIRE_OFF_HEADER_LEN) < SYSINFO_WIRE_OFF_MOUNT_SIZE + 2) {
+        return 0;
+    }
+    return sysinfo_wire_get16(buf, SYSINFO_WIRE_OFF_MOUNT_COUNT);
+}
+
+const unsigned char *sysinfo_wire_mount(const void *buf, uint32_t i) {
+    uint32_t off = sysinfo_wire_get32(buf, SYSINFO_WIRE_OFF_MOUNT_OFF);
+    uint32_t size = sysinfo_wire_get16(buf, SYSINFO_WIRE_OFF_MOUNT_SIZE);
+    return (const unsigned char *)buf + off + (size_t)i * size;
+}
+
+const char *sysinfo_wire_mount_string(const void *buf, const unsigned char *mount, size_t field) {
+    return (const char *)buf + sysinfo_wire_get32(mount, field);
+}
@@ -0,0 +1,92 @@
+#include "timerwheel.h"
+#include <stddef.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void timer_list_init(struct timer *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+void timer_init(struct timer *t, int kind) {
+    t->prev = NULL;
+    t->next = NULL;
+    t->expires = 0;
+    t->kind = kind;
+}
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t now_ms) {
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        timer_list_init(&w->slots[i]);
+    }
+    w->current = now_ms / TIMER_WHEEL_TICK_MS;
+}
+
+static void list_unlink(struct timer *t) {
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = NULL;
+    t->next = NULL;
+}
+
+static void list_append(struct timer *head, struct timer *t) {
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+int timer_armed(const struct timer *t) {
+    return t->prev != NULL;
+}
+
+void timer_cancel(struct timer *t) {
+    if (t->prev != NULL) {
+        list_unlink(t);
+    }
+}
+
+void timer_arm(struct timer_wheel *w, struct timer *t, uint64_t expires_ms) {
+    timer_cancel(t);
+    // Round up: a timer never fires before its deadline
+    uint64_t tick = (expires_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    if (tick < w->current) {
+        tick = w->current;
+    }
+    t->expires = tick;
+    list_append(&w->slots[tick & SLOT_MASK], t);
+}
+
+void timer_wheel_expire(struct timer_wheel *w, uint64_t now_ms, struct timer *expired) {
+    uint64_t target = now_ms / TIMER_WHEEL_TICK_MS;
+    if (target < w->current) {
+        return;
+    }
+    // After a long stall one revolution visits every slot; no need for more
+    uint64_t steps = target - w->current + 1;
+    if (steps > TIMER_WHEEL_SLOTS) {
+        steps = TIMER_WHEEL_SLOTS;
+    }
+    for (uint64_t i = 0; i < steps; i++) {
+        struct timer *head = &w->slots[(w->current + i) & SLOT_MASK];
+        struct timer *t = head->next;
+        while (t != head) {
+            struct timer *next = t->next;
+            if (t->expires <= target) {
+                list_unlink(t);
+                list_append(expired, t);
+            }
+            t = next;
+        }
+    }
+    w->current = target + 1;
+}
+
+struct timer *timer_list_pop(struct timer *head) {
+    struct timer *t = head->next;
+    if (t == head) {
+        return NULL;
+    }
+    list_unlink(t);
+    return t;
+}
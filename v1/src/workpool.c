@@ -0,0 +1,172 @@
+#include "workpool.h"
+#include "debug.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+struct workpool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct work_item *queue_head;   // pending items (FIFO)
+    struct work_item *queue_tail;
+    struct work_item *done_head;    // completed items (FIFO)
+    struct work_item *done_tail;
+    int stopping;
+    int efd;
+    int nthreads;
+    pthread_t *threads;
+};
+
+static void *workpool_thread(void *arg) {
+    struct workpool *wp = arg;
+    for (;;) {
+        pthread_mutex_lock(&wp->lock);
+        while (wp->queue_head == NULL && !wp->stopping) {
+            pthread_cond_wait(&wp->cond, &wp->lock);
+        }
+        struct work_item *item = wp->queue_head;
+        if (item == NULL) {
+            // stopping and nothing left to do
+            pthread_mutex_unlock(&wp->lock);
+            break;
+        }
+        wp->queue_head = item->next;
+        if (wp->queue_head == NULL) {
+            wp->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&wp->lock);
+
+        item->next = NULL;
+        item->run(item);
+
+        pthread_mutex_lock(&wp->lock);
+        if (wp->done_tail != NULL) {
+            wp->done_tail->next = item;
+        } else {
+            wp->done_head = item;
+        }
+        wp->done_tail = item;
+        pthread_mutex_unlock(&wp->lock);
+
+        uint64_t one = 1;
+        if (write(wp->efd, &one, sizeof(one)) != sizeof(one)) {
+            WARN_LOG(stderr, "workpool: eventfd write failed\n");
+        }
+    }
+    return NULL;
+}
+
+struct workpool *workpool_create(int nthreads) {
+    if (nthreads <= 0) {
+        ERROR_LOG(stderr, "workpool_create: invalid thread count %d\n", nthreads);
+        return NULL;
+    }
+    struct workpool *wp = calloc(1, sizeof(*wp));
+    if (wp == NULL) {
+        ERROR_LOG(stderr, "workpool_create: calloc() failed\n");
+        return NULL;
+    }
+    wp->threads = calloc((size_t)nthreads, sizeof(pthread_t));
+    if (wp->threads == NULL) {
+        ERROR_LOG(stderr, "workpool_create: calloc() failed\n");
+        free(wp);
+        return NULL;
+    }
+    wp->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wp->efd < 0) {
+        ERROR_LOG(stderr, "eventfd() failed\n");
+        perror("eventfd");
+        free(wp->threads);
+        free(wp);
+        return NULL;
+    }
+    pthread_mutex_init(&wp->lock, NULL);
+    pthread_cond_init(&wp->cond, NULL);
+
+    // Worker threads must never take SIGQUIT: the I/O loop relies on it
+    // interrupting its own wait. Block everything while spawning so the
+    // threads inherit a full mask.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&wp->threads[i], NULL, workpool_thread, wp) != 0) {
+            ERROR_LOG(stderr, "pthread_create() failed\n");
+            break;
+        }
+        wp->nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (wp->nthreads == 0) {
+        workpool_destroy(wp);
+        return NULL;
+    }
+    DEBUG_LOG(stderr, "workpool: started %d threads\n", wp->nthreads);
+    return wp;
+}
+
+void workpool_stop(struct workpool *wp) {
+    pthread_mutex_lock(&wp->lock);
+    wp->stopping = 1;
+    pthread_cond_broadcast(&wp->cond);
+    pthread_mutex_unlock(&wp->lock);
+    for (int i = 0; i < wp->nthreads; i++) {
+        pthread_join(wp->threads[i], NULL);
+    }
+    wp->nthreads = 0;
+}
+
+void workpool_destroy(struct workpool *wp) {
+    if (wp == NULL) {
+        return;
+    }
+    workpool_stop(wp);
+    pthread_cond_destroy(&wp->cond);
+    pthread_mutex_destroy(&wp->lock);
+    close(wp->efd);
+    free(wp->threads);
+    free(wp);
+}
+
+int workpool_submit(struct workpool *wp, struct work_item *item) {
+    if (wp == NULL || item == NULL || item->run == NULL) {
+        return -1;
+    }
+    item->next = NULL;
+    pthread_mutex_lock(&wp->lock);
+    if (wp->stopping) {
+        pthread_mutex_unlock(&wp->lock);
+        return -1;
+    }
+    if (wp->queue_tail != NULL) {
+        wp->queue_tail->next = item;
+    } else {
+        wp->queue_head = item;
+    }
+    wp->queue_tail = item;
+    pthread_cond_signal(&wp->cond);
+    pthread_mutex_unlock(&wp->lock);
+    return 0;
+}
+
+int workpool_fd(const struct workpool *wp) {
+    return wp->efd;
+}
+
+struct work_item *workpool_reap(struct workpool *wp) {
+    uint64_t count;
+    // Non-blocking eventfd: EAGAIN simply means nothing was signalled
+    ssize_t r = read(wp->efd, &count, sizeof(count));
+    (void)r;
+    pthread_mutex_lock(&wp->lock);
+    struct work_item *list = wp->done_head;
+    wp->done_head = NULL;
+    wp->done_tail = NULL;
+    pthread_mutex_unlock(&wp->lock);
+    return list;
+}